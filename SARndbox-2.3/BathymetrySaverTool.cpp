@@ -22,28 +22,47 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "BathymetrySaverTool.h"
 
+#include <string.h>
+#include <algorithm>
 #include <stdexcept>
 #include <iomanip>
+#include <vector>
+#include <Misc/SizedTypes.h>
 #include <Misc/PrintInteger.h>
 #include <Misc/ThrowStdErr.h>
 #include <Misc/MessageLogger.h>
 #include <Misc/StandardValueCoders.h>
 #include <Misc/ConfigurationFile.h>
+#include <Misc/FileNameExtensions.h>
+#include <IO/OpenFile.h>
+#include <IO/GzipFilter.h>
 #include <IO/ValueSource.h>
 #include <IO/OStream.h>
 #include <Comm/TCPPipe.h>
 #include <Math/Math.h>
-#include <Vrui/OpenFile.h>
 
 #include "WaterTable2.h"
 #include "Sandbox.h"
 
+namespace {
+
+/****************
+Helper constants:
+****************/
+
+const char* fileFormatNames[3]={"USGSDEM","RawDEM","GeoTIFF"}; // Configuration file names of the supported file formats
+const double gridCenter[2]={609959.0,4268028.0}; // Easter egg: all exported geo-referenced grids are centered around Davis, CA
+const unsigned int tiffTileSize=256; // Width and height of GeoTIFF tiles; must be a multiple of 16
+
+}
+
 /**********************************************************
 Methods of class BathymetrySaverToolFactory::Configuration:
 **********************************************************/
 
 BathymetrySaverToolFactory::Configuration::Configuration(void)
 	:saveFileName("BathymetrySaverTool.dem"),
+	 fileFormat(USGSDEM),compressFile(false),
 	 postUpdate(false),postUpdatePort(80),postUpdatePage(""),
 	 postUpdateMessage("app.GenerateTileCache();"),
 	 gridScale(1.0)
@@ -53,6 +72,16 @@ BathymetrySaverToolFactory::Configuration::Configuration(void)
 void BathymetrySaverToolFactory::Configuration::read(const Misc::ConfigurationFileSection& cfs)
 	{
 	saveFileName=cfs.retrieveString("./saveFileName",saveFileName);
+	std::string fileFormatName=cfs.retrieveString("./fileFormat",fileFormatNames[fileFormat]);
+	if(strcasecmp(fileFormatName.c_str(),fileFormatNames[USGSDEM])==0)
+		fileFormat=USGSDEM;
+	else if(strcasecmp(fileFormatName.c_str(),fileFormatNames[RAWDEM])==0)
+		fileFormat=RAWDEM;
+	else if(strcasecmp(fileFormatName.c_str(),fileFormatNames[GEOTIFF])==0)
+		fileFormat=GEOTIFF;
+	else
+		Misc::throwStdErr("BathymetrySaverTool: Unknown file format \"%s\"",fileFormatName.c_str());
+	compressFile=cfs.retrieveValue<bool>("./compressFile",compressFile);
 	postUpdate=cfs.retrieveValue<bool>("./postUpdate",postUpdate);
 	postUpdateHostName=cfs.retrieveString("./postUpdateHostName",postUpdateHostName);
 	postUpdatePort=cfs.retrieveValue<int>("./postUpdatePort",postUpdatePort);
@@ -64,6 +93,8 @@ void BathymetrySaverToolFactory::Configuration::read(const Misc::ConfigurationFi
 void BathymetrySaverToolFactory::Configuration::write(Misc::ConfigurationFileSection& cfs) const
 	{
 	cfs.storeString("./saveFileName",saveFileName);
+	cfs.storeString("./fileFormat",fileFormatNames[fileFormat]);
+	cfs.storeValue<bool>("./compressFile",compressFile);
 	cfs.storeValue<bool>("./postUpdate",postUpdate);
 	cfs.storeString("./postUpdateHostName",postUpdateHostName);
 	cfs.storeValue<int>("./postUpdatePort",postUpdatePort);
@@ -85,6 +116,9 @@ BathymetrySaverToolFactory::BathymetrySaverToolFactory(WaterTable2* sWaterTable,
 		{
 		gridSize[i]=waterTable->getBathymetrySize(i);
 		cellSize[i]=waterTable->getCellSize()[i];
+		
+		/* The bathymetry grid's vertices are the corners between the water table's cells: */
+		gridOrigin[i]=GLfloat(waterTable->getDomain().min[i])+cellSize[i];
 		}
 	
 	/* Initialize tool layout: */
@@ -205,12 +239,21 @@ std::ostream& printFloat8(std::ostream& os,double value)
 	return os;
 	}
 
+void writeTIFFEntry(IO::File& file,Misc::UInt16 tag,Misc::UInt16 type,Misc::UInt32 count,Misc::UInt32 valueOrOffset)
+	{
+	/* Write a 12-byte image file directory entry; values of up to four bytes are stored left-justified in the value field: */
+	file.write<Misc::UInt16>(tag);
+	file.write<Misc::UInt16>(type);
+	file.write<Misc::UInt32>(count);
+	file.write<Misc::UInt32>(valueOrOffset);
+	}
+
 }
 
-void BathymetrySaverTool::writeDEMFile(void) const
+void BathymetrySaverTool::writeDEMFile(IO::FilePtr file,const GLfloat* grid) const
 	{
-	/* Open the output file as a std::ostream: */
-	IO::OStream demFile(Vrui::openFile(configuration.saveFileName.c_str(),IO::File::WriteOnly));
+	/* Attach a std::ostream to the output file: */
+	IO::OStream demFile(file);
 	
 	/* Write the bathymetry name: */
 	static const char* fileHeader="Augmented Reality Sandbox bathymetry grid";
@@ -238,8 +281,7 @@ void BathymetrySaverTool::writeDEMFile(void) const
 	/* Write the DEM coverage polygon: */
 	printInt2(demFile,4); // Polygon is quadrangle
 	
-	/* Easter egg: all exported DEMs are centered around Davis, CA: */
-	static const double gridCenter[2]={609959.0, 4268028.0};
+	/* Calculate the DEM's bounding box around the exported grid center: */
 	double west=gridCenter[0]-double(factory->gridSize[0]-1)*double(factory->cellSize[0])*gs*0.5;
 	double east=gridCenter[0]+double(factory->gridSize[0]-1)*double(factory->cellSize[0])*gs*0.5;
 	double north=gridCenter[1]+double(factory->gridSize[1]-1)*double(factory->cellSize[1])*gs*0.5;
@@ -257,8 +299,8 @@ void BathymetrySaverTool::writeDEMFile(void) const
 	
 	/* Calculate and write the grid's elevation range: */
 	GLfloat elevMin,elevMax;
-	elevMin=elevMax=bathymetryBuffer[0];
-	const GLfloat* bbPtr=bathymetryBuffer+1;
+	elevMin=elevMax=grid[0];
+	const GLfloat* bbPtr=grid+1;
 	for(GLsizei count=factory->gridSize[1]*factory->gridSize[0]-1;count>0;--count,++bbPtr)
 		{
 		if(elevMin>*bbPtr)
@@ -325,7 +367,7 @@ void BathymetrySaverTool::writeDEMFile(void) const
 		printFloat8(demFile,elevationBase); // Local datum elevation
 		
 		/* Calculate and write the profile's elevation range: */
-		const GLfloat* pPtr=bathymetryBuffer+column;
+		const GLfloat* pPtr=grid+column;
 		GLfloat elevMin,elevMax;
 		elevMin=elevMax=*pPtr;
 		pPtr+=factory->gridSize[0];
@@ -343,7 +385,7 @@ void BathymetrySaverTool::writeDEMFile(void) const
 		fileSize+=6*4+24*5;
 		
 		/* Quantize and write the profile's elevation postings: */
-		pPtr=bathymetryBuffer+column;
+		pPtr=grid+column;
 		for(GLsizei count=factory->gridSize[1];count>0;--count,pPtr+=factory->gridSize[0])
 			{
 			/* Check if there is enough space left in the current 1024-character record: */
@@ -378,6 +420,173 @@ void BathymetrySaverTool::writeDEMFile(void) const
 		demFile<<' ';
 	}
 
+void BathymetrySaverTool::writeRawDEMFile(IO::File& file,const GLfloat* grid) const
+	{
+	/* Retrieve the grid scale factor: */
+	double gs=configuration.gridScale;
+	
+	/* Write the grid size and the bounding box of the grid's vertices in the layout read by DEM::load: */
+	file.setEndianness(Misc::LittleEndian);
+	int demSize[2];
+	for(int i=0;i<2;++i)
+		demSize[i]=int(factory->gridSize[i]);
+	file.write<int>(demSize,2);
+	for(int i=0;i<2;++i)
+		file.write<float>(float(double(factory->gridOrigin[i])*gs));
+	for(int i=0;i<2;++i)
+		file.write<float>(float((double(factory->gridOrigin[i])+double(factory->gridSize[i]-1)*double(factory->cellSize[i]))*gs));
+	
+	/* Write the elevation postings: */
+	if(gs==1.0)
+		file.write<float>(grid,size_t(factory->gridSize[1])*size_t(factory->gridSize[0]));
+	else
+		{
+		/* Scale and write the grid one row at a time: */
+		std::vector<float> row(factory->gridSize[0]);
+		const GLfloat* gPtr=grid;
+		for(GLsizei y=0;y<factory->gridSize[1];++y)
+			{
+			for(GLsizei x=0;x<factory->gridSize[0];++x,++gPtr)
+				row[x]=float(double(*gPtr)*gs);
+			file.write<float>(&row.front(),row.size());
+			}
+		}
+	}
+
+void BathymetrySaverTool::writeGeoTIFFFile(IO::File& file,const GLfloat* grid) const
+	{
+	/* TIFF field types: */
+	const Misc::UInt16 tiffShort=3;
+	const Misc::UInt16 tiffLong=4;
+	const Misc::UInt16 tiffDouble=12;
+	
+	/* Retrieve the grid scale factor and layout: */
+	double gs=configuration.gridScale;
+	unsigned int width=factory->gridSize[0];
+	unsigned int height=factory->gridSize[1];
+	unsigned int numTilesX=(width+tiffTileSize-1)/tiffTileSize;
+	unsigned int numTilesY=(height+tiffTileSize-1)/tiffTileSize;
+	Misc::UInt32 numTiles=numTilesX*numTilesY;
+	Misc::UInt32 tileByteCount=tiffTileSize*tiffTileSize*sizeof(Misc::Float32);
+	
+	/* Lay out the file as header, image file directory, out-of-line tag values, and tiles so that it can be written front-to-back: */
+	const Misc::UInt16 numEntries=15;
+	Misc::UInt32 ifdOffset=8;
+	Misc::UInt32 dataOffset=ifdOffset+2+numEntries*12+4;
+	Misc::UInt32 tileOffsetsOffset=dataOffset;
+	Misc::UInt32 tileByteCountsOffset=dataOffset;
+	if(numTiles>1)
+		{
+		/* Tile offset and byte count arrays don't fit into their directory entries: */
+		tileByteCountsOffset+=numTiles*4;
+		dataOffset+=numTiles*8;
+		}
+	Misc::UInt32 pixelScaleOffset=dataOffset;
+	dataOffset+=3*8;
+	Misc::UInt32 tiepointOffset=dataOffset;
+	dataOffset+=6*8;
+	Misc::UInt32 geoKeysOffset=dataOffset;
+	dataOffset+=16*2;
+	Misc::UInt32 tilesOffset=dataOffset;
+	
+	/* Write the file header: */
+	file.setEndianness(Misc::LittleEndian);
+	file.writeRaw("II",2);
+	file.write<Misc::UInt16>(42);
+	file.write<Misc::UInt32>(ifdOffset);
+	
+	/* Write the image file directory, with entries sorted by tag: */
+	file.write<Misc::UInt16>(numEntries);
+	writeTIFFEntry(file,256,tiffLong,1,width); // ImageWidth
+	writeTIFFEntry(file,257,tiffLong,1,height); // ImageLength
+	writeTIFFEntry(file,258,tiffShort,1,32); // BitsPerSample
+	writeTIFFEntry(file,259,tiffShort,1,1); // Compression: none
+	writeTIFFEntry(file,262,tiffShort,1,1); // PhotometricInterpretation: BlackIsZero
+	writeTIFFEntry(file,277,tiffShort,1,1); // SamplesPerPixel
+	writeTIFFEntry(file,284,tiffShort,1,1); // PlanarConfiguration: chunky
+	writeTIFFEntry(file,322,tiffLong,1,tiffTileSize); // TileWidth
+	writeTIFFEntry(file,323,tiffLong,1,tiffTileSize); // TileLength
+	writeTIFFEntry(file,324,tiffLong,numTiles,numTiles>1?tileOffsetsOffset:tilesOffset); // TileOffsets
+	writeTIFFEntry(file,325,tiffLong,numTiles,numTiles>1?tileByteCountsOffset:tileByteCount); // TileByteCounts
+	writeTIFFEntry(file,339,tiffShort,1,3); // SampleFormat: IEEE floating point
+	writeTIFFEntry(file,33550,tiffDouble,3,pixelScaleOffset); // ModelPixelScaleTag
+	writeTIFFEntry(file,33922,tiffDouble,6,tiepointOffset); // ModelTiepointTag
+	writeTIFFEntry(file,34735,tiffShort,16,geoKeysOffset); // GeoKeyDirectoryTag
+	file.write<Misc::UInt32>(0); // No further image file directories
+	
+	/* Write the tile offset and byte count arrays: */
+	if(numTiles>1)
+		{
+		for(Misc::UInt32 i=0;i<numTiles;++i)
+			file.write<Misc::UInt32>(tilesOffset+i*tileByteCount);
+		for(Misc::UInt32 i=0;i<numTiles;++i)
+			file.write<Misc::UInt32>(tileByteCount);
+		}
+	
+	/* Write the pixel scale and the tie point of the grid's north-west posting, in the same coordinates as USGS DEM exports: */
+	file.write<Misc::Float64>(double(factory->cellSize[0])*gs);
+	file.write<Misc::Float64>(double(factory->cellSize[1])*gs);
+	file.write<Misc::Float64>(0.0);
+	double west=gridCenter[0]-double(width-1)*double(factory->cellSize[0])*gs*0.5;
+	double north=gridCenter[1]+double(height-1)*double(factory->cellSize[1])*gs*0.5;
+	Misc::Float64 tiepoint[6]={0.0,0.0,0.0,west,north,0.0};
+	file.write<Misc::Float64>(tiepoint,6);
+	
+	/* Write the GeoKey directory: projected model, pixels are postings, NAD83 / UTM zone 10N: */
+	static const Misc::UInt16 geoKeys[16]={1,1,0,3,1024,0,1,1,1025,0,1,2,3072,0,1,26910};
+	file.write<Misc::UInt16>(geoKeys,16);
+	
+	/* Write all tiles left-to-right and top-to-bottom, flipping the grid's south-to-north row order: */
+	std::vector<Misc::Float32> tileRow(tiffTileSize);
+	for(unsigned int tileY=0;tileY<numTilesY;++tileY)
+		for(unsigned int tileX=0;tileX<numTilesX;++tileX)
+			for(unsigned int row=0;row<tiffTileSize;++row)
+				{
+				unsigned int y=tileY*tiffTileSize+row;
+				unsigned int x0=tileX*tiffTileSize;
+				unsigned int x=0;
+				if(y<height)
+					{
+					/* Scale the part of the grid row covered by the tile: */
+					const GLfloat* gPtr=grid+size_t(height-1-y)*size_t(width)+x0;
+					for(;x<tiffTileSize&&x0+x<width;++x)
+						tileRow[x]=Misc::Float32(double(gPtr[x])*gs);
+					}
+				
+				/* Pad tiles extending past the grid's edges: */
+				for(;x<tiffTileSize;++x)
+					tileRow[x]=Misc::Float32(0);
+				
+				file.write<Misc::Float32>(&tileRow.front(),tiffTileSize);
+				}
+	}
+
+void BathymetrySaverTool::saveGrid(const GLfloat* grid) const
+	{
+	/* Open the output file; Vrui::openFile is not safe to call from background threads: */
+	IO::FilePtr file=IO::openFile(configuration.saveFileName.c_str(),IO::File::WriteOnly);
+	
+	/* Wrap a gzip filter around the output file if requested and not already done by IO::openFile: */
+	if(configuration.compressFile&&!Misc::hasCaseExtension(configuration.saveFileName.c_str(),".gz"))
+		file=new IO::GzipFilter(file);
+	
+	/* Write the grid in the configured format: */
+	switch(configuration.fileFormat)
+		{
+		case BathymetrySaverToolFactory::Configuration::USGSDEM:
+			writeDEMFile(file,grid);
+			break;
+		
+		case BathymetrySaverToolFactory::Configuration::RAWDEM:
+			writeRawDEMFile(*file,grid);
+			break;
+		
+		case BathymetrySaverToolFactory::Configuration::GEOTIFF:
+			writeGeoTIFFFile(*file,grid);
+			break;
+		}
+	}
+
 void BathymetrySaverTool::postUpdate(void) const
 	{
 	/* Connect to the HTTP server: */
@@ -579,6 +788,48 @@ void BathymetrySaverTool::postUpdate(void) const
 	// std::cout<<std::endl;
 	}
 
+void* BathymetrySaverTool::saveThreadMethod(void)
+	{
+	while(true)
+		{
+		{
+		Threads::MutexCond::Lock saveLock(saveCond);
+		
+		/* Wait until a new grid arrives or the tool shuts down: */
+		while(runSaveThread&&!savePending)
+			saveCond.wait(saveLock);
+		
+		/* Bail out if the tool is shutting down and the last grid has been saved: */
+		if(!savePending)
+			break;
+		
+		/* Take the pending grid: */
+		std::swap(pendingBuffer,saveBuffer);
+		savePending=false;
+		}
+		
+		try
+			{
+			/* Export the bathymetry grid: */
+			saveGrid(saveBuffer);
+			
+			if(configuration.postUpdate)
+				{
+				/* Send an update message to the configured web server: */
+				postUpdate();
+				}
+			}
+		catch(const std::runtime_error& err)
+			{
+			/* Hand the error message to the main thread for reporting: */
+			Threads::MutexCond::Lock saveLock(saveCond);
+			saveError=err.what();
+			}
+		}
+	
+	return 0;
+	}
+
 BathymetrySaverToolFactory* BathymetrySaverTool::initClass(WaterTable2* sWaterTable,Vrui::ToolManager& toolManager)
 	{
 	/* Create the tool factory: */
@@ -593,13 +844,29 @@ BathymetrySaverTool::BathymetrySaverTool(const Vrui::ToolFactory* factory,const
 	:Vrui::Tool(factory,inputAssignment),
 	 configuration(BathymetrySaverTool::factory->configuration),
 	 bathymetryBuffer(new GLfloat[BathymetrySaverTool::factory->gridSize[1]*BathymetrySaverTool::factory->gridSize[0]]),
-	 requestPending(false)
+	 requestPending(false),
+	 pendingBuffer(new GLfloat[BathymetrySaverTool::factory->gridSize[1]*BathymetrySaverTool::factory->gridSize[0]]),
+	 savePending(false),
+	 saveBuffer(new GLfloat[BathymetrySaverTool::factory->gridSize[1]*BathymetrySaverTool::factory->gridSize[0]]),
+	 runSaveThread(true)
 	{
+	/* Start the background save thread: */
+	saveThread.start(this,&BathymetrySaverTool::saveThreadMethod);
 	}
 
 BathymetrySaverTool::~BathymetrySaverTool(void)
 	{
+	/* Shut down the save thread after it saved the last pending grid: */
+	{
+	Threads::MutexCond::Lock saveLock(saveCond);
+	runSaveThread=false;
+	saveCond.signal();
+	}
+	saveThread.join();
+	
 	delete[] bathymetryBuffer;
+	delete[] pendingBuffer;
+	delete[] saveBuffer;
 	}
 
 void BathymetrySaverTool::configure(const Misc::ConfigurationFileSection& configFileSection)
@@ -630,24 +897,24 @@ void BathymetrySaverTool::buttonCallback(int buttonSlotIndex,Vrui::InputDevice::
 
 void BathymetrySaverTool::frame(void)
 	{
+	std::string error;
+	{
+	Threads::MutexCond::Lock saveLock(saveCond);
+	
 	if(requestPending&&factory->waterTable->haveBathymetry())
 		{
-		try
-			{
-			/* Export the bathymetry grid: */
-			writeDEMFile();
-			
-			if(configuration.postUpdate)
-				{
-				/* Send an update message to the configured web server: */
-				postUpdate();
-				}
-			}
-		catch(std::runtime_error err)
-			{
-			Misc::formattedUserError("Save Bathymetry: Unable to save bathymetry due to exception \"%s\"",err.what());
-			}
+		/* Hand the new grid to the save thread, replacing a grid that is still waiting to be saved: */
+		std::swap(bathymetryBuffer,pendingBuffer);
+		savePending=true;
+		saveCond.signal();
 		
 		requestPending=false;
 		}
+	
+	/* Retrieve the save thread's most recent error message: */
+	std::swap(error,saveError);
+	}
+	
+	if(!error.empty())
+		Misc::formattedUserError("Save Bathymetry: Unable to save bathymetry due to exception \"%s\"",error.c_str());
 	}
@@ -24,6 +24,9 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #define BATHYMETRYSAVERTOOL_INCLUDED
 
 #include <string>
+#include <IO/File.h>
+#include <Threads/Thread.h>
+#include <Threads/MutexCond.h>
 #include <GL/gl.h>
 #include <Vrui/Tool.h>
 #include <Vrui/Application.h>
@@ -45,7 +48,16 @@ class BathymetrySaverToolFactory:public Vrui::ToolFactory
 		{
 		/* Elements: */
 		public:
+		enum FileFormat // Enumerated type for bathymetry grid file formats
+			{
+			USGSDEM, // Fixed-width ASCII USGS DEM format
+			RAWDEM, // Raw little-endian floating-point grid in the layout read by class DEM
+			GEOTIFF // Tiled 32-bit floating-point GeoTIFF
+			};
+		
 		std::string saveFileName; // Name of file to which to save the bathymetry grid
+		FileFormat fileFormat; // Format in which to save the bathymetry grid
+		bool compressFile; // Flag whether to compress saved bathymetry grids with gzip
 		bool postUpdate; // Flag whether to post an update message to a web server after saving the bathymetry grid
 		std::string postUpdateHostName; // Name of web server to which to send update messages
 		int postUpdatePort; // TCP port number of web server to which to send update messages
@@ -67,6 +79,7 @@ class BathymetrySaverToolFactory:public Vrui::ToolFactory
 	WaterTable2* waterTable; // Pointer to water table object from which to request bathymetry grids
 	GLsizei gridSize[2]; // Width and height of the water table's bathymetry grid
 	GLfloat cellSize[2]; // Width and height of each water table cell
+	GLfloat gridOrigin[2]; // Position of the bathymetry grid's first vertex in water table coordinates
 	
 	/* Constructors and destructors: */
 	public:
@@ -88,12 +101,23 @@ class BathymetrySaverTool:public Vrui::Tool,public Vrui::Application::Tool<Sandb
 	private:
 	static BathymetrySaverToolFactory* factory; // Pointer to the factory object for this class
 	BathymetrySaverToolFactory::Configuration configuration; // Configuration of this tool
-	GLfloat* bathymetryBuffer; // Bathymetry grid buffer
+	GLfloat* bathymetryBuffer; // Bathymetry grid buffer receiving grids from the water table
 	bool requestPending; // Flag if this tool has a pending request to retrieve a bathymetry grid
+	Threads::MutexCond saveCond; // Condition variable protecting the pending grid and signaling new grids to the save thread
+	GLfloat* pendingBuffer; // Bathymetry grid buffer waiting to be saved
+	bool savePending; // Flag whether the pending grid buffer holds a grid that has not been saved yet
+	GLfloat* saveBuffer; // Bathymetry grid buffer being saved by the save thread
+	std::string saveError; // Message of the most recent error encountered by the save thread; empty if none
+	volatile bool runSaveThread; // Flag to keep the background save thread running
+	Threads::Thread saveThread; // Background thread writing bathymetry grids to files
 	
 	/* Private methods: */
-	void writeDEMFile(void) const; // Writes the bathymetry grid to a file in USGS DEM format
+	void writeDEMFile(IO::FilePtr file,const GLfloat* grid) const; // Writes the given bathymetry grid to the given file in USGS DEM format
+	void writeRawDEMFile(IO::File& file,const GLfloat* grid) const; // Writes the given bathymetry grid to the given file in raw DEM format
+	void writeGeoTIFFFile(IO::File& file,const GLfloat* grid) const; // Writes the given bathymetry grid to the given file in tiled GeoTIFF format
+	void saveGrid(const GLfloat* grid) const; // Saves the given bathymetry grid to the configured file in the configured format
 	void postUpdate(void) const; // Sends an update message to a web server
+	void* saveThreadMethod(void); // Method for the background save thread
 	
 	/* Constructors and destructors: */
 	public:
@@ -0,0 +1,120 @@
+/***********************************************************************
+BlobExtractor - Class to extract four-connected blobs of pixels matching
+an arbitrary property from frames using run-length encoded spans,
+optionally splitting frames into bands of rows processed by multiple
+threads.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef BLOBEXTRACTOR_INCLUDED
+#define BLOBEXTRACTOR_INCLUDED
+
+#include <vector>
+#include <Threads/Thread.h>
+#include <Threads/Barrier.h>
+#include <Images/ExtractBlobs.h>
+
+template <class BlobParam,class ForegroundSelectorParam,class MergeCheckerParam =Images::BlobMergeChecker<typename BlobParam::Pixel> >
+class BlobExtractor // Class to extract blobs; blob accumulators follow the interface of Images::Blob
+	{
+	/* Embedded classes: */
+	public:
+	typedef BlobParam Blob; // Type of blob accumulators
+	typedef typename BlobParam::Pixel Pixel; // Type of frame pixels
+	typedef typename BlobParam::Creator Creator; // Type of helper objects to create and modify blobs
+	typedef ForegroundSelectorParam ForegroundSelector; // Type of functors deciding whether a pixel belongs to any blob
+	typedef MergeCheckerParam MergeChecker; // Type of functors deciding whether two neighboring pixels belong to the same blob
+	
+	struct Span:public BlobParam // Structure for horizontal runs of foreground pixels; root spans accumulate their entire blobs
+		{
+		/* Elements: */
+		public:
+		unsigned int y; // Row index of the span
+		unsigned int x1,x2; // Half-open column range of the span
+		unsigned int parent; // Index of the span's parent span; points to the root span of the span's blob after extraction
+		
+		/* Constructors and destructors: */
+		Span(unsigned int sX,unsigned int sY,const Pixel& pixel,const Creator& creator)
+			:BlobParam(sX,sY,pixel,creator),
+			 y(sY),x1(sX)
+			{
+			}
+		};
+	
+	/* Elements: */
+	private:
+	unsigned int size[2]; // Width and height of processed frames
+	unsigned int numWorkerThreads; // Number of worker threads processing bands of rows in addition to the extracting thread
+	Threads::Thread* workerThreads; // Array of worker threads
+	Threads::Barrier workerBarrier; // Barrier to synchronize the worker threads with the extracting thread
+	volatile bool runWorkerThreads; // Flag to keep the worker threads running
+	
+	const Pixel* image; // Frame currently being processed
+	unsigned int regionMin[2],regionMax[2]; // Half-open pixel rectangle of the frame currently being processed
+	const ForegroundSelector* foregroundSelector; // Foreground selector for the frame currently being processed
+	const MergeChecker* mergeChecker; // Merge checker for the frame currently being processed
+	const Creator* blobCreator; // Blob creator for the frame currently being processed
+	
+	std::vector<Span>* bandSpans; // Array of span pools for the bands processed by the worker threads
+	std::vector<Span> spans; // Pool of spans of all bands, in row-major order
+	std::vector<BlobParam> blobs; // Pool of extracted blobs, indexed by blob ID
+	
+	/* Private methods: */
+	unsigned int getBandRowBegin(unsigned int bandIndex) const // Returns the first row of the given band
+		{
+		return regionMin[1]+((regionMax[1]-regionMin[1])*bandIndex)/(numWorkerThreads+1);
+		}
+	void extractSpans(unsigned int rowBegin,unsigned int rowEnd,std::vector<Span>& bandSpans); // Extracts and links the spans in the given range of rows
+	void mergeSpans(unsigned int span1,unsigned int span2); // Merges the blobs containing the two given spans
+	void* workerThreadMethod(unsigned int workerIndex); // Method for the worker threads
+	void stopWorkerThreads(void); // Shuts down all worker threads
+	
+	/* Constructors and destructors: */
+	public:
+	BlobExtractor(const unsigned int sSize[2]); // Creates a blob extractor for frames of the given size
+	private:
+	BlobExtractor(const BlobExtractor& source); // Prohibit copy constructor
+	BlobExtractor& operator=(const BlobExtractor& source); // Prohibit assignment operator
+	public:
+	~BlobExtractor(void);
+	
+	/* Methods: */
+	unsigned int getNumThreads(void) const // Returns the number of threads extracting blobs from each frame
+		{
+		return numWorkerThreads+1;
+		}
+	void setNumThreads(unsigned int newNumThreads); // Sets the number of threads extracting blobs from each frame; must not be called during extraction
+	const std::vector<BlobParam>& extractBlobs(const Pixel* newImage,const ForegroundSelector& newForegroundSelector,const MergeChecker& newMergeChecker,const Creator& newBlobCreator); // Extracts all blobs from the given frame
+	const std::vector<BlobParam>& extractBlobs(const unsigned int newRegionMin[2],const unsigned int newRegionMax[2],const Pixel* newImage,const ForegroundSelector& newForegroundSelector,const MergeChecker& newMergeChecker,const Creator& newBlobCreator); // Extracts all blobs from the given half-open pixel rectangle of the given frame
+	const std::vector<Span>& getSpans(void) const // Returns the spans of the most recently processed frame in row-major order; each span's blob ID identifies its blob
+		{
+		return spans;
+		}
+	const std::vector<BlobParam>& getBlobs(void) const // Returns the blobs of the most recently processed frame
+		{
+		return blobs;
+		}
+	void createBlobIdImage(unsigned int* blobIdImage) const; // Writes the blob IDs of the most recently processed frame's pixels into the given frame-sized image; pixels outside of blobs receive ~0x0U
+	};
+
+#ifndef BLOBEXTRACTOR_IMPLEMENTATION
+#include "BlobExtractor.icpp"
+#endif
+
+#endif
@@ -0,0 +1,1256 @@
+/***********************************************************************
+CPUWaterSolver - Class to run the shallow water flow simulation used by
+WaterTable2 on the CPU, as a multithreaded and vectorized reference
+implementation of the GPU shaders.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "CPUWaterSolver.h"
+
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <Math/Math.h>
+#include <Math/Constants.h>
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+/*********************************************************************
+The kernels below are templates over the arithmetic type, so that the
+same expressions evaluate one cell at a time using float, or four cells
+at a time using Float4. All expressions follow the order of operations
+of the corresponding GLSL shaders.
+*********************************************************************/
+
+inline void load(float& value,const float* ptr)
+	{
+	value=*ptr;
+	}
+
+inline void store(float* ptr,float value)
+	{
+	*ptr=value;
+	}
+
+inline float vMin(float a,float b)
+	{
+	return a<b?a:b;
+	}
+
+inline float vMax(float a,float b)
+	{
+	return a>b?a:b;
+	}
+
+inline float vSqrt(float a)
+	{
+	return Math::sqrt(a);
+	}
+
+inline bool vLess(float a,float b)
+	{
+	return a<b;
+	}
+
+inline bool vNotEqual(float a,float b)
+	{
+	return a!=b;
+	}
+
+inline float vSelect(bool mask,float a,float b)
+	{
+	return mask?a:b;
+	}
+
+inline float hMin(float a)
+	{
+	return a;
+	}
+
+#ifdef __SSE2__
+
+struct Float4 // Structure wrapping four SSE single-precision values
+	{
+	/* Elements: */
+	public:
+	__m128 v;
+	
+	/* Constructors and destructors: */
+	Float4(void)
+		{
+		}
+	Float4(__m128 sV)
+		:v(sV)
+		{
+		}
+	Float4(float s)
+		:v(_mm_set1_ps(s))
+		{
+		}
+	};
+
+inline void load(Float4& value,const float* ptr)
+	{
+	value.v=_mm_loadu_ps(ptr);
+	}
+
+inline void store(float* ptr,const Float4& value)
+	{
+	_mm_storeu_ps(ptr,value.v);
+	}
+
+inline Float4 operator+(const Float4& a,const Float4& b)
+	{
+	return Float4(_mm_add_ps(a.v,b.v));
+	}
+
+inline Float4 operator-(const Float4& a,const Float4& b)
+	{
+	return Float4(_mm_sub_ps(a.v,b.v));
+	}
+
+inline Float4 operator-(const Float4& a)
+	{
+	return Float4(_mm_xor_ps(a.v,_mm_set1_ps(-0.0f)));
+	}
+
+inline Float4 operator*(const Float4& a,const Float4& b)
+	{
+	return Float4(_mm_mul_ps(a.v,b.v));
+	}
+
+inline Float4 operator/(const Float4& a,const Float4& b)
+	{
+	return Float4(_mm_div_ps(a.v,b.v));
+	}
+
+inline Float4 vMin(const Float4& a,const Float4& b)
+	{
+	return Float4(_mm_min_ps(a.v,b.v));
+	}
+
+inline Float4 vMax(const Float4& a,const Float4& b)
+	{
+	return Float4(_mm_max_ps(a.v,b.v));
+	}
+
+inline Float4 vSqrt(const Float4& a)
+	{
+	return Float4(_mm_sqrt_ps(a.v));
+	}
+
+inline Float4 vLess(const Float4& a,const Float4& b)
+	{
+	return Float4(_mm_cmplt_ps(a.v,b.v));
+	}
+
+inline Float4 vNotEqual(const Float4& a,const Float4& b)
+	{
+	return Float4(_mm_cmpneq_ps(a.v,b.v));
+	}
+
+inline Float4 vSelect(const Float4& mask,const Float4& a,const Float4& b)
+	{
+	return Float4(_mm_or_ps(_mm_and_ps(mask.v,a.v),_mm_andnot_ps(mask.v,b.v)));
+	}
+
+inline float hMin(const Float4& a)
+	{
+	__m128 m=_mm_min_ps(a.v,_mm_shuffle_ps(a.v,a.v,_MM_SHUFFLE(1,0,3,2)));
+	m=_mm_min_ps(m,_mm_shuffle_ps(m,m,_MM_SHUFFLE(2,3,0,1)));
+	return _mm_cvtss_f32(m);
+	}
+
+#endif
+
+template <class VectorParam>
+inline
+void reconstruct(unsigned int i,const float* const q0[3],const float* const q1[3],const float* const q2[3],const float* b0,const float* b1,float cellSize,float theta,float* const minus[3],float* const plus[3])
+	{
+	/* Calculate the minmod-limited slope of each quantity: */
+	VectorParam slope[3],q[3];
+	for(int j=0;j<3;++j)
+		{
+		VectorParam ql,qr;
+		load(ql,q0[j]+i);
+		load(q[j],q1[j]+i);
+		load(qr,q2[j]+i);
+		
+		/* Calculate the left, central, and right differences: */
+		VectorParam d01=(q[j]-ql)*VectorParam(theta/cellSize);
+		VectorParam d02=(qr-ql)/VectorParam(2.0f*cellSize);
+		VectorParam d12=(qr-q[j])*VectorParam(theta/cellSize);
+		
+		/* Calculate the minmod-limited slope from the interval of differences: */
+		VectorParam dMin=vMin(vMin(d01,d02),d12);
+		VectorParam dMax=vMax(vMax(d01,d02),d12);
+		slope[j]=vSelect(vLess(VectorParam(0.0f),dMin),dMin,vSelect(vLess(dMax,VectorParam(0.0f)),dMax,VectorParam(0.0f)));
+		}
+	
+	/* Check the water surface slope against the left and right face-centered bathymetry values: */
+	VectorParam bl,br;
+	load(bl,b0+i);
+	load(br,b1+i);
+	VectorParam halfCellSize(cellSize*0.5f);
+	slope[0]=vSelect(vLess(q[0]-slope[0]*VectorParam(cellSize)*VectorParam(0.5f),bl),(q[0]-bl)/halfCellSize,slope[0]);
+	slope[0]=vSelect(vLess(q[0]+slope[0]*VectorParam(cellSize)*VectorParam(0.5f),br),(br-q[0])/halfCellSize,slope[0]);
+	
+	/* Calculate the one-sided quantities at the two faces: */
+	for(int j=0;j<3;++j)
+		{
+		VectorParam delta=slope[j]*halfCellSize;
+		store(minus[j]+i,q[j]-delta);
+		store(plus[j]+i,q[j]+delta);
+		}
+	}
+
+template <class VectorParam>
+inline
+void calcVelocity(VectorParam q[3],const VectorParam& h,int n,int t,float epsilon,VectorParam& un,VectorParam& ut)
+	{
+	/* Calculate velocity using a desingularizing division operator: */
+	VectorParam h4=h*h*h*h;
+	VectorParam factor=VectorParam(1.41421356237309f)*h/vSqrt(h4+vMax(h4,VectorParam(epsilon)));
+	un=q[n]*factor;
+	ut=q[t]*factor;
+	
+	/* Recalculate discharge based on desingularized velocity: */
+	q[n]=un*h;
+	q[t]=ut*h;
+	}
+
+template <class VectorParam>
+inline
+VectorParam calcFlux(unsigned int i,const float* const left[3],const float* const right[3],const float* b,int n,int t,float g,float epsilon,float cellSize,float* const flux[3])
+	{
+	/* Load the one-sided quantities: */
+	VectorParam ql[3],qr[3];
+	for(int j=0;j<3;++j)
+		{
+		load(ql[j],left[j]+i);
+		load(qr[j],right[j]+i);
+		}
+	VectorParam bf;
+	load(bf,b+i);
+	
+	/* Calculate one-sided water column heights: */
+	VectorParam hl=vMax(ql[0]-bf,VectorParam(0.0f));
+	VectorParam hr=vMax(qr[0]-bf,VectorParam(0.0f));
+	
+	/* Calculate one-sided velocities in face-normal and face-tangential direction: */
+	VectorParam unl,utl,unr,utr;
+	calcVelocity(ql,hl,n,t,epsilon,unl,utl);
+	calcVelocity(qr,hr,n,t,epsilon,unr,utr);
+	
+	/* Calculate one-sided flux quadratures: */
+	VectorParam fl[3],fr[3];
+	fl[0]=ql[n];
+	fl[n]=unl*ql[n]+VectorParam(0.5f*g)*hl*hl;
+	fl[t]=utl*ql[n];
+	fr[0]=qr[n];
+	fr[n]=unr*qr[n]+VectorParam(0.5f*g)*hr*hr;
+	fr[t]=utr*qr[n];
+	
+	/* Calculate one-sided local speeds of propagation: */
+	VectorParam sghl=vSqrt(VectorParam(g)*hl);
+	VectorParam sghr=vSqrt(VectorParam(g)*hr);
+	VectorParam al=vMin(vMin(unl-sghl,unr-sghr),VectorParam(0.0f));
+	VectorParam ar=vMax(vMax(unl+sghl,unr+sghr),VectorParam(0.0f));
+	
+	/* Calculate the complete flux across the face: */
+	VectorParam denom=ar-al;
+	VectorParam valid=vNotEqual(denom,VectorParam(0.0f));
+	for(int j=0;j<3;++j)
+		store(flux[j]+i,vSelect(valid,((fl[j]*ar-fr[j]*al)+(qr[j]-ql[j])*(ar*al))/denom,VectorParam(0.0f)));
+	
+	/* Return maximum possible step size: */
+	return VectorParam(0.5f*cellSize)/vMax(-al,ar);
+	}
+
+template <class VectorParam>
+inline
+void calcCellDerivative(unsigned int i,const float* w,const float* bw,const float* be,const float* bs,const float* bn,const float* const fluxW[3],const float* const fluxE[3],const float* const fluxS[3],const float* const fluxN[3],const float cellSize[2],float g,float* const derivative[3])
+	{
+	/* Calculate the water column height at the cell center: */
+	VectorParam q0,b3,b4,b1,b6;
+	load(q0,w+i);
+	load(b3,bw+i);
+	load(b4,be+i);
+	load(b1,bs+i);
+	load(b6,bn+i);
+	VectorParam h=vMax(q0-(b3+b4)*VectorParam(0.5f),VectorParam(0.0f));
+	
+	/* Calculate equation source terms at the cell center: */
+	VectorParam source[3];
+	source[0]=VectorParam(0.0f);
+	source[1]=VectorParam(-g)*h*(b4-b3)/VectorParam(cellSize[0]);
+	source[2]=VectorParam(-g)*h*(b6-b1)/VectorParam(cellSize[1]);
+	
+	/* Calculate the temporal derivative: */
+	for(int j=0;j<3;++j)
+		{
+		VectorParam fw,fe,fs,fn;
+		load(fw,fluxW[j]+i);
+		load(fe,fluxE[j]+i);
+		load(fs,fluxS[j]+i);
+		load(fn,fluxN[j]+i);
+		store(derivative[j]+i,source[j]-(fe-fw)/VectorParam(cellSize[0])-(fn-fs)/VectorParam(cellSize[1]));
+		}
+	}
+
+void reconstructSpan(unsigned int numCells,const float* const q0[3],const float* const q1[3],const float* const q2[3],const float* b0,const float* b1,float cellSize,float theta,float* const minus[3],float* const plus[3])
+	{
+	unsigned int i=0;
+	#ifdef __SSE2__
+	for(;i+4<=numCells;i+=4)
+		reconstruct<Float4>(i,q0,q1,q2,b0,b1,cellSize,theta,minus,plus);
+	#endif
+	for(;i<numCells;++i)
+		reconstruct<float>(i,q0,q1,q2,b0,b1,cellSize,theta,minus,plus);
+	}
+
+float calcFluxSpan(unsigned int numFaces,const float* const left[3],const float* const right[3],const float* b,int n,int t,float g,float epsilon,float cellSize,float* const flux[3])
+	{
+	float maxStepSize=Math::Constants<float>::max;
+	unsigned int i=0;
+	#ifdef __SSE2__
+	Float4 maxStepSize4(maxStepSize);
+	for(;i+4<=numFaces;i+=4)
+		maxStepSize4=vMin(maxStepSize4,calcFlux<Float4>(i,left,right,b,n,t,g,epsilon,cellSize,flux));
+	maxStepSize=hMin(maxStepSize4);
+	#endif
+	for(;i<numFaces;++i)
+		maxStepSize=vMin(maxStepSize,calcFlux<float>(i,left,right,b,n,t,g,epsilon,cellSize,flux));
+	return maxStepSize;
+	}
+
+void calcDerivativeSpan(unsigned int numCells,const float* w,const float* bw,const float* be,const float* bs,const float* bn,const float* const fluxW[3],const float* const fluxE[3],const float* const fluxS[3],const float* const fluxN[3],const float cellSize[2],float g,float* const derivative[3])
+	{
+	unsigned int i=0;
+	#ifdef __SSE2__
+	for(;i+4<=numCells;i+=4)
+		calcCellDerivative<Float4>(i,w,bw,be,bs,bn,fluxW,fluxE,fluxS,fluxN,cellSize,g,derivative);
+	#endif
+	for(;i<numCells;++i)
+		calcCellDerivative<float>(i,w,bw,be,bs,bn,fluxW,fluxE,fluxS,fluxN,cellSize,g,derivative);
+	}
+
+inline int clamp(int value,int max)
+	{
+	return value<0?0:value>max?max:value;
+	}
+
+}
+
+/*******************************************
+Methods of class CPUWaterSolver::BandState:
+*******************************************/
+
+void CPUWaterSolver::BandState::init(unsigned int width)
+	{
+	/* Allocate one buffer for all scratch rows: */
+	delete[] buffer;
+	size_t rowSize=(width+4)+(width+2)*2+(width+1)+width*5;
+	buffer=new float[rowSize*3];
+	
+	/* Carve the scratch rows out of the buffer: */
+	float* bPtr=buffer;
+	for(int j=0;j<3;++j)
+		{
+		paddedRow[j]=bPtr;
+		bPtr+=width+4;
+		xMinus[j]=bPtr;
+		bPtr+=width+2;
+		xPlus[j]=bPtr;
+		bPtr+=width+2;
+		fluxX[j]=bPtr;
+		bPtr+=width+1;
+		yMinus[j]=bPtr;
+		bPtr+=width;
+		yPlus[j]=bPtr;
+		bPtr+=width;
+		prevYPlus[j]=bPtr;
+		bPtr+=width;
+		for(int k=0;k<2;++k)
+			{
+			fluxY[k][j]=bPtr;
+			bPtr+=width;
+			}
+		}
+	}
+
+/**************************************
+Methods of class CPUWaterSolver::Tile:
+**************************************/
+
+void CPUWaterSolver::Tile::init(const unsigned int sCellMin[2],const unsigned int sCellMax[2],unsigned int tileSize)
+	{
+	for(int i=0;i<2;++i)
+		{
+		cellMin[i]=sCellMin[i];
+		cellMax[i]=sCellMax[i];
+		}
+	
+	/* Allocate one buffer for all edge flux buffers: */
+	delete[] buffer;
+	buffer=new float[tileSize*3*4*2];
+	
+	/* Carve the edge flux buffers out of the buffer: */
+	float* bPtr=buffer;
+	for(int edge=0;edge<4;++edge)
+		for(int j=0;j<3;++j)
+			{
+			flux[edge][j]=bPtr;
+			bPtr+=tileSize;
+			fluxSum[edge][j]=bPtr;
+			bPtr+=tileSize;
+			}
+	}
+
+/*******************************
+Methods of class CPUWaterSolver:
+*******************************/
+
+void CPUWaterSolver::calcDerivative(float* const q[3],unsigned int rowBegin,unsigned int rowEnd,unsigned int colBegin,unsigned int colEnd,CPUWaterSolver::BandState& band,CPUWaterSolver::Tile* tile)
+	{
+	int w=int(size[0]);
+	int h=int(size[1]);
+	int n=int(colEnd-colBegin);
+	float maxBandStepSize=Math::Constants<float>::max;
+	
+	/* Copy the band's scratch row pointers to swap them as rows advance: */
+	float* yMinus[3];
+	float* yPlus[3];
+	float* prevYPlus[3];
+	float* fluxS[3];
+	float* fluxN[3];
+	for(int j=0;j<3;++j)
+		{
+		yMinus[j]=band.yMinus[j];
+		yPlus[j]=band.yPlus[j];
+		prevYPlus[j]=band.prevYPlus[j];
+		fluxS[j]=band.fluxY[0][j];
+		fluxN[j]=band.fluxY[1][j];
+		}
+	
+	/* Reconstruct the y-direction quantities of the row below the rectangle and of the rectangle's first row: */
+	for(int y=int(rowBegin)-1;y<=int(rowBegin);++y)
+		{
+		const float* q0[3];
+		const float* q1[3];
+		const float* q2[3];
+		for(int j=0;j<3;++j)
+			{
+			q0[j]=q[j]+clamp(y-1,h-1)*w+colBegin;
+			q1[j]=q[j]+clamp(y,h-1)*w+colBegin;
+			q2[j]=q[j]+clamp(y+1,h-1)*w+colBegin;
+			}
+		reconstructSpan(n,q0,q1,q2,faceBathymetryY+(y+1)*w+colBegin,faceBathymetryY+(y+2)*w+colBegin,cellSize[1],theta,yMinus,yPlus);
+		
+		if(y<int(rowBegin))
+			{
+			/* Keep the north-side quantities of the row below the rectangle: */
+			for(int j=0;j<3;++j)
+				std::swap(prevYPlus[j],yPlus[j]);
+			}
+		}
+	
+	/* Calculate the partial fluxes across the southern faces of the rectangle's first row: */
+	maxBandStepSize=vMin(maxBandStepSize,calcFluxSpan(n,prevYPlus,yMinus,faceBathymetryY+(rowBegin+1)*w+colBegin,2,1,g,epsilon,cellSize[1],fluxS));
+	for(int j=0;j<3;++j)
+		std::swap(prevYPlus[j],yPlus[j]);
+	if(tile!=0)
+		{
+		/* Record the partial fluxes across the tile's southern edge: */
+		for(int j=0;j<3;++j)
+			std::copy(fluxS[j],fluxS[j]+n,tile->flux[2][j]);
+		}
+	
+	for(int y=int(rowBegin);y<int(rowEnd);++y)
+		{
+		/* Reconstruct the y-direction quantities of the next row: */
+		{
+		const float* q0[3];
+		const float* q1[3];
+		const float* q2[3];
+		for(int j=0;j<3;++j)
+			{
+			q0[j]=q[j]+y*w+colBegin;
+			q1[j]=q[j]+clamp(y+1,h-1)*w+colBegin;
+			q2[j]=q[j]+clamp(y+2,h-1)*w+colBegin;
+			}
+		reconstructSpan(n,q0,q1,q2,faceBathymetryY+(y+2)*w+colBegin,faceBathymetryY+(y+3)*w+colBegin,cellSize[1],theta,yMinus,yPlus);
+		}
+		
+		/* Calculate the partial fluxes across the northern faces of the current row: */
+		maxBandStepSize=vMin(maxBandStepSize,calcFluxSpan(n,prevYPlus,yMinus,faceBathymetryY+(y+2)*w+colBegin,2,1,g,epsilon,cellSize[1],fluxN));
+		for(int j=0;j<3;++j)
+			std::swap(prevYPlus[j],yPlus[j]);
+		
+		/* Copy the current row's cells into the padded row buffer, replicating edge cells into two ghost cells on either side: */
+		for(int j=0;j<3;++j)
+			{
+			const float* qRow=q[j]+y*w;
+			float* pRow=band.paddedRow[j];
+			pRow[0]=qRow[clamp(int(colBegin)-2,w-1)];
+			pRow[1]=qRow[clamp(int(colBegin)-1,w-1)];
+			std::copy(qRow+colBegin,qRow+colEnd,pRow+2);
+			pRow[n+2]=qRow[clamp(int(colEnd),w-1)];
+			pRow[n+3]=qRow[clamp(int(colEnd)+1,w-1)];
+			}
+		
+		/* Reconstruct the x-direction quantities of the current row, including one ghost cell on either side: */
+		const float* fbxRow=faceBathymetryX+y*(w+3)+colBegin;
+		{
+		const float* q0[3];
+		const float* q1[3];
+		const float* q2[3];
+		for(int j=0;j<3;++j)
+			{
+			q0[j]=band.paddedRow[j];
+			q1[j]=band.paddedRow[j]+1;
+			q2[j]=band.paddedRow[j]+2;
+			}
+		reconstructSpan(n+2,q0,q1,q2,fbxRow,fbxRow+1,cellSize[0],theta,band.xMinus,band.xPlus);
+		}
+		
+		/* Calculate the partial fluxes across the vertical faces of the current row: */
+		{
+		const float* left[3];
+		const float* right[3];
+		for(int j=0;j<3;++j)
+			{
+			left[j]=band.xPlus[j];
+			right[j]=band.xMinus[j]+1;
+			}
+		maxBandStepSize=vMin(maxBandStepSize,calcFluxSpan(n+1,left,right,fbxRow+1,1,2,g,epsilon,cellSize[0],band.fluxX));
+		}
+		
+		/* Calculate the temporal derivative of the current row: */
+		{
+		const float* fluxW[3];
+		const float* fluxE[3];
+		const float* cfluxS[3];
+		const float* cfluxN[3];
+		float* dRow[3];
+		for(int j=0;j<3;++j)
+			{
+			fluxW[j]=band.fluxX[j];
+			fluxE[j]=band.fluxX[j]+1;
+			cfluxS[j]=fluxS[j];
+			cfluxN[j]=fluxN[j];
+			dRow[j]=derivative[j]+y*w+colBegin;
+			}
+		calcDerivativeSpan(n,q[0]+y*w+colBegin,fbxRow+1,fbxRow+2,faceBathymetryY+(y+1)*w+colBegin,faceBathymetryY+(y+2)*w+colBegin,fluxW,fluxE,cfluxS,cfluxN,cellSize,g,dRow);
+		}
+		
+		if(tile!=0)
+			{
+			/* Record the partial fluxes across the tile's western and eastern edges, and across its northern edge in its last row: */
+			int tileRow=y-int(rowBegin);
+			for(int j=0;j<3;++j)
+				{
+				tile->flux[0][j][tileRow]=band.fluxX[j][0];
+				tile->flux[1][j][tileRow]=band.fluxX[j][n];
+				}
+			if(y==int(rowEnd)-1)
+				for(int j=0;j<3;++j)
+					std::copy(fluxN[j],fluxN[j]+n,tile->flux[3][j]);
+			}
+		
+		/* The northern faces of this row are the southern faces of the next row: */
+		for(int j=0;j<3;++j)
+			std::swap(fluxS[j],fluxN[j]);
+		}
+	
+	band.maxStepSize=maxBandStepSize;
+	}
+
+void CPUWaterSolver::integrateTileFluxes(CPUWaterSolver::Tile& tile,float weight)
+	{
+	for(int edge=0;edge<4;++edge)
+		{
+		/* Western and eastern edges run along the tile's rows, southern and northern edges along its columns: */
+		unsigned int edgeLength=edge<2?tile.cellMax[1]-tile.cellMin[1]:tile.cellMax[0]-tile.cellMin[0];
+		for(int j=0;j<3;++j)
+			{
+			const float* fPtr=tile.flux[edge][j];
+			float* fsPtr=tile.fluxSum[edge][j];
+			for(unsigned int i=0;i<edgeLength;++i)
+				fsPtr[i]+=fPtr[i]*weight;
+			}
+		}
+	}
+
+void CPUWaterSolver::classifyTiles(void)
+	{
+	/* Find the globally stable step size: */
+	unsigned int numAllTiles=numTiles[1]*numTiles[0];
+	float minStepSize=Math::Constants<float>::max;
+	for(unsigned int i=0;i<numAllTiles;++i)
+		minStepSize=Math::min(minStepSize,tiles[i].maxStepSize);
+	maxStepSize=minStepSize;
+	
+	/* Let the fastest tile take the maximum number of sub-steps: */
+	stepSize=Math::min(minStepSize*float(1U<<multiRateLevels),stepSizeLimit);
+	
+	/* Assign each tile to the lowest level whose step size is stable for the tile: */
+	for(unsigned int i=0;i<numAllTiles;++i)
+		{
+		Tile& tile=tiles[i];
+		tile.level=0;
+		float tileStepSize=stepSize;
+		while(tile.level<multiRateLevels&&tileStepSize>tile.maxStepSize)
+			{
+			tileStepSize*=0.5f;
+			++tile.level;
+			}
+		}
+	
+	/* Refine tiles until the levels of neighboring tiles differ by at most one, to buffer fast tiles against waves from slow tiles: */
+	bool changed=true;
+	while(changed)
+		{
+		changed=false;
+		for(unsigned int ty=0;ty<numTiles[1];++ty)
+			for(unsigned int tx=0;tx<numTiles[0];++tx)
+				{
+				Tile& tile=tiles[ty*numTiles[0]+tx];
+				for(int edge=0;edge<4;++edge)
+					{
+					Tile* neighbor=getNeighbor(tx,ty,edge);
+					if(neighbor!=0&&neighbor->level>tile.level+1U)
+						{
+						tile.level=neighbor->level-1U;
+						changed=true;
+						}
+					}
+				}
+		}
+	
+	/* Calculate the number of sub-steps and the attenuation factors of all levels' step sizes: */
+	maxTileLevel=0;
+	for(unsigned int i=0;i<numAllTiles;++i)
+		maxTileLevel=Math::max(maxTileLevel,tiles[i].level);
+	for(unsigned int level=0;level<=maxTileLevel;++level)
+		levelAttenuations[level]=Math::pow(attenuation,stepSize/float(1U<<level));
+	}
+
+void CPUWaterSolver::correctTileFluxes(CPUWaterSolver::Tile& tile,unsigned int tileX,unsigned int tileY,unsigned int subStep)
+	{
+	/* Bail out if the tile's step does not end with the given sub-step: */
+	if(!isSubStepActive(tile.level,subStep+1U))
+		return;
+	
+	int w=int(size[0]);
+	for(int edge=0;edge<4;++edge)
+		{
+		/* Check if the neighbor across the edge took finer sub-steps: */
+		Tile* neighbor=getNeighbor(tileX,tileY,edge);
+		if(neighbor==0||neighbor->level<=tile.level)
+			continue;
+		
+		/* Determine the row or column of cells along the edge, and the sign and scale of the correction: */
+		unsigned int cellBegin,cellEnd,cellStride;
+		if(edge<2)
+			{
+			unsigned int x=edge==0?tile.cellMin[0]:tile.cellMax[0]-1;
+			cellBegin=tile.cellMin[1]*w+x;
+			cellEnd=tile.cellMax[1]*w+x;
+			cellStride=w;
+			}
+		else
+			{
+			unsigned int y=edge==2?tile.cellMin[1]:tile.cellMax[1]-1;
+			cellBegin=y*w+tile.cellMin[0];
+			cellEnd=y*w+tile.cellMax[0];
+			cellStride=1;
+			}
+		float scale=(edge&0x1?1.0f:-1.0f)/cellSize[edge>>1];
+		
+		/* Replace the fluxes the tile applied to its edge cells with the fluxes the finer neighbor applied to its own edge cells: */
+		const float* const* coarseFlux=tile.fluxSum[edge];
+		const float* const* fineFlux=neighbor->fluxSum[edge^0x1];
+		unsigned int i=0;
+		for(unsigned int cell=cellBegin;cell<cellEnd;cell+=cellStride,++i)
+			{
+			/* Leave enforced dry boundary cells alone: */
+			unsigned int x=cell%size[0];
+			unsigned int y=cell/size[0];
+			if(dryBoundary&&(x==0||x==size[0]-1||y==0||y==size[1]-1))
+				continue;
+			
+			for(int j=0;j<3;++j)
+				quantity[j][cell]+=(coarseFlux[j][i]-fineFlux[j][i])*scale;
+			
+			/* Keep the water surface above the bathymetry: */
+			quantity[0][cell]=Math::max(quantity[0][cell],cellBathymetry[cell]);
+			}
+		}
+	}
+
+void CPUWaterSolver::processTileBand(unsigned int bandIndex)
+	{
+	/* Calculate the band's range of tile rows: */
+	unsigned int tileRowBegin=(numTiles[1]*bandIndex)/numBands;
+	unsigned int tileRowEnd=(numTiles[1]*(bandIndex+1))/numBands;
+	BandState& band=bands[bandIndex];
+	size_t w=size[0];
+	
+	/* Calculate the temporal derivative of the current quantities and the maximum stable step size of each tile: */
+	for(unsigned int ty=tileRowBegin;ty<tileRowEnd;++ty)
+		for(unsigned int tx=0;tx<numTiles[0];++tx)
+			{
+			Tile& tile=tiles[ty*numTiles[0]+tx];
+			calcDerivative(quantity,tile.cellMin[1],tile.cellMax[1],tile.cellMin[0],tile.cellMax[0],band,&tile);
+			tile.maxStepSize=band.maxStepSize;
+			}
+	synchronizeBands();
+	
+	/* Assign all tiles to levels: */
+	if(bandIndex==0)
+		classifyTiles();
+	synchronizeBands();
+	
+	unsigned int numSubSteps=1U<<maxTileLevel;
+	for(unsigned int subStep=0;subStep<numSubSteps;++subStep)
+		{
+		/* Perform the tentative Euler steps of all tiles starting a step with this sub-step: */
+		for(unsigned int ty=tileRowBegin;ty<tileRowEnd;++ty)
+			for(unsigned int tx=0;tx<numTiles[0];++tx)
+				{
+				Tile& tile=tiles[ty*numTiles[0]+tx];
+				Tile* neighbors[4];
+				for(int edge=0;edge<4;++edge)
+					neighbors[edge]=getNeighbor(tx,ty,edge);
+				
+				if(isSubStepActive(tile.level,subStep))
+					{
+					/* Reset the integrated fluxes across edges where the coarser side starts a step: */
+					for(int edge=0;edge<4;++edge)
+						if(neighbors[edge]!=0&&isSubStepActive(Math::min(tile.level,neighbors[edge]->level),subStep))
+							for(int j=0;j<3;++j)
+								std::fill(tile.fluxSum[edge][j],tile.fluxSum[edge][j]+tileSize,0.0f);
+					
+					/* Calculate the temporal derivative of the tile's current quantities; it is already known for the first sub-step: */
+					if(subStep>0)
+						calcDerivative(quantity,tile.cellMin[1],tile.cellMax[1],tile.cellMin[0],tile.cellMax[0],band,&tile);
+					
+					float tileStepSize=stepSize/float(1U<<tile.level);
+					integrateTileFluxes(tile,tileStepSize*0.5f);
+					
+					/* Perform the tentative Euler integration step: */
+					float att=levelAttenuations[tile.level];
+					for(unsigned int y=tile.cellMin[1];y<tile.cellMax[1];++y)
+						{
+						size_t rowBegin=y*w+tile.cellMin[0];
+						size_t rowEnd=y*w+tile.cellMax[0];
+						for(size_t i=rowBegin;i<rowEnd;++i)
+							quantityStar[0][i]=quantity[0][i]+derivative[0][i]*tileStepSize;
+						for(int j=1;j<3;++j)
+							for(size_t i=rowBegin;i<rowEnd;++i)
+								quantityStar[j][i]=(quantity[j][i]+derivative[j][i]*tileStepSize)*att;
+						}
+					}
+				else
+					{
+					/* Copy the two rows or columns of cells along each edge facing an active neighbor into the intermediate quantities, where the neighbor's reconstruction will read them: */
+					for(int edge=0;edge<4;++edge)
+						if(neighbors[edge]!=0&&isSubStepActive(neighbors[edge]->level,subStep))
+							{
+							unsigned int rect[2][2];
+							for(int i=0;i<2;++i)
+								{
+								rect[i][0]=tile.cellMin[i];
+								rect[i][1]=tile.cellMax[i];
+								}
+							int axis=edge>>1;
+							if(edge&0x1)
+								rect[axis][0]=Math::max(rect[axis][1],rect[axis][0]+2U)-2U;
+							else
+								rect[axis][1]=Math::min(rect[axis][0]+2U,rect[axis][1]);
+							for(unsigned int y=rect[1][0];y<rect[1][1];++y)
+								for(int j=0;j<3;++j)
+									std::copy(quantity[j]+(y*w+rect[0][0]),quantity[j]+(y*w+rect[0][1]),quantityStar[j]+(y*w+rect[0][0]));
+							}
+					}
+				}
+		synchronizeBands();
+		
+		/* Perform the final Runge-Kutta integration steps of all tiles starting a step with this sub-step: */
+		for(unsigned int ty=tileRowBegin;ty<tileRowEnd;++ty)
+			for(unsigned int tx=0;tx<numTiles[0];++tx)
+				{
+				Tile& tile=tiles[ty*numTiles[0]+tx];
+				if(!isSubStepActive(tile.level,subStep))
+					continue;
+				
+				/* Calculate the temporal derivative of the tile's intermediate quantities: */
+				calcDerivative(quantityStar,tile.cellMin[1],tile.cellMax[1],tile.cellMin[0],tile.cellMax[0],band,&tile);
+				float tileStepSize=stepSize/float(1U<<tile.level);
+				integrateTileFluxes(tile,tileStepSize*0.5f);
+				
+				/* Perform the final Runge-Kutta integration step: */
+				float att=levelAttenuations[tile.level];
+				for(unsigned int y=tile.cellMin[1];y<tile.cellMax[1];++y)
+					{
+					size_t rowBegin=y*w+tile.cellMin[0];
+					size_t rowEnd=y*w+tile.cellMax[0];
+					for(size_t i=rowBegin;i<rowEnd;++i)
+						quantity[0][i]=(quantity[0][i]+quantityStar[0][i]+derivative[0][i]*tileStepSize)*0.5f;
+					for(int j=1;j<3;++j)
+						for(size_t i=rowBegin;i<rowEnd;++i)
+							quantity[j][i]=((quantity[j][i]+quantityStar[j][i]+derivative[j][i]*tileStepSize)*0.5f)*att;
+					}
+				
+				if(dryBoundary)
+					{
+					/* Set the tile's cells on the outermost layer of the grid to dry conditions: */
+					for(unsigned int y=tile.cellMin[1];y<tile.cellMax[1];++y)
+						for(unsigned int x=tile.cellMin[0];x<tile.cellMax[0];++x)
+							if(x==0||x==size[0]-1||y==0||y==size[1]-1)
+								{
+								size_t i=y*w+x;
+								quantity[0][i]=cellBathymetry[i];
+								quantity[1][i]=0.0f;
+								quantity[2][i]=0.0f;
+								}
+					}
+				}
+		synchronizeBands();
+		
+		if(maxTileLevel>0)
+			{
+			/* Correct coarse tiles whose steps end with this sub-step for the fluxes applied by their finer neighbors: */
+			for(unsigned int ty=tileRowBegin;ty<tileRowEnd;++ty)
+				for(unsigned int tx=0;tx<numTiles[0];++tx)
+					correctTileFluxes(tiles[ty*numTiles[0]+tx],tx,ty,subStep);
+			synchronizeBands();
+			}
+		}
+	}
+
+void CPUWaterSolver::synchronizeBands(void)
+	{
+	if(numWorkerThreads>0)
+		workerBarrier.synchronize();
+	}
+
+void CPUWaterSolver::processBand(unsigned int bandIndex)
+	{
+	/* Calculate the band's row range: */
+	unsigned int rowBegin=(size[1]*bandIndex)/numBands;
+	unsigned int rowEnd=(size[1]*(bandIndex+1))/numBands;
+	size_t cellBegin=size_t(rowBegin)*size_t(size[0]);
+	size_t cellEnd=size_t(rowEnd)*size_t(size[0]);
+	
+	if(operation==SIMULATION_STEP)
+		{
+		/* Calculate the temporal derivative of the current quantities: */
+		calcDerivative(quantity,rowBegin,rowEnd,0,size[0],bands[bandIndex]);
+		synchronizeBands();
+		
+		/* Gather the maximum stable step size from all bands; all threads arrive at the same result: */
+		float bandMaxStepSize=Math::Constants<float>::max;
+		for(unsigned int i=0;i<numBands;++i)
+			bandMaxStepSize=Math::min(bandMaxStepSize,bands[i].maxStepSize);
+		float bandStepSize=forceStepSize?stepSizeLimit:Math::min(bandMaxStepSize,stepSizeLimit);
+		float att=Math::pow(attenuation,bandStepSize);
+		if(bandIndex==0)
+			{
+			maxStepSize=bandMaxStepSize;
+			stepSize=bandStepSize;
+			}
+		
+		/* Perform the tentative Euler integration step: */
+		for(size_t i=cellBegin;i<cellEnd;++i)
+			quantityStar[0][i]=quantity[0][i]+derivative[0][i]*bandStepSize;
+		for(int j=1;j<3;++j)
+			for(size_t i=cellBegin;i<cellEnd;++i)
+				quantityStar[j][i]=(quantity[j][i]+derivative[j][i]*bandStepSize)*att;
+		synchronizeBands();
+		
+		/* Calculate the temporal derivative of the intermediate quantities: */
+		calcDerivative(quantityStar,rowBegin,rowEnd,0,size[0],bands[bandIndex]);
+		
+		/* Perform the final Runge-Kutta integration step: */
+		for(size_t i=cellBegin;i<cellEnd;++i)
+			quantity[0][i]=(quantity[0][i]+quantityStar[0][i]+derivative[0][i]*bandStepSize)*0.5f;
+		for(int j=1;j<3;++j)
+			for(size_t i=cellBegin;i<cellEnd;++i)
+				quantity[j][i]=((quantity[j][i]+quantityStar[j][i]+derivative[j][i]*bandStepSize)*0.5f)*att;
+		
+		if(dryBoundary)
+			{
+			/* Set the outermost layer of cells in the band to dry conditions: */
+			for(unsigned int y=rowBegin;y<rowEnd;++y)
+				{
+				size_t rowOffset=size_t(y)*size_t(size[0]);
+				if(y==0||y==size[1]-1)
+					{
+					for(unsigned int x=0;x<size[0];++x)
+						{
+						quantity[0][rowOffset+x]=cellBathymetry[rowOffset+x];
+						quantity[1][rowOffset+x]=0.0f;
+						quantity[2][rowOffset+x]=0.0f;
+						}
+					}
+				else
+					{
+					size_t ends[2]={rowOffset,rowOffset+size[0]-1};
+					for(int i=0;i<2;++i)
+						{
+						quantity[0][ends[i]]=cellBathymetry[ends[i]];
+						quantity[1][ends[i]]=0.0f;
+						quantity[2][ends[i]]=0.0f;
+						}
+					}
+				}
+			}
+		}
+	else if(operation==MULTI_RATE_STEP)
+		processTileBand(bandIndex);
+	else if(operation==WATER_UPDATE)
+		{
+		for(size_t i=cellBegin;i<cellEnd;++i)
+			{
+			/* Calculate the old and new water column heights: */
+			float b=cellBathymetry[i];
+			float hOld=quantity[0][i]-b;
+			float hNew=Math::max(hOld+(waterGrid!=0?waterGrid[i]:waterAmount),0.0f);
+			
+			/* Update the water surface height: */
+			quantity[0][i]=hNew+b;
+			
+			/* Update the partial discharges; new water is added with zero velocity, and water is removed at current velocity: */
+			if(hNew==0.0f)
+				{
+				quantity[1][i]=0.0f;
+				quantity[2][i]=0.0f;
+				}
+			else if(hNew<hOld)
+				{
+				float scale=hNew/hOld;
+				quantity[1][i]*=scale;
+				quantity[2][i]*=scale;
+				}
+			}
+		}
+	}
+
+void* CPUWaterSolver::workerThreadMethod(unsigned int workerIndex)
+	{
+	while(true)
+		{
+		/* Wait for the next operation or for shutdown: */
+		workerBarrier.synchronize();
+		if(!runWorkerThreads)
+			break;
+		
+		/* Process this worker's band of rows; band 0 is processed by the calling thread: */
+		processBand(workerIndex+1);
+		
+		/* Signal completion: */
+		workerBarrier.synchronize();
+		}
+	
+	return 0;
+	}
+
+void CPUWaterSolver::stopWorkerThreads(void)
+	{
+	if(numWorkerThreads>0)
+		{
+		/* Wake up the worker threads and tell them to shut down: */
+		runWorkerThreads=false;
+		workerBarrier.synchronize();
+		for(unsigned int i=0;i<numWorkerThreads;++i)
+			workerThreads[i].join();
+		delete[] workerThreads;
+		workerThreads=0;
+		numWorkerThreads=0;
+		workerBarrier.setNumSynchronizingThreads(1);
+		}
+	}
+
+void CPUWaterSolver::runOperation(CPUWaterSolver::Operation newOperation)
+	{
+	/* Hand the operation to the worker threads: */
+	operation=newOperation;
+	synchronizeBands();
+	
+	/* Process the first band of rows: */
+	processBand(0);
+	
+	/* Wait for all worker threads to finish their bands: */
+	synchronizeBands();
+	}
+
+CPUWaterSolver::CPUWaterSolver(const unsigned int sSize[2],const float sCellSize[2],float sTheta,float sG,float sEpsilon)
+	:theta(sTheta),g(sG),epsilon(sEpsilon),
+	 waterGrid(0),waterAmount(0.0f),operation(SIMULATION_STEP),
+	 stepSizeLimit(1.0f),forceStepSize(false),attenuation(1.0f),dryBoundary(true),stepSize(0.0f),maxStepSize(0.0f),
+	 numBands(0),bands(0),
+	 numWorkerThreads(0),workerThreads(0),runWorkerThreads(false),
+	 multiRateLevels(0),tileSize(0),tiles(0),maxTileLevel(0)
+	{
+	/* Initialize the grid size and cell size: */
+	for(int i=0;i<2;++i)
+		{
+		size[i]=sSize[i];
+		cellSize[i]=sCellSize[i];
+		}
+	
+	/* Allocate the bathymetry grids: */
+	size_t numCells=size_t(size[1])*size_t(size[0]);
+	bathymetry=new float[size_t(size[1]-1)*size_t(size[0]-1)];
+	std::fill(bathymetry,bathymetry+size_t(size[1]-1)*size_t(size[0]-1),0.0f);
+	faceBathymetryX=new float[size_t(size[1])*size_t(size[0]+3)];
+	faceBathymetryY=new float[size_t(size[1]+3)*size_t(size[0])];
+	cellBathymetry=new float[numCells];
+	setBathymetry(bathymetry);
+	
+	/* Allocate the quantity grids: */
+	for(int j=0;j<3;++j)
+		{
+		quantity[j]=new float[numCells];
+		std::fill(quantity[j],quantity[j]+numCells,0.0f);
+		quantityStar[j]=new float[numCells];
+		derivative[j]=new float[numCells];
+		}
+	
+	numTiles[0]=numTiles[1]=0;
+	
+	/* Process the grid in a single band: */
+	setNumThreads(1);
+	}
+
+CPUWaterSolver::~CPUWaterSolver(void)
+	{
+	/* Shut down all worker threads: */
+	stopWorkerThreads();
+	delete[] bands;
+	delete[] tiles;
+	
+	/* Release all grids: */
+	delete[] bathymetry;
+	delete[] faceBathymetryX;
+	delete[] faceBathymetryY;
+	delete[] cellBathymetry;
+	for(int j=0;j<3;++j)
+		{
+		delete[] quantity[j];
+		delete[] quantityStar[j];
+		delete[] derivative[j];
+		}
+	}
+
+bool CPUWaterSolver::isVectorized(void)
+	{
+	#ifdef __SSE2__
+	return true;
+	#else
+	return false;
+	#endif
+	}
+
+void CPUWaterSolver::setNumThreads(unsigned int newNumThreads)
+	{
+	/* Shut down the current worker threads: */
+	stopWorkerThreads();
+	
+	/* Allocate per-band scratch states: */
+	if(newNumThreads<1)
+		newNumThreads=1;
+	if(newNumThreads>size[1])
+		newNumThreads=size[1];
+	delete[] bands;
+	numBands=newNumThreads;
+	bands=new BandState[numBands];
+	for(unsigned int i=0;i<numBands;++i)
+		bands[i].init(size[0]);
+	
+	/* Start the new worker threads; the calling thread handles the first band of rows itself: */
+	if(numBands>1)
+		{
+		numWorkerThreads=numBands-1;
+		workerBarrier.setNumSynchronizingThreads(numBands);
+		runWorkerThreads=true;
+		workerThreads=new Threads::Thread[numWorkerThreads];
+		for(unsigned int i=0;i<numWorkerThreads;++i)
+			workerThreads[i].start(this,&CPUWaterSolver::workerThreadMethod,i);
+		}
+	}
+
+void CPUWaterSolver::setBathymetry(const float* newBathymetry)
+	{
+	int w=int(size[0]);
+	int h=int(size[1]);
+	int bw=w-1;
+	
+	/* Copy the new vertex-centered bathymetry grid: */
+	if(newBathymetry!=bathymetry)
+		std::copy(newBathymetry,newBathymetry+size_t(h-1)*size_t(bw),bathymetry);
+	
+	/* Calculate bathymetry elevations at vertical face centers, clamping vertex indices to the grid as the GPU's texture sampler does: */
+	float* fbxPtr=faceBathymetryX;
+	for(int y=0;y<h;++y)
+		{
+		const float* b0Row=bathymetry+clamp(y-1,h-2)*bw;
+		const float* b1Row=bathymetry+clamp(y,h-2)*bw;
+		for(int x=-1;x<=w+1;++x,++fbxPtr)
+			{
+			int bx=clamp(x-1,w-2);
+			*fbxPtr=(b0Row[bx]+b1Row[bx])*0.5f;
+			}
+		}
+	
+	/* Calculate bathymetry elevations at horizontal face centers: */
+	float* fbyPtr=faceBathymetryY;
+	for(int y=-1;y<=h+1;++y)
+		{
+		const float* bRow=bathymetry+clamp(y-1,h-2)*bw;
+		for(int x=0;x<w;++x,++fbyPtr)
+			*fbyPtr=(bRow[clamp(x-1,w-2)]+bRow[clamp(x,w-2)])*0.5f;
+		}
+	
+	/* Calculate bathymetry elevations at cell centers: */
+	float* cbPtr=cellBathymetry;
+	for(int y=0;y<h;++y)
+		{
+		const float* b0Row=bathymetry+clamp(y-1,h-2)*bw;
+		const float* b1Row=bathymetry+clamp(y,h-2)*bw;
+		for(int x=0;x<w;++x,++cbPtr)
+			{
+			int bx0=clamp(x-1,w-2);
+			int bx1=clamp(x,w-2);
+			*cbPtr=(b0Row[bx0]+b0Row[bx1]+b1Row[bx0]+b1Row[bx1])*0.25f;
+			}
+		}
+	}
+
+void CPUWaterSolver::updateBathymetry(const float* newBathymetry)
+	{
+	/* Calculate water column heights with respect to the old bathymetry: */
+	size_t numCells=size_t(size[1])*size_t(size[0]);
+	for(size_t i=0;i<numCells;++i)
+		quantity[0][i]=Math::max(quantity[0][i]-cellBathymetry[i],0.0f);
+	
+	/* Set the new bathymetry and add it back to the water column heights: */
+	setBathymetry(newBathymetry);
+	for(size_t i=0;i<numCells;++i)
+		quantity[0][i]+=cellBathymetry[i];
+	}
+
+void CPUWaterSolver::setQuantity(const float* newQuantity)
+	{
+	size_t numCells=size_t(size[1])*size_t(size[0]);
+	const float* nqPtr=newQuantity;
+	for(size_t i=0;i<numCells;++i,nqPtr+=3)
+		for(int j=0;j<3;++j)
+			quantity[j][i]=nqPtr[j];
+	}
+
+void CPUWaterSolver::getQuantity(float* quantityBuffer) const
+	{
+	size_t numCells=size_t(size[1])*size_t(size[0]);
+	float* qbPtr=quantityBuffer;
+	for(size_t i=0;i<numCells;++i,qbPtr+=3)
+		for(int j=0;j<3;++j)
+			qbPtr[j]=quantity[j][i];
+	}
+
+void CPUWaterSolver::setWaterLevel(const float* newWaterLevel)
+	{
+	size_t numCells=size_t(size[1])*size_t(size[0]);
+	for(size_t i=0;i<numCells;++i)
+		{
+		quantity[0][i]=Math::max(newWaterLevel[i],cellBathymetry[i]);
+		quantity[1][i]=0.0f;
+		quantity[2][i]=0.0f;
+		}
+	}
+
+void CPUWaterSolver::setMultiRate(unsigned int newMultiRateLevels,unsigned int newTileSize)
+	{
+	/* Limit the number of levels and the tile size to sensible ranges: */
+	if(newMultiRateLevels>8)
+		newMultiRateLevels=8;
+	if(newTileSize<4)
+		newTileSize=4;
+	multiRateLevels=newMultiRateLevels;
+	
+	if(multiRateLevels==0)
+		{
+		/* Release the tiles: */
+		delete[] tiles;
+		tiles=0;
+		numTiles[0]=numTiles[1]=0;
+		}
+	else if(tiles==0||tileSize!=newTileSize)
+		{
+		/* Split the grid into tiles of the new size; the last row and column of tiles can be smaller: */
+		delete[] tiles;
+		tileSize=newTileSize;
+		for(int i=0;i<2;++i)
+			numTiles[i]=(size[i]+tileSize-1)/tileSize;
+		tiles=new Tile[numTiles[1]*numTiles[0]];
+		Tile* tPtr=tiles;
+		for(unsigned int ty=0;ty<numTiles[1];++ty)
+			for(unsigned int tx=0;tx<numTiles[0];++tx,++tPtr)
+				{
+				unsigned int cellMin[2]={tx*tileSize,ty*tileSize};
+				unsigned int cellMax[2];
+				for(int i=0;i<2;++i)
+					cellMax[i]=Math::min(cellMin[i]+tileSize,size[i]);
+				tPtr->init(cellMin,cellMax,tileSize);
+				}
+		}
+	}
+
+float CPUWaterSolver::runSimulationStep(float newStepSizeLimit,bool newForceStepSize,float newAttenuation,bool newDryBoundary)
+	{
+	/* Run the integration step on all row bands, or on all bands of tile rows if multi-rate integration is enabled: */
+	stepSizeLimit=newStepSizeLimit;
+	forceStepSize=newForceStepSize;
+	attenuation=newAttenuation;
+	dryBoundary=newDryBoundary;
+	runOperation(multiRateLevels>0&&!forceStepSize?MULTI_RATE_STEP:SIMULATION_STEP);
+	
+	return stepSize;
+	}
+
+void CPUWaterSolver::updateWater(const float* newWaterGrid)
+	{
+	waterGrid=newWaterGrid;
+	runOperation(WATER_UPDATE);
+	waterGrid=0;
+	}
+
+void CPUWaterSolver::updateWater(float newWaterAmount)
+	{
+	waterGrid=0;
+	waterAmount=newWaterAmount;
+	runOperation(WATER_UPDATE);
+	}
@@ -0,0 +1,199 @@
+/***********************************************************************
+CPUWaterSolver - Class to run the shallow water flow simulation used by
+WaterTable2 on the CPU, as a multithreaded and vectorized reference
+implementation of the GPU shaders.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef CPUWATERSOLVER_INCLUDED
+#define CPUWATERSOLVER_INCLUDED
+
+#include <Threads/Thread.h>
+#include <Threads/Barrier.h>
+
+class CPUWaterSolver
+	{
+	/* Embedded classes: */
+	private:
+	enum Operation // Enumerated type for operations executed by all row bands in parallel
+		{
+		SIMULATION_STEP, // Runs a complete Runge-Kutta integration step
+		MULTI_RATE_STEP, // Runs a Runge-Kutta integration step where each tile takes sub-steps matching its local maximum step size
+		WATER_UPDATE // Adds or removes water
+		};
+	
+	struct Tile // Structure holding the state of a square tile of cells during a multi-rate integration step
+		{
+		/* Elements: */
+		public:
+		unsigned int cellMin[2]; // Index of the tile's lower-left cell
+		unsigned int cellMax[2]; // Index one past the tile's upper-right cell
+		float* buffer; // Single allocation holding all edge flux buffers
+		float* flux[4][3]; // Partial fluxes across the tile's western, eastern, southern, and northern edge faces calculated by the most recent temporal derivative computation
+		float* fluxSum[4][3]; // Partial fluxes across the tile's edge faces integrated over time since the beginning of the coarser of the tile's and the respective neighbor's step
+		float maxStepSize; // Maximum stable step size over all faces of the tile's cells at the beginning of the integration step
+		unsigned int level; // Number of times the tile's step size is halved relative to the integration step size
+		
+		/* Constructors and destructors: */
+		Tile(void)
+			:buffer(0),maxStepSize(0.0f),level(0)
+			{
+			}
+		~Tile(void)
+			{
+			delete[] buffer;
+			}
+		
+		/* Methods: */
+		void init(const unsigned int sCellMin[2],const unsigned int sCellMax[2],unsigned int tileSize); // Sets the tile's cell range and allocates edge flux buffers for tiles of the given maximum size
+		};
+	
+	struct BandState // Structure holding per-band scratch buffers for the temporal derivative computation
+		{
+		/* Elements: */
+		public:
+		float* buffer; // Single allocation holding all scratch rows
+		float* paddedRow[3]; // One row of conserved quantities with two clamped ghost cells on each side
+		float* xMinus[3]; // West-side reconstructed quantities for one row including one ghost cell on each side
+		float* xPlus[3]; // East-side reconstructed quantities for one row including one ghost cell on each side
+		float* fluxX[3]; // Partial fluxes across the vertical cell faces of one row
+		float* yMinus[3]; // South-side reconstructed quantities for one row
+		float* yPlus[3]; // North-side reconstructed quantities for one row
+		float* prevYPlus[3]; // North-side reconstructed quantities for the previous row
+		float* fluxY[2][3]; // Partial fluxes across the southern and northern horizontal cell faces of one row
+		float maxStepSize; // Maximum stable step size over all cell faces in the band
+		
+		/* Constructors and destructors: */
+		BandState(void)
+			:buffer(0),maxStepSize(0.0f)
+			{
+			}
+		~BandState(void)
+			{
+			delete[] buffer;
+			}
+		
+		/* Methods: */
+		void init(unsigned int width); // Allocates scratch buffers for rows of the given width
+		};
+	
+	/* Elements: */
+	unsigned int size[2]; // Width and height of the cell-centered simulation grid
+	float cellSize[2]; // Width and height of a grid cell
+	float theta; // Coefficient for minmod flux-limiting differential operator
+	float g; // Gravitational acceleration constant
+	float epsilon; // Coefficient for desingularizing division operator
+	float* bathymetry; // Vertex-centered bathymetry grid of grid size minus 1
+	float* faceBathymetryX; // Bathymetry elevations at the centers of vertical cell faces, including two ghost faces on each side
+	float* faceBathymetryY; // Bathymetry elevations at the centers of horizontal cell faces, including two ghost faces on each side
+	float* cellBathymetry; // Bathymetry elevations at cell centers
+	float* quantity[3]; // Cell-centered conserved quantities (w, hu, hv) as separate planes
+	float* quantityStar[3]; // Intermediate quantities after the tentative Euler step
+	float* derivative[3]; // Cell-centered temporal derivatives of the conserved quantities
+	const float* waterGrid; // Grid of water amounts to add or remove during the current water update, or null
+	float waterAmount; // Constant water amount to add or remove during the current water update if the water grid is null
+	Operation operation; // Operation currently executed by the row bands
+	float stepSizeLimit; // Upper limit for the step size of the current integration step
+	bool forceStepSize; // Flag whether the current integration step uses the step size limit regardless of stability
+	float attenuation; // Attenuation factor for partial discharges per unit of simulation time
+	bool dryBoundary; // Flag whether to enforce dry boundaries after the current integration step
+	float stepSize; // Step size taken by the most recent integration step
+	float maxStepSize; // Maximum stable step size calculated during the most recent integration step
+	unsigned int numBands; // Number of row bands processed in parallel
+	BandState* bands; // Array of per-band scratch states
+	unsigned int numWorkerThreads; // Number of worker threads in addition to the calling thread
+	Threads::Thread* workerThreads; // Array of worker threads
+	Threads::Barrier workerBarrier; // Barrier to synchronize the worker threads with the calling thread
+	volatile bool runWorkerThreads; // Flag to keep the worker threads running
+	unsigned int multiRateLevels; // Maximum number of times a tile's step size can be halved in multi-rate integration steps; multi-rate integration is disabled if zero
+	unsigned int tileSize; // Width and height of the tiles into which the grid is split for multi-rate integration steps
+	unsigned int numTiles[2]; // Number of tiles in x and y
+	Tile* tiles; // Array of tiles in row-major order
+	unsigned int maxTileLevel; // Highest level of any tile during the current multi-rate integration step
+	float levelAttenuations[9]; // Attenuation factors for the step sizes of all tile levels during the current multi-rate integration step
+	
+	/* Private methods: */
+	bool isSubStepActive(unsigned int level,unsigned int subStep) const // Returns true if a tile of the given level starts a step with the given sub-step
+		{
+		return (subStep&((1U<<(maxTileLevel-level))-1U))==0U;
+		}
+	Tile* getNeighbor(unsigned int tileX,unsigned int tileY,int edge) // Returns the neighbor of the given tile across its western, eastern, southern, or northern edge, or null at the grid boundary
+		{
+		switch(edge)
+			{
+			case 0:
+				return tileX>0?tiles+(tileY*numTiles[0]+tileX-1):0;
+			
+			case 1:
+				return tileX<numTiles[0]-1?tiles+(tileY*numTiles[0]+tileX+1):0;
+			
+			case 2:
+				return tileY>0?tiles+((tileY-1)*numTiles[0]+tileX):0;
+			
+			default:
+				return tileY<numTiles[1]-1?tiles+((tileY+1)*numTiles[0]+tileX):0;
+			}
+		}
+	void calcDerivative(float* const q[3],unsigned int rowBegin,unsigned int rowEnd,unsigned int colBegin,unsigned int colEnd,BandState& band,Tile* tile =0); // Calculates the temporal derivative of the given quantities for the given rectangle of cells and the rectangle's maximum stable step size; records partial fluxes across the rectangle's edges in the given tile if not null
+	void integrateTileFluxes(Tile& tile,float weight); // Adds the tile's most recently calculated edge fluxes with the given weight to its integrated edge fluxes
+	void classifyTiles(void); // Calculates the current multi-rate integration step size and the level of all tiles
+	void correctTileFluxes(Tile& tile,unsigned int tileX,unsigned int tileY,unsigned int subStep); // Corrects the cells along the tile's edges for flux mismatches with finer neighbors whose sub-steps ended with the given sub-step
+	void processTileBand(unsigned int bandIndex); // Executes a multi-rate integration step on the given band of tile rows
+	void synchronizeBands(void); // Synchronizes all threads processing row bands
+	void processBand(unsigned int bandIndex); // Executes the current operation on the given band of rows
+	void* workerThreadMethod(unsigned int workerIndex); // Method for the worker threads
+	void stopWorkerThreads(void); // Shuts down all worker threads
+	void runOperation(Operation newOperation); // Executes the given operation on all row bands and waits for completion
+	
+	/* Constructors and destructors: */
+	public:
+	CPUWaterSolver(const unsigned int sSize[2],const float sCellSize[2],float sTheta,float sG,float sEpsilon); // Creates a solver for a grid of the given size and cell size, with the given simulation parameters; initializes bathymetry and water surface to zero
+	~CPUWaterSolver(void);
+	
+	/* Methods: */
+	static bool isVectorized(void); // Returns true if the temporal derivative computation was compiled to process four cells at a time
+	void setNumThreads(unsigned int newNumThreads); // Sets the number of threads processing row bands of the simulation grid
+	unsigned int getNumThreads(void) const // Returns the number of threads processing row bands of the simulation grid
+		{
+		return numBands;
+		}
+	void setBathymetry(const float* newBathymetry); // Replaces the vertex-centered bathymetry grid without adjusting the conserved quantities
+	void updateBathymetry(const float* newBathymetry); // Replaces the vertex-centered bathymetry grid and adjusts the water surface to retain water column heights
+	void setQuantity(const float* newQuantity); // Sets the conserved quantities from an interleaved (w, hu, hv) grid
+	void getQuantity(float* quantityBuffer) const; // Writes the conserved quantities into an interleaved (w, hu, hv) grid
+	void setWaterLevel(const float* newWaterLevel); // Sets the water surface to the given grid, clamped to the bathymetry, and resets partial discharges to zero
+	void setMultiRate(unsigned int newMultiRateLevels,unsigned int newTileSize); // Enables multi-rate integration steps where tiles of the given size take up to 2^newMultiRateLevels sub-steps; disables multi-rate integration if newMultiRateLevels is zero
+	unsigned int getMultiRateLevels(void) const // Returns the maximum number of step size halvings in multi-rate integration steps
+		{
+		return multiRateLevels;
+		}
+	unsigned int getTileSize(void) const // Returns the width and height of tiles in multi-rate integration steps
+		{
+		return tileSize;
+		}
+	float runSimulationStep(float newStepSizeLimit,bool newForceStepSize,float newAttenuation,bool newDryBoundary); // Runs a Runge-Kutta integration step of at most the given size, as a multi-rate step if enabled and the step size is not forced; returns the step size taken
+	float getMaxStepSize(void) const // Returns the maximum stable step size calculated during the most recent integration step, even if the step size was forced
+		{
+		return maxStepSize;
+		}
+	void updateWater(const float* newWaterGrid); // Adds or removes the cell-centered water amounts in the given grid
+	void updateWater(float newWaterAmount); // Adds or removes the given water amount in all cells
+	};
+
+#endif
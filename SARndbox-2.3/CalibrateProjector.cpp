@@ -39,7 +39,6 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Geometry/GeometryValueCoders.h>
 #include <GL/GLContextData.h>
 #include <GL/Extensions/GLARBTextureNonPowerOfTwo.h>
-#include <Images/ExtractBlobs.h>
 #include <Vrui/Vrui.h>
 #include <Vrui/ToolManager.h>
 #include <Vrui/OpenFile.h>
@@ -97,44 +96,6 @@ CalibrateProjector::DataItem::~DataItem(void)
 	glDeleteTextures(1,&blobImageTextureId);
 	}
 
-namespace {
-
-/**************
-Helper classes:
-**************/
-
-class BlobForegroundSelector // Functor class to select foreground pixels
-	{
-	/* Methods: */
-	public:
-	bool operator()(unsigned int x,unsigned int y,const Kinect::FrameSource::DepthPixel& pixel) const
-		{
-		return pixel<Kinect::FrameSource::invalidDepth;
-		}
-	};
-
-class BlobMergeChecker // Functor class to check whether two pixels can belong to the same blob
-	{
-	/* Elements: */
-	private:
-	int maxDepthDist;
-	
-	/* Constructors and destructors: */
-	public:
-	BlobMergeChecker(int sMaxDepthDist)
-		:maxDepthDist(sMaxDepthDist)
-		{
-		}
-	
-	/* Methods: */
-	bool operator()(unsigned int x1,unsigned int y1,const Kinect::FrameSource::DepthPixel& pixel1,unsigned int x2,unsigned int y2,const Kinect::FrameSource::DepthPixel& pixel2) const
-		{
-		return Math::abs(int(pixel1)-int(pixel2))<=maxDepthDist;
-		}
-	};
-
-}
-
 /***********************************
 Methods of class CalibrateProjector:
 ***********************************/
@@ -170,7 +131,7 @@ CalibrateProjector::CalibrateProjector(int& argc,char**& argv)
 	 camera(0),
 	 pixelDepthCorrection(0),
 	 capturingBackground(false),
-	 blobIdImage(0),blobImage(0),blobImageVersion(0),
+	 blobExtractor(0),blobIdImage(0),blobImage(0),blobImageVersion(0),
 	 currentBlob(0),
 	 capturingTiePoint(false),numCaptureFrames(0),
 	 haveProjection(false),projection(4,4)
@@ -333,7 +294,8 @@ CalibrateProjector::CalibrateProjector(int& argc,char**& argv)
 	/* Get the camera's intrinsic parameters: */
 	cameraIps=camera->getIntrinsicParameters();
 	
-	/* Create the blob ID image: */
+	/* Create the blob extractor and the blob ID image: */
+	blobExtractor=new DepthBlobExtractor(frameSize);
 	blobIdImage=new unsigned int[frameSize[1]*frameSize[0]];
 	blobImage=new GLColor<GLubyte,3>[frameSize[1]*frameSize[0]];
 	GLColor<GLubyte,3>* biPtr=blobImage;
@@ -359,6 +321,7 @@ CalibrateProjector::~CalibrateProjector(void)
 	delete camera;
 	
 	/* Delete allocated buffers: */
+	delete blobExtractor;
 	delete[] blobIdImage;
 	delete[] blobImage;
 	delete[] pixelDepthCorrection;
@@ -378,12 +341,13 @@ void CalibrateProjector::frame(void)
 			blobCreator.frameSize[i]=frameSize[i];
 		blobCreator.pixelDepthCorrection=pixelDepthCorrection;
 		blobCreator.depthProjection=cameraIps.depthProjection;
-		std::vector<DepthCentroidBlob> blobs=Images::extractBlobs<DepthCentroidBlob>(frameSize,framePixels,bfs,bmc,blobCreator,blobIdImage);
+		const std::vector<DepthCentroidBlob>& blobs=blobExtractor->extractBlobs(framePixels,bfs,bmc,blobCreator);
+		blobExtractor->createBlobIdImage(blobIdImage);
 		
 		/* Find the largest blob that is inside the sandbox area and roughly disk-shaped: */
-		std::vector<DepthCentroidBlob>::iterator biggestBlobIt=blobs.end();
+		std::vector<DepthCentroidBlob>::const_iterator biggestBlobIt=blobs.end();
 		size_t maxNumPixels=50;
-		for(std::vector<DepthCentroidBlob>::iterator bIt=blobs.begin();bIt!=blobs.end();++bIt)
+		for(std::vector<DepthCentroidBlob>::const_iterator bIt=blobs.begin();bIt!=blobs.end();++bIt)
 			if(maxNumPixels<bIt->numPixels)
 				{
 				/* Check if the blob is inside the configured sandbox area and roughly blob-shaped: */
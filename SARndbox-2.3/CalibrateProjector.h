@@ -27,6 +27,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Threads/Mutex.h>
 #include <Threads/Cond.h>
 #include <Threads/TripleBuffer.h>
+#include <Math/Math.h>
 #include <Math/Matrix.h>
 #include <Geometry/Point.h>
 #include <Geometry/AffineCombiner.h>
@@ -41,6 +42,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Kinect/FrameBuffer.h>
 #include <Kinect/Camera.h>
 
+#include "BlobExtractor.h"
+
 class CalibrateProjector:public Vrui::Application,public GLObject
 	{
 	/* Embedded classes: */
@@ -124,6 +127,38 @@ class CalibrateProjector:public Vrui::Application,public GLObject
 			}
 		};
 	
+	class BlobForegroundSelector // Functor class to select foreground pixels
+		{
+		/* Methods: */
+		public:
+		bool operator()(unsigned int x,unsigned int y,const DepthPixel& pixel) const
+			{
+			return pixel<Kinect::FrameSource::invalidDepth;
+			}
+		};
+	
+	class BlobMergeChecker // Functor class to check whether two pixels can belong to the same blob
+		{
+		/* Elements: */
+		private:
+		int maxDepthDist;
+		
+		/* Constructors and destructors: */
+		public:
+		BlobMergeChecker(int sMaxDepthDist)
+			:maxDepthDist(sMaxDepthDist)
+			{
+			}
+		
+		/* Methods: */
+		bool operator()(unsigned int x1,unsigned int y1,const DepthPixel& pixel1,unsigned int x2,unsigned int y2,const DepthPixel& pixel2) const
+			{
+			return Math::abs(int(pixel1)-int(pixel2))<=maxDepthDist;
+			}
+		};
+	
+	typedef BlobExtractor<DepthCentroidBlob,BlobForegroundSelector,BlobMergeChecker> DepthBlobExtractor; // Type for blob extractors finding calibration targets
+	
 	struct TiePoint // Tie point between 3D object space and 2D projector space
 		{
 		/* Elements: */
@@ -183,6 +218,7 @@ class CalibrateProjector:public Vrui::Application,public GLObject
 	bool capturingBackground; // Flag if the Kinect camera is currently capturing a background frame
 	
 	Threads::TripleBuffer<Kinect::FrameBuffer> rawFrames; // Triple buffer for raw depth frames from the Kinect camera
+	DepthBlobExtractor* blobExtractor; // Blob extractor finding foreground blobs in raw depth frames
 	unsigned int* blobIdImage; // An image of blob IDs
 	GLColor<GLubyte,3>* blobImage; // A texture image visualizing the current target tracking state
 	unsigned int blobImageVersion; // Version counter for the blob image
@@ -0,0 +1,535 @@
+/***********************************************************************
+ContourLineExtractor - Class to extract topographic contour lines from
+filtered depth frames as simplified vector polylines in a background
+thread, and to render them from cached vertex buffers.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "ContourLineExtractor.h"
+
+#include <algorithm>
+#include <Misc/FunctionCalls.h>
+#include <Math/Math.h>
+#include <Geometry/Vector.h>
+#include <GL/gl.h>
+#include <GL/GLGeometryWrappers.h>
+#include <GL/GLTransformationWrappers.h>
+#include <GL/GLContextData.h>
+#include <GL/Extensions/GLARBVertexBufferObject.h>
+
+/***********************************************
+Methods of class ContourLineExtractor::DataItem:
+***********************************************/
+
+ContourLineExtractor::DataItem::DataItem(void)
+	:vertexBuffer(0),version(0)
+	{
+	/* Initialize all required extensions: */
+	GLARBVertexBufferObject::initExtension();
+	
+	/* Create the vertex buffer: */
+	glGenBuffersARB(1,&vertexBuffer);
+	}
+
+ContourLineExtractor::DataItem::~DataItem(void)
+	{
+	/* Release the vertex buffer: */
+	glDeleteBuffersARB(1,&vertexBuffer);
+	}
+
+/*************************************
+Methods of class ContourLineExtractor:
+*************************************/
+
+void ContourLineExtractor::addSegment(int level,unsigned int edge0,const ContourLineExtractor::LinePoint& end0,unsigned int edge1,const ContourLineExtractor::LinePoint& end1)
+	{
+	/* Create the new segment: */
+	int segmentIndex=int(segments.size());
+	segments.push_back(Segment());
+	Segment& s=segments.back();
+	s.level=level;
+	s.ends[0]=end0;
+	s.ends[1]=end1;
+	s.links[0]=s.links[1]=-1;
+	s.visited=false;
+	
+	/* Register the segment's end points with their grid edges, keyed by contour level: */
+	Misc::UInt64 levelKey=Misc::UInt64(Misc::UInt32(level))<<32;
+	edgeEnds.push_back(std::make_pair(levelKey|Misc::UInt64(edge0),segmentIndex*2+0));
+	edgeEnds.push_back(std::make_pair(levelKey|Misc::UInt64(edge1),segmentIndex*2+1));
+	}
+
+void ContourLineExtractor::traceSegments(Scalar spacing,Scalar tolerance,ContourLineExtractor::ContourLineSet& lines)
+	{
+	/* Link segments whose end points lie on the same grid edge of the same contour level: */
+	std::sort(edgeEnds.begin(),edgeEnds.end());
+	for(size_t i=0;i+1<edgeEnds.size();++i)
+		if(edgeEnds[i].first==edgeEnds[i+1].first)
+			{
+			int e0=edgeEnds[i].second;
+			int e1=edgeEnds[i+1].second;
+			segments[e0>>1].links[e0&1]=e1;
+			segments[e1>>1].links[e1&1]=e0;
+			++i;
+			}
+	
+	Scalar tolerance2=tolerance*tolerance;
+	int numSegments=int(segments.size());
+	for(int startSegment=0;startSegment<numSegments;++startSegment)
+		{
+		if(segments[startSegment].visited)
+			continue;
+		
+		/* Walk backwards from the segment to the open beginning of its chain, or around its closed loop: */
+		int seg=startSegment;
+		int end=0;
+		for(int i=0;i<numSegments;++i)
+			{
+			int link=segments[seg].links[end];
+			if(link<0)
+				break;
+			seg=link>>1;
+			end=1-(link&1);
+			if(seg==startSegment)
+				{
+				/* Start closed loops at the original segment: */
+				end=0;
+				break;
+				}
+			}
+		
+		/* Trace the chain forward into the polyline: */
+		polyline.clear();
+		polyline.push_back(segments[seg].ends[end]);
+		while(true)
+			{
+			segments[seg].visited=true;
+			int out=1-end;
+			polyline.push_back(segments[seg].ends[out]);
+			int link=segments[seg].links[out];
+			if(link<0)
+				break;
+			seg=link>>1;
+			end=link&1;
+			if(segments[seg].visited)
+				break;
+			}
+		
+		/* Simplify the polyline: */
+		unsigned int numPoints=polyline.size();
+		keep.clear();
+		keep.resize(numPoints,false);
+		keep[0]=keep[numPoints-1]=true;
+		simplifyPolyline(0,numPoints-1,tolerance2);
+		
+		/* Append the simplified polyline to the contour line set: */
+		lines.firsts.push_back(GLint(lines.points.size()));
+		for(unsigned int i=0;i<numPoints;++i)
+			if(keep[i])
+				lines.points.push_back(polyline[i]);
+		lines.counts.push_back(GLsizei(lines.points.size())-lines.firsts.back());
+		lines.elevations.push_back(GLfloat(Scalar(segments[startSegment].level)*spacing));
+		}
+	}
+
+void ContourLineExtractor::simplifyPolyline(unsigned int first,unsigned int last,Scalar tolerance2)
+	{
+	/* Douglas-Peucker simplification with an explicit stack of index intervals: */
+	std::vector<std::pair<unsigned int,unsigned int> > stack;
+	stack.push_back(std::make_pair(first,last));
+	while(!stack.empty())
+		{
+		unsigned int i0=stack.back().first;
+		unsigned int i1=stack.back().second;
+		stack.pop_back();
+		if(i1<=i0+1)
+			continue;
+		
+		/* Find the vertex farthest from the line segment between the interval's end points: */
+		const LinePoint& p0=polyline[i0];
+		Geometry::Vector<GLfloat,3> d=polyline[i1]-p0;
+		Scalar dLen2=Geometry::sqr(d);
+		Scalar maxDist2=Scalar(-1);
+		unsigned int maxIndex=i0;
+		for(unsigned int i=i0+1;i<i1;++i)
+			{
+			Geometry::Vector<GLfloat,3> v=polyline[i]-p0;
+			Scalar dist2=Geometry::sqr(v);
+			if(dLen2>Scalar(0))
+				{
+				/* Calculate the distance to the segment, clamping the foot point to the segment's end points: */
+				Scalar t=(v*d)/dLen2;
+				if(t>=Scalar(1))
+					dist2=Geometry::sqr(polyline[i]-polyline[i1]);
+				else if(t>Scalar(0))
+					dist2-=t*t*dLen2;
+				}
+			if(maxDist2<dist2)
+				{
+				maxDist2=dist2;
+				maxIndex=i;
+				}
+			}
+		
+		/* Keep the farthest vertex and subdivide if it exceeds the tolerance: */
+		if(maxDist2>tolerance2)
+			{
+			keep[maxIndex]=true;
+			stack.push_back(std::make_pair(i0,maxIndex));
+			stack.push_back(std::make_pair(maxIndex,i1));
+			}
+		}
+	}
+
+void* ContourLineExtractor::extractorThreadMethod(void)
+	{
+	unsigned int lastInputFrameVersion=0;
+	
+	while(true)
+		{
+		Kinect::FrameBuffer frame;
+		Scalar spacing,tolerance;
+		{
+		Threads::MutexCond::Lock inputLock(inputCond);
+		
+		/* Wait until a new frame arrives or the program shuts down: */
+		while(runExtractorThread&&lastInputFrameVersion==inputFrameVersion)
+			inputCond.wait(inputLock);
+		
+		/* Bail out if the program is shutting down: */
+		if(!runExtractorThread)
+			break;
+		
+		/* Work on the new frame with the current extraction parameters: */
+		frame=inputFrame;
+		lastInputFrameVersion=inputFrameVersion;
+		spacing=contourLineSpacing;
+		tolerance=simplificationTolerance;
+		}
+		
+		/* Prepare a new output contour line set: */
+		ContourLineSet& newContourLines=contourLines.startNewValue();
+		
+		/* Extract contour lines from the new input frame: */
+		extractContourLines(frame.getData<float>(),spacing,tolerance,newContourLines);
+		
+		/* Finalize the new contour line set in the output buffer: */
+		contourLines.postNewValue();
+		
+		/* Pass the new contour line set to the registered receiver: */
+		if(contourLinesExtractedFunction!=0)
+			(*contourLinesExtractedFunction)(newContourLines);
+		}
+	
+	return 0;
+	}
+
+ContourLineExtractor::ContourLineExtractor(const unsigned int sDepthFrameSize[2],const PTransform& sDepthProjection,const Plane& sBasePlane)
+	:depthProjection(sDepthProjection),basePlane(sBasePlane),
+	 inputFrameVersion(0),
+	 contourLineSpacing(0.75),simplificationTolerance(0.05),
+	 runExtractorThread(false),stageContourLines(0),
+	 nextVersion(1),
+	 contourLinesExtractedFunction(0),
+	 lineWidth(1.5f),lineLift(0)
+	{
+	/* Copy the depth frame size: */
+	for(int i=0;i<2;++i)
+		depthFrameSize[i]=sDepthFrameSize[i];
+	
+	/* Allocate the per-pixel arrays: */
+	elevations.resize(depthFrameSize[1]*depthFrameSize[0]);
+	cameraPoints.resize(depthFrameSize[1]*depthFrameSize[0]);
+	}
+
+ContourLineExtractor::~ContourLineExtractor(void)
+	{
+	/* Shut down the extraction thread if it was started: */
+	{
+	Threads::MutexCond::Lock inputLock(inputCond);
+	runExtractorThread=false;
+	inputCond.signal();
+	}
+	if(!extractorThread.isJoined())
+		extractorThread.join();
+	
+	delete contourLinesExtractedFunction;
+	}
+
+void ContourLineExtractor::initContext(GLContextData& contextData) const
+	{
+	/* Create a data item and add it to the context: */
+	DataItem* dataItem=new DataItem;
+	contextData.addDataItem(this,dataItem);
+	}
+
+unsigned int ContourLineExtractor::startFrame(const Kinect::FrameBuffer& frame,unsigned int numThreads)
+	{
+	/* Work on the new frame with the current extraction parameters: */
+	{
+	Threads::MutexCond::Lock inputLock(inputCond);
+	stageSpacing=contourLineSpacing;
+	stageTolerance=simplificationTolerance;
+	}
+	stageInputFrame=frame;
+	
+	/* Prepare a new output contour line set: */
+	stageContourLines=&contourLines.startNewValue();
+	
+	return 1;
+	}
+
+void ContourLineExtractor::processBand(unsigned int pass,unsigned int bandIndex,unsigned int numBands)
+	{
+	/* Extract contour lines from the entire input frame: */
+	extractContourLines(stageInputFrame.getData<float>(),stageSpacing,stageTolerance,*stageContourLines);
+	}
+
+Kinect::FrameBuffer ContourLineExtractor::finishFrame(void)
+	{
+	/* Finalize the new contour line set in the output buffer: */
+	ContourLineSet& newContourLines=*stageContourLines;
+	contourLines.postNewValue();
+	stageInputFrame=Kinect::FrameBuffer();
+	stageContourLines=0;
+	
+	/* Pass the new contour line set to the registered receiver: */
+	if(contourLinesExtractedFunction!=0)
+		(*contourLinesExtractedFunction)(newContourLines);
+	
+	return Kinect::FrameBuffer();
+	}
+
+void ContourLineExtractor::setContourLineSpacing(Scalar newContourLineSpacing)
+	{
+	Threads::MutexCond::Lock inputLock(inputCond);
+	contourLineSpacing=newContourLineSpacing;
+	}
+
+void ContourLineExtractor::setSimplificationTolerance(Scalar newSimplificationTolerance)
+	{
+	Threads::MutexCond::Lock inputLock(inputCond);
+	simplificationTolerance=newSimplificationTolerance;
+	}
+
+void ContourLineExtractor::setLineWidth(GLfloat newLineWidth)
+	{
+	lineWidth=newLineWidth;
+	}
+
+void ContourLineExtractor::setLineLift(Scalar newLineLift)
+	{
+	lineLift=newLineLift;
+	}
+
+void ContourLineExtractor::extractContourLines(const float* depthFrame,Scalar spacing,Scalar tolerance,ContourLineExtractor::ContourLineSet& lines)
+	{
+	/* Reset the contour line set: */
+	lines.version=nextVersion;
+	++nextVersion;
+	lines.points.clear();
+	lines.firsts.clear();
+	lines.counts.clear();
+	lines.elevations.clear();
+	
+	/* Calculate the camera-space position and elevation of each depth pixel: */
+	unsigned int width=depthFrameSize[0];
+	unsigned int height=depthFrameSize[1];
+	Vector normal=basePlane.getNormal();
+	Scalar normalMag=Geometry::mag(normal);
+	Scalar offset=basePlane.getOffset();
+	const float* dfPtr=depthFrame;
+	float* ePtr=&elevations.front();
+	LinePoint* cpPtr=&cameraPoints.front();
+	for(unsigned int y=0;y<height;++y)
+		for(unsigned int x=0;x<width;++x,++dfPtr,++ePtr,++cpPtr)
+			{
+			Point cp=depthProjection.transform(Point(Scalar(x)+Scalar(0.5),Scalar(y)+Scalar(0.5),Scalar(*dfPtr)));
+			*cpPtr=LinePoint(cp);
+			*ePtr=float(((cp-Point::origin)*normal-offset)/normalMag);
+			}
+	
+	/* Run marching squares on all grid cells for all contour levels crossing each cell: */
+	segments.clear();
+	edgeEnds.clear();
+	Scalar invSpacing=Scalar(1)/spacing;
+	unsigned int verticalEdgeBase=width*height;
+	for(unsigned int y=0;y+1<height;++y)
+		for(unsigned int x=0;x+1<width;++x)
+			{
+			/* Get the cell's corner indices and elevations in the order (x,y), (x+1,y), (x,y+1), (x+1,y+1): */
+			unsigned int ci[4];
+			ci[0]=y*width+x;
+			ci[1]=ci[0]+1;
+			ci[2]=ci[0]+width;
+			ci[3]=ci[2]+1;
+			float e[4];
+			for(int i=0;i<4;++i)
+				e[i]=elevations[ci[i]];
+			
+			/* Determine the range of contour levels crossing the cell: */
+			float eMin=Math::min(Math::min(e[0],e[1]),Math::min(e[2],e[3]));
+			float eMax=Math::max(Math::max(e[0],e[1]),Math::max(e[2],e[3]));
+			int levelMin=int(Math::floor(Scalar(eMin)*invSpacing))+1;
+			int levelMax=int(Math::floor(Scalar(eMax)*invSpacing));
+			
+			/* Grid edges of the cell, bottom, top, left, right: */
+			unsigned int edges[4];
+			edges[0]=ci[0];
+			edges[1]=ci[2];
+			edges[2]=verticalEdgeBase+ci[0];
+			edges[3]=verticalEdgeBase+ci[1];
+			static const int edgeCorners[4][2]={{0,1},{2,3},{0,2},{1,3}};
+			
+			for(int level=levelMin;level<=levelMax;++level)
+				{
+				float le=float(Scalar(level)*spacing);
+				
+				/* Calculate the crossing points on all edges whose corners lie on different sides of the level: */
+				LinePoint crossings[4];
+				bool crossed[4];
+				for(int i=0;i<4;++i)
+					{
+					int c0=edgeCorners[i][0];
+					int c1=edgeCorners[i][1];
+					crossed[i]=(e[c0]>=le)!=(e[c1]>=le);
+					if(crossed[i])
+						crossings[i]=Geometry::affineCombination(cameraPoints[ci[c0]],cameraPoints[ci[c1]],(le-e[c0])/(e[c1]-e[c0]));
+					}
+				
+				if(crossed[0]&&crossed[1]&&crossed[2]&&crossed[3])
+					{
+					/* Resolve the saddle by the elevation of the cell center: */
+					bool centerAbove=(e[0]+e[1]+e[2]+e[3])*0.25f>=le;
+					if(centerAbove==(e[0]>=le))
+						{
+						/* Corners (x,y) and (x+1,y+1) are connected; separate corners (x+1,y) and (x,y+1): */
+						addSegment(level,edges[0],crossings[0],edges[3],crossings[3]);
+						addSegment(level,edges[2],crossings[2],edges[1],crossings[1]);
+						}
+					else
+						{
+						/* Corners (x+1,y) and (x,y+1) are connected; separate corners (x,y) and (x+1,y+1): */
+						addSegment(level,edges[0],crossings[0],edges[2],crossings[2]);
+						addSegment(level,edges[3],crossings[3],edges[1],crossings[1]);
+						}
+					}
+				else
+					{
+					/* Connect the two crossed edges: */
+					int e0=-1,e1=-1;
+					for(int i=0;i<4;++i)
+						if(crossed[i])
+							{
+							if(e0<0)
+								e0=i;
+							else
+								e1=i;
+							}
+					if(e1>=0)
+						addSegment(level,edges[e0],crossings[e0],edges[e1],crossings[e1]);
+					}
+				}
+			}
+	
+	/* Link the segments into simplified polylines: */
+	traceSegments(spacing,tolerance,lines);
+	}
+
+void ContourLineExtractor::setContourLinesExtractedFunction(ContourLineExtractor::ContourLinesExtractedFunction* newContourLinesExtractedFunction)
+	{
+	delete contourLinesExtractedFunction;
+	contourLinesExtractedFunction=newContourLinesExtractedFunction;
+	}
+
+void ContourLineExtractor::receiveFilteredFrame(const Kinect::FrameBuffer& newFrame)
+	{
+	Threads::MutexCond::Lock inputLock(inputCond);
+	
+	/* Store the new frame: */
+	inputFrame=newFrame;
+	++inputFrameVersion;
+	
+	/* Start the extraction thread on the first frame: */
+	if(!runExtractorThread)
+		{
+		runExtractorThread=true;
+		extractorThread.start(this,&ContourLineExtractor::extractorThreadMethod);
+		}
+	
+	/* Wake up the extraction thread: */
+	inputCond.signal();
+	}
+
+void ContourLineExtractor::glRenderAction(const PTransform& projection,const OGTransform& modelview,GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	
+	/* Upload the locked contour line set into the vertex buffer if it is outdated: */
+	const ContourLineSet& lines=contourLines.getLockedValue();
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB,dataItem->vertexBuffer);
+	if(dataItem->version!=lines.version)
+		{
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB,lines.points.size()*sizeof(LinePoint),lines.points.empty()?0:&lines.points.front(),GL_DYNAMIC_DRAW_ARB);
+		dataItem->version=lines.version;
+		}
+	
+	if(!lines.counts.empty())
+		{
+		/* Set up OpenGL state for anti-aliased lines: */
+		glPushAttrib(GL_COLOR_BUFFER_BIT|GL_ENABLE_BIT|GL_LINE_BIT|GL_CURRENT_BIT);
+		glDisable(GL_LIGHTING);
+		glDisable(GL_TEXTURE_2D);
+		glEnable(GL_LINE_SMOOTH);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA);
+		glLineWidth(lineWidth);
+		glColor4f(0.0f,0.0f,0.0f,1.0f);
+		
+		/* Set up the projection and modelview matrices, raising the lines above the surface along the base plane normal: */
+		glMatrixMode(GL_PROJECTION);
+		glPushMatrix();
+		glLoadMatrix(projection);
+		glMatrixMode(GL_MODELVIEW);
+		glPushMatrix();
+		glLoadMatrix(modelview);
+		Vector lift=basePlane.getNormal();
+		lift*=lineLift/Geometry::mag(lift);
+		glTranslate(lift);
+		
+		/* Draw all polylines from the vertex buffer: */
+		glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glVertexPointer(3,GL_FLOAT,0,0);
+		for(size_t i=0;i<lines.counts.size();++i)
+			glDrawArrays(GL_LINE_STRIP,lines.firsts[i],lines.counts[i]);
+		glPopClientAttrib();
+		
+		/* Restore OpenGL state: */
+		glPopMatrix();
+		glMatrixMode(GL_PROJECTION);
+		glPopMatrix();
+		glMatrixMode(GL_MODELVIEW);
+		glPopAttrib();
+		}
+	
+	/* Protect the vertex buffer: */
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB,0);
+	}
@@ -0,0 +1,167 @@
+/***********************************************************************
+ContourLineExtractor - Class to extract topographic contour lines from
+filtered depth frames as simplified vector polylines in a background
+thread, and to render them from cached vertex buffers.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef CONTOURLINEEXTRACTOR_INCLUDED
+#define CONTOURLINEEXTRACTOR_INCLUDED
+
+#include <utility>
+#include <vector>
+#include <Misc/SizedTypes.h>
+#include <Threads/Thread.h>
+#include <Threads/MutexCond.h>
+#include <Threads/TripleBuffer.h>
+#include <Geometry/Point.h>
+#include <GL/gl.h>
+#include <GL/GLObject.h>
+#include <Kinect/FrameBuffer.h>
+
+#include "Types.h"
+#include "DepthFramePipeline.h"
+
+/* Forward declarations: */
+namespace Misc {
+template <class ParameterParam>
+class FunctionCall;
+}
+
+class ContourLineExtractor:public GLObject,public DepthFramePipeline::Stage
+	{
+	/* Embedded classes: */
+	public:
+	typedef Geometry::Point<GLfloat,3> LinePoint; // Type for camera-space polyline vertices
+	struct ContourLineSet;
+	typedef Misc::FunctionCall<const ContourLineSet&> ContourLinesExtractedFunction; // Type for functions called when a new contour line set has been extracted
+	
+	struct ContourLineSet // Structure holding all contour lines extracted from one depth frame
+		{
+		/* Elements: */
+		public:
+		unsigned int version; // Version number of the contour line set, incremented for each extracted frame
+		std::vector<LinePoint> points; // Camera-space vertices of all polylines
+		std::vector<GLint> firsts; // Index of the first vertex of each polyline
+		std::vector<GLsizei> counts; // Number of vertices of each polyline
+		std::vector<GLfloat> elevations; // Elevation of each polyline relative to the base plane
+		
+		/* Constructors and destructors: */
+		ContourLineSet(void)
+			:version(0)
+			{
+			}
+		};
+	
+	private:
+	struct Segment // Helper structure for a single line segment produced by marching squares
+		{
+		/* Elements: */
+		public:
+		int level; // Index of the contour level containing the segment
+		LinePoint ends[2]; // The segment's end points
+		int links[2]; // Index times two plus end index of the segments sharing each end point, or -1 for open ends
+		bool visited; // Flag whether the segment was already added to a polyline
+		};
+	
+	struct DataItem:public GLObject::DataItem
+		{
+		/* Elements: */
+		public:
+		GLuint vertexBuffer; // Vertex buffer holding the vertices of the most recently uploaded contour line set
+		unsigned int version; // Version number of the contour line set in the vertex buffer
+		
+		/* Constructors and destructors: */
+		DataItem(void);
+		virtual ~DataItem(void);
+		};
+	
+	/* Elements: */
+	unsigned int depthFrameSize[2]; // Size of incoming depth frames
+	PTransform depthProjection; // Projective transformation from depth image space to camera space
+	Plane basePlane; // Base plane relative to which elevations are measured
+	
+	Threads::MutexCond inputCond; // Condition variable to signal arrival of a new input frame
+	Kinect::FrameBuffer inputFrame; // The most recent input frame
+	unsigned int inputFrameVersion; // Version number of input frame
+	Scalar contourLineSpacing; // Elevation distance between adjacent contour lines
+	Scalar simplificationTolerance; // Maximum distance between simplified and original polylines in camera-space units
+	volatile bool runExtractorThread; // Flag to keep the background extraction thread running
+	Threads::Thread extractorThread; // The background extraction thread, started when the first filtered frame is received
+	Kinect::FrameBuffer stageInputFrame; // Filtered input frame currently processed as a pipeline stage
+	Scalar stageSpacing,stageTolerance; // Extraction parameters for the frame currently processed as a pipeline stage
+	ContourLineSet* stageContourLines; // Output contour line set currently written as a pipeline stage
+	
+	std::vector<float> elevations; // Per-pixel elevations of the current depth frame
+	std::vector<LinePoint> cameraPoints; // Per-pixel camera-space positions of the current depth frame
+	std::vector<Segment> segments; // Segments of all contour levels in the current depth frame
+	std::vector<std::pair<Misc::UInt64,int> > edgeEnds; // List of contour level and grid edge keys and segment end points to link adjacent segments
+	std::vector<LinePoint> polyline; // Unsimplified polyline being traced
+	std::vector<bool> keep; // Flags for polyline vertices surviving simplification
+	unsigned int nextVersion; // Version number of the next extracted contour line set
+	
+	Threads::TripleBuffer<ContourLineSet> contourLines; // Triple buffer of extracted contour line sets
+	ContourLinesExtractedFunction* contourLinesExtractedFunction; // Function called when a new contour line set is ready
+	
+	GLfloat lineWidth; // Width of rendered contour lines in pixels
+	Scalar lineLift; // Distance by which rendered contour lines are raised along the base plane normal to avoid depth fighting with the surface
+	
+	/* Private methods: */
+	void addSegment(int level,unsigned int edge0,const LinePoint& end0,unsigned int edge1,const LinePoint& end1); // Adds a segment between the given grid edges to the given contour level
+	void traceSegments(Scalar spacing,Scalar tolerance,ContourLineSet& lines); // Links all segments into polylines, simplifies them, and adds them to the given contour line set
+	void simplifyPolyline(unsigned int first,unsigned int last,Scalar tolerance2); // Marks the vertices of the traced polyline between the given indices that are required to stay within the tolerance
+	void* extractorThreadMethod(void); // Method for the background contour line extraction thread
+	
+	/* Constructors and destructors: */
+	public:
+	ContourLineExtractor(const unsigned int sDepthFrameSize[2],const PTransform& sDepthProjection,const Plane& sBasePlane); // Creates a contour line extractor for depth frames of the given size
+	private:
+	ContourLineExtractor(const ContourLineExtractor& source); // Prohibit copy constructor
+	ContourLineExtractor& operator=(const ContourLineExtractor& source); // Prohibit assignment operator
+	public:
+	virtual ~ContourLineExtractor(void);
+	
+	/* Methods from GLObject: */
+	virtual void initContext(GLContextData& contextData) const;
+	
+	/* Methods from DepthFramePipeline::Stage: */
+	virtual unsigned int startFrame(const Kinect::FrameBuffer& frame,unsigned int numThreads);
+	virtual void processBand(unsigned int pass,unsigned int bandIndex,unsigned int numBands);
+	virtual Kinect::FrameBuffer finishFrame(void);
+	
+	/* New methods: */
+	void setContourLineSpacing(Scalar newContourLineSpacing); // Sets the elevation distance between adjacent contour lines; takes effect with the next frame
+	void setSimplificationTolerance(Scalar newSimplificationTolerance); // Sets the maximum distance between simplified and original polylines; takes effect with the next frame
+	void setLineWidth(GLfloat newLineWidth); // Sets the width of rendered contour lines in pixels
+	void setLineLift(Scalar newLineLift); // Sets the distance by which rendered contour lines are raised above the surface
+	void extractContourLines(const float* depthFrame,Scalar spacing,Scalar tolerance,ContourLineSet& lines); // Extracts simplified contour lines from the given depth frame; not thread-safe against the extraction thread
+	void setContourLinesExtractedFunction(ContourLinesExtractedFunction* newContourLinesExtractedFunction); // Sets the output function; adopts given functor object
+	void receiveFilteredFrame(const Kinect::FrameBuffer& newFrame); // Called to receive a new filtered depth frame; must not be mixed with use as a pipeline stage
+	bool lockNewContourLines(void) // Locks the most recently extracted contour line set for reading; returns true if the locked set is new
+		{
+		return contourLines.lockNewValue();
+		}
+	const ContourLineSet& getLockedContourLines(void) const // Returns the most recently locked contour line set
+		{
+		return contourLines.getLockedValue();
+		}
+	void glRenderAction(const PTransform& projection,const OGTransform& modelview,GLContextData& contextData) const; // Renders the most recently locked contour line set
+	};
+
+#endif
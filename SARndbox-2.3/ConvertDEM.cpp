@@ -0,0 +1,78 @@
+/***********************************************************************
+ConvertDEM - Utility to convert digital elevation models from the flat
+DEM file format into tiled multi-resolution DEM pyramid files that can
+be memory-mapped by the Augmented Reality Sandbox.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include <string.h>
+#include <stdlib.h>
+#include <iostream>
+#include <stdexcept>
+
+#include "DEM.h"
+
+int main(int argc,char* argv[])
+	{
+	/* Parse the command line: */
+	const char* demFileName=0;
+	const char* pyramidFileName=0;
+	int tileSize=256;
+	for(int i=1;i<argc;++i)
+		{
+		if(argv[i][0]=='-')
+			{
+			if(strcasecmp(argv[i]+1,"ts")==0)
+				{
+				++i;
+				tileSize=atoi(argv[i]);
+				}
+			else
+				std::cerr<<"Ignoring unrecognized command line switch "<<argv[i]<<std::endl;
+			}
+		else if(demFileName==0)
+			demFileName=argv[i];
+		else if(pyramidFileName==0)
+			pyramidFileName=argv[i];
+		}
+	if(demFileName==0||pyramidFileName==0)
+		{
+		std::cerr<<"Usage: "<<argv[0]<<" <DEM file name> <DEM pyramid file name> [-ts <tile size>]"<<std::endl;
+		return 1;
+		}
+	
+	try
+		{
+		/* Convert the DEM: */
+		DEM::convertToPyramid(demFileName,pyramidFileName,tileSize);
+		
+		/* Print the resulting pyramid's layout: */
+		DEM pyramid;
+		pyramid.load(pyramidFileName);
+		const Scalar* demBox=pyramid.getDemBox();
+		std::cout<<"Wrote DEM pyramid covering ["<<demBox[0]<<", "<<demBox[2]<<"] x ["<<demBox[1]<<", "<<demBox[3]<<"] with "<<pyramid.getNumLevels()<<" levels"<<std::endl;
+		}
+	catch(std::runtime_error err)
+		{
+		std::cerr<<"Caught exception "<<err.what()<<std::endl;
+		return 1;
+		}
+	
+	return 0;
+	}
@@ -1,6 +1,7 @@
 /***********************************************************************
 DEM - Class to represent digital elevation models (DEMs) as float-valued
-texture objects.
+texture objects, optionally backed by memory-mapped multi-resolution
+tile pyramids of which only the parts covering the sandbox are uploaded.
 Copyright (c) 2013-2016 Oliver Kreylos
 
 This file is part of the Augmented Reality Sandbox (SARndbox).
@@ -22,8 +23,14 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "DEM.h"
 
+#include <string.h>
+#include <Misc/SizedTypes.h>
+#include <Misc/Endianness.h>
+#include <Misc/ThrowStdErr.h>
 #include <IO/File.h>
 #include <IO/OpenFile.h>
+#include <Math/Math.h>
+#include <Math/Constants.h>
 #include <GL/gl.h>
 #include <GL/GLContextData.h>
 #include <GL/Extensions/GLARBTextureFloat.h>
@@ -32,12 +39,24 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <GL/Extensions/GLARBShaderObjects.h>
 #include <Geometry/Matrix.h>
 
+namespace {
+
+/****************
+Helper constants:
+****************/
+
+const Misc::UInt32 pyramidFileMagic=0x50444153U; // "SADP" for SARndbox DEM pyramid
+const Misc::UInt32 pyramidFileFormatVersion=1U;
+const size_t pyramidLevelAlignment=4096; // Alignment of each level's tiles in a pyramid file to keep them page-aligned in memory
+
+}
+
 /******************************
 Methods of class DEM::DataItem:
 ******************************/
 
 DEM::DataItem::DataItem(void)
-	:textureObjectId(0)
+	:textureObjectId(0),textureObjectVersion(0)
 	{
 	/* Check for and initialize all required OpenGL extensions: */
 	GLARBTextureFloat::initExtension();
@@ -59,18 +78,203 @@ DEM::DataItem::~DataItem(void)
 Methods of class DEM:
 ********************/
 
+void DEM::loadPyramid(const char* demFileName)
+	{
+	/* Memory-map the pyramid file: */
+	IO::MemMappedFile* file=new IO::MemMappedFile(demFileName);
+	pyramidFile=file;
+	file->setEndianness(Misc::LittleEndian);
+	swapSamples=file->mustSwapOnRead();
+	
+	/* Read the file header: */
+	if(file->read<Misc::UInt32>()!=pyramidFileMagic||file->read<Misc::UInt32>()!=pyramidFileFormatVersion)
+		Misc::throwStdErr("DEM::load: %s is not a version %u DEM pyramid file",demFileName,pyramidFileFormatVersion);
+	for(int i=0;i<2;++i)
+		tileSize[i]=int(file->read<Misc::UInt32>());
+	unsigned int numLevels=file->read<Misc::UInt32>();
+	for(int i=0;i<4;++i)
+		demBox[i]=Scalar(file->read<Misc::Float64>());
+	if(tileSize[0]<2||tileSize[1]<2||numLevels==0)
+		Misc::throwStdErr("DEM::load: Malformed header in DEM pyramid file %s",demFileName);
+	
+	/* Read the level descriptors and locate each level's tiles in the memory map: */
+	const char* memBase=static_cast<const char*>(file->getMemory());
+	size_t fileSize=size_t(file->getSize());
+	size_t tileBytes=size_t(tileSize[1])*size_t(tileSize[0])*sizeof(float);
+	levels.resize(numLevels);
+	for(unsigned int level=0;level<numLevels;++level)
+		{
+		Level& l=levels[level];
+		for(int i=0;i<2;++i)
+			l.size[i]=int(file->read<Misc::UInt32>());
+		for(int i=0;i<2;++i)
+			l.origin[i]=Scalar(file->read<Misc::Float64>());
+		for(int i=0;i<2;++i)
+			l.spacing[i]=Scalar(file->read<Misc::Float64>());
+		size_t tileOffset=size_t(file->read<Misc::UInt64>());
+		for(int i=0;i<2;++i)
+			l.numTiles[i]=(l.size[i]+tileSize[i]-1)/tileSize[i];
+		
+		/* Check that the level's tiles are aligned and completely contained in the file: */
+		if(l.size[0]<2||l.size[1]<2||tileOffset%sizeof(float)!=0||tileOffset+size_t(l.numTiles[1])*size_t(l.numTiles[0])*tileBytes>fileSize)
+			Misc::throwStdErr("DEM::load: Level %u of DEM pyramid file %s is malformed or truncated",level,demFileName);
+		l.tiles=reinterpret_cast<const float*>(memBase+tileOffset);
+		}
+	
+	/* The finest level defines the DEM's size: */
+	for(int i=0;i<2;++i)
+		demSize[i]=levels[0].size[i];
+	}
+
+void DEM::copyRow(const DEM::Level& level,int y,int x0,int x1,float* dest) const
+	{
+	/* Find the row of tiles containing the requested row: */
+	int tileY=y/tileSize[1];
+	const float* tileRow=level.tiles+(size_t(tileY)*size_t(level.numTiles[0])*size_t(tileSize[1])+size_t(y-tileY*tileSize[1]))*size_t(tileSize[0]);
+	
+	/* Copy the requested postings from all overlapping tiles: */
+	float* destPtr=dest;
+	for(int x=x0;x<x1;)
+		{
+		int tileX=x/tileSize[0];
+		int tileX1=(tileX+1)*tileSize[0];
+		if(tileX1>x1)
+			tileX1=x1;
+		memcpy(destPtr,tileRow+size_t(tileX)*size_t(tileSize[1])*size_t(tileSize[0])+size_t(x-tileX*tileSize[0]),size_t(tileX1-x)*sizeof(float));
+		destPtr+=tileX1-x;
+		x=tileX1;
+		}
+	
+	/* Convert the copied postings to host endianness if necessary: */
+	if(swapSamples)
+		Misc::swapEndianness(dest,size_t(x1-x0));
+	}
+
+void DEM::updateTexture(void)
+	{
+	/* Calculate the DEM-space region that needs to be covered by the texture; default to the entire DEM: */
+	Scalar region[4];
+	for(int i=0;i<4;++i)
+		region[i]=demBox[i];
+	if(!footprint.isNull())
+		{
+		/* Transform the footprint's corners to DEM space: */
+		Scalar fp[4]={Math::Constants<Scalar>::max,Math::Constants<Scalar>::max,Math::Constants<Scalar>::min,Math::Constants<Scalar>::min};
+		for(int v=0;v<8;++v)
+			{
+			Point p=transform.transform(footprint.getVertex(v));
+			for(int i=0;i<2;++i)
+				{
+				if(fp[i]>p[i])
+					fp[i]=p[i];
+				if(fp[2+i]<p[i])
+					fp[2+i]=p[i];
+				}
+			}
+		
+		/* Restrict the region to the footprint if the two overlap: */
+		if(fp[0]<demBox[2]&&fp[2]>demBox[0]&&fp[1]<demBox[3]&&fp[3]>demBox[1])
+			for(int i=0;i<2;++i)
+				{
+				region[i]=Math::max(fp[i],demBox[i]);
+				region[2+i]=Math::min(fp[2+i],demBox[2+i]);
+				}
+		}
+	
+	/* Find the finest level at which the tiles covering the region fit into the maximum texture size: */
+	int numLevels=int(levels.size());
+	int level;
+	int range[4];
+	for(level=0;level<numLevels;++level)
+		{
+		const Level& l=levels[level];
+		for(int i=0;i<2;++i)
+			{
+			/* Calculate the range of postings covering the region: */
+			int p0=int(Math::floor((region[i]-l.origin[i])/l.spacing[i]));
+			int p1=int(Math::ceil((region[2+i]-l.origin[i])/l.spacing[i]))+1;
+			if(p0>l.size[i]-2)
+				p0=l.size[i]-2;
+			if(p0<0)
+				p0=0;
+			if(p1>l.size[i])
+				p1=l.size[i];
+			if(p1<p0+2)
+				p1=p0+2;
+			range[i]=p0;
+			range[2+i]=p1;
+			}
+		
+		if(range[2]-range[0]<=maxTextureSize&&range[3]-range[1]<=maxTextureSize)
+			{
+			/* Extend the range to tile boundaries where it fits so that small transformation changes don't require re-assembling the texture: */
+			for(int i=0;i<2;++i)
+				{
+				int t0=(range[i]/tileSize[i])*tileSize[i];
+				int t1=((range[2+i]+tileSize[i]-1)/tileSize[i])*tileSize[i];
+				if(t1>l.size[i])
+					t1=l.size[i];
+				if(t1-t0<=maxTextureSize)
+					{
+					range[i]=t0;
+					range[2+i]=t1;
+					}
+				}
+			break;
+			}
+		}
+	
+	/* Fall back to the coarsest level if no level fits: */
+	if(level==numLevels)
+		level=numLevels-1;
+	
+	/* Bail out if the texture already covers the selected range: */
+	if(level==textureLevel&&range[0]==textureRange[0]&&range[1]==textureRange[1]&&range[2]==textureRange[2]&&range[3]==textureRange[3])
+		return;
+	
+	/* Update the texture layout: */
+	const Level& l=levels[level];
+	textureLevel=level;
+	for(int i=0;i<2;++i)
+		{
+		textureRange[i]=range[i];
+		textureRange[2+i]=range[2+i];
+		textureSize[i]=range[2+i]-range[i];
+		textureBox[i]=l.origin[i]+Scalar(range[i])*l.spacing[i];
+		textureBox[2+i]=l.origin[i]+Scalar(range[2+i]-1)*l.spacing[i];
+		}
+	
+	if(l.numTiles[0]==1&&l.numTiles[1]==1&&textureSize[0]==tileSize[0]&&textureSize[1]==tileSize[1]&&!swapSamples)
+		{
+		/* Use the level's only tile as the texture directly: */
+		std::vector<float>().swap(textureBuffer);
+		texture=l.tiles;
+		}
+	else
+		{
+		/* Assemble the texture from the level's tiles, touching only the tiles covering the selected range: */
+		textureBuffer.resize(size_t(textureSize[1])*size_t(textureSize[0]));
+		float* tbPtr=&textureBuffer.front();
+		for(int y=range[1];y<range[3];++y,tbPtr+=textureSize[0])
+			copyRow(l,y,range[0],range[2],tbPtr);
+		texture=&textureBuffer.front();
+		}
+	
+	++textureVersion;
+	}
+
 void DEM::calcMatrix(void)
 	{
 	/* Convert the DEM transformation into a projective transformation matrix: */
 	demTransform=PTransform(transform);
 	PTransform::Matrix& dtm=demTransform.getMatrix();
 	
-	/* Pre-multiply the projective transformation matrix with the DEM space to DEM pixel space transformation: */
+	/* Pre-multiply the projective transformation matrix with the DEM space to DEM texture pixel space transformation: */
 	PTransform dem;
-	dem.getMatrix()(0,0)=Scalar(demSize[0]-1)/(demBox[2]-demBox[0]);
-	dem.getMatrix()(0,3)=Scalar(0.5)-Scalar(demSize[0]-1)/(demBox[2]-demBox[0])*demBox[0];
-	dem.getMatrix()(1,1)=Scalar(demSize[1]-1)/(demBox[3]-demBox[1]);
-	dem.getMatrix()(1,3)=Scalar(0.5)-Scalar(demSize[1]-1)/(demBox[3]-demBox[1])*demBox[1];
+	dem.getMatrix()(0,0)=Scalar(textureSize[0]-1)/(textureBox[2]-textureBox[0]);
+	dem.getMatrix()(0,3)=Scalar(0.5)-Scalar(textureSize[0]-1)/(textureBox[2]-textureBox[0])*textureBox[0];
+	dem.getMatrix()(1,1)=Scalar(textureSize[1]-1)/(textureBox[3]-textureBox[1]);
+	dem.getMatrix()(1,3)=Scalar(0.5)-Scalar(textureSize[1]-1)/(textureBox[3]-textureBox[1])*textureBox[1];
 	dem.getMatrix()(2,2)=Scalar(1)/verticalScale;
 	dem.getMatrix()(2,3)=verticalScaleBase-verticalScaleBase/verticalScale;
 	demTransform.leftMultiply(dem);
@@ -84,10 +288,17 @@ void DEM::calcMatrix(void)
 
 DEM::DEM(void)
 	:dem(0),
+	 swapSamples(false),
+	 footprint(Box::empty),maxTextureSize(2048),
+	 textureLevel(-1),texture(0),textureVersion(0),
 	 transform(OGTransform::identity),
 	 verticalScale(1),verticalScaleBase(0)
 	{
 	demSize[0]=demSize[1]=0;
+	tileSize[0]=tileSize[1]=0;
+	for(int i=0;i<4;++i)
+		textureRange[i]=0;
+	textureSize[0]=textureSize[1]=0;
 	}
 
 DEM::~DEM(void)
@@ -101,41 +312,197 @@ void DEM::initContext(GLContextData& contextData) const
 	DataItem* dataItem=new DataItem;
 	contextData.addDataItem(this,dataItem);
 	
-	/* Upload the DEM array into the texture object: */
+	/* Initialize the texture object; the DEM texture is uploaded on first use: */
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->textureObjectId);
 	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_S,GL_CLAMP);
 	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_T,GL_CLAMP);
-	glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_LUMINANCE32F_ARB,demSize[0],demSize[1],0,GL_LUMINANCE,GL_FLOAT,dem);
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
 	}
 
+void DEM::convertToPyramid(const char* demFileName,const char* pyramidFileName,int newTileSize)
+	{
+	if(newTileSize<2)
+		Misc::throwStdErr("DEM::convertToPyramid: Invalid tile size %d",newTileSize);
+	
+	/* Load the source DEM: */
+	DEM source;
+	source.load(demFileName);
+	if(source.dem==0)
+		Misc::throwStdErr("DEM::convertToPyramid: %s already is a DEM pyramid file",demFileName);
+	
+	/* Create the pyramid's levels by repeatedly averaging 2x2 blocks of postings until a level fits into a single tile: */
+	std::vector<Level> pyramid;
+	std::vector<std::vector<float> > grids;
+	pyramid.push_back(source.levels[0]);
+	const float* grid=source.dem;
+	while(true)
+		{
+		const Level& l=pyramid.back();
+		if((l.size[0]<=newTileSize&&l.size[1]<=newTileSize)||l.size[0]<4||l.size[1]<4)
+			break;
+		
+		/* The coarser level's postings are centered on the 2x2 blocks they average: */
+		Level next;
+		for(int i=0;i<2;++i)
+			{
+			next.size[i]=l.size[i]/2;
+			next.origin[i]=l.origin[i]+l.spacing[i]*Scalar(0.5);
+			next.spacing[i]=l.spacing[i]*Scalar(2);
+			}
+		grids.push_back(std::vector<float>(size_t(next.size[1])*size_t(next.size[0])));
+		float* nPtr=&grids.back().front();
+		for(int y=0;y<next.size[1];++y)
+			{
+			const float* r0=grid+size_t(y*2)*size_t(l.size[0]);
+			const float* r1=r0+l.size[0];
+			for(int x=0;x<next.size[0];++x,++nPtr,r0+=2,r1+=2)
+				*nPtr=(r0[0]+r0[1]+r1[0]+r1[1])*0.25f;
+			}
+		pyramid.push_back(next);
+		grid=&grids.back().front();
+		}
+	
+	/* Lay out the pyramid file: */
+	unsigned int numLevels=pyramid.size();
+	size_t headerSize=4*4+4+4*8+numLevels*(2*4+4*8+8);
+	size_t tileBytes=size_t(newTileSize)*size_t(newTileSize)*sizeof(float);
+	std::vector<size_t> tileOffsets(numLevels);
+	size_t offset=headerSize;
+	for(unsigned int level=0;level<numLevels;++level)
+		{
+		Level& l=pyramid[level];
+		for(int i=0;i<2;++i)
+			l.numTiles[i]=(l.size[i]+newTileSize-1)/newTileSize;
+		offset=(offset+pyramidLevelAlignment-1)&~(pyramidLevelAlignment-1);
+		tileOffsets[level]=offset;
+		offset+=size_t(l.numTiles[1])*size_t(l.numTiles[0])*tileBytes;
+		}
+	
+	/* Write the file header: */
+	IO::FilePtr file=IO::openFile(pyramidFileName,IO::File::WriteOnly);
+	file->setEndianness(Misc::LittleEndian);
+	file->write<Misc::UInt32>(pyramidFileMagic);
+	file->write<Misc::UInt32>(pyramidFileFormatVersion);
+	for(int i=0;i<2;++i)
+		file->write<Misc::UInt32>(Misc::UInt32(newTileSize));
+	file->write<Misc::UInt32>(numLevels);
+	for(int i=0;i<4;++i)
+		file->write<Misc::Float64>(source.demBox[i]);
+	for(unsigned int level=0;level<numLevels;++level)
+		{
+		const Level& l=pyramid[level];
+		for(int i=0;i<2;++i)
+			file->write<Misc::UInt32>(Misc::UInt32(l.size[i]));
+		for(int i=0;i<2;++i)
+			file->write<Misc::Float64>(l.origin[i]);
+		for(int i=0;i<2;++i)
+			file->write<Misc::Float64>(l.spacing[i]);
+		file->write<Misc::UInt64>(Misc::UInt64(tileOffsets[level]));
+		}
+	
+	/* Write each level's tiles, replicating edge postings into partial tiles: */
+	std::vector<float> tileRow(newTileSize);
+	offset=headerSize;
+	for(unsigned int level=0;level<numLevels;++level)
+		{
+		/* Pad the file to the level's tile offset: */
+		for(;offset<tileOffsets[level];++offset)
+			file->write<Misc::UInt8>(0);
+		
+		const Level& l=pyramid[level];
+		const float* levelGrid=level==0?source.dem:&grids[level-1].front();
+		for(int tileY=0;tileY<l.numTiles[1];++tileY)
+			for(int tileX=0;tileX<l.numTiles[0];++tileX)
+				{
+				for(int row=0;row<newTileSize;++row)
+					{
+					int y=Math::min(tileY*newTileSize+row,l.size[1]-1);
+					const float* gPtr=levelGrid+size_t(y)*size_t(l.size[0]);
+					for(int col=0;col<newTileSize;++col)
+						tileRow[col]=gPtr[Math::min(tileX*newTileSize+col,l.size[0]-1)];
+					file->write<float>(&tileRow.front(),newTileSize);
+					}
+				offset+=tileBytes;
+				}
+		}
+	}
+
 void DEM::load(const char* demFileName)
 	{
-	/* Read the DEM file: */
+	/* Release a previously loaded DEM: */
+	delete[] dem;
+	dem=0;
+	pyramidFile=0;
+	levels.clear();
+	swapSamples=false;
+	
+	/* Open the DEM file and check whether it is a DEM pyramid file: */
 	IO::FilePtr demFile=IO::openFile(demFileName);
 	demFile->setEndianness(Misc::LittleEndian);
-	demFile->read<int>(demSize,2);
-	dem=new float[demSize[1]*demSize[0]];
-	for(int i=0;i<4;++i)
-		demBox[i]=double(demFile->read<float>());
-	demFile->read<float>(dem,demSize[1]*demSize[0]);
+	Misc::UInt32 magic=demFile->read<Misc::UInt32>();
+	if(magic==pyramidFileMagic)
+		{
+		/* Memory-map the pyramid file: */
+		demFile=0;
+		loadPyramid(demFileName);
+		}
+	else
+		{
+		/* Read the rest of the DEM file; the first word was the DEM's width: */
+		demSize[0]=int(magic);
+		demSize[1]=demFile->read<int>();
+		dem=new float[demSize[1]*demSize[0]];
+		for(int i=0;i<4;++i)
+			demBox[i]=double(demFile->read<float>());
+		demFile->read<float>(dem,demSize[1]*demSize[0]);
+		
+		/* Represent the DEM as a single-level pyramid consisting of a single tile: */
+		levels.resize(1);
+		Level& l=levels[0];
+		for(int i=0;i<2;++i)
+			{
+			tileSize[i]=demSize[i];
+			l.size[i]=demSize[i];
+			l.origin[i]=demBox[i];
+			l.spacing[i]=(demBox[2+i]-demBox[i])/Scalar(demSize[i]-1);
+			l.numTiles[i]=1;
+			}
+		l.tiles=dem;
+		}
 	
-	/* Update the DEM transformation: */
+	/* Assemble the DEM texture and update the DEM transformation: */
+	textureLevel=-1;
+	updateTexture();
 	calcMatrix();
 	}
 
 float DEM::calcAverageElevation(void) const
 	{
-	/* Sum all elevation measurements: */
+	/* Sum all elevation measurements of the coarsest level: */
+	const Level& l=levels.back();
+	std::vector<float> row(l.size[0]);
 	double elevSum=0.0;
-	const float* demPtr=dem;
-	for(int i=demSize[1]*demSize[0];i>0;--i,++demPtr)
-		elevSum+=double(*demPtr);
+	for(int y=0;y<l.size[1];++y)
+		{
+		copyRow(l,y,0,l.size[0],&row.front());
+		for(int x=0;x<l.size[0];++x)
+			elevSum+=double(row[x]);
+		}
 	
 	/* Return the average elevation: */
-	return float(elevSum/double(demSize[1]*demSize[0]));
+	return float(elevSum/double(l.size[1]*l.size[0]));
+	}
+
+void DEM::setFootprint(const DEM::Box& newFootprint)
+	{
+	footprint=newFootprint;
+	}
+
+void DEM::setMaxTextureSize(int newMaxTextureSize)
+	{
+	maxTextureSize=newMaxTextureSize;
 	}
 
 void DEM::setTransform(const OGTransform& newTransform,Scalar newVerticalScale,Scalar newVerticalScaleBase)
@@ -144,7 +511,8 @@ void DEM::setTransform(const OGTransform& newTransform,Scalar newVerticalScale,S
 	verticalScale=newVerticalScale;
 	verticalScaleBase=newVerticalScaleBase;
 	
-	/* Update the DEM transformation: */
+	/* Re-assemble the DEM texture if the footprint moved to different tiles or levels, and update the DEM transformation: */
+	updateTexture();
 	calcMatrix();
 	}
 
@@ -155,6 +523,14 @@ void DEM::bindTexture(GLContextData& contextData) const
 	
 	/* Bind the DEM texture: */
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->textureObjectId);
+	
+	/* Check if the DEM texture is outdated: */
+	if(dataItem->textureObjectVersion!=textureVersion)
+		{
+		/* Upload the current DEM texture: */
+		glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_LUMINANCE32F_ARB,textureSize[0],textureSize[1],0,GL_LUMINANCE,GL_FLOAT,texture);
+		dataItem->textureObjectVersion=textureVersion;
+		}
 	}
 
 void DEM::uploadDemTransform(GLint location) const
@@ -1,6 +1,7 @@
 /***********************************************************************
 DEM - Class to represent digital elevation models (DEMs) as float-valued
-texture objects.
+texture objects, optionally backed by memory-mapped multi-resolution
+tile pyramids of which only the parts covering the sandbox are uploaded.
 Copyright (c) 2013-2016 Oliver Kreylos
 
 This file is part of the Augmented Reality Sandbox (SARndbox).
@@ -23,6 +24,10 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef DEM_INCLUDED
 #define DEM_INCLUDED
 
+#include <vector>
+#include <Misc/Autopointer.h>
+#include <IO/MemMappedFile.h>
+#include <Geometry/Box.h>
 #include <GL/gl.h>
 #include <GL/GLObject.h>
 
@@ -31,23 +36,51 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 class DEM:public GLObject
 	{
 	/* Embedded classes: */
+	public:
+	typedef Geometry::Box<Scalar,3> Box; // Type for bounding boxes
+	
 	private:
 	struct DataItem:public GLObject::DataItem
 		{
 		/* Elements: */
 		public:
 		GLuint textureObjectId; // ID of texture object holding digital elevation model
+		unsigned int textureObjectVersion; // Version of the DEM window in the texture object
 		
 		/* Constructors and destructors: */
 		DataItem(void);
 		virtual ~DataItem(void);
 		};
 	
+	struct Level // Structure describing one level of a DEM's resolution pyramid
+		{
+		/* Elements: */
+		public:
+		int size[2]; // Width and height of the level's grid
+		Scalar origin[2]; // DEM-space position of the level's first posting
+		Scalar spacing[2]; // DEM-space distance between adjacent postings
+		int numTiles[2]; // Number of tiles covering the level's grid in x and y
+		const float* tiles; // The level's tiles in row-major order, each stored as a row-major grid of tile size samples
+		};
+	
 	/* Elements: */
 	private:
 	int demSize[2]; // Width and height of the DEM grid
 	Scalar demBox[4]; // Lower-left and upper-right corner coordinates of the DEM
-	float* dem; // Array of DEM elevation measurements
+	float* dem; // Array of DEM elevation measurements for DEMs loaded from non-pyramid files
+	Misc::Autopointer<IO::MemMappedFile> pyramidFile; // Memory-mapped tile pyramid file for DEMs loaded from pyramid files
+	bool swapSamples; // Flag whether samples in the pyramid file need to be endianness-swapped
+	int tileSize[2]; // Width and height of the DEM's tiles
+	std::vector<Level> levels; // The DEM's resolution levels, from finest to coarsest
+	Box footprint; // Camera-space region that needs to be covered by the DEM texture; empty to cover the entire DEM
+	int maxTextureSize; // Maximum width and height of the DEM texture
+	int textureLevel; // Index of the resolution level from which the DEM texture was assembled
+	int textureRange[4]; // Half-open range of level postings covered by the DEM texture as x0, y0, x1, y1
+	int textureSize[2]; // Width and height of the DEM texture
+	Scalar textureBox[4]; // Lower-left and upper-right corner coordinates of the DEM texture
+	std::vector<float> textureBuffer; // Buffer holding the DEM texture if it needed to be assembled from several tiles
+	const float* texture; // Pointer to the DEM texture's samples
+	unsigned int textureVersion; // Version number of the DEM texture
 	OGTransform transform; // Transformation from camera space to DEM space (z up)
 	Scalar verticalScale; // Vertical scale (exaggeration) factor
 	Scalar verticalScaleBase; // Base elevation around which vertical scale is applied
@@ -55,23 +88,41 @@ class DEM:public GLObject
 	GLfloat demTransformMatrix[16]; // Full transformation matrix from camera space to DEM pixel space to upload to OpenGL
 	
 	/* Private methods: */
+	void loadPyramid(const char* demFileName); // Memory-maps the given DEM pyramid file
+	void copyRow(const Level& level,int y,int x0,int x1,float* dest) const; // Copies the given half-open range of postings of the given row of the given level into the given buffer
+	void updateTexture(void); // Assembles the DEM texture from the tiles of the coarsest resolution level that resolves the footprint within the maximum texture size
 	void calcMatrix(void); // Calculates the camera space to DEM pixel space transformation
 	
 	/* Constructors and destructors: */
 	public:
 	DEM(void); // Creates an uninitialized DEM
+	private:
+	DEM(const DEM& source); // Prohibit copy constructor
+	DEM& operator=(const DEM& source); // Prohibit assignment operator
+	public:
 	virtual ~DEM(void);
 	
 	/* Methods from class GLObject: */
 	virtual void initContext(GLContextData& contextData) const;
 	
 	/* New methods: */
-	void load(const char* demFileName); // Loads the DEM from the given file
+	static void convertToPyramid(const char* demFileName,const char* pyramidFileName,int newTileSize); // Converts the given DEM file to a DEM pyramid file with the given tile size
+	void load(const char* demFileName); // Loads the DEM from the given DEM or DEM pyramid file
 	const Scalar* getDemBox(void) const // Returns the DEM's bounding box as lower-left x, lower-left y, upper-right x, upper-right y
 		{
 		return demBox;
 		}
+	int getNumLevels(void) const // Returns the number of resolution levels of the DEM
+		{
+		return int(levels.size());
+		}
+	int getTextureLevel(void) const // Returns the resolution level from which the current DEM texture was assembled
+		{
+		return textureLevel;
+		}
 	float calcAverageElevation(void) const; // Calculates the average elevation of the DEM
+	void setFootprint(const Box& newFootprint); // Sets the camera-space region that needs to be covered by the DEM texture; takes effect with the next transformation change
+	void setMaxTextureSize(int newMaxTextureSize); // Sets the maximum width and height of the DEM texture; takes effect with the next transformation change
 	void setTransform(const OGTransform& newTransform,Scalar newVerticalScale,Scalar newVerticalScaleBase); // Sets the DEM transformation
 	const PTransform& getDemTransform(void) const // Returns the full transformation from camera space to vertically-scaled DEM pixel space
 		{
@@ -90,6 +90,10 @@ Methods of class DEMTool:
 
 void DEMTool::loadDEMFile(const char* demFileName)
 	{
+	/* Only upload the part of the DEM covering the sandbox, at a resolution fitting into the maximum texture size: */
+	setFootprint(application->bbox);
+	setMaxTextureSize(demMaxTextureSize);
+	
 	/* Load the selected DEM file: */
 	load(demFileName);
 	
@@ -153,7 +157,8 @@ DEMToolFactory* DEMTool::initClass(Vrui::ToolManager& toolManager)
 DEMTool::DEMTool(const Vrui::ToolFactory* factory,const Vrui::ToolInputAssignment& inputAssignment)
 	:Vrui::Tool(factory,inputAssignment),
 	 haveDemTransform(false),demTransform(OGTransform::identity),
-	 demVerticalShift(0),demVerticalScale(1)
+	 demVerticalShift(0),demVerticalScale(1),
+	 demMaxTextureSize(2048)
 	{
 	}
 
@@ -175,6 +180,7 @@ void DEMTool::configure(const Misc::ConfigurationFileSection& configFileSection)
 	
 	demVerticalShift=configFileSection.retrieveValue<Scalar>("./demVerticalShift",demVerticalShift);
 	demVerticalScale=configFileSection.retrieveValue<Scalar>("./demVerticalScale",demVerticalScale);
+	demMaxTextureSize=configFileSection.retrieveValue<int>("./demMaxTextureSize",demMaxTextureSize);
 	}
 
 void DEMTool::initialize(void)
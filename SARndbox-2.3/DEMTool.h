@@ -70,6 +70,7 @@ class DEMTool:public DEM,public Vrui::Tool,public Vrui::Application::Tool<Sandbo
 	OGTransform demTransform; // The transformation to apply to the DEM
 	Scalar demVerticalShift; // Extra vertical shift to apply to DEM in sandbox coordinate units
 	Scalar demVerticalScale; // The vertical exaggeration to apply to the DEM
+	int demMaxTextureSize; // Maximum width and height of the texture holding the part of the DEM covering the sandbox
 	
 	/* Private methods: */
 	void loadDEMFile(const char* demFileName); // Loads a DEM from a file
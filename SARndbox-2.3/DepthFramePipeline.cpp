@@ -0,0 +1,341 @@
+/***********************************************************************
+DepthFramePipeline - Class to run a graph of processing stages on each
+incoming depth frame, using a shared pool of work-stealing threads that
+process row bands of the same frame in parallel.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "DepthFramePipeline.h"
+
+/******************************************
+Methods of class DepthFramePipeline::Stage:
+******************************************/
+
+DepthFramePipeline::Stage::~Stage(void)
+	{
+	}
+
+unsigned int DepthFramePipeline::Stage::getNumBands(unsigned int pass) const
+	{
+	return 1;
+	}
+
+/***********************************
+Methods of class DepthFramePipeline:
+***********************************/
+
+const unsigned int DepthFramePipeline::rawFrameSource;
+
+void DepthFramePipeline::queueTasks(unsigned int stageIndex,unsigned int numBands,unsigned int workerIndex)
+	{
+	/* Count the new tasks before queueing them so that no pool thread goes idle while they are in flight: */
+	numQueuedTasks.preAdd(numBands);
+	
+	Task task;
+	task.stageIndex=stageIndex;
+	task.numBands=numBands;
+	if(workerIndex<numThreads)
+		{
+		/* Queue all tasks on the calling pool thread; idle pool threads will steal them: */
+		Worker& worker=workers[workerIndex];
+		Threads::Spinlock::Lock taskLock(worker.taskLock);
+		for(task.bandIndex=0;task.bandIndex<numBands;++task.bandIndex)
+			worker.tasks.push_back(task);
+		}
+	else
+		{
+		/* Distribute the tasks across all pool threads: */
+		for(task.bandIndex=0;task.bandIndex<numBands;++task.bandIndex)
+			{
+			Worker& worker=workers[nextWorker];
+			{
+			Threads::Spinlock::Lock taskLock(worker.taskLock);
+			worker.tasks.push_back(task);
+			}
+			if(++nextWorker==numThreads)
+				nextWorker=0;
+			}
+		}
+	
+	/* Wake up idle pool threads: */
+	Threads::MutexCond::Lock idleLock(idleCond);
+	if(numIdleWorkers>0)
+		idleCond.broadcast();
+	}
+
+bool DepthFramePipeline::getTask(unsigned int workerIndex,DepthFramePipeline::Task& task)
+	{
+	/* Take the most recently queued task from the pool thread's own queue: */
+	{
+	Worker& worker=workers[workerIndex];
+	Threads::Spinlock::Lock taskLock(worker.taskLock);
+	if(!worker.tasks.empty())
+		{
+		task=worker.tasks.back();
+		worker.tasks.pop_back();
+		numQueuedTasks.preSub(1);
+		return true;
+		}
+	}
+	
+	/* Steal the oldest queued task from another pool thread: */
+	for(unsigned int i=1;i<numThreads;++i)
+		{
+		Worker& victim=workers[(workerIndex+i)%numThreads];
+		Threads::Spinlock::Lock taskLock(victim.taskLock);
+		if(!victim.tasks.empty())
+			{
+			task=victim.tasks.front();
+			victim.tasks.pop_front();
+			numQueuedTasks.preSub(1);
+			return true;
+			}
+		}
+	
+	return false;
+	}
+
+void DepthFramePipeline::startStage(unsigned int stageIndex,unsigned int workerIndex)
+	{
+	StageState& ss=*stages[stageIndex];
+	
+	/* Skip the frame if the stage is disabled or its source stage did not produce an output frame: */
+	bool skipped=!ss.enabled;
+	if(!skipped&&ss.source!=rawFrameSource&&!stages[ss.source]->output.isValid())
+		skipped=true;
+	
+	if(!skipped)
+		{
+		/* Hand the input frame to the stage: */
+		ss.input=ss.source!=rawFrameSource?stages[ss.source]->output:rawFrame;
+		ss.numPasses=ss.stage->startFrame(ss.input,numThreads);
+		skipped=ss.numPasses==0;
+		}
+	
+	if(skipped)
+		finishStage(stageIndex,true,workerIndex);
+	else
+		{
+		/* Start the first pass: */
+		ss.pass=0;
+		schedulePass(stageIndex,workerIndex);
+		}
+	}
+
+void DepthFramePipeline::schedulePass(unsigned int stageIndex,unsigned int workerIndex)
+	{
+	StageState& ss=*stages[stageIndex];
+	
+	/* Queue one task for each of the pass's bands: */
+	unsigned int numBands=ss.stage->getNumBands(ss.pass);
+	if(numBands==0)
+		numBands=1;
+	ss.numPendingBands.preAdd(numBands);
+	queueTasks(stageIndex,numBands,workerIndex);
+	}
+
+void DepthFramePipeline::finishStage(unsigned int stageIndex,bool skipped,unsigned int workerIndex)
+	{
+	StageState& ss=*stages[stageIndex];
+	
+	/* Release the input frame and retrieve the stage's output frame: */
+	ss.input=Kinect::FrameBuffer();
+	ss.output=skipped?Kinect::FrameBuffer():ss.stage->finishFrame();
+	
+	/* Start all dependent stages that are no longer waiting for other stages: */
+	for(std::vector<unsigned int>::iterator dIt=ss.dependents.begin();dIt!=ss.dependents.end();++dIt)
+		if(stages[*dIt]->numPendingDependencies.preSub(1)==0)
+			startStage(*dIt,workerIndex);
+	
+	/* Finish the frame if this was the last stage: */
+	if(numPendingStages.preSub(1)==0)
+		finishFrame(workerIndex);
+	}
+
+void DepthFramePipeline::startFrame(const Kinect::FrameBuffer& frame,unsigned int workerIndex)
+	{
+	/* Reset the per-frame stage state: */
+	rawFrame=frame;
+	numPendingStages.preAdd(stages.size());
+	for(std::vector<StageState*>::iterator sIt=stages.begin();sIt!=stages.end();++sIt)
+		(*sIt)->numPendingDependencies.preAdd((*sIt)->numDependencies);
+	
+	/* Start all stages that do not depend on other stages: */
+	for(unsigned int i=0;i<stages.size();++i)
+		if(stages[i]->numDependencies==0)
+			startStage(i,workerIndex);
+	}
+
+void DepthFramePipeline::finishFrame(unsigned int workerIndex)
+	{
+	/* Release all frames referenced by the current frame: */
+	rawFrame=Kinect::FrameBuffer();
+	for(std::vector<StageState*>::iterator sIt=stages.begin();sIt!=stages.end();++sIt)
+		(*sIt)->output=Kinect::FrameBuffer();
+	
+	/* Check if another frame arrived in the meantime: */
+	Kinect::FrameBuffer nextFrame;
+	{
+	Threads::MutexCond::Lock frameLock(frameCond);
+	if(!havePendingFrame)
+		{
+		/* Go idle: */
+		frameActive=false;
+		frameCond.broadcast();
+		return;
+		}
+	nextFrame=pendingFrame;
+	pendingFrame=Kinect::FrameBuffer();
+	havePendingFrame=false;
+	}
+	
+	/* Process the pending frame: */
+	startFrame(nextFrame,workerIndex);
+	}
+
+void* DepthFramePipeline::workerThreadMethod(unsigned int workerIndex)
+	{
+	while(true)
+		{
+		Task task;
+		if(!getTask(workerIndex,task))
+			{
+			/* Wait until new tasks are queued or the pipeline shuts down: */
+			Threads::MutexCond::Lock idleLock(idleCond);
+			while(runWorkers&&numQueuedTasks.get()==0)
+				{
+				++numIdleWorkers;
+				idleCond.wait(idleLock);
+				--numIdleWorkers;
+				}
+			
+			/* Bail out if the pipeline is shutting down: */
+			if(!runWorkers)
+				break;
+			
+			continue;
+			}
+		
+		/* Process the task's band: */
+		StageState& ss=*stages[task.stageIndex];
+		ss.stage->processBand(ss.pass,task.bandIndex,task.numBands);
+		
+		/* Start the stage's next pass or finish the stage if this was the pass's last band: */
+		if(ss.numPendingBands.preSub(1)==0)
+			{
+			if(++ss.pass<ss.numPasses)
+				schedulePass(task.stageIndex,workerIndex);
+			else
+				finishStage(task.stageIndex,false,workerIndex);
+			}
+		}
+	
+	return 0;
+	}
+
+DepthFramePipeline::DepthFramePipeline(void)
+	:numThreads(0),workers(0),nextWorker(0),
+	 numQueuedTasks(0),numIdleWorkers(0),runWorkers(false),
+	 frameActive(false),havePendingFrame(false),
+	 numPendingStages(0)
+	{
+	}
+
+DepthFramePipeline::~DepthFramePipeline(void)
+	{
+	/* Drop the pending frame and wait for the current frame to finish: */
+	{
+	Threads::MutexCond::Lock frameLock(frameCond);
+	havePendingFrame=false;
+	pendingFrame=Kinect::FrameBuffer();
+	while(frameActive)
+		frameCond.wait(frameLock);
+	}
+	
+	/* Shut down the pool threads: */
+	if(numThreads>0)
+		{
+		{
+		Threads::MutexCond::Lock idleLock(idleCond);
+		runWorkers=false;
+		idleCond.broadcast();
+		}
+		for(unsigned int i=0;i<numThreads;++i)
+			workers[i].thread.join();
+		delete[] workers;
+		}
+	
+	/* Release the stage states: */
+	for(std::vector<StageState*>::iterator sIt=stages.begin();sIt!=stages.end();++sIt)
+		delete *sIt;
+	}
+
+unsigned int DepthFramePipeline::addStage(DepthFramePipeline::Stage* newStage,unsigned int source)
+	{
+	/* Add the new stage and make it depend on its source stage: */
+	unsigned int stageIndex=stages.size();
+	stages.push_back(new StageState(newStage,source));
+	if(source!=rawFrameSource)
+		addDependency(stageIndex,source);
+	
+	return stageIndex;
+	}
+
+void DepthFramePipeline::addDependency(unsigned int stageIndex,unsigned int dependencyIndex)
+	{
+	stages[dependencyIndex]->dependents.push_back(stageIndex);
+	++stages[stageIndex]->numDependencies;
+	}
+
+void DepthFramePipeline::setStageEnabled(unsigned int stageIndex,bool newEnabled)
+	{
+	stages[stageIndex]->enabled=newEnabled;
+	}
+
+void DepthFramePipeline::start(unsigned int newNumThreads)
+	{
+	/* Start the pool threads: */
+	numThreads=newNumThreads>0?newNumThreads:1;
+	workers=new Worker[numThreads];
+	runWorkers=true;
+	for(unsigned int i=0;i<numThreads;++i)
+		workers[i].thread.start(this,&DepthFramePipeline::workerThreadMethod,i);
+	}
+
+void DepthFramePipeline::receiveRawFrame(const Kinect::FrameBuffer& newFrame)
+	{
+	/* Ignore frames until the pool threads are running: */
+	if(numThreads==0)
+		return;
+	
+	{
+	Threads::MutexCond::Lock frameLock(frameCond);
+	if(frameActive)
+		{
+		/* Replace the pending frame; it will be picked up when the current frame finishes: */
+		pendingFrame=newFrame;
+		havePendingFrame=true;
+		return;
+		}
+	frameActive=true;
+	}
+	
+	/* Start processing the new frame from outside the pool: */
+	startFrame(newFrame,numThreads);
+	}
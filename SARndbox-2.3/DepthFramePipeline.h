@@ -0,0 +1,146 @@
+/***********************************************************************
+DepthFramePipeline - Class to run a graph of processing stages on each
+incoming depth frame, using a shared pool of work-stealing threads that
+process row bands of the same frame in parallel.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef DEPTHFRAMEPIPELINE_INCLUDED
+#define DEPTHFRAMEPIPELINE_INCLUDED
+
+#include <deque>
+#include <vector>
+#include <Threads/Atomic.h>
+#include <Threads/Spinlock.h>
+#include <Threads/Thread.h>
+#include <Threads/MutexCond.h>
+#include <Kinect/FrameBuffer.h>
+
+class DepthFramePipeline
+	{
+	/* Embedded classes: */
+	public:
+	class Stage // Abstract base class for processing stages
+		{
+		/* Constructors and destructors: */
+		public:
+		virtual ~Stage(void);
+		
+		/* Methods: */
+		virtual unsigned int startFrame(const Kinect::FrameBuffer& frame,unsigned int numThreads) =0; // Prepares to process the given input frame with the given number of pool threads; returns the number of passes to run, or 0 to skip the frame
+		virtual unsigned int getNumBands(unsigned int pass) const; // Returns the number of row bands to process in parallel in the given pass of the current frame; defaults to a single band
+		virtual void processBand(unsigned int pass,unsigned int bandIndex,unsigned int numBands) =0; // Processes the given row band in the given pass of the current frame; all bands of a pass finish before the next pass starts
+		virtual Kinect::FrameBuffer finishFrame(void) =0; // Finishes processing the current frame after its last pass; returns the stage's output frame for dependent stages, or an invalid frame
+		};
+	
+	static const unsigned int rawFrameSource=~0x0U; // Source index selecting the raw input frames as a stage's input
+	
+	private:
+	struct StageState // Structure holding a processing stage and its per-frame state
+		{
+		/* Elements: */
+		public:
+		Stage* stage; // The processing stage
+		unsigned int source; // Index of the stage whose output frames are this stage's input frames, or rawFrameSource
+		std::vector<unsigned int> dependents; // Indices of stages that must wait for this stage to finish each frame
+		unsigned int numDependencies; // Number of stages for which this stage must wait each frame
+		volatile bool enabled; // Flag whether the stage processes frames
+		
+		Threads::Atomic<unsigned int> numPendingDependencies; // Number of stages for which this stage is still waiting in the current frame
+		Kinect::FrameBuffer input; // The stage's input frame in the current frame
+		unsigned int numPasses; // Number of passes to run in the current frame
+		unsigned int pass; // Index of the currently running pass
+		Threads::Atomic<unsigned int> numPendingBands; // Number of bands of the current pass that have not finished yet
+		Kinect::FrameBuffer output; // The stage's output frame in the current frame
+		
+		/* Constructors and destructors: */
+		StageState(Stage* sStage,unsigned int sSource)
+			:stage(sStage),source(sSource),numDependencies(0),enabled(true),
+			 numPendingDependencies(0),numPasses(0),pass(0),numPendingBands(0)
+			{
+			}
+		};
+	
+	struct Task // Structure describing a row band of a stage's pass waiting to be processed
+		{
+		/* Elements: */
+		public:
+		unsigned int stageIndex; // Index of the processing stage
+		unsigned int bandIndex; // Index of the row band
+		unsigned int numBands; // Total number of row bands in the stage's current pass
+		};
+	
+	struct Worker // Structure holding a pool thread and its queue of tasks
+		{
+		/* Elements: */
+		public:
+		Threads::Spinlock taskLock; // Lock protecting the task queue
+		std::deque<Task> tasks; // Queue of tasks; the owning thread works from the back, other threads steal from the front
+		Threads::Thread thread; // The pool thread
+		};
+	
+	/* Elements: */
+	std::vector<StageState*> stages; // List of processing stages in order of addition
+	unsigned int numThreads; // Number of pool threads
+	Worker* workers; // Array of pool threads
+	unsigned int nextWorker; // Index of the pool thread that receives the next task queued from outside the pool
+	Threads::Atomic<unsigned int> numQueuedTasks; // Number of tasks waiting in all task queues
+	Threads::MutexCond idleCond; // Condition variable to wake up idle pool threads
+	unsigned int numIdleWorkers; // Number of pool threads waiting on the idle condition variable
+	volatile bool runWorkers; // Flag to keep the pool threads running
+	
+	Threads::MutexCond frameCond; // Condition variable protecting the frame state and signaling completion of frames
+	bool frameActive; // Flag whether a frame is currently being processed
+	Kinect::FrameBuffer pendingFrame; // Most recent raw frame that arrived while another frame was being processed
+	bool havePendingFrame; // Flag whether the pending frame has not been processed yet
+	Kinect::FrameBuffer rawFrame; // Raw frame currently being processed
+	Threads::Atomic<unsigned int> numPendingStages; // Number of stages that have not finished the current frame
+	
+	/* Private methods: */
+	void queueTasks(unsigned int stageIndex,unsigned int numBands,unsigned int workerIndex); // Queues the bands of the given stage's current pass from the given pool thread, or from outside the pool if the index is invalid
+	bool getTask(unsigned int workerIndex,Task& task); // Takes a task from the given pool thread's own queue, or steals one from another pool thread; returns false if all queues are empty
+	void startStage(unsigned int stageIndex,unsigned int workerIndex); // Starts the given stage on the current frame
+	void schedulePass(unsigned int stageIndex,unsigned int workerIndex); // Queues the bands of the given stage's current pass
+	void finishStage(unsigned int stageIndex,bool skipped,unsigned int workerIndex); // Finishes the given stage on the current frame and starts dependent stages that are ready
+	void startFrame(const Kinect::FrameBuffer& frame,unsigned int workerIndex); // Starts processing the given raw frame
+	void finishFrame(unsigned int workerIndex); // Releases the current frame and starts processing the pending frame, if any
+	void* workerThreadMethod(unsigned int workerIndex); // Method for the pool threads
+	
+	/* Constructors and destructors: */
+	public:
+	DepthFramePipeline(void); // Creates an empty pipeline without pool threads
+	private:
+	DepthFramePipeline(const DepthFramePipeline& source); // Prohibit copy constructor
+	DepthFramePipeline& operator=(const DepthFramePipeline& source); // Prohibit assignment operator
+	public:
+	~DepthFramePipeline(void); // Waits for the current frame to finish and shuts down the pool threads; does not destroy the processing stages
+	
+	/* Methods: */
+	unsigned int addStage(Stage* newStage,unsigned int source =rawFrameSource); // Adds a processing stage receiving the output frames of the given source stage, which becomes its dependency; returns the new stage's index; must be called before the pool threads are started
+	void addDependency(unsigned int stageIndex,unsigned int dependencyIndex); // Makes the given stage wait for the given earlier stage to finish each frame; must be called before the pool threads are started
+	void setStageEnabled(unsigned int stageIndex,bool newEnabled); // Enables or disables the given stage starting with the next frame; stages whose source stage is disabled skip frames as well
+	unsigned int getNumThreads(void) const // Returns the number of pool threads
+		{
+		return numThreads;
+		}
+	void start(unsigned int newNumThreads); // Starts the given number of pool threads
+	void receiveRawFrame(const Kinect::FrameBuffer& newFrame); // Called to receive a new raw depth frame; drops the previous pending frame if the pipeline is busy
+	};
+
+#endif
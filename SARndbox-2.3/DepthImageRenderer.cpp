@@ -23,6 +23,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "DepthImageRenderer.h"
 
+#include <string.h>
+#include <algorithm>
+#include <Math/Math.h>
+#include <Math/Constants.h>
+#include <Geometry/HVector.h>
 #include <GL/gl.h>
 #include <GL/GLVertexArrayParts.h>
 #include <GL/GLContextData.h>
@@ -38,13 +43,18 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "ShaderHelper.h"
 
+#ifndef GL_PIXEL_UNPACK_BUFFER_ARB
+#define GL_PIXEL_UNPACK_BUFFER_ARB 0x88EC
+#endif
+
 /*********************************************
 Methods of class DepthImageRenderer::DataItem:
 *********************************************/
 
-DepthImageRenderer::DataItem::DataItem(void)
+DepthImageRenderer::DataItem::DataItem(unsigned int sNumUploadBuffers)
 	:vertexBuffer(0),indexBuffer(0),
 	 depthTexture(0),depthTextureVersion(0),
+	 numUploadBuffers(sNumUploadBuffers),uploadBuffers(0),nextUploadBuffer(0),
 	 depthShader(0),elevationShader(0)
 	{
 	/* Initialize all required extensions: */
@@ -61,6 +71,11 @@ DepthImageRenderer::DataItem::DataItem(void)
 	glGenBuffersARB(1,&vertexBuffer);
 	glGenBuffersARB(1,&indexBuffer);
 	glGenTextures(1,&depthTexture);
+	if(numUploadBuffers>0)
+		{
+		uploadBuffers=new GLuint[numUploadBuffers];
+		glGenBuffersARB(numUploadBuffers,uploadBuffers);
+		}
 	}
 
 DepthImageRenderer::DataItem::~DataItem(void)
@@ -69,6 +84,11 @@ DepthImageRenderer::DataItem::~DataItem(void)
 	glDeleteBuffersARB(1,&vertexBuffer);
 	glDeleteBuffersARB(1,&indexBuffer);
 	glDeleteTextures(1,&depthTexture);
+	if(numUploadBuffers>0)
+		{
+		glDeleteBuffersARB(numUploadBuffers,uploadBuffers);
+		delete[] uploadBuffers;
+		}
 	glDeleteObjectARB(depthShader);
 	glDeleteObjectARB(elevationShader);
 	}
@@ -77,8 +97,451 @@ DepthImageRenderer::DataItem::~DataItem(void)
 Methods of class DepthImageRenderer:
 ***********************************/
 
+void DepthImageRenderer::resetTiles(unsigned int newTileSize)
+	{
+	tileSize=newTileSize;
+	for(int i=0;i<2;++i)
+		numTiles[i]=(depthImageSize[i]+tileSize-1)/tileSize;
+	tileVersions.assign(numTiles[1]*numTiles[0],depthImageVersion);
+	}
+
+void DepthImageRenderer::updatePyramid(unsigned int cellMinX,unsigned int cellMinY,unsigned int cellMaxX,unsigned int cellMaxY)
+	{
+	if(pyramid.empty())
+		return;
+	
+	/* Calculate the depth ranges of the level-0 cells from their four corner pixels: */
+	PyramidLevel& level0=pyramid[0];
+	const float* diPtr=depthImage.getData<float>();
+	for(unsigned int y=cellMinY;y<cellMaxY;++y)
+		{
+		const float* row0=diPtr+y*depthImageSize[0];
+		const float* row1=row0+depthImageSize[0];
+		DepthRange* rPtr=&level0.ranges[y*level0.size[0]];
+		for(unsigned int x=cellMinX;x<cellMaxX;++x)
+			{
+			rPtr[x].min=Math::min(Math::min(row0[x],row0[x+1]),Math::min(row1[x],row1[x+1]));
+			rPtr[x].max=Math::max(Math::max(row0[x],row0[x+1]),Math::max(row1[x],row1[x+1]));
+			}
+		}
+	
+	/* Propagate the changed rectangle up the pyramid: */
+	for(unsigned int l=1;l<pyramid.size();++l)
+		{
+		const PyramidLevel& child=pyramid[l-1];
+		PyramidLevel& level=pyramid[l];
+		cellMinX>>=1;
+		cellMinY>>=1;
+		cellMaxX=(cellMaxX+1)>>1;
+		cellMaxY=(cellMaxY+1)>>1;
+		for(unsigned int y=cellMinY;y<cellMaxY;++y)
+			for(unsigned int x=cellMinX;x<cellMaxX;++x)
+				{
+				/* Combine the depth ranges of the node's up to four children: */
+				DepthRange& range=level.ranges[y*level.size[0]+x];
+				range=child.ranges[(y*2)*child.size[0]+x*2];
+				for(unsigned int cy=y*2;cy<y*2+2&&cy<child.size[1];++cy)
+					for(unsigned int cx=x*2;cx<x*2+2&&cx<child.size[0];++cx)
+						{
+						const DepthRange& childRange=child.ranges[cy*child.size[0]+cx];
+						if(range.min>childRange.min)
+							range.min=childRange.min;
+						if(range.max<childRange.max)
+							range.max=childRange.max;
+						}
+				}
+		}
+	}
+
+void DepthImageRenderer::updateChangedTilesInPyramid(void)
+	{
+	if(pyramid.empty())
+		return;
+	
+	/* Count the tiles changed by the current depth image: */
+	unsigned int numChangedTiles=0;
+	for(std::vector<unsigned int>::const_iterator tvIt=tileVersions.begin();tvIt!=tileVersions.end();++tvIt)
+		if(*tvIt==depthImageVersion)
+			++numChangedTiles;
+	
+	if(numChangedTiles==numTiles[1]*numTiles[0])
+		{
+		/* Rebuild the entire pyramid: */
+		updatePyramid(0,0,pyramid[0].size[0],pyramid[0].size[1]);
+		}
+	else if(numChangedTiles>0)
+		{
+		/* Update all cells that have a corner pixel inside a changed tile: */
+		const unsigned int* cellSize=pyramid[0].size;
+		const unsigned int* tvPtr=&tileVersions.front();
+		for(unsigned int ty=0;ty<numTiles[1];++ty)
+			for(unsigned int tx=0;tx<numTiles[0];++tx,++tvPtr)
+				if(*tvPtr==depthImageVersion)
+					{
+					unsigned int x0=tx*tileSize;
+					unsigned int y0=ty*tileSize;
+					updatePyramid(x0>0?x0-1:0,y0>0?y0-1:0,Math::min(x0+tileSize,cellSize[0]),Math::min(y0+tileSize,cellSize[1]));
+					}
+		}
+	}
+
+bool DepthImageRenderer::clipToNode(const Scalar q0[3],const Scalar dq[3],unsigned int level,unsigned int nodeX,unsigned int nodeY,Scalar& mu0,Scalar& mu1) const
+	{
+	const unsigned int* cellSize=pyramid[0].size;
+	unsigned int node[2];
+	node[0]=nodeX;
+	node[1]=nodeY;
+	for(int i=0;i<2;++i)
+		{
+		/* Calculate the node's extent in depth image space; cell corners are at pixel centers: */
+		Scalar min=Scalar(node[i]<<level)+Scalar(0.5);
+		Scalar max=Scalar(Math::min((node[i]+1)<<level,cellSize[i]))+Scalar(0.5);
+		
+		/* Clip the interval against the node's extent: */
+		if(dq[i]!=Scalar(0))
+			{
+			Scalar l0=(min-q0[i])/dq[i];
+			Scalar l1=(max-q0[i])/dq[i];
+			if(l0>l1)
+				std::swap(l0,l1);
+			if(mu0<l0)
+				mu0=l0;
+			if(mu1>l1)
+				mu1=l1;
+			}
+		else if(q0[i]<min||q0[i]>max)
+			return false;
+		}
+	
+	return mu0<=mu1;
+	}
+
+Scalar DepthImageRenderer::intersectCell(const Scalar q0[3],const Scalar dq[3],unsigned int cellX,unsigned int cellY,Scalar mu0,Scalar mu1) const
+	{
+	/* Get the depths of the cell's corner pixels: */
+	const float* diPtr=depthImage.getData<float>()+(cellY*depthImageSize[0]+cellX);
+	Scalar d00=diPtr[0];
+	Scalar d10=diPtr[1];
+	Scalar d01=diPtr[depthImageSize[0]];
+	Scalar d11=diPtr[depthImageSize[0]+1];
+	
+	/* Express the line segment in the cell's local coordinates: */
+	Scalar u0=q0[0]-(Scalar(cellX)+Scalar(0.5));
+	Scalar v0=q0[1]-(Scalar(cellY)+Scalar(0.5));
+	
+	/* Split the interval where it crosses the diagonal from (0, 0) to (1, 1) separating the cell's two triangles: */
+	Scalar pieces[3];
+	int numPieces=1;
+	pieces[0]=mu0;
+	Scalar g0=(u0+dq[0]*mu0)-(v0+dq[1]*mu0);
+	Scalar g1=(u0+dq[0]*mu1)-(v0+dq[1]*mu1);
+	if((g0<Scalar(0)&&g1>Scalar(0))||(g0>Scalar(0)&&g1<Scalar(0)))
+		{
+		pieces[1]=mu0+(mu1-mu0)*g0/(g0-g1);
+		++numPieces;
+		}
+	pieces[numPieces]=mu1;
+	
+	for(int piece=0;piece<numPieces;++piece)
+		{
+		Scalar s=pieces[piece];
+		Scalar e=pieces[piece+1];
+		
+		/* Get the plane equation depth=a+b*u+c*v of the triangle containing the piece: */
+		Scalar mid=(s+e)*Scalar(0.5);
+		Scalar a=d00,b,c;
+		if(u0+dq[0]*mid>=v0+dq[1]*mid)
+			{
+			b=d10-d00;
+			c=d11-d10;
+			}
+		else
+			{
+			b=d11-d01;
+			c=d01-d00;
+			}
+		
+		/* Find the first point along the piece that is on or below the triangle: */
+		Scalar f0=q0[2]-a-b*u0-c*v0;
+		Scalar df=dq[2]-b*dq[0]-c*dq[1];
+		Scalar fs=f0+df*s;
+		if(fs>=Scalar(0))
+			return s;
+		Scalar fe=f0+df*e;
+		if(fe>=Scalar(0))
+			return s+(e-s)*fs/(fs-fe);
+		}
+	
+	return Scalar(2);
+	}
+
+Scalar DepthImageRenderer::intersectNode(const Scalar q0[3],const Scalar dq[3],unsigned int level,unsigned int nodeX,unsigned int nodeY,Scalar mu0,Scalar mu1) const
+	{
+	/* Compare the interval's depth range against the node's depth range: */
+	const DepthRange& range=pyramid[level].ranges[nodeY*pyramid[level].size[0]+nodeX];
+	Scalar z0=q0[2]+dq[2]*mu0;
+	Scalar z1=q0[2]+dq[2]*mu1;
+	if(Math::max(z0,z1)<Scalar(range.min))
+		{
+		/* The interval is entirely above the surface inside the node: */
+		return Scalar(2);
+		}
+	if(Math::min(z0,z1)>=Scalar(range.max))
+		{
+		/* The interval is entirely on or below the surface inside the node: */
+		return mu0;
+		}
+	
+	/* Intersect the cell's triangles at the lowest level: */
+	if(level==0)
+		return intersectCell(q0,dq,nodeX,nodeY,mu0,mu1);
+	
+	/* Clip the interval against the node's children, and sort them in the order in which the segment enters them: */
+	struct ChildInterval
+		{
+		unsigned int x,y;
+		Scalar mu0,mu1;
+		};
+	ChildInterval children[4];
+	int numChildren=0;
+	unsigned int childLevel=level-1;
+	const unsigned int* childLevelSize=pyramid[childLevel].size;
+	for(unsigned int cy=nodeY*2;cy<nodeY*2+2&&cy<childLevelSize[1];++cy)
+		for(unsigned int cx=nodeX*2;cx<nodeX*2+2&&cx<childLevelSize[0];++cx)
+			{
+			Scalar cmu0=mu0;
+			Scalar cmu1=mu1;
+			if(clipToNode(q0,dq,childLevel,cx,cy,cmu0,cmu1))
+				{
+				int i;
+				for(i=numChildren;i>0&&children[i-1].mu0>cmu0;--i)
+					children[i]=children[i-1];
+				children[i].x=cx;
+				children[i].y=cy;
+				children[i].mu0=cmu0;
+				children[i].mu1=cmu1;
+				++numChildren;
+				}
+			}
+	
+	/* Intersect the children front to back; the first hit is the closest one: */
+	for(int i=0;i<numChildren;++i)
+		{
+		Scalar mu=intersectNode(q0,dq,childLevel,children[i].x,children[i].y,children[i].mu0,children[i].mu1);
+		if(mu<=Scalar(1))
+			return mu;
+		}
+	
+	return Scalar(2);
+	}
+
+void DepthImageRenderer::updateTextureDepthProjection(void)
+	{
+	textureDepthProjection=depthProjection;
+	if(packDepth)
+		{
+		/* Find the range of depth values between the packed elevation range over the depth image's corners: */
+		const PTransform::Matrix& dpm=depthProjection.getMatrix();
+		const Plane::Vector& bpn=basePlane.getNormal();
+		Scalar bpnMag=bpn.mag();
+		Scalar depthMin=Math::Constants<Scalar>::max;
+		Scalar depthMax=-Math::Constants<Scalar>::max;
+		for(int i=0;i<2;++i)
+			{
+			/* Calculate the equation of the elevation plane in depth image space: */
+			Scalar eq[4];
+			for(int j=0;j<4;++j)
+				eq[j]=dpm(0,j)*bpn[0]+dpm(1,j)*bpn[1]+dpm(2,j)*bpn[2]-dpm(3,j)*(basePlane.getOffset()+packElevationRange[i]*bpnMag);
+			if(eq[2]==Scalar(0))
+				continue;
+			
+			/* Intersect the plane with the rays through the depth image's corners; depth is affine in pixel position along the plane: */
+			for(unsigned int y=0;y<=depthImageSize[1];y+=depthImageSize[1])
+				for(unsigned int x=0;x<=depthImageSize[0];x+=depthImageSize[0])
+					{
+					Scalar depth=-(eq[0]*Scalar(x)+eq[1]*Scalar(y)+eq[3])/eq[2];
+					if(depthMin>depth)
+						depthMin=depth;
+					if(depthMax<depth)
+						depthMax=depth;
+					}
+			}
+		if(depthMin>=depthMax)
+			{
+			/* Fall back to the full range of raw depth values: */
+			depthMin=Scalar(0);
+			depthMax=Scalar(65535);
+			}
+		packDepthOffset=GLfloat(depthMin);
+		packDepthScale=GLfloat(depthMax-depthMin);
+		
+		/* Prepend the unpacking of normalized texture values to the depth projection: */
+		PTransform::Matrix unpack=PTransform::Matrix::one;
+		unpack(2,2)=Scalar(packDepthScale);
+		unpack(2,3)=Scalar(packDepthOffset);
+		textureDepthProjection*=PTransform(unpack);
+		}
+	
+	/* Convert the depth texture projection matrix to column-major OpenGL format: */
+	const PTransform::Matrix& tdpm=textureDepthProjection.getMatrix();
+	GLfloat* dpmPtr=depthProjectionMatrix;
+	for(int j=0;j<4;++j)
+		for(int i=0;i<4;++i,++dpmPtr)
+			*dpmPtr=GLfloat(tdpm(i,j));
+	
+	/* Create the weight calculation equation: */
+	for(int i=0;i<4;++i)
+		weightDicEq[i]=GLfloat(tdpm(3,i));
+	
+	/* Transform the base plane to depth texture space and into a GLSL-compatible format: */
+	const Plane::Vector& bpn=basePlane.getNormal();
+	Scalar bpo=basePlane.getOffset();
+	for(int i=0;i<4;++i)
+		basePlaneDicEq[i]=GLfloat(tdpm(0,i)*bpn[0]+tdpm(1,i)*bpn[1]+tdpm(2,i)*bpn[2]-tdpm(3,i)*bpo);
+	}
+
+void DepthImageRenderer::packChangedTiles(void)
+	{
+	if(!packDepth)
+		return;
+	
+	/* Pack all pixels of tiles changed by the current depth image: */
+	GLfloat packFactor=65535.0f/packDepthScale;
+	const float* diPtr=depthImage.getData<float>();
+	const unsigned int* tvPtr=&tileVersions.front();
+	for(unsigned int ty=0;ty<numTiles[1];++ty,tvPtr+=numTiles[0])
+		{
+		unsigned int y0=ty*tileSize;
+		unsigned int y1=Math::min(y0+tileSize,depthImageSize[1]);
+		for(unsigned int tx=0;tx<numTiles[0];++tx)
+			if(tvPtr[tx]==depthImageVersion)
+				{
+				unsigned int x0=tx*tileSize;
+				unsigned int x1=Math::min(x0+tileSize,depthImageSize[0]);
+				for(unsigned int y=y0;y<y1;++y)
+					{
+					const float* dRowPtr=diPtr+y*depthImageSize[0];
+					GLushort* pRowPtr=&packedDepthImage[y*depthImageSize[0]];
+					for(unsigned int x=x0;x<x1;++x)
+						{
+						/* Quantize the depth value and clamp it to the packed range: */
+						float packed=(dRowPtr[x]-packDepthOffset)*packFactor+0.5f;
+						pRowPtr[x]=packed<=0.0f?GLushort(0):packed>=65535.0f?GLushort(65535):GLushort(packed);
+						}
+					}
+				}
+		}
+	}
+
+void DepthImageRenderer::updateDepthTexture(DepthImageRenderer::DataItem* dataItem) const
+	{
+	/* Bail out if the texture is current: */
+	if(dataItem->depthTextureVersion==depthImageVersion)
+		return;
+	
+	/* Count the tiles that changed since the texture was last updated: */
+	unsigned int numChangedTiles=0;
+	for(std::vector<unsigned int>::const_iterator tvIt=tileVersions.begin();tvIt!=tileVersions.end();++tvIt)
+		if(*tvIt>dataItem->depthTextureVersion)
+			++numChangedTiles;
+	
+	if(numChangedTiles>0)
+		{
+		/* Collect the rectangles to upload, either the entire image or runs of changed tiles in each row of tiles: */
+		std::vector<unsigned int> rects; // Half-open pixel rectangles (x0, y0, x1, y1)
+		if(numChangedTiles*2>numTiles[1]*numTiles[0])
+			{
+			rects.push_back(0);
+			rects.push_back(0);
+			rects.push_back(depthImageSize[0]);
+			rects.push_back(depthImageSize[1]);
+			}
+		else
+			{
+			const unsigned int* tvPtr=&tileVersions.front();
+			for(unsigned int ty=0;ty<numTiles[1];++ty,tvPtr+=numTiles[0])
+				{
+				unsigned int tx=0;
+				while(tx<numTiles[0])
+					{
+					/* Find the next run of changed tiles: */
+					for(;tx<numTiles[0]&&tvPtr[tx]<=dataItem->depthTextureVersion;++tx)
+						;
+					unsigned int runStart=tx;
+					for(;tx<numTiles[0]&&tvPtr[tx]>dataItem->depthTextureVersion;++tx)
+						;
+					if(runStart<tx)
+						{
+						rects.push_back(runStart*tileSize);
+						rects.push_back(ty*tileSize);
+						rects.push_back(Math::min(tx*tileSize,depthImageSize[0]));
+						rects.push_back(Math::min((ty+1)*tileSize,depthImageSize[1]));
+						}
+					}
+				}
+			}
+		
+		/* Select the source of the pixel data: */
+		GLenum pixelType=packDepth?GL_UNSIGNED_SHORT:GL_FLOAT;
+		size_t pixelSize=packDepth?sizeof(GLushort):sizeof(GLfloat);
+		size_t rowSize=size_t(depthImageSize[0])*pixelSize;
+		const char* pixels=packDepth?reinterpret_cast<const char*>(&packedDepthImage.front()):depthImage.getData<char>();
+		const char* uploadBase=pixels;
+		
+		if(dataItem->numUploadBuffers>0)
+			{
+			/* Bind the next pixel buffer object in the ring and orphan its previous storage, so the driver never waits for a pending upload from it: */
+			glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB,dataItem->uploadBuffers[dataItem->nextUploadBuffer]);
+			if(++dataItem->nextUploadBuffer==dataItem->numUploadBuffers)
+				dataItem->nextUploadBuffer=0;
+			glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB,depthImageSize[1]*rowSize,0,GL_STREAM_DRAW_ARB);
+			
+			/* Copy the changed rectangles into the buffer at their offsets in the depth image: */
+			char* bufferPtr=static_cast<char*>(glMapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB,GL_WRITE_ONLY_ARB));
+			if(bufferPtr!=0)
+				{
+				for(std::vector<unsigned int>::const_iterator rIt=rects.begin();rIt!=rects.end();rIt+=4)
+					{
+					size_t offset=size_t(rIt[1])*rowSize+size_t(rIt[0])*pixelSize;
+					size_t length=size_t(rIt[2]-rIt[0])*pixelSize;
+					for(unsigned int y=rIt[1];y<rIt[3];++y,offset+=rowSize)
+						memcpy(bufferPtr+offset,pixels+offset,length);
+					}
+				glUnmapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB);
+				
+				/* Source the texture uploads from the buffer, which lets the driver transfer them asynchronously: */
+				uploadBase=0;
+				}
+			else
+				{
+				/* Fall back to uploading from client memory: */
+				glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB,0);
+				}
+			}
+		
+		/* Upload the changed rectangles into the depth texture: */
+		glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH,depthImageSize[0]);
+		for(std::vector<unsigned int>::const_iterator rIt=rects.begin();rIt!=rects.end();rIt+=4)
+			{
+			size_t offset=size_t(rIt[1])*rowSize+size_t(rIt[0])*pixelSize;
+			glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,rIt[0],rIt[1],rIt[2]-rIt[0],rIt[3]-rIt[1],GL_LUMINANCE,pixelType,uploadBase+offset);
+			}
+		glPixelStorei(GL_UNPACK_ROW_LENGTH,0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+		if(dataItem->numUploadBuffers>0)
+			glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB,0);
+		}
+	
+	/* Mark the depth texture as current: */
+	dataItem->depthTextureVersion=depthImageVersion;
+	}
+
 DepthImageRenderer::DepthImageRenderer(const unsigned int sDepthImageSize[2])
-	:depthImageVersion(0)
+	:packDepth(false),packDepthOffset(0.0f),packDepthScale(65535.0f),
+	 numUploadBuffers(2),
+	 depthImageVersion(0),
+	 lastFrameIndex(0)
 	{
 	/* Copy the depth image size: */
 	for(int i=0;i<2;++i)
@@ -91,12 +554,33 @@ DepthImageRenderer::DepthImageRenderer(const unsigned int sDepthImageSize[2])
 		for(unsigned int x=0;x<depthImageSize[0];++x,++diPtr)
 			*diPtr=0.0f;
 	++depthImageVersion;
+	
+	/* Initialize the tile grid: */
+	resetTiles(16);
+	
+	/* Create the levels of the min-max pyramid, halving the grid of cells between pixel centers until a single root node remains: */
+	if(depthImageSize[0]>=2&&depthImageSize[1]>=2)
+		{
+		PyramidLevel level;
+		for(int i=0;i<2;++i)
+			level.size[i]=depthImageSize[i]-1;
+		while(true)
+			{
+			level.ranges.resize(level.size[1]*level.size[0]);
+			pyramid.push_back(level);
+			if(level.size[0]==1&&level.size[1]==1)
+				break;
+			for(int i=0;i<2;++i)
+				level.size[i]=(level.size[i]+1)/2;
+			}
+		updatePyramid(0,0,pyramid[0].size[0],pyramid[0].size[1]);
+		}
 	}
 
 void DepthImageRenderer::initContext(GLContextData& contextData) const
 	{
 	/* Create a data item and add it to the context: */
-	DataItem* dataItem=new DataItem;
+	DataItem* dataItem=new DataItem(numUploadBuffers);
 	contextData.addDataItem(this,dataItem);
 	
 	/* Upload the grid of template vertices into the vertex buffer: */
@@ -132,7 +616,10 @@ void DepthImageRenderer::initContext(GLContextData& contextData) const
 	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_S,GL_CLAMP);
 	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_T,GL_CLAMP);
-	glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_LUMINANCE32F_ARB,depthImageSize[0],depthImageSize[1],0,GL_LUMINANCE,GL_FLOAT,0);
+	if(packDepth)
+		glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_LUMINANCE16,depthImageSize[0],depthImageSize[1],0,GL_LUMINANCE,GL_UNSIGNED_SHORT,0);
+	else
+		glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_LUMINANCE32F_ARB,depthImageSize[0],depthImageSize[1],0,GL_LUMINANCE,GL_FLOAT,0);
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
 	
 	/* Create the depth rendering shader: */
@@ -153,17 +640,7 @@ void DepthImageRenderer::setDepthProjection(const PTransform& newDepthProjection
 	/* Set the depth unprojection matrix: */
 	depthProjection=newDepthProjection;
 	
-	/* Convert the depth projection matrix to column-major OpenGL format: */
-	GLfloat* dpmPtr=depthProjectionMatrix;
-	for(int j=0;j<4;++j)
-		for(int i=0;i<4;++i,++dpmPtr)
-			*dpmPtr=GLfloat(depthProjection.getMatrix()(i,j));
-	
-	/* Create the weight calculation equation: */
-	for(int i=0;i<4;++i)
-		weightDicEq[i]=GLfloat(depthProjection.getMatrix()(3,i));
-	
-	/* Recalculate the base plane equation in depth image space: */
+	/* Recalculate the depth texture-space matrices and equations: */
 	setBasePlane(basePlane);
 	}
 
@@ -172,12 +649,38 @@ void DepthImageRenderer::setBasePlane(const Plane& newBasePlane)
 	/* Set the base plane: */
 	basePlane=newBasePlane;
 	
-	/* Transform the base plane to depth image space and into a GLSL-compatible format: */
-	const PTransform::Matrix& dpm=depthProjection.getMatrix();
-	const Plane::Vector& bpn=basePlane.getNormal();
-	Scalar bpo=basePlane.getOffset();
-	for(int i=0;i<4;++i)
-		basePlaneDicEq[i]=GLfloat(dpm(0,i)*bpn[0]+dpm(1,i)*bpn[1]+dpm(2,i)*bpn[2]-dpm(3,i)*bpo);
+	/* Recalculate the depth texture-space matrices and equations, which depend on the base plane if depth values are packed: */
+	updateTextureDepthProjection();
+	
+	if(packDepth)
+		{
+		/* Repack the entire depth image into the new packed depth range: */
+		++depthImageVersion;
+		tileVersions.assign(tileVersions.size(),depthImageVersion);
+		packChangedTiles();
+		}
+	}
+
+void DepthImageRenderer::setPackDepth(bool newPackDepth,Scalar elevationMin,Scalar elevationMax)
+	{
+	/* Set the packing parameters: */
+	packDepth=newPackDepth;
+	packElevationRange[0]=elevationMin;
+	packElevationRange[1]=elevationMax;
+	
+	/* Allocate or release the packed depth image: */
+	if(packDepth)
+		packedDepthImage.resize(depthImageSize[1]*depthImageSize[0],0);
+	else
+		std::vector<GLushort>().swap(packedDepthImage);
+	
+	/* Recalculate the packed depth range and repack the depth image: */
+	setBasePlane(basePlane);
+	}
+
+void DepthImageRenderer::setNumUploadBuffers(unsigned int newNumUploadBuffers)
+	{
+	numUploadBuffers=newNumUploadBuffers;
 	}
 
 void DepthImageRenderer::setDepthImage(const Kinect::FrameBuffer& newDepthImage)
@@ -185,32 +688,101 @@ void DepthImageRenderer::setDepthImage(const Kinect::FrameBuffer& newDepthImage)
 	/* Update the depth image: */
 	depthImage=newDepthImage;
 	++depthImageVersion;
+	
+	/* Mark all tiles as changed: */
+	tileVersions.assign(tileVersions.size(),depthImageVersion);
+	lastFrameIndex=0;
+	
+	/* Rebuild the min-max pyramid and repack the depth image: */
+	updateChangedTilesInPyramid();
+	packChangedTiles();
+	}
+
+void DepthImageRenderer::setDepthImage(const Kinect::FrameBuffer& newDepthImage,unsigned int frameIndex,unsigned int newTileSize,const unsigned int* tileChangeIndices)
+	{
+	/* Update the depth image: */
+	depthImage=newDepthImage;
+	++depthImageVersion;
+	
+	if(newTileSize!=tileSize||frameIndex<=lastFrameIndex)
+		{
+		/* Mark all tiles of a new tile grid, or of a restarted frame sequence, as changed: */
+		resetTiles(newTileSize);
+		}
+	else
+		{
+		/* Mark all tiles that changed in any frame since the previous one as changed: */
+		std::vector<unsigned int>::iterator tvIt=tileVersions.begin();
+		const unsigned int* tciPtr=tileChangeIndices;
+		for(;tvIt!=tileVersions.end();++tvIt,++tciPtr)
+			if(*tciPtr>lastFrameIndex)
+				*tvIt=depthImageVersion;
+		}
+	lastFrameIndex=frameIndex;
+	
+	/* Update the min-max pyramid and the packed depth image over the changed tiles: */
+	updateChangedTilesInPyramid();
+	packChangedTiles();
 	}
 
 Scalar DepthImageRenderer::intersectLine(const Point& p0,const Point& p1,Scalar elevationMin,Scalar elevationMax) const
 	{
-	/* Initialize the line segment: */
+	if(pyramid.empty())
+		return Scalar(2);
+	
+	/* Clip the line segment against the elevation range relative to the base plane: */
 	Scalar lambda0=Scalar(0);
 	Scalar lambda1=Scalar(1);
-	
-	/* Intersect the line segment with the upper elevation plane: */
-	Scalar d0=basePlane.calcDistance(p0);
-	Scalar d1=basePlane.calcDistance(p1);
-	if(d0*d1<Scalar(0))
+	Scalar normalMag=basePlane.getNormal().mag();
+	Scalar e0=basePlane.calcDistance(p0)/normalMag;
+	Scalar e1=basePlane.calcDistance(p1)/normalMag;
+	if(e0!=e1)
 		{
-		/* Calculate the intersection parameter: */
-		
-		// IMPLEMENT ME!
-		
-		return Scalar(2);
+		Scalar l0=(elevationMin-e0)/(e1-e0);
+		Scalar l1=(elevationMax-e0)/(e1-e0);
+		if(l0>l1)
+			std::swap(l0,l1);
+		if(lambda0<l0)
+			lambda0=l0;
+		if(lambda1>l1)
+			lambda1=l1;
 		}
-	else if(d1>Scalar(0))
+	else if(e0<elevationMin||e0>elevationMax)
+		lambda0=Scalar(2);
+	if(lambda0>lambda1)
 		{
 		/* Trivially reject with maximum intercept: */
 		return Scalar(2);
 		}
 	
-	return Scalar(2);
+	/* Transform the clipped line segment into depth image space, where the surface is a height field over the pixel grid: */
+	PTransform::HVector h0=depthProjection.inverseTransform(PTransform::HVector(Geometry::affineCombination(p0,p1,lambda0)));
+	PTransform::HVector h1=depthProjection.inverseTransform(PTransform::HVector(Geometry::affineCombination(p0,p1,lambda1)));
+	if(h0[3]*h1[3]<=Scalar(0))
+		{
+		/* Reject segments that cross the camera's focal plane: */
+		return Scalar(2);
+		}
+	Scalar q0[3],dq[3];
+	for(int i=0;i<3;++i)
+		{
+		q0[i]=h0[i]/h0[3];
+		dq[i]=h1[i]/h1[3]-q0[i];
+		}
+	
+	/* Intersect the segment with the surface by descending the min-max pyramid from its root: */
+	unsigned int rootLevel=pyramid.size()-1;
+	Scalar mu0=Scalar(0);
+	Scalar mu1=Scalar(1);
+	if(!clipToNode(q0,dq,rootLevel,0,0,mu0,mu1))
+		return Scalar(2);
+	Scalar mu=intersectNode(q0,dq,rootLevel,0,0,mu0,mu1);
+	if(mu>Scalar(1))
+		return Scalar(2);
+	
+	/* Map the intersection parameter from the projectively transformed segment back to the original line segment: */
+	Scalar lambda=mu*h0[3]/((Scalar(1)-mu)*h1[3]+mu*h0[3]);
+	return lambda0+(lambda1-lambda0)*lambda;
 	}
 
 void DepthImageRenderer::uploadDepthProjection(GLint location) const
@@ -227,15 +799,8 @@ void DepthImageRenderer::bindDepthTexture(GLContextData& contextData) const
 	/* Bind the depth image texture: */
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->depthTexture);
 	
-	/* Check if the texture is outdated: */
-	if(dataItem->depthTextureVersion!=depthImageVersion)
-		{
-		/* Upload the new depth texture: */
-		glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,0,0,depthImageSize[0],depthImageSize[1],GL_LUMINANCE,GL_FLOAT,depthImage.getData<GLfloat>());
-		
-		/* Mark the depth texture as current: */
-		dataItem->depthTextureVersion=depthImageVersion;
-		}
+	/* Upload the changed parts of the depth image if the texture is outdated: */
+	updateDepthTexture(dataItem);
 	}
 
 void DepthImageRenderer::renderSurfaceTemplate(GLContextData& contextData) const
@@ -276,20 +841,13 @@ void DepthImageRenderer::renderDepth(const PTransform& projectionModelview,GLCon
 	glActiveTextureARB(GL_TEXTURE0_ARB);
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->depthTexture);
 	
-	/* Check if the texture is outdated: */
-	if(dataItem->depthTextureVersion!=depthImageVersion)
-		{
-		/* Upload the new depth texture: */
-		glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,0,0,depthImageSize[0],depthImageSize[1],GL_LUMINANCE,GL_FLOAT,depthImage.getData<GLfloat>());
-		
-		/* Mark the depth texture as current: */
-		dataItem->depthTextureVersion=depthImageVersion;
-		}
+	/* Upload the changed parts of the depth image if the texture is outdated: */
+	updateDepthTexture(dataItem);
 	glUniform1iARB(dataItem->depthShaderUniforms[0],0); // Tell the shader that the depth texture is in texture unit 0
 	
 	/* Upload the combined projection, modelview, and depth projection matrix: */
 	PTransform pmvdp=projectionModelview;
-	pmvdp*=depthProjection;
+	pmvdp*=textureDepthProjection;
 	glUniformARB(dataItem->depthShaderUniforms[1],pmvdp);
 	
 	/* Draw the surface: */
@@ -310,6 +868,12 @@ void DepthImageRenderer::renderDepth(const PTransform& projectionModelview,GLCon
 	}
 
 void DepthImageRenderer::renderElevation(const PTransform& projectionModelview,GLContextData& contextData) const
+	{
+	/* Render all rows of the depth image: */
+	renderElevation(projectionModelview,0,depthImageSize[1],contextData);
+	}
+
+void DepthImageRenderer::renderElevation(const PTransform& projectionModelview,unsigned int rowBegin,unsigned int rowEnd,GLContextData& contextData) const
 	{
 	/* Get the data item: */
 	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
@@ -321,15 +885,8 @@ void DepthImageRenderer::renderElevation(const PTransform& projectionModelview,G
 	glActiveTextureARB(GL_TEXTURE0_ARB);
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->depthTexture);
 	
-	/* Check if the texture is outdated: */
-	if(dataItem->depthTextureVersion!=depthImageVersion)
-		{
-		/* Upload the new depth texture: */
-		glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,0,0,depthImageSize[0],depthImageSize[1],GL_LUMINANCE,GL_FLOAT,depthImage.getData<GLfloat>());
-		
-		/* Mark the depth texture as current: */
-		dataItem->depthTextureVersion=depthImageVersion;
-		}
+	/* Upload the changed parts of the depth image if the texture is outdated: */
+	updateDepthTexture(dataItem);
 	glUniform1iARB(dataItem->elevationShaderUniforms[0],0); // Tell the shader that the depth texture is in texture unit 0
 	
 	/* Upload the base plane equation in depth image space: */
@@ -340,18 +897,21 @@ void DepthImageRenderer::renderElevation(const PTransform& projectionModelview,G
 	
 	/* Upload the combined projection, modelview, and depth projection matrix: */
 	PTransform pmvdp=projectionModelview;
-	pmvdp*=depthProjection;
+	pmvdp*=textureDepthProjection;
 	glUniformARB(dataItem->elevationShaderUniforms[3],pmvdp);
 	
 	/* Bind the vertex and index buffers: */
 	glBindBufferARB(GL_ARRAY_BUFFER_ARB,dataItem->vertexBuffer);
 	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB,dataItem->indexBuffer);
 	
-	/* Draw the surface: */
+	/* Draw the quad strips connecting the requested rows; the strip ending in row y starts at index (y-1)*width*2: */
 	GLVertexArrayParts::enable(Vertex::getPartsMask());
 	glVertexPointer(static_cast<const Vertex*>(0));
+	rowEnd=Math::min(rowEnd,depthImageSize[1]);
+	unsigned int y=rowBegin+1;
 	GLuint* indexPtr=0;
-	for(unsigned int y=1;y<depthImageSize[1];++y,indexPtr+=depthImageSize[0]*2)
+	indexPtr+=rowBegin*depthImageSize[0]*2;
+	for(;y<rowEnd;++y,indexPtr+=depthImageSize[0]*2)
 		glDrawElements(GL_QUAD_STRIP,depthImageSize[0]*2,GL_UNSIGNED_INT,indexPtr);
 	GLVertexArrayParts::disable(Vertex::getPartsMask());
 	
@@ -24,6 +24,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef DEPTHIMAGERENDERER_INCLUDED
 #define DEPTHIMAGERENDERER_INCLUDED
 
+#include <vector>
 #include <GL/gl.h>
 #include <GL/Extensions/GLARBShaderObjects.h>
 #include <GL/GLObject.h>
@@ -48,6 +49,9 @@ class DepthImageRenderer:public GLObject
 		GLuint indexBuffer; // ID of index buffer object holding surface's triangles
 		GLuint depthTexture; // ID of texture object holding surface's vertex elevations in depth image space
 		unsigned int depthTextureVersion; // Version number of the depth image texture
+		unsigned int numUploadBuffers; // Number of pixel buffer objects in the ring streaming depth image updates into the depth texture
+		GLuint* uploadBuffers; // Ring of pixel buffer objects streaming depth image updates into the depth texture
+		unsigned int nextUploadBuffer; // Index of the pixel buffer object to use for the next depth texture update
 		
 		/* GLSL shader management: */
 		GLhandleARB depthShader; // Shader program to render the surface's depth only
@@ -56,10 +60,25 @@ class DepthImageRenderer:public GLObject
 		GLint elevationShaderUniforms[4]; // Locations of the elevation shader's uniform variables
 		
 		/* Constructors and destructors: */
-		DataItem(void);
+		DataItem(unsigned int sNumUploadBuffers);
 		virtual ~DataItem(void);
 		};
 	
+	struct DepthRange // Structure for the range of depth values of a node of the min-max pyramid
+		{
+		/* Elements: */
+		public:
+		float min,max; // Minimum and maximum depth value of the surface inside the node
+		};
+	
+	struct PyramidLevel // Structure for one level of the min-max pyramid
+		{
+		/* Elements: */
+		public:
+		unsigned int size[2]; // Width and height of the level's grid of nodes
+		std::vector<DepthRange> ranges; // Depth ranges of the level's nodes in row-major order
+		};
+	
 	/* Elements: */
 	unsigned int depthImageSize[2]; // Size of depth image texture
 	PTransform depthProjection; // Projection matrix from depth image space into 3D camera space
@@ -67,10 +86,32 @@ class DepthImageRenderer:public GLObject
 	GLfloat weightDicEq[4]; // Equation to calculate the weight of a depth image-space point in 3D camera space
 	Plane basePlane; // Base plane to calculate surface elevation
 	GLfloat basePlaneDicEq[4]; // Base plane equation in depth image space in GLSL-compatible format
+	bool packDepth; // Flag whether the depth texture stores depth values as 16-bit unsigned integers instead of floats
+	Scalar packElevationRange[2]; // Range of elevations relative to the base plane that must be representable by packed depth values
+	GLfloat packDepthOffset,packDepthScale; // Depth value represented by packed value 0, and depth difference between packed values 0 and 65535
+	PTransform textureDepthProjection; // Projection matrix from depth texture space, i.e., depth image space with packed depth values, into 3D camera space
+	unsigned int numUploadBuffers; // Number of pixel buffer objects per OpenGL context to stream depth image updates into the depth texture; 0 uploads directly from client memory
 	
 	/* Transient state: */
 	Kinect::FrameBuffer depthImage; // The most recent float-pixel depth image
 	unsigned int depthImageVersion; // Version number of the depth image
+	unsigned int tileSize; // Width and height of the tiles in which changes to the depth image are tracked
+	unsigned int numTiles[2]; // Width and height of the grid of tiles
+	std::vector<unsigned int> tileVersions; // Version number of the most recent depth image that changed each tile
+	unsigned int lastFrameIndex; // Index of the most recent filtered frame with per-tile change indices
+	std::vector<PyramidLevel> pyramid; // Min-max pyramid over the depth image's cells between pixel centers; level 0 holds single cells, the last level is the root
+	std::vector<GLushort> packedDepthImage; // The most recent depth image with packed depth values if depth packing is enabled
+	
+	/* Private methods: */
+	void resetTiles(unsigned int newTileSize); // Sets up a grid of tiles of the given size and marks all tiles as changed in the current depth image
+	void updatePyramid(unsigned int cellMinX,unsigned int cellMinY,unsigned int cellMaxX,unsigned int cellMaxY); // Updates the min-max pyramid over the given half-open rectangle of level-0 cells
+	void updateChangedTilesInPyramid(void); // Updates the min-max pyramid over all tiles changed by the current depth image
+	Scalar intersectCell(const Scalar q0[3],const Scalar dq[3],unsigned int cellX,unsigned int cellY,Scalar mu0,Scalar mu1) const; // Intersects the given interval of a line segment in depth image space with the surface triangles of the given cell; returns the first intersection's parameter, or 2 if there is none
+	bool clipToNode(const Scalar q0[3],const Scalar dq[3],unsigned int level,unsigned int nodeX,unsigned int nodeY,Scalar& mu0,Scalar& mu1) const; // Clips the given interval of a line segment in depth image space against the footprint of the given pyramid node; returns false if the interval misses the node
+	Scalar intersectNode(const Scalar q0[3],const Scalar dq[3],unsigned int level,unsigned int nodeX,unsigned int nodeY,Scalar mu0,Scalar mu1) const; // Intersects the given interval of a line segment in depth image space, already clipped to the given pyramid node, with the surface inside the node; returns the first intersection's parameter, or 2 if there is none
+	void updateTextureDepthProjection(void); // Recalculates the packed depth range and all depth texture-space matrices and equations from the current depth projection and base plane
+	void packChangedTiles(void); // Packs the depth values of all tiles changed by the current depth image if depth packing is enabled
+	void updateDepthTexture(DataItem* dataItem) const; // Uploads all tiles of the depth image that changed since the given context's depth texture was last updated
 	
 	/* Constructors and destructors: */
 	public:
@@ -98,17 +139,49 @@ class DepthImageRenderer:public GLObject
 		}
 	void setDepthProjection(const PTransform& newDepthProjection); // Sets a new depth unprojection matrix
 	void setBasePlane(const Plane& newBasePlane); // Sets a new base plane for elevation rendering
+	bool getPackDepth(void) const // Returns true if the depth texture stores packed 16-bit depth values
+		{
+		return packDepth;
+		}
+	void setPackDepth(bool newPackDepth,Scalar elevationMin,Scalar elevationMax); // Enables or disables packing depth values into 16 bits, covering the given elevation range relative to the base plane; must be called before the renderer is used in any OpenGL context or by any surface renderer
+	const PTransform& getTextureDepthProjection(void) const // Returns the unprojection matrix from depth texture space, which must be used for depth values sampled from the depth texture
+		{
+		return textureDepthProjection;
+		}
+	unsigned int getNumUploadBuffers(void) const // Returns the number of pixel buffer objects per OpenGL context streaming depth image updates
+		{
+		return numUploadBuffers;
+		}
+	void setNumUploadBuffers(unsigned int newNumUploadBuffers); // Sets the number of pixel buffer objects per OpenGL context streaming depth image updates; 0 uploads directly from client memory; must be called before the renderer is used in any OpenGL context
 	void setDepthImage(const Kinect::FrameBuffer& newDepthImage); // Sets a new depth image for subsequent surface rendering
-	Scalar intersectLine(const Point& p0,const Point& p1,Scalar elevationMin,Scalar elevationMax) const; // Intersects a line segment with the current depth image in camera space; returns intersection point's parameter along line
+	void setDepthImage(const Kinect::FrameBuffer& newDepthImage,unsigned int frameIndex,unsigned int newTileSize,const unsigned int* tileChangeIndices); // Sets a new filtered depth image of the given index, with the index of the most recent frame that changed each tile of the given size, for incremental updates
+	const Kinect::FrameBuffer& getDepthImage(void) const // Returns the current depth image
+		{
+		return depthImage;
+		}
+	Scalar intersectLine(const Point& p0,const Point& p1,Scalar elevationMin,Scalar elevationMax) const; // Intersects a line segment with the current depth image in camera space, considering only the part of the segment between the given elevations relative to the base plane; returns the first intersection point's parameter along the line, or 2 if the segment does not hit the surface
 	unsigned int getDepthImageVersion(void) const // Returns the version number of the current depth image
 		{
 		return depthImageVersion;
 		}
-	void uploadDepthProjection(GLint location) const; // Uploads the depth unprojection matrix into the GLSL 4x4 matrix at the given uniform location
+	unsigned int getTileSize(void) const // Returns the size of the tiles in which changes to the depth image are tracked
+		{
+		return tileSize;
+		}
+	const unsigned int* getNumTiles(void) const // Returns the size of the grid of tiles
+		{
+		return numTiles;
+		}
+	const unsigned int* getTileVersions(void) const // Returns the version number of the most recent depth image that changed each tile, in row-major order
+		{
+		return &tileVersions.front();
+		}
+	void uploadDepthProjection(GLint location) const; // Uploads the depth texture-space unprojection matrix into the GLSL 4x4 matrix at the given uniform location
 	void bindDepthTexture(GLContextData& contextData) const; // Binds the up-to-date depth texture image to the currently active texture unit
 	void renderSurfaceTemplate(GLContextData& contextData) const; // Renders the template quad strip mesh using current OpenGL settings
 	void renderDepth(const PTransform& projectionModelview,GLContextData& contextData) const; // Renders the surface into a pure depth buffer, for early z culling or shadow passes etc.
 	void renderElevation(const PTransform& projectionModelview,GLContextData& contextData) const; // Renders the surface's elevation relative to the base plane into the current one-component floating-point valued frame buffer
+	void renderElevation(const PTransform& projectionModelview,unsigned int rowBegin,unsigned int rowEnd,GLContextData& contextData) const; // Ditto, but only renders the quad strips connecting the given half-open range of depth image rows
 	};
 
 #endif
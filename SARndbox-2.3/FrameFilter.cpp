@@ -23,179 +23,937 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "FrameFilter.h"
 
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include <Misc/ThrowStdErr.h>
 #include <Misc/FunctionCalls.h>
 #include <Geometry/HVector.h>
 #include <Geometry/Matrix.h>
 
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+#ifdef __SSE2__
+
+inline __m128i mulLo(__m128i a,__m128i b) // Multiplies two vectors of unsigned 32-bit integers modulo 2^32, like SSE4.1's pmulld
+	{
+	__m128i even=_mm_mul_epu32(a,b);
+	__m128i odd=_mm_mul_epu32(_mm_srli_epi64(a,32),_mm_srli_epi64(b,32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even,_MM_SHUFFLE(0,0,2,0)),_mm_shuffle_epi32(odd,_MM_SHUFFLE(0,0,2,0)));
+	}
+
+#endif
+
+}
+
+/************************************
+Static elements of class FrameFilter:
+************************************/
+
+const unsigned int FrameFilter::dirtyTileSize;
+
 /****************************
 Methods of class FrameFilter:
 ****************************/
 
-void* FrameFilter::filterThreadMethod(void)
+void FrameFilter::createAveragingBuffers(void)
 	{
-	unsigned int lastInputFrameVersion=0;
+	unsigned int numPixels=size[1]*size[0];
 	
-	while(true)
+	/* Initialize the averaging buffer: */
+	averagingBuffer=new RawDepth[numAveragingSlots*numPixels];
+	RawDepth* abPtr=averagingBuffer;
+	for(unsigned int i=0;i<numAveragingSlots*numPixels;++i,++abPtr)
+		*abPtr=2048U; // Mark sample as invalid
+	averagingSlotIndex=0U;
+	
+	/* Initialize the statistics buffers in the current layout: */
+	if(compactStats)
 		{
-		Kinect::FrameBuffer frame;
+		countBuffer=new unsigned char[numPixels];
+		sumBuffer=new unsigned int[numPixels];
+		sumSqBuffer=new unsigned int[numPixels];
+		memset(countBuffer,0,numPixels*sizeof(unsigned char));
+		memset(sumBuffer,0,numPixels*sizeof(unsigned int));
+		memset(sumSqBuffer,0,numPixels*sizeof(unsigned int));
+		}
+	else
 		{
-		Threads::MutexCond::Lock inputLock(inputCond);
+		statBuffer=new unsigned int[numPixels*3];
+		memset(statBuffer,0,numPixels*3*sizeof(unsigned int));
+		}
+	}
+
+void FrameFilter::deleteAveragingBuffers(void)
+	{
+	delete[] averagingBuffer;
+	averagingBuffer=0;
+	delete[] statBuffer;
+	statBuffer=0;
+	delete[] countBuffer;
+	countBuffer=0;
+	delete[] sumBuffer;
+	sumBuffer=0;
+	delete[] sumSqBuffer;
+	sumSqBuffer=0;
+	}
+
+template <class CountParam>
+inline
+void FrameFilter::filterSpanScalar(const FrameFilter::RawDepth* inputFrame,float* outputFrame,unsigned int y,unsigned int xBegin,unsigned int xEnd,CountParam* cPtr,unsigned int* sumPtr,unsigned int* sumSqPtr,unsigned int statStride)
+	{
+	/* Enter the new frame into the averaging buffer and calculate the output frame's pixel values: */
+	unsigned int pixelIndex=y*size[0]+xBegin;
+	const RawDepth* ifPtr=inputFrame+pixelIndex;
+	RawDepth* abPtr=averagingBuffer+averagingSlotIndex*size[1]*size[0]+pixelIndex;
+	float* ofPtr=validBuffer+pixelIndex;
+	float* nofPtr=outputFrame+pixelIndex;
+	const PixelDepthCorrection* pdcPtr=pixelDepthCorrection+pixelIndex;
+	float py=float(y)+0.5f;
+	for(unsigned int x=xBegin;x<xEnd;++x,++ifPtr,++pdcPtr,++abPtr,cPtr+=statStride,sumPtr+=statStride,sumSqPtr+=statStride,++ofPtr,++nofPtr)
+		{
+		float px=float(x)+0.5f;
 		
-		/* Wait until a new frame arrives or the program shuts down: */
-		while(runFilterThread&&lastInputFrameVersion==inputFrameVersion)
-			inputCond.wait(inputLock);
+		unsigned int oldVal=*abPtr;
+		unsigned int newVal=*ifPtr;
 		
-		/* Bail out if the program is shutting down: */
-		if(!runFilterThread)
-			break;
+		/* Retrieve the pixel's statistics: */
+		unsigned int count=*cPtr; // Number of valid samples
+		unsigned int sum=*sumPtr; // Sum of valid samples
+		unsigned int sumSq=*sumSqPtr; // Sum of squares of valid samples
 		
-		/* Work on the new frame: */
-		frame=inputFrame;
-		lastInputFrameVersion=inputFrameVersion;
+		/* Depth-correct the new value: */
+		float newCVal=pdcPtr->correct(newVal);
+		
+		/* Plug the depth-corrected new value into the minimum and maximum plane equations to determine its validity: */
+		float minD=minPlane[0]*px+minPlane[1]*py+minPlane[2]*newCVal+minPlane[3];
+		float maxD=maxPlane[0]*px+maxPlane[1]*py+maxPlane[2]*newCVal+maxPlane[3];
+		if(minD>=0.0f&&maxD<=0.0f)
+			{
+			/* Store the new input value: */
+			*abPtr=newVal;
+			
+			/* Update the pixel's statistics: */
+			++count;
+			sum+=newVal;
+			sumSq+=newVal*newVal;
+			
+			/* Check if the previous value in the averaging buffer was valid: */
+			if(oldVal!=2048U)
+				{
+				--count;
+				sum-=oldVal;
+				sumSq-=oldVal*oldVal;
+				}
+			}
+		else if(!retainValids)
+			{
+			/* Store an invalid input value: */
+			*abPtr=2048U;
+			
+			/* Check if the previous value in the averaging buffer was valid: */
+			if(oldVal!=2048U)
+				{
+				--count;
+				sum-=oldVal;
+				sumSq-=oldVal*oldVal;
+				}
+			}
+		
+		/* Store the pixel's updated statistics: */
+		*cPtr=CountParam(count);
+		*sumPtr=sum;
+		*sumSqPtr=sumSq;
+		
+		/* Check if the pixel is considered "stable": */
+		if(count>=minNumSamples&&sumSq*count<=maxVariance*count*count+sum*sum)
+			{
+			/* Check if the new depth-corrected running mean is outside the previous value's envelope: */
+			float newFiltered=pdcPtr->correct(float(sum)/float(count));
+			if(Math::abs(newFiltered-*ofPtr)>=hysteresis)
+				{
+				/* Set the output pixel value to the depth-corrected running mean: */
+				*nofPtr=*ofPtr=newFiltered;
+				}
+			else
+				{
+				/* Leave the pixel at its previous value: */
+				*nofPtr=*ofPtr;
+				}
+			}
+		else if(retainValids)
+			{
+			/* Leave the pixel at its previous value: */
+			*nofPtr=*ofPtr;
+			}
+		else
+			{
+			/* Assign default value to instable pixels: */
+			*nofPtr=instableValue;
+			}
+		}
+	}
+
+void FrameFilter::filterRowScalar(const FrameFilter::RawDepth* inputFrame,float* outputFrame,unsigned int y,unsigned int xBegin,unsigned int xEnd)
+	{
+	unsigned int pixelIndex=y*size[0]+xBegin;
+	if(compactStats)
+		filterSpanScalar(inputFrame,outputFrame,y,xBegin,xEnd,countBuffer+pixelIndex,sumBuffer+pixelIndex,sumSqBuffer+pixelIndex,1);
+	else
+		{
+		unsigned int* sPtr=statBuffer+pixelIndex*3;
+		filterSpanScalar(inputFrame,outputFrame,y,xBegin,xEnd,sPtr,sPtr+1,sPtr+2,3);
 		}
+	}
+
+#ifdef __SSE2__
+
+unsigned int FrameFilter::filterRowSSE2(const FrameFilter::RawDepth* inputFrame,float* outputFrame,unsigned int y)
+	{
+	/*********************************************************************
+	This is a branch-free transcription of filterRowScalar. All floating-
+	point operations are carried out in the same order as in the scalar
+	code, and all integer statistics use the same modulo-2^32 arithmetic,
+	so both produce bit-identical results as long as the compiler does
+	not contract multiplications and additions.
+	*********************************************************************/
+	
+	/* Set up per-row constants: */
+	const __m128i zero=_mm_setzero_si128();
+	const __m128i one=_mm_set1_epi32(1);
+	const __m128i invalid=_mm_set1_epi32(2048);
+	const __m128i signBit=_mm_set1_epi32(0x80000000);
+	const __m128i bias16=_mm_set1_epi32(0x8000);
+	const __m128i bias16Packed=_mm_set1_epi16(short(0x8000));
+	const __m128i resetInvalids=retainValids?zero:_mm_set1_epi32(-1);
+	const __m128i minNumSamplesBiased=_mm_set1_epi32(int(minNumSamples^0x80000000U));
+	const __m128i maxVar=_mm_set1_epi32(int(maxVariance));
+	const __m128 absMask=_mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 fzero=_mm_setzero_ps();
+	const __m128 hyst=_mm_set1_ps(hysteresis);
+	const __m128 instable=_mm_set1_ps(instableValue);
+	const __m128 retainMask=_mm_castsi128_ps(retainValids?_mm_set1_epi32(-1):zero);
+	float py=float(y)+0.5f;
+	const __m128 minP0=_mm_set1_ps(minPlane[0]);
+	const __m128 minP1Py=_mm_set1_ps(minPlane[1]*py);
+	const __m128 minP2=_mm_set1_ps(minPlane[2]);
+	const __m128 minP3=_mm_set1_ps(minPlane[3]);
+	const __m128 maxP0=_mm_set1_ps(maxPlane[0]);
+	const __m128 maxP1Py=_mm_set1_ps(maxPlane[1]*py);
+	const __m128 maxP2=_mm_set1_ps(maxPlane[2]);
+	const __m128 maxP3=_mm_set1_ps(maxPlane[3]);
+	__m128i xi=_mm_setr_epi32(0,1,2,3);
+	const __m128i xStep=_mm_set1_epi32(4);
+	const __m128 half=_mm_set1_ps(0.5f);
+	
+	unsigned int pixelIndex=y*size[0];
+	const RawDepth* ifPtr=inputFrame+pixelIndex;
+	RawDepth* abPtr=averagingBuffer+averagingSlotIndex*size[1]*size[0]+pixelIndex;
+	unsigned int* sPtr=statBuffer+pixelIndex*3;
+	unsigned char* cPtr=countBuffer+pixelIndex;
+	unsigned int* sumPtr=sumBuffer+pixelIndex;
+	unsigned int* sumSqPtr=sumSqBuffer+pixelIndex;
+	float* ofPtr=validBuffer+pixelIndex;
+	float* nofPtr=outputFrame+pixelIndex;
+	const PixelDepthCorrection* pdcPtr=pixelDepthCorrection+pixelIndex;
+	unsigned int x;
+	for(x=0;x+4<=size[0];x+=4,ifPtr+=4,pdcPtr+=4,abPtr+=4,sPtr+=12,cPtr+=4,sumPtr+=4,sumSqPtr+=4,ofPtr+=4,nofPtr+=4,xi=_mm_add_epi32(xi,xStep))
+		{
+		__m128 px=_mm_add_ps(_mm_cvtepi32_ps(xi),half);
 		
-		/* Prepare a new output frame: */
-		Kinect::FrameBuffer& newOutputFrame=outputFrames.startNewValue();
+		/* Load the old and new raw values: */
+		__m128i oldVal=_mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(abPtr)),zero);
+		__m128i newVal=_mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(ifPtr)),zero);
 		
-		/* Enter the new frame into the averaging buffer and calculate the output frame's pixel values: */
-		const RawDepth* ifPtr=inputFrame.getData<RawDepth>();
-		RawDepth* abPtr=averagingBuffer+averagingSlotIndex*size[1]*size[0];
-		unsigned int* sPtr=statBuffer;
-		float* ofPtr=validBuffer;
-		float* nofPtr=newOutputFrame.getData<float>();
-		const PixelDepthCorrection* pdcPtr=pixelDepthCorrection;
-		for(unsigned int y=0;y<size[1];++y)
+		/* Load and de-interleave the pixels' depth correction coefficients: */
+		__m128 pdc01=_mm_loadu_ps(&pdcPtr[0].scale);
+		__m128 pdc23=_mm_loadu_ps(&pdcPtr[2].scale);
+		__m128 scale=_mm_shuffle_ps(pdc01,pdc23,_MM_SHUFFLE(2,0,2,0));
+		__m128 offset=_mm_shuffle_ps(pdc01,pdc23,_MM_SHUFFLE(3,1,3,1));
+		
+		/* Depth-correct the new values: */
+		__m128 newCVal=_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(newVal),scale),offset);
+		
+		/* Plug the depth-corrected new values into the minimum and maximum plane equations to determine their validity: */
+		__m128 minD=_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(minP0,px),minP1Py),_mm_mul_ps(minP2,newCVal)),minP3);
+		__m128 maxD=_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(maxP0,px),maxP1Py),_mm_mul_ps(maxP2,newCVal)),maxP3);
+		__m128i valid=_mm_castps_si128(_mm_and_ps(_mm_cmpge_ps(minD,fzero),_mm_cmple_ps(maxD,fzero)));
+		
+		/* Determine which pixels remove their previous value from the statistics: */
+		__m128i remove=_mm_andnot_si128(_mm_cmpeq_epi32(oldVal,invalid),_mm_or_si128(valid,resetInvalids));
+		
+		/* Store the new values in the averaging buffer: */
+		__m128i abVal=_mm_or_si128(_mm_and_si128(valid,newVal),_mm_andnot_si128(valid,_mm_or_si128(_mm_and_si128(resetInvalids,invalid),_mm_andnot_si128(resetInvalids,oldVal))));
+		abVal=_mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(abVal,bias16),zero),bias16Packed);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(abPtr),abVal);
+		
+		/* Update the pixels' statistics: */
+		__m128i count,sum,sumSq;
+		if(compactStats)
+			{
+			int counts;
+			memcpy(&counts,cPtr,sizeof(int));
+			count=_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(counts),zero),zero);
+			sum=_mm_loadu_si128(reinterpret_cast<const __m128i*>(sumPtr));
+			sumSq=_mm_loadu_si128(reinterpret_cast<const __m128i*>(sumSqPtr));
+			}
+		else
+			{
+			count=_mm_setr_epi32(int(sPtr[0]),int(sPtr[3]),int(sPtr[6]),int(sPtr[9]));
+			sum=_mm_setr_epi32(int(sPtr[1]),int(sPtr[4]),int(sPtr[7]),int(sPtr[10]));
+			sumSq=_mm_setr_epi32(int(sPtr[2]),int(sPtr[5]),int(sPtr[8]),int(sPtr[11]));
+			}
+		count=_mm_sub_epi32(_mm_add_epi32(count,_mm_and_si128(valid,one)),_mm_and_si128(remove,one));
+		sum=_mm_sub_epi32(_mm_add_epi32(sum,_mm_and_si128(valid,newVal)),_mm_and_si128(remove,oldVal));
+		sumSq=_mm_sub_epi32(_mm_add_epi32(sumSq,_mm_and_si128(valid,mulLo(newVal,newVal))),_mm_and_si128(remove,mulLo(oldVal,oldVal)));
+		if(compactStats)
+			{
+			int counts=_mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(count,zero),zero));
+			memcpy(cPtr,&counts,sizeof(int));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(sumPtr),sum);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(sumSqPtr),sumSq);
+			}
+		else
+			{
+			unsigned int stats[3][4] __attribute__((aligned(16)));
+			_mm_store_si128(reinterpret_cast<__m128i*>(stats[0]),count);
+			_mm_store_si128(reinterpret_cast<__m128i*>(stats[1]),sum);
+			_mm_store_si128(reinterpret_cast<__m128i*>(stats[2]),sumSq);
+			for(int i=0;i<4;++i)
+				for(int j=0;j<3;++j)
+					sPtr[i*3+j]=stats[j][i];
+			}
+		
+		/* Check which pixels are considered "stable" using unsigned comparisons: */
+		__m128i enoughSamples=_mm_xor_si128(_mm_cmplt_epi32(_mm_xor_si128(count,signBit),minNumSamplesBiased),_mm_set1_epi32(-1));
+		__m128i lhs=_mm_xor_si128(mulLo(sumSq,count),signBit);
+		__m128i rhs=_mm_xor_si128(_mm_add_epi32(mulLo(mulLo(maxVar,count),count),mulLo(sum,sum)),signBit);
+		__m128 stable=_mm_castsi128_ps(_mm_andnot_si128(_mm_cmpgt_epi32(lhs,rhs),enoughSamples));
+		
+		/* Calculate the new depth-corrected running means: */
+		__m128 newFiltered=_mm_add_ps(_mm_mul_ps(_mm_div_ps(_mm_cvtepi32_ps(sum),_mm_cvtepi32_ps(count)),scale),offset);
+		
+		/* Check if the new running means are outside the previous values' envelopes: */
+		__m128 oldFiltered=_mm_loadu_ps(ofPtr);
+		__m128 update=_mm_and_ps(stable,_mm_cmpge_ps(_mm_and_ps(_mm_sub_ps(newFiltered,oldFiltered),absMask),hyst));
+		__m128 newValid=_mm_or_ps(_mm_and_ps(update,newFiltered),_mm_andnot_ps(update,oldFiltered));
+		_mm_storeu_ps(ofPtr,newValid);
+		
+		/* Assign the default value to instable pixels if requested: */
+		__m128 keep=_mm_or_ps(stable,retainMask);
+		_mm_storeu_ps(nofPtr,_mm_or_ps(_mm_and_ps(keep,newValid),_mm_andnot_ps(keep,instable)));
+		}
+	
+	return x;
+	}
+
+#endif
+
+#ifdef __AVX2__
+
+unsigned int FrameFilter::filterRowAVX2(const FrameFilter::RawDepth* inputFrame,float* outputFrame,unsigned int y)
+	{
+	/* Eight-pixel version of filterRowSSE2; see comments there: */
+	const __m256i zero=_mm256_setzero_si256();
+	const __m256i one=_mm256_set1_epi32(1);
+	const __m256i allOnes=_mm256_set1_epi32(-1);
+	const __m256i invalid=_mm256_set1_epi32(2048);
+	const __m256i signBit=_mm256_set1_epi32(0x80000000);
+	const __m256i resetInvalids=retainValids?zero:allOnes;
+	const __m256i minNumSamplesBiased=_mm256_set1_epi32(int(minNumSamples^0x80000000U));
+	const __m256i maxVar=_mm256_set1_epi32(int(maxVariance));
+	const __m256i statIndices=_mm256_setr_epi32(0,3,6,9,12,15,18,21);
+	const __m256 absMask=_mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	const __m256 fzero=_mm256_setzero_ps();
+	const __m256 hyst=_mm256_set1_ps(hysteresis);
+	const __m256 instable=_mm256_set1_ps(instableValue);
+	const __m256 retainMask=_mm256_castsi256_ps(retainValids?allOnes:zero);
+	float py=float(y)+0.5f;
+	const __m256 minP0=_mm256_set1_ps(minPlane[0]);
+	const __m256 minP1Py=_mm256_set1_ps(minPlane[1]*py);
+	const __m256 minP2=_mm256_set1_ps(minPlane[2]);
+	const __m256 minP3=_mm256_set1_ps(minPlane[3]);
+	const __m256 maxP0=_mm256_set1_ps(maxPlane[0]);
+	const __m256 maxP1Py=_mm256_set1_ps(maxPlane[1]*py);
+	const __m256 maxP2=_mm256_set1_ps(maxPlane[2]);
+	const __m256 maxP3=_mm256_set1_ps(maxPlane[3]);
+	__m256i xi=_mm256_setr_epi32(0,1,2,3,4,5,6,7);
+	const __m256i xStep=_mm256_set1_epi32(8);
+	const __m256 half=_mm256_set1_ps(0.5f);
+	
+	unsigned int pixelIndex=y*size[0];
+	const RawDepth* ifPtr=inputFrame+pixelIndex;
+	RawDepth* abPtr=averagingBuffer+averagingSlotIndex*size[1]*size[0]+pixelIndex;
+	unsigned int* sPtr=statBuffer+pixelIndex*3;
+	unsigned char* cPtr=countBuffer+pixelIndex;
+	unsigned int* sumPtr=sumBuffer+pixelIndex;
+	unsigned int* sumSqPtr=sumSqBuffer+pixelIndex;
+	float* ofPtr=validBuffer+pixelIndex;
+	float* nofPtr=outputFrame+pixelIndex;
+	const PixelDepthCorrection* pdcPtr=pixelDepthCorrection+pixelIndex;
+	unsigned int x;
+	for(x=0;x+8<=size[0];x+=8,ifPtr+=8,pdcPtr+=8,abPtr+=8,sPtr+=24,cPtr+=8,sumPtr+=8,sumSqPtr+=8,ofPtr+=8,nofPtr+=8,xi=_mm256_add_epi32(xi,xStep))
+		{
+		__m256 px=_mm256_add_ps(_mm256_cvtepi32_ps(xi),half);
+		
+		/* Load the old and new raw values: */
+		__m256i oldVal=_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(abPtr)));
+		__m256i newVal=_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ifPtr)));
+		
+		/* Load and de-interleave the pixels' depth correction coefficients: */
+		__m256 pdc03=_mm256_loadu_ps(&pdcPtr[0].scale);
+		__m256 pdc47=_mm256_loadu_ps(&pdcPtr[4].scale);
+		__m256 scale=_mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(pdc03,pdc47,_MM_SHUFFLE(2,0,2,0))),_MM_SHUFFLE(3,1,2,0)));
+		__m256 offset=_mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(pdc03,pdc47,_MM_SHUFFLE(3,1,3,1))),_MM_SHUFFLE(3,1,2,0)));
+		
+		/* Depth-correct the new values and test them against the minimum and maximum planes: */
+		__m256 newCVal=_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(newVal),scale),offset);
+		__m256 minD=_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(minP0,px),minP1Py),_mm256_mul_ps(minP2,newCVal)),minP3);
+		__m256 maxD=_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(maxP0,px),maxP1Py),_mm256_mul_ps(maxP2,newCVal)),maxP3);
+		__m256i valid=_mm256_castps_si256(_mm256_and_ps(_mm256_cmp_ps(minD,fzero,_CMP_GE_OQ),_mm256_cmp_ps(maxD,fzero,_CMP_LE_OQ)));
+		__m256i remove=_mm256_andnot_si256(_mm256_cmpeq_epi32(oldVal,invalid),_mm256_or_si256(valid,resetInvalids));
+		
+		/* Store the new values in the averaging buffer: */
+		__m256i abVal=_mm256_blendv_epi8(_mm256_blendv_epi8(oldVal,invalid,resetInvalids),newVal,valid);
+		abVal=_mm256_permute4x64_epi64(_mm256_packus_epi32(abVal,abVal),_MM_SHUFFLE(3,1,2,0));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(abPtr),_mm256_castsi256_si128(abVal));
+		
+		/* Update the pixels' statistics: */
+		__m256i count,sum,sumSq;
+		if(compactStats)
+			{
+			count=_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(cPtr)));
+			sum=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(sumPtr));
+			sumSq=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(sumSqPtr));
+			}
+		else
 			{
-			float py=float(y)+0.5f;
-			for(unsigned int x=0;x<size[0];++x,++ifPtr,++pdcPtr,++abPtr,sPtr+=3,++ofPtr,++nofPtr)
+			const int* sgPtr=reinterpret_cast<const int*>(sPtr);
+			count=_mm256_i32gather_epi32(sgPtr,statIndices,4);
+			sum=_mm256_i32gather_epi32(sgPtr+1,statIndices,4);
+			sumSq=_mm256_i32gather_epi32(sgPtr+2,statIndices,4);
+			}
+		count=_mm256_sub_epi32(_mm256_add_epi32(count,_mm256_and_si256(valid,one)),_mm256_and_si256(remove,one));
+		sum=_mm256_sub_epi32(_mm256_add_epi32(sum,_mm256_and_si256(valid,newVal)),_mm256_and_si256(remove,oldVal));
+		sumSq=_mm256_sub_epi32(_mm256_add_epi32(sumSq,_mm256_and_si256(valid,_mm256_mullo_epi32(newVal,newVal))),_mm256_and_si256(remove,_mm256_mullo_epi32(oldVal,oldVal)));
+		if(compactStats)
+			{
+			__m128i counts=_mm_packs_epi32(_mm256_castsi256_si128(count),_mm256_extracti128_si256(count,1));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(cPtr),_mm_packus_epi16(counts,counts));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(sumPtr),sum);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(sumSqPtr),sumSq);
+			}
+		else
+			{
+			unsigned int stats[3][8] __attribute__((aligned(32)));
+			_mm256_store_si256(reinterpret_cast<__m256i*>(stats[0]),count);
+			_mm256_store_si256(reinterpret_cast<__m256i*>(stats[1]),sum);
+			_mm256_store_si256(reinterpret_cast<__m256i*>(stats[2]),sumSq);
+			for(int i=0;i<8;++i)
+				for(int j=0;j<3;++j)
+					sPtr[i*3+j]=stats[j][i];
+			}
+		
+		/* Check which pixels are considered "stable" using unsigned comparisons: */
+		__m256i enoughSamples=_mm256_xor_si256(_mm256_cmpgt_epi32(minNumSamplesBiased,_mm256_xor_si256(count,signBit)),allOnes);
+		__m256i lhs=_mm256_xor_si256(_mm256_mullo_epi32(sumSq,count),signBit);
+		__m256i rhs=_mm256_xor_si256(_mm256_add_epi32(_mm256_mullo_epi32(_mm256_mullo_epi32(maxVar,count),count),_mm256_mullo_epi32(sum,sum)),signBit);
+		__m256 stable=_mm256_castsi256_ps(_mm256_andnot_si256(_mm256_cmpgt_epi32(lhs,rhs),enoughSamples));
+		
+		/* Calculate the new depth-corrected running means and apply the hysteresis envelope: */
+		__m256 newFiltered=_mm256_add_ps(_mm256_mul_ps(_mm256_div_ps(_mm256_cvtepi32_ps(sum),_mm256_cvtepi32_ps(count)),scale),offset);
+		__m256 oldFiltered=_mm256_loadu_ps(ofPtr);
+		__m256 update=_mm256_and_ps(stable,_mm256_cmp_ps(_mm256_and_ps(_mm256_sub_ps(newFiltered,oldFiltered),absMask),hyst,_CMP_GE_OQ));
+		__m256 newValid=_mm256_blendv_ps(oldFiltered,newFiltered,update);
+		_mm256_storeu_ps(ofPtr,newValid);
+		_mm256_storeu_ps(nofPtr,_mm256_blendv_ps(instable,newValid,_mm256_or_ps(stable,retainMask)));
+		}
+	
+	return x;
+	}
+
+#endif
+
+void FrameFilter::filterRowAdaptive(const FrameFilter::RawDepth* inputFrame,float* outputFrame,unsigned int y)
+	{
+	/*********************************************************************
+	Each pixel runs a scalar Kalman filter with a constant-value model on
+	its raw depth values. On a static surface the filter's gain decays
+	towards sqrt(processVariance/measurementVariance), which averages
+	noise over a window comparable to the averaging filter's. A sample
+	outside the estimate's confidence envelope is held back as a
+	candidate; if the next sample agrees with the candidate, the surface
+	is considered changed, and the estimate restarts from the two new
+	samples. Single-frame spikes are thereby rejected, while real changes
+	are reflected after two frames.
+	*********************************************************************/
+	
+	float measurementVariance=adaptiveMeasurementVariance;
+	float processVariance=adaptiveProcessVariance;
+	float threshold2=adaptiveChangeThreshold*adaptiveChangeThreshold;
+	float candidateEnvelope=threshold2*2.0f*measurementVariance;
+	
+	unsigned int pixelIndex=y*size[0];
+	const RawDepth* ifPtr=inputFrame+pixelIndex;
+	AdaptivePixel* apPtr=adaptiveBuffer+pixelIndex;
+	float* ofPtr=validBuffer+pixelIndex;
+	float* nofPtr=outputFrame+pixelIndex;
+	const PixelDepthCorrection* pdcPtr=pixelDepthCorrection+pixelIndex;
+	float py=float(y)+0.5f;
+	for(unsigned int x=0;x<size[0];++x,++ifPtr,++apPtr,++pdcPtr,++ofPtr,++nofPtr)
+		{
+		float px=float(x)+0.5f;
+		
+		float newVal=float(*ifPtr);
+		
+		/* Depth-correct the new value: */
+		float newCVal=pdcPtr->correct(newVal);
+		
+		/* Plug the depth-corrected new value into the minimum and maximum plane equations to determine its validity: */
+		float minD=minPlane[0]*px+minPlane[1]*py+minPlane[2]*newCVal+minPlane[3];
+		float maxD=maxPlane[0]*px+maxPlane[1]*py+maxPlane[2]*newCVal+maxPlane[3];
+		if(minD>=0.0f&&maxD<=0.0f)
+			{
+			if(apPtr->variance<0.0f)
 				{
-				float px=float(x)+0.5f;
-				
-				unsigned int oldVal=*abPtr;
-				unsigned int newVal=*ifPtr;
-				
-				/* Depth-correct the new value: */
-				float newCVal=pdcPtr->correct(newVal);
-				
-				/* Plug the depth-corrected new value into the minimum and maximum plane equations to determine its validity: */
-				float minD=minPlane[0]*px+minPlane[1]*py+minPlane[2]*newCVal+minPlane[3];
-				float maxD=maxPlane[0]*px+maxPlane[1]*py+maxPlane[2]*newCVal+maxPlane[3];
-				if(minD>=0.0f&&maxD<=0.0f)
-					{
-					/* Store the new input value: */
-					*abPtr=newVal;
-					
-					/* Update the pixel's statistics: */
-					++sPtr[0]; // Number of valid samples
-					sPtr[1]+=newVal; // Sum of valid samples
-					sPtr[2]+=newVal*newVal; // Sum of squares of valid samples
-					
-					/* Check if the previous value in the averaging buffer was valid: */
-					if(oldVal!=2048U)
-						{
-						--sPtr[0]; // Number of valid samples
-						sPtr[1]-=oldVal; // Sum of valid samples
-						sPtr[2]-=oldVal*oldVal; // Sum of squares of valid samples
-						}
-					}
-				else if(!retainValids)
-					{
-					/* Store an invalid input value: */
-					*abPtr=2048U;
-					
-					/* Check if the previous value in the averaging buffer was valid: */
-					if(oldVal!=2048U)
-						{
-						--sPtr[0]; // Number of valid samples
-						sPtr[1]-=oldVal; // Sum of valid samples
-						sPtr[2]-=oldVal*oldVal; // Sum of squares of valid samples
-						}
-					}
-				
-				/* Check if the pixel is considered "stable": */
-				if(sPtr[0]>=minNumSamples&&sPtr[2]*sPtr[0]<=maxVariance*sPtr[0]*sPtr[0]+sPtr[1]*sPtr[1])
+				/* Start a new estimate from the new value: */
+				apPtr->estimate=newVal;
+				apPtr->variance=measurementVariance;
+				apPtr->candidate=-1.0f;
+				}
+			else
+				{
+				/* Predict the estimate's variance and check whether the new value is inside its confidence envelope: */
+				float predictedVariance=apPtr->variance+processVariance;
+				float innovation=newVal-apPtr->estimate;
+				if(innovation*innovation<=threshold2*(predictedVariance+measurementVariance))
 					{
-					/* Check if the new depth-corrected running mean is outside the previous value's envelope: */
-					float newFiltered=pdcPtr->correct(float(sPtr[1])/float(sPtr[0]));
-					if(Math::abs(newFiltered-*ofPtr)>=hysteresis)
-						{
-						/* Set the output pixel value to the depth-corrected running mean: */
-						*nofPtr=*ofPtr=newFiltered;
-						}
-					else
-						{
-						/* Leave the pixel at its previous value: */
-						*nofPtr=*ofPtr;
-						}
+					/* Blend the new value into the estimate: */
+					float gain=predictedVariance/(predictedVariance+measurementVariance);
+					apPtr->estimate+=innovation*gain;
+					apPtr->variance=predictedVariance*(1.0f-gain);
+					apPtr->candidate=-1.0f;
 					}
-				else if(retainValids)
+				else if(apPtr->candidate>=0.0f&&Math::sqr(newVal-apPtr->candidate)<=candidateEnvelope)
 					{
-					/* Leave the pixel at its previous value: */
-					*nofPtr=*ofPtr;
+					/* Two consecutive outliers agree; restart the estimate from both of them: */
+					apPtr->estimate=(apPtr->candidate+newVal)*0.5f;
+					apPtr->variance=measurementVariance*0.5f;
+					apPtr->candidate=-1.0f;
 					}
 				else
 					{
-					/* Assign default value to instable pixels: */
-					*nofPtr=instableValue;
+					/* Hold the new value back until the next frame confirms or refutes it: */
+					apPtr->candidate=newVal;
 					}
 				}
 			}
+		else if(!retainValids)
+			{
+			/* Discard the pixel's estimate: */
+			apPtr->variance=-1.0f;
+			apPtr->candidate=-1.0f;
+			}
+		
+		/* Check if the pixel is considered "stable," i.e., its estimate is based on more than a single sample: */
+		if(apPtr->variance>=0.0f&&apPtr->variance<measurementVariance)
+			{
+			/* Check if the new depth-corrected estimate is outside the previous value's envelope: */
+			float newFiltered=pdcPtr->correct(apPtr->estimate);
+			if(Math::abs(newFiltered-*ofPtr)>=hysteresis)
+				{
+				/* Set the output pixel value to the depth-corrected estimate: */
+				*nofPtr=*ofPtr=newFiltered;
+				}
+			else
+				{
+				/* Leave the pixel at its previous value: */
+				*nofPtr=*ofPtr;
+				}
+			}
+		else if(retainValids)
+			{
+			/* Leave the pixel at its previous value: */
+			*nofPtr=*ofPtr;
+			}
+		else
+			{
+			/* Assign default value to instable pixels: */
+			*nofPtr=instableValue;
+			}
+		}
+	}
+
+void FrameFilter::filterRows(const FrameFilter::RawDepth* inputFrame,float* outputFrame,unsigned int rowBegin,unsigned int rowEnd)
+	{
+	if(temporalFilterType==ADAPTIVE_TEMPORAL_FILTER)
+		{
+		/* The adaptive filter only has a reference implementation: */
+		for(unsigned int y=rowBegin;y<rowEnd;++y)
+			filterRowAdaptive(inputFrame,outputFrame,y);
+		return;
+		}
+	
+	for(unsigned int y=rowBegin;y<rowEnd;++y)
+		{
+		/* Process as much of the row as possible using the selected vector kernel: */
+		unsigned int x=0;
+		switch(filterKernel)
+			{
+			#ifdef __SSE2__
+			case SSE2_KERNEL:
+				x=filterRowSSE2(inputFrame,outputFrame,y);
+				break;
+			#endif
+			
+			#ifdef __AVX2__
+			case AVX2_KERNEL:
+				x=filterRowAVX2(inputFrame,outputFrame,y);
+				break;
+			#endif
+			
+			default:
+				;
+			}
 		
-		/* Go to the next averaging slot: */
-		if(++averagingSlotIndex==numAveragingSlots)
-			averagingSlotIndex=0U;
+		/* Process the rest of the row using the reference kernel: */
+		filterRowScalar(inputFrame,outputFrame,y,x,size[0]);
+		}
+	}
+
+void FrameFilter::legacyFilterColumns(const float* src,float* dst,unsigned int rowBegin,unsigned int rowEnd) const
+	{
+	/* Filter the given rows with a vertical [1 2 1] kernel, processing entire rows at a time for cache efficiency: */
+	for(unsigned int y=rowBegin;y<rowEnd;++y)
+		{
+		const float* sPtr=src+y*size[0];
+		float* dPtr=dst+y*size[0];
+		if(y==0)
+			{
+			/* Filter the first row: */
+			for(unsigned int x=0;x<size[0];++x,++sPtr,++dPtr)
+				*dPtr=(sPtr[0]*2.0f+sPtr[size[0]])/3.0f;
+			}
+		else if(y==size[1]-1)
+			{
+			/* Filter the last row: */
+			for(unsigned int x=0;x<size[0];++x,++sPtr,++dPtr)
+				*dPtr=(sPtr[-int(size[0])]+sPtr[0]*2.0f)/3.0f;
+			}
+		else
+			{
+			/* Filter an interior row: */
+			for(unsigned int x=0;x<size[0];++x,++sPtr,++dPtr)
+				*dPtr=(sPtr[-int(size[0])]+sPtr[0]*2.0f+sPtr[size[0]])*0.25f;
+			}
+		}
+	}
+
+void FrameFilter::legacyFilterRows(const float* src,float* dst,unsigned int rowBegin,unsigned int rowEnd) const
+	{
+	/* Filter the given rows with a horizontal [1 2 1] kernel: */
+	for(unsigned int y=rowBegin;y<rowEnd;++y)
+		{
+		const float* sPtr=src+y*size[0];
+		float* dPtr=dst+y*size[0];
+		
+		/* Filter the first pixel in the row: */
+		*dPtr=(sPtr[0]*2.0f+sPtr[1])/3.0f;
+		++sPtr;
+		++dPtr;
+		
+		/* Filter the interior pixels in the row: */
+		for(unsigned int x=1;x<size[0]-1;++x,++sPtr,++dPtr)
+			*dPtr=(sPtr[-1]+sPtr[0]*2.0f+sPtr[1])*0.25f;
 		
-		/* Apply a spatial filter if requested: */
-		if(spatialFilter)
+		/* Filter the last pixel in the row: */
+		*dPtr=(sPtr[-1]+sPtr[0]*2.0f)/3.0f;
+		}
+	}
+
+void FrameFilter::separableFilterRows(const float* src,float* dst,unsigned int rowBegin,unsigned int rowEnd) const
+	{
+	int radius=int(spatialFilterRadius);
+	const float* weights=spatialFilterWeights+radius; // Filter weights indexed from -radius to +radius
+	bool bilateral=spatialFilterType==BILATERAL_SPATIAL_FILTER;
+	float rangeScale=0.5f/(spatialFilterRangeSigma*spatialFilterRangeSigma);
+	int width=int(size[0]);
+	for(unsigned int y=rowBegin;y<rowEnd;++y)
+		{
+		const float* sRow=src+y*size[0];
+		float* dRow=dst+y*size[0];
+		for(int x=0;x<width;++x)
 			{
-			for(int filterPass=0;filterPass<2;++filterPass)
+			/* Clip the filter kernel against the row's ends: */
+			int k0=x>=radius?-radius:-x;
+			int k1=x+radius<width?radius:width-1-x;
+			
+			/* Accumulate the weighted pixel values, re-normalizing the weights of the clipped kernel: */
+			float center=sRow[x];
+			float acc=0.0f;
+			float weightSum=0.0f;
+			for(int k=k0;k<=k1;++k)
 				{
-				/* Low-pass filter the entire output frame in-place: */
-				for(unsigned int x=0;x<size[0];++x)
+				float w=weights[k];
+				if(bilateral)
 					{
-					/* Get a pointer to the current column: */
-					float* colPtr=newOutputFrame.getData<float>()+x;
-					
-					/* Filter the first pixel in the column: */
-					float lastVal=*colPtr;
-					*colPtr=(colPtr[0]*2.0f+colPtr[size[0]])/3.0f;
-					colPtr+=size[0];
-					
-					/* Filter the interior pixels in the column: */
-					for(unsigned int y=1;y<size[1]-1;++y,colPtr+=size[0])
-						{
-						/* Filter the pixel: */
-						float nextLastVal=*colPtr;
-						*colPtr=(lastVal+colPtr[0]*2.0f+colPtr[size[0]])*0.25f;
-						lastVal=nextLastVal;
-						}
-					
-					/* Filter the last pixel in the column: */
-					*colPtr=(lastVal+colPtr[0]*2.0f)/3.0f;
+					float d=sRow[x+k]-center;
+					w*=Math::exp(-d*d*rangeScale);
 					}
-				float* rowPtr=newOutputFrame.getData<float>();
-				for(unsigned int y=0;y<size[1];++y)
+				acc+=sRow[x+k]*w;
+				weightSum+=w;
+				}
+			dRow[x]=acc/weightSum;
+			}
+		}
+	}
+
+void FrameFilter::separableFilterColumns(const float* src,float* dst,unsigned int rowBegin,unsigned int rowEnd) const
+	{
+	int radius=int(spatialFilterRadius);
+	const float* weights=spatialFilterWeights+radius; // Filter weights indexed from -radius to +radius
+	bool bilateral=spatialFilterType==BILATERAL_SPATIAL_FILTER;
+	float rangeScale=0.5f/(spatialFilterRangeSigma*spatialFilterRangeSigma);
+	int height=int(size[1]);
+	
+	/* Process the rows in vertical strips so that all source rows touched by the kernel stay in cache: */
+	const unsigned int stripWidth=256;
+	float weightSums[stripWidth];
+	for(unsigned int x0=0;x0<size[0];x0+=stripWidth)
+		{
+		unsigned int x1=x0+stripWidth<size[0]?x0+stripWidth:size[0];
+		for(unsigned int y=rowBegin;y<rowEnd;++y)
+			{
+			/* Clip the filter kernel against the image's top and bottom: */
+			int yi=int(y);
+			int k0=yi>=radius?-radius:-yi;
+			int k1=yi+radius<height?radius:height-1-yi;
+			
+			/* Accumulate the weighted source rows into the destination row: */
+			const float* cRow=src+y*size[0];
+			float* dRow=dst+y*size[0];
+			for(unsigned int x=x0;x<x1;++x)
+				dRow[x]=0.0f;
+			if(bilateral)
+				{
+				for(unsigned int x=x0;x<x1;++x)
+					weightSums[x-x0]=0.0f;
+				for(int k=k0;k<=k1;++k)
 					{
-					/* Filter the first pixel in the row: */
-					float lastVal=*rowPtr;
-					*rowPtr=(rowPtr[0]*2.0f+rowPtr[1])/3.0f;
-					++rowPtr;
-					
-					/* Filter the interior pixels in the row: */
-					for(unsigned int x=1;x<size[0]-1;++x,++rowPtr)
+					const float* sRow=cRow+k*int(size[0]);
+					for(unsigned int x=x0;x<x1;++x)
 						{
-						/* Filter the pixel: */
-						float nextLastVal=*rowPtr;
-						*rowPtr=(lastVal+rowPtr[0]*2.0f+rowPtr[1])*0.25f;
-						lastVal=nextLastVal;
+						float d=sRow[x]-cRow[x];
+						float w=weights[k]*Math::exp(-d*d*rangeScale);
+						dRow[x]+=sRow[x]*w;
+						weightSums[x-x0]+=w;
 						}
-					
-					/* Filter the last pixel in the row: */
-					*rowPtr=(lastVal+rowPtr[0]*2.0f)/3.0f;
-					++rowPtr;
+					}
+				for(unsigned int x=x0;x<x1;++x)
+					dRow[x]/=weightSums[x-x0];
+				}
+			else
+				{
+				/* Re-normalize the weights of the clipped kernel: */
+				float weightSum=0.0f;
+				for(int k=k0;k<=k1;++k)
+					weightSum+=weights[k];
+				for(int k=k0;k<=k1;++k)
+					{
+					const float* sRow=cRow+k*int(size[0]);
+					float w=weights[k]/weightSum;
+					for(unsigned int x=x0;x<x1;++x)
+						dRow[x]+=sRow[x]*w;
 					}
 				}
 			}
+		}
+	}
+
+void FrameFilter::markChangedTiles(const float* outputFrame,unsigned int rowBegin,unsigned int rowEnd)
+	{
+	for(unsigned int y=rowBegin;y<rowEnd;++y)
+		{
+		const float* ofRow=outputFrame+y*size[0];
+		float* lofRow=lastOutputBuffer+y*size[0];
+		unsigned char* rctPtr=rowChangedTiles+y*numDirtyTiles[0];
+		for(unsigned int x0=0;x0<size[0];x0+=dirtyTileSize,++rctPtr)
+			{
+			/* Compare the tile's span of the row bit-wise against the previous output frame: */
+			unsigned int spanSize=(x0+dirtyTileSize<size[0]?dirtyTileSize:size[0]-x0)*sizeof(float);
+			*rctPtr=memcmp(ofRow+x0,lofRow+x0,spanSize)!=0?1U:0U;
+			if(*rctPtr)
+				memcpy(lofRow+x0,ofRow+x0,spanSize);
+			}
+		}
+	}
+
+unsigned int FrameFilter::getNumPasses(void) const
+	{
+	/* The temporal filter takes one pass; each spatial filter pass reads rows from neighboring bands and therefore needs its own pass: */
+	if(!spatialFilter)
+		return 1;
+	else if(spatialFilterType==LEGACY_SPATIAL_FILTER)
+		return 5;
+	else
+		return 3;
+	}
+
+void FrameFilter::processPass(unsigned int pass,unsigned int rowBegin,unsigned int rowEnd)
+	{
+	if(pass==0)
+		{
+		/* Enter the new frame into the averaging buffer and calculate the band's output pixel values: */
+		filterRows(workerInputFrame,workerOutputFrame,rowBegin,rowEnd);
+		}
+	else if(spatialFilterType==LEGACY_SPATIAL_FILTER)
+		{
+		/* Apply two passes of a [1 2 1] kernel, each first vertically, then horizontally: */
+		if(pass%2==1)
+			legacyFilterColumns(workerOutputFrame,spatialFilterBuffer,rowBegin,rowEnd);
+		else
+			legacyFilterRows(spatialFilterBuffer,workerOutputFrame,rowBegin,rowEnd);
+		}
+	else
+		{
+		/* Apply the separable filter, first horizontally, then vertically: */
+		if(pass==1)
+			separableFilterRows(workerOutputFrame,spatialFilterBuffer,rowBegin,rowEnd);
+		else
+			separableFilterColumns(spatialFilterBuffer,workerOutputFrame,rowBegin,rowEnd);
+		}
+	
+	/* Flag the band's tile rows that changed since the previous output frame after the last pass: */
+	if(pass==getNumPasses()-1)
+		markChangedTiles(workerOutputFrame,rowBegin,rowEnd);
+	}
+
+void FrameFilter::synchronizeBands(void)
+	{
+	if(numWorkerThreads>0)
+		workerBarrier.synchronize();
+	}
+
+void FrameFilter::filterBand(unsigned int bandIndex)
+	{
+	/* Calculate the band's row range: */
+	unsigned int numBands=numWorkerThreads+1;
+	unsigned int rowBegin=(size[1]*bandIndex)/numBands;
+	unsigned int rowEnd=(size[1]*(bandIndex+1))/numBands;
+	
+	/* Run all passes; bands must synchronize between passes: */
+	unsigned int numPasses=getNumPasses();
+	for(unsigned int pass=0;pass<numPasses;++pass)
+		{
+		if(pass>0)
+			synchronizeBands();
+		processPass(pass,rowBegin,rowEnd);
+		}
+	}
+
+void FrameFilter::beginFilterFrame(const Kinect::FrameBuffer& rawFrame,Kinect::FrameBuffer& outputFrame)
+	{
+	workerInputFrame=rawFrame.getData<RawDepth>();
+	workerOutputFrame=outputFrame.getData<float>();
+	}
+
+void FrameFilter::endFilterFrame(const Kinect::FrameBuffer& rawFrame,Kinect::FrameBuffer& outputFrame)
+	{
+	/* Go to the next averaging slot: */
+	if(temporalFilterType==AVERAGING_TEMPORAL_FILTER&&++averagingSlotIndex==numAveragingSlots)
+		averagingSlotIndex=0U;
+	
+	/* Record the new output frame's index in all dirty tiles with at least one changed row: */
+	++frameIndex;
+	const unsigned char* rctPtr=rowChangedTiles;
+	for(unsigned int y=0;y<size[1];++y)
+		{
+		unsigned int* tciRow=tileChangeIndices+(y/dirtyTileSize)*numDirtyTiles[0];
+		for(unsigned int tx=0;tx<numDirtyTiles[0];++tx,++rctPtr)
+			if(*rctPtr)
+				tciRow[tx]=frameIndex;
+		}
+	
+	/* Let the output frame inherit the raw frame's time stamp: */
+	outputFrame.timeStamp=rawFrame.timeStamp;
+	
+	/* Store the frame index and the per-tile change indices following the output frame's depth values: */
+	unsigned int* trailer=reinterpret_cast<unsigned int*>(outputFrame.getData<float>()+size[1]*size[0]);
+	trailer[0]=frameIndex;
+	memcpy(trailer+1,tileChangeIndices,numDirtyTiles[1]*numDirtyTiles[0]*sizeof(unsigned int));
+	}
+
+void* FrameFilter::workerThreadMethod(unsigned int workerIndex)
+	{
+	while(true)
+		{
+		/* Wait for the next frame or for shutdown: */
+		workerBarrier.synchronize();
+		if(!runWorkerThreads)
+			break;
+		
+		/* Process this worker's band of rows; band 0 is processed by the calling thread: */
+		filterBand(workerIndex+1);
+		
+		/* Signal completion: */
+		workerBarrier.synchronize();
+		}
+	
+	return 0;
+	}
+
+void FrameFilter::stopWorkerThreads(void)
+	{
+	if(numWorkerThreads>0)
+		{
+		/* Wake up the worker threads and tell them to shut down: */
+		runWorkerThreads=false;
+		workerBarrier.synchronize();
+		for(unsigned int i=0;i<numWorkerThreads;++i)
+			workerThreads[i].join();
+		delete[] workerThreads;
+		workerThreads=0;
+		numWorkerThreads=0;
+		workerBarrier.setNumSynchronizingThreads(1);
+		}
+	}
+
+void* FrameFilter::filterThreadMethod(void)
+	{
+	unsigned int lastInputFrameVersion=0;
+	
+	while(true)
+		{
+		Kinect::FrameBuffer frame;
+		{
+		Threads::MutexCond::Lock inputLock(inputCond);
+		
+		/* Wait until a new frame arrives or the program shuts down: */
+		while(runFilterThread&&lastInputFrameVersion==inputFrameVersion)
+			inputCond.wait(inputLock);
+		
+		/* Bail out if the program is shutting down: */
+		if(!runFilterThread)
+			break;
+		
+		/* Work on the new frame: */
+		frame=inputFrame;
+		lastInputFrameVersion=inputFrameVersion;
+		}
+		
+		/* Prepare a new output frame: */
+		Kinect::FrameBuffer& newOutputFrame=outputFrames.startNewValue();
+		
+		/* Filter the new frame: */
+		filterFrame(frame,newOutputFrame);
 		
 		/* Finalize the new output frame in the output buffer: */
 		outputFrames.postNewValue();
@@ -211,46 +969,52 @@ void* FrameFilter::filterThreadMethod(void)
 FrameFilter::FrameFilter(const unsigned int sSize[2],unsigned int sNumAveragingSlots,const FrameFilter::PixelDepthCorrection* sPixelDepthCorrection,const PTransform& depthProjection,const Plane& basePlane)
 	:pixelDepthCorrection(sPixelDepthCorrection),
 	 averagingBuffer(0),
-	 statBuffer(0),
+	 compactStats(false),statBuffer(0),countBuffer(0),sumBuffer(0),sumSqBuffer(0),
+	 temporalFilterType(AVERAGING_TEMPORAL_FILTER),adaptiveBuffer(0),
+	 stageFrameActive(false),
+	 numWorkerThreads(0),workerThreads(0),runWorkerThreads(false),
+	 workerInputFrame(0),workerOutputFrame(0),
+	 numStageBands(1),stageOutputFrame(0),
+	 frameIndex(0),tileChangeIndices(0),rowChangedTiles(0),lastOutputBuffer(0),
 	 outputFrameFunction(0)
 	{
 	/* Remember the frame size: */
 	for(int i=0;i<2;++i)
 		size[i]=sSize[i];
 	
-	/* Initialize the input frame slot: */
+	/* Initialize the input frame slot; the filtering thread is started when the first frame arrives: */
 	inputFrameVersion=0;
+	runFilterThread=false;
 	
 	/* Initialize the valid depth range: */
 	setValidDepthInterval(0U,2046U);
 	
-	/* Initialize the averaging buffer: */
+	/* Initialize the averaging and statistics buffers: */
 	numAveragingSlots=sNumAveragingSlots;
-	averagingBuffer=new RawDepth[numAveragingSlots*size[1]*size[0]];
-	RawDepth* abPtr=averagingBuffer;
-	for(unsigned int i=0;i<numAveragingSlots;++i)
-		for(unsigned int y=0;y<size[1];++y)
-			for(unsigned int x=0;x<size[0];++x,++abPtr)
-				*abPtr=2048U; // Mark sample as invalid
-	averagingSlotIndex=0U;
-	
-	/* Initialize the statistics buffer: */
-	statBuffer=new unsigned int[size[1]*size[0]*3];
-	unsigned int* sbPtr=statBuffer;
-	for(unsigned int y=0;y<size[1];++y)
-		for(unsigned int x=0;x<size[0];++x)
-			for(int i=0;i<3;++i,++sbPtr)
-				*sbPtr=0;
+	createAveragingBuffers();
 	
 	/* Initialize the stability criterion: */
 	minNumSamples=(numAveragingSlots+1)/2;
 	maxVariance=4;
+	adaptiveMeasurementVariance=2.0f;
+	adaptiveProcessVariance=0.01f;
+	adaptiveChangeThreshold=4.0f;
 	hysteresis=0.1f;
 	retainValids=true;
 	instableValue=0.0;
 	
 	/* Enable spatial filtering: */
 	spatialFilter=true;
+	spatialFilterType=LEGACY_SPATIAL_FILTER;
+	spatialFilterRadius=1;
+	spatialFilterRangeSigma=2.0f;
+	spatialFilterWeights=new float[3];
+	for(int i=0;i<3;++i)
+		spatialFilterWeights[i]=1.0f/3.0f;
+	spatialFilterBuffer=new float[size[1]*size[0]];
+	
+	/* Select the fastest temporal filter kernel: */
+	filterKernel=getBestKernel();
 	
 	/* Convert the base plane equation from camera space to depth-image space: */
 	PTransform::HVector basePlaneCc(basePlane.getNormal());
@@ -265,32 +1029,192 @@ FrameFilter::FrameFilter(const unsigned int sSize[2],unsigned int sNumAveragingS
 		for(unsigned int x=0;x<size[0];++x,++vbPtr)
 			*vbPtr=float(-((double(x)+0.5)*basePlaneDic[0]+(double(y)+0.5)*basePlaneDic[1]+basePlaneDic[3])/basePlaneDic[2]);
 	
+	/* Initialize the dirty tile state such that the first output frame changes all tiles: */
+	for(int i=0;i<2;++i)
+		numDirtyTiles[i]=(size[i]+dirtyTileSize-1)/dirtyTileSize;
+	tileChangeIndices=new unsigned int[numDirtyTiles[1]*numDirtyTiles[0]];
+	for(unsigned int i=0;i<numDirtyTiles[1]*numDirtyTiles[0];++i)
+		tileChangeIndices[i]=1U;
+	rowChangedTiles=new unsigned char[size[1]*numDirtyTiles[0]];
+	lastOutputBuffer=new float[size[1]*size[0]];
+	memcpy(lastOutputBuffer,validBuffer,size[1]*size[0]*sizeof(float));
+	
 	/* Initialize the output frame buffer: */
 	for(int i=0;i<3;++i)
-		outputFrames.getBuffer(i)=Kinect::FrameBuffer(size[0],size[1],size[1]*size[0]*sizeof(float));
-	
-	/* Start the filtering thread: */
-	runFilterThread=true;
-	filterThread.start(this,&FrameFilter::filterThreadMethod);
+		outputFrames.getBuffer(i)=createOutputFrame();
 	}
 
 FrameFilter::~FrameFilter(void)
 	{
-	/* Shut down the filtering thread: */
+	/* Shut down the filtering thread if it was started: */
 	{
 	Threads::MutexCond::Lock inputLock(inputCond);
 	runFilterThread=false;
 	inputCond.signal();
 	}
-	filterThread.join();
+	if(!filterThread.isJoined())
+		filterThread.join();
+	
+	/* Shut down the worker threads: */
+	{
+	FrameLock frameLock(*this);
+	stopWorkerThreads();
+	}
 	
 	/* Release all allocated buffers: */
-	delete[] averagingBuffer;
-	delete[] statBuffer;
+	deleteAveragingBuffers();
+	delete[] adaptiveBuffer;
+	delete[] spatialFilterWeights;
+	delete[] spatialFilterBuffer;
 	delete[] validBuffer;
+	delete[] tileChangeIndices;
+	delete[] rowChangedTiles;
+	delete[] lastOutputBuffer;
 	delete outputFrameFunction;
 	}
 
+unsigned int FrameFilter::startFrame(const Kinect::FrameBuffer& frame,unsigned int numThreads)
+	{
+	/* Lock out parameter changes until the frame is finished: */
+	{
+	FrameLock frameLock(*this);
+	stageFrameActive=true;
+	}
+	
+	/* Split each pass into one band of rows per pipeline thread: */
+	numStageBands=numThreads<size[1]?numThreads:size[1];
+	
+	/* Prepare a new output frame: */
+	stageInputFrame=frame;
+	stageOutputFrame=&outputFrames.startNewValue();
+	beginFilterFrame(stageInputFrame,*stageOutputFrame);
+	
+	return getNumPasses();
+	}
+
+unsigned int FrameFilter::getNumBands(unsigned int pass) const
+	{
+	return numStageBands;
+	}
+
+void FrameFilter::processBand(unsigned int pass,unsigned int bandIndex,unsigned int numBands)
+	{
+	/* Calculate the band's row range and process it: */
+	unsigned int rowBegin=(size[1]*bandIndex)/numBands;
+	unsigned int rowEnd=(size[1]*(bandIndex+1))/numBands;
+	processPass(pass,rowBegin,rowEnd);
+	}
+
+Kinect::FrameBuffer FrameFilter::finishFrame(void)
+	{
+	/* Finalize the new output frame in the output buffer: */
+	endFilterFrame(stageInputFrame,*stageOutputFrame);
+	Kinect::FrameBuffer result=*stageOutputFrame;
+	outputFrames.postNewValue();
+	stageInputFrame=Kinect::FrameBuffer();
+	stageOutputFrame=0;
+	
+	/* Allow parameter changes again: */
+	{
+	Threads::MutexCond::Lock workerLock(workerCond);
+	stageFrameActive=false;
+	workerCond.broadcast();
+	}
+	
+	/* Pass the new output frame to the registered receiver: */
+	if(outputFrameFunction!=0)
+		(*outputFrameFunction)(result);
+	
+	return result;
+	}
+
+bool FrameFilter::isKernelSupported(FrameFilter::FilterKernel kernel)
+	{
+	switch(kernel)
+		{
+		case SCALAR_KERNEL:
+			return true;
+		
+		#ifdef __SSE2__
+		case SSE2_KERNEL:
+			return true;
+		#endif
+		
+		#ifdef __AVX2__
+		case AVX2_KERNEL:
+			return true;
+		#endif
+		
+		default:
+			return false;
+		}
+	}
+
+FrameFilter::FilterKernel FrameFilter::getBestKernel(void)
+	{
+	#if defined(__AVX2__)
+	return AVX2_KERNEL;
+	#elif defined(__SSE2__)
+	return SSE2_KERNEL;
+	#else
+	return SCALAR_KERNEL;
+	#endif
+	}
+
+const char* FrameFilter::getKernelName(FrameFilter::FilterKernel kernel)
+	{
+	switch(kernel)
+		{
+		case SCALAR_KERNEL:
+			return "Scalar";
+		
+		case SSE2_KERNEL:
+			return "SSE2";
+		
+		case AVX2_KERNEL:
+			return "AVX2";
+		
+		default:
+			return "Unknown";
+		}
+	}
+
+const char* FrameFilter::getTemporalFilterTypeName(FrameFilter::TemporalFilterType type)
+	{
+	switch(type)
+		{
+		case AVERAGING_TEMPORAL_FILTER:
+			return "Averaging";
+		
+		case ADAPTIVE_TEMPORAL_FILTER:
+			return "Adaptive";
+		
+		default:
+			return "Unknown";
+		}
+	}
+
+const char* FrameFilter::getSpatialFilterTypeName(FrameFilter::SpatialFilterType type)
+	{
+	switch(type)
+		{
+		case LEGACY_SPATIAL_FILTER:
+			return "Legacy";
+		
+		case BOX_SPATIAL_FILTER:
+			return "Box";
+		
+		case GAUSSIAN_SPATIAL_FILTER:
+			return "Gaussian";
+		
+		case BILATERAL_SPATIAL_FILTER:
+			return "Bilateral";
+		
+		default:
+			return "Unknown";
+		}
+	}
+
 void FrameFilter::setValidDepthInterval(unsigned int newMinDepth,unsigned int newMaxDepth)
 	{
 	/* Set the equations for the minimum and maximum plane in depth image space: */
@@ -329,6 +1253,51 @@ void FrameFilter::setStableParameters(unsigned int newMinNumSamples,unsigned int
 	maxVariance=newMaxVariance;
 	}
 
+void FrameFilter::setTemporalFilterType(FrameFilter::TemporalFilterType newTemporalFilterType)
+	{
+	FrameLock frameLock(*this);
+	
+	if(temporalFilterType==newTemporalFilterType)
+		return;
+	
+	/* Replace the previous filter's per-pixel state with the new filter's: */
+	if(newTemporalFilterType==ADAPTIVE_TEMPORAL_FILTER)
+		{
+		deleteAveragingBuffers();
+		unsigned int numPixels=size[1]*size[0];
+		adaptiveBuffer=new AdaptivePixel[numPixels];
+		for(unsigned int i=0;i<numPixels;++i)
+			{
+			adaptiveBuffer[i].estimate=0.0f;
+			adaptiveBuffer[i].variance=-1.0f;
+			adaptiveBuffer[i].candidate=-1.0f;
+			}
+		}
+	else
+		{
+		delete[] adaptiveBuffer;
+		adaptiveBuffer=0;
+		createAveragingBuffers();
+		}
+	temporalFilterType=newTemporalFilterType;
+	}
+
+size_t FrameFilter::getTemporalFilterStateSize(void) const
+	{
+	size_t numPixels=size_t(size[1])*size_t(size[0]);
+	if(temporalFilterType==ADAPTIVE_TEMPORAL_FILTER)
+		return numPixels*sizeof(AdaptivePixel);
+	size_t statSize=compactStats?sizeof(unsigned char)+2*sizeof(unsigned int):3*sizeof(unsigned int);
+	return numPixels*(numAveragingSlots*sizeof(RawDepth)+statSize);
+	}
+
+void FrameFilter::setAdaptiveParameters(float newMeasurementVariance,float newProcessVariance,float newChangeThreshold)
+	{
+	adaptiveMeasurementVariance=newMeasurementVariance;
+	adaptiveProcessVariance=newProcessVariance;
+	adaptiveChangeThreshold=newChangeThreshold;
+	}
+
 void FrameFilter::setHysteresis(float newHysteresis)
 	{
 	hysteresis=newHysteresis;
@@ -346,9 +1315,129 @@ void FrameFilter::setInstableValue(float newInstableValue)
 
 void FrameFilter::setSpatialFilter(bool newSpatialFilter)
 	{
+	FrameLock frameLock(*this);
 	spatialFilter=newSpatialFilter;
 	}
 
+void FrameFilter::setSpatialFilterType(FrameFilter::SpatialFilterType newSpatialFilterType,unsigned int newSpatialFilterRadius)
+	{
+	if(newSpatialFilterRadius<1U)
+		newSpatialFilterRadius=1U;
+	
+	/* Calculate the new kernel weights: */
+	int radius=int(newSpatialFilterRadius);
+	float* newWeights=new float[2*radius+1];
+	float sigma=float(radius)*0.5f;
+	float weightSum=0.0f;
+	for(int i=-radius;i<=radius;++i)
+		{
+		float w=1.0f;
+		if(newSpatialFilterType==GAUSSIAN_SPATIAL_FILTER||newSpatialFilterType==BILATERAL_SPATIAL_FILTER)
+			w=Math::exp(-float(i*i)/(2.0f*sigma*sigma));
+		newWeights[i+radius]=w;
+		weightSum+=w;
+		}
+	for(int i=0;i<2*radius+1;++i)
+		newWeights[i]/=weightSum;
+	
+	/* Install the new filter: */
+	FrameLock frameLock(*this);
+	spatialFilterType=newSpatialFilterType;
+	spatialFilterRadius=newSpatialFilterRadius;
+	delete[] spatialFilterWeights;
+	spatialFilterWeights=newWeights;
+	}
+
+void FrameFilter::setSpatialFilterRangeSigma(float newSpatialFilterRangeSigma)
+	{
+	FrameLock frameLock(*this);
+	spatialFilterRangeSigma=newSpatialFilterRangeSigma;
+	}
+
+void FrameFilter::setCompactStatistics(bool newCompactStatistics)
+	{
+	if(newCompactStatistics&&numAveragingSlots>255U)
+		Misc::throwStdErr("FrameFilter::setCompactStatistics: Compact statistics not supported for more than 255 averaging slots");
+	
+	FrameLock frameLock(*this);
+	
+	if(compactStats==newCompactStatistics)
+		return;
+	
+	/* The averaging filter's statistics buffers are created in the selected layout once it is selected again: */
+	if(temporalFilterType!=AVERAGING_TEMPORAL_FILTER)
+		{
+		compactStats=newCompactStatistics;
+		return;
+		}
+	
+	/* Convert the current pixel statistics into the new layout: */
+	unsigned int numPixels=size[1]*size[0];
+	if(newCompactStatistics)
+		{
+		countBuffer=new unsigned char[numPixels];
+		sumBuffer=new unsigned int[numPixels];
+		sumSqBuffer=new unsigned int[numPixels];
+		const unsigned int* sPtr=statBuffer;
+		for(unsigned int i=0;i<numPixels;++i,sPtr+=3)
+			{
+			countBuffer[i]=(unsigned char)(sPtr[0]);
+			sumBuffer[i]=sPtr[1];
+			sumSqBuffer[i]=sPtr[2];
+			}
+		delete[] statBuffer;
+		statBuffer=0;
+		}
+	else
+		{
+		statBuffer=new unsigned int[numPixels*3];
+		unsigned int* sPtr=statBuffer;
+		for(unsigned int i=0;i<numPixels;++i,sPtr+=3)
+			{
+			sPtr[0]=countBuffer[i];
+			sPtr[1]=sumBuffer[i];
+			sPtr[2]=sumSqBuffer[i];
+			}
+		delete[] countBuffer;
+		countBuffer=0;
+		delete[] sumBuffer;
+		sumBuffer=0;
+		delete[] sumSqBuffer;
+		sumSqBuffer=0;
+		}
+	compactStats=newCompactStatistics;
+	}
+
+void FrameFilter::setFilterKernel(FrameFilter::FilterKernel newFilterKernel)
+	{
+	if(!isKernelSupported(newFilterKernel))
+		Misc::throwStdErr("FrameFilter::setFilterKernel: %s filter kernel not supported",getKernelName(newFilterKernel));
+	
+	FrameLock frameLock(*this);
+	filterKernel=newFilterKernel;
+	}
+
+void FrameFilter::setNumFilterThreads(unsigned int newNumFilterThreads)
+	{
+	FrameLock frameLock(*this);
+	
+	/* Shut down the current worker threads: */
+	stopWorkerThreads();
+	
+	/* Start the new worker threads; the thread processing a frame handles the first band of rows itself: */
+	if(newNumFilterThreads>size[1])
+		newNumFilterThreads=size[1];
+	if(newNumFilterThreads>1)
+		{
+		numWorkerThreads=newNumFilterThreads-1;
+		workerBarrier.setNumSynchronizingThreads(newNumFilterThreads);
+		runWorkerThreads=true;
+		workerThreads=new Threads::Thread[numWorkerThreads];
+		for(unsigned int i=0;i<numWorkerThreads;++i)
+			workerThreads[i].start(this,&FrameFilter::workerThreadMethod,i);
+		}
+	}
+
 void FrameFilter::setOutputFrameFunction(FrameFilter::OutputFrameFunction* newOutputFrameFunction)
 	{
 	delete outputFrameFunction;
@@ -363,6 +1452,38 @@ void FrameFilter::receiveRawFrame(const Kinect::FrameBuffer& newFrame)
 	inputFrame=newFrame;
 	++inputFrameVersion;
 	
+	/* Start the filtering thread on the first frame: */
+	if(!runFilterThread)
+		{
+		runFilterThread=true;
+		filterThread.start(this,&FrameFilter::filterThreadMethod);
+		}
+	
 	/* Signal the background thread: */
 	inputCond.signal();
 	}
+
+Kinect::FrameBuffer FrameFilter::createOutputFrame(void) const
+	{
+	/* Append the frame index and the per-tile change indices to the depth values: */
+	size_t numTiles=size_t(numDirtyTiles[1])*size_t(numDirtyTiles[0]);
+	return Kinect::FrameBuffer(size[0],size[1],size[1]*size[0]*sizeof(float)+(1+numTiles)*sizeof(unsigned int));
+	}
+
+void FrameFilter::filterFrame(const Kinect::FrameBuffer& rawFrame,Kinect::FrameBuffer& outputFrame)
+	{
+	FrameLock frameLock(*this);
+	
+	/* Hand the frame to the worker threads: */
+	beginFilterFrame(rawFrame,outputFrame);
+	synchronizeBands();
+	
+	/* Process the first band of rows: */
+	filterBand(0);
+	
+	/* Wait for all worker threads to finish their bands: */
+	synchronizeBands();
+	
+	/* Update the filter state and finalize the output frame: */
+	endFilterFrame(rawFrame,outputFrame);
+	}
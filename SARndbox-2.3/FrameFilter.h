@@ -25,12 +25,15 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #define FRAMEFILTER_INCLUDED
 
 #include <Threads/Thread.h>
+#include <Threads/Mutex.h>
 #include <Threads/MutexCond.h>
+#include <Threads/Barrier.h>
 #include <Threads/TripleBuffer.h>
 #include <Kinect/FrameBuffer.h>
 #include <Kinect/FrameSource.h>
 
 #include "Types.h"
+#include "DepthFramePipeline.h"
 
 /* Forward declarations: */
 namespace Misc {
@@ -38,7 +41,7 @@ template <class ParameterParam>
 class FunctionCall;
 }
 
-class FrameFilter
+class FrameFilter:public DepthFramePipeline::Stage
 	{
 	/* Embedded classes: */
 	public:
@@ -47,49 +50,189 @@ class FrameFilter
 	typedef Misc::FunctionCall<const Kinect::FrameBuffer&> OutputFrameFunction; // Type for functions called when a new output frame is ready
 	typedef Kinect::FrameSource::DepthCorrection::PixelCorrection PixelDepthCorrection; // Type for per-pixel depth correction factors
 	
-	/* Elements: */
+	enum FilterKernel // Enumerated type for implementations of the per-pixel temporal filter; all implementations produce bit-identical results
+		{
+		SCALAR_KERNEL, // Portable reference implementation processing one pixel at a time
+		SSE2_KERNEL, // SSE2 implementation processing four pixels at a time
+		AVX2_KERNEL // AVX2 implementation processing eight pixels at a time
+		};
+	
+	enum TemporalFilterType // Enumerated type for per-pixel temporal filters
+		{
+		AVERAGING_TEMPORAL_FILTER, // Running average over a fixed number of frames, considered stable based on sample count and variance
+		ADAPTIVE_TEMPORAL_FILTER // Recursive per-pixel estimator that suppresses noise on static surfaces and re-converges within two frames after a surface change
+		};
+	
+	enum SpatialFilterType // Enumerated type for spatial filters applied to time-averaged depth values
+		{
+		LEGACY_SPATIAL_FILTER, // Two passes of a separable [1 2 1] kernel
+		BOX_SPATIAL_FILTER, // Separable box filter of configurable radius
+		GAUSSIAN_SPATIAL_FILTER, // Separable Gaussian filter of configurable radius, with standard deviation of half the radius
+		BILATERAL_SPATIAL_FILTER // Separable approximation of an edge-preserving bilateral filter with Gaussian spatial and range kernels
+		};
+	
+	static const unsigned int dirtyTileSize=16; // Width and height of the tiles in which output frames track changed pixels
+	
 	private:
+	struct AdaptivePixel // Structure holding the state of a pixel's adaptive temporal filter
+		{
+		/* Elements: */
+		public:
+		float estimate; // Current estimate of the pixel's raw depth value
+		float variance; // Variance of the current estimate, or negative if the pixel has no estimate
+		float candidate; // Raw depth value of a preceding outlier that might have been the start of a surface change, or negative if there was none
+		};
+	
+	class FrameLock // Helper class to lock out frame processing while changing filter parameters or worker threads
+		{
+		/* Elements: */
+		private:
+		Threads::MutexCond::Lock lock; // Lock on the frame filter's worker condition variable
+		
+		/* Constructors and destructors: */
+		public:
+		FrameLock(FrameFilter& filter) // Waits until the frame filter's current pipeline frame, if any, is finished
+			:lock(filter.workerCond)
+			{
+			while(filter.stageFrameActive)
+				filter.workerCond.wait(lock);
+			}
+		};
+	
+	friend class FrameLock;
+	
+	/* Elements: */
 	unsigned int size[2]; // Width and height of processed frames
 	const PixelDepthCorrection* pixelDepthCorrection; // Buffer of per-pixel depth correction coefficients
 	Threads::MutexCond inputCond; // Condition variable to signal arrival of a new input frame
 	Kinect::FrameBuffer inputFrame; // The most recent input frame
 	unsigned int inputFrameVersion; // Version number of input frame
 	volatile bool runFilterThread; // Flag to keep the background filtering thread running
-	Threads::Thread filterThread; // The background filtering thread
+	Threads::Thread filterThread; // The background filtering thread, started when the first raw frame is received
 	float minPlane[4]; // Plane equation of the lower bound of valid depth values in depth image space
 	float maxPlane[4]; // Plane equation of the upper bound of valid depth values in depth image space
 	unsigned int numAveragingSlots; // Number of slots in each pixel's averaging buffer
 	RawDepth* averagingBuffer; // Buffer to calculate running averages of each pixel's depth value
 	unsigned int averagingSlotIndex; // Index of averaging slot in which to store the next frame's depth values
+	bool compactStats; // Flag whether pixel statistics are stored in compact planar buffers instead of the interleaved statistics buffer
 	unsigned int* statBuffer; // Buffer retaining the running means and variances of each pixel's depth value
+	unsigned char* countBuffer; // Compact planar buffer of each pixel's number of valid samples
+	unsigned int* sumBuffer; // Compact planar buffer of each pixel's sum of valid samples
+	unsigned int* sumSqBuffer; // Compact planar buffer of each pixel's sum of squares of valid samples
+	TemporalFilterType temporalFilterType; // Type of per-pixel temporal filter
+	AdaptivePixel* adaptiveBuffer; // Buffer holding each pixel's adaptive filter state; only allocated while the adaptive filter is selected
+	float adaptiveMeasurementVariance; // Variance of raw depth measurements on a static surface assumed by the adaptive filter
+	float adaptiveProcessVariance; // Variance by which a pixel's estimate is assumed to drift between frames by the adaptive filter
+	float adaptiveChangeThreshold; // Distance from the current estimate, in standard deviations, at which the adaptive filter considers a sample an outlier
 	unsigned int minNumSamples; // Minimum number of valid samples needed to consider a pixel stable
 	unsigned int maxVariance; // Maximum variance to consider a pixel stable
 	float hysteresis; // Amount by which a new filtered value has to differ from the current value to update
 	bool retainValids; // Flag whether to retain previous stable values if a new pixel in instable, or reset to a default value
 	float instableValue; // Value to assign to instable pixels if retainValids is false
 	bool spatialFilter; // Flag whether to apply a spatial filter to time-averaged depth values
+	SpatialFilterType spatialFilterType; // Type of spatial filter
+	unsigned int spatialFilterRadius; // Radius of the separable spatial filter kernel in pixels
+	float spatialFilterRangeSigma; // Standard deviation of the bilateral filter's range kernel in depth units
+	float* spatialFilterWeights; // Array of 2*spatialFilterRadius+1 spatial filter kernel weights
+	float* spatialFilterBuffer; // Intermediate buffer holding the result of the first spatial filter pass
+	FilterKernel filterKernel; // Implementation of the per-pixel temporal filter
+	Threads::MutexCond workerCond; // Condition variable serializing frame processing against changes to filter parameters and the set of worker threads
+	bool stageFrameActive; // Flag whether a frame is currently being processed as a pipeline stage
+	unsigned int numWorkerThreads; // Number of worker threads processing row bands of each frame in addition to the filtering thread
+	Threads::Thread* workerThreads; // Array of worker threads
+	Threads::Barrier workerBarrier; // Barrier to synchronize the worker threads with the thread processing a frame
+	volatile bool runWorkerThreads; // Flag to keep the worker threads running
+	const RawDepth* workerInputFrame; // Raw input frame currently processed by the worker threads
+	float* workerOutputFrame; // Output frame currently written by the worker threads
+	unsigned int numStageBands; // Number of row bands into which each pass of the current pipeline frame is split
+	Kinect::FrameBuffer stageInputFrame; // Raw input frame currently processed as a pipeline stage
+	Kinect::FrameBuffer* stageOutputFrame; // Output frame currently written as a pipeline stage
 	float* validBuffer; // Buffer holding the most recent stable depth value for each pixel
+	unsigned int numDirtyTiles[2]; // Width and height of the grid of dirty tiles
+	unsigned int frameIndex; // Index of the most recently produced output frame
+	unsigned int* tileChangeIndices; // Index of the most recent output frame that changed any pixel in each dirty tile
+	unsigned char* rowChangedTiles; // Flags whether the current output frame changed any pixel of each row of each dirty tile
+	float* lastOutputBuffer; // Copy of the most recent output frame to detect changed pixels
 	Threads::TripleBuffer<Kinect::FrameBuffer> outputFrames; // Triple buffer of output frames
 	OutputFrameFunction* outputFrameFunction; // Function called when a new output frame is ready
 	
 	/* Private methods: */
+	void createAveragingBuffers(void); // Allocates and initializes the averaging filter's averaging and statistics buffers
+	void deleteAveragingBuffers(void); // Releases the averaging filter's averaging and statistics buffers
+	template <class CountParam>
+	void filterSpanScalar(const RawDepth* inputFrame,float* outputFrame,unsigned int y,unsigned int xBegin,unsigned int xEnd,CountParam* cPtr,unsigned int* sumPtr,unsigned int* sumSqPtr,unsigned int statStride); // Filters the given pixel span using the given statistics layout
+	void filterRowScalar(const RawDepth* inputFrame,float* outputFrame,unsigned int y,unsigned int xBegin,unsigned int xEnd); // Filters the given pixel span of the given row using the reference implementation
+	#ifdef __SSE2__
+	unsigned int filterRowSSE2(const RawDepth* inputFrame,float* outputFrame,unsigned int y); // Filters the given row four pixels at a time; returns the index of the first unprocessed pixel
+	#endif
+	#ifdef __AVX2__
+	unsigned int filterRowAVX2(const RawDepth* inputFrame,float* outputFrame,unsigned int y); // Filters the given row eight pixels at a time; returns the index of the first unprocessed pixel
+	#endif
+	void filterRowAdaptive(const RawDepth* inputFrame,float* outputFrame,unsigned int y); // Filters the given row using the adaptive temporal filter
+	void filterRows(const RawDepth* inputFrame,float* outputFrame,unsigned int rowBegin,unsigned int rowEnd); // Filters the given band of rows using the current filter kernel
+	void legacyFilterColumns(const float* src,float* dst,unsigned int rowBegin,unsigned int rowEnd) const; // Applies a vertical [1 2 1] kernel to the given band of rows
+	void legacyFilterRows(const float* src,float* dst,unsigned int rowBegin,unsigned int rowEnd) const; // Applies a horizontal [1 2 1] kernel to the given band of rows
+	void separableFilterRows(const float* src,float* dst,unsigned int rowBegin,unsigned int rowEnd) const; // Applies the horizontal pass of the separable spatial filter to the given band of rows
+	void separableFilterColumns(const float* src,float* dst,unsigned int rowBegin,unsigned int rowEnd) const; // Applies the vertical pass of the separable spatial filter to the given band of rows in cache-sized vertical strips
+	void markChangedTiles(const float* outputFrame,unsigned int rowBegin,unsigned int rowEnd); // Compares the given band of rows of the output frame against the previous output frame and flags changed tile rows
+	unsigned int getNumPasses(void) const; // Returns the number of passes over the rows of each frame required by the current filter settings
+	void processPass(unsigned int pass,unsigned int rowBegin,unsigned int rowEnd); // Runs the given pass of the temporal and spatial filters on the given band of rows of the current frame
+	void synchronizeBands(void); // Synchronizes all threads processing row bands of the current frame
+	void filterBand(unsigned int bandIndex); // Runs all passes on the given band of rows of the current frame, synchronizing with the worker threads between passes
+	void beginFilterFrame(const Kinect::FrameBuffer& rawFrame,Kinect::FrameBuffer& outputFrame); // Prepares to filter the given raw frame into the given output frame
+	void endFilterFrame(const Kinect::FrameBuffer& rawFrame,Kinect::FrameBuffer& outputFrame); // Updates the filter state after all bands of the given raw frame have been filtered and finalizes the given output frame
+	void* workerThreadMethod(unsigned int workerIndex); // Method for the worker threads
+	void stopWorkerThreads(void); // Shuts down all worker threads; assumes a frame lock is held
 	void* filterThreadMethod(void); // Method for the background filtering thread
 	
 	/* Constructors and destructors: */
 	public:
 	FrameFilter(const unsigned int sSize[2],unsigned int sNumAveragingSlots,const PixelDepthCorrection* sPixelDepthCorrection,const PTransform& depthProjection,const Plane& basePlane); // Creates a filter for frames of the given size and the given running average length
-	~FrameFilter(void); // Destroys the frame filter
+	virtual ~FrameFilter(void); // Destroys the frame filter
 	
-	/* Methods: */
+	/* Methods from DepthFramePipeline::Stage: */
+	virtual unsigned int startFrame(const Kinect::FrameBuffer& frame,unsigned int numThreads);
+	virtual unsigned int getNumBands(unsigned int pass) const;
+	virtual void processBand(unsigned int pass,unsigned int bandIndex,unsigned int numBands);
+	virtual Kinect::FrameBuffer finishFrame(void);
+	
+	/* New methods: */
+	static bool isKernelSupported(FilterKernel kernel); // Returns true if the given filter kernel was compiled into the executable
+	static FilterKernel getBestKernel(void); // Returns the fastest supported filter kernel
+	static const char* getKernelName(FilterKernel kernel); // Returns a human-readable name for the given filter kernel
+	static const char* getTemporalFilterTypeName(TemporalFilterType type); // Returns a human-readable name for the given temporal filter type
+	static const char* getSpatialFilterTypeName(SpatialFilterType type); // Returns a human-readable name for the given spatial filter type
+	static unsigned int getFrameIndex(const Kinect::FrameBuffer& outputFrame) // Returns the index of the given output frame
+		{
+		return reinterpret_cast<const unsigned int*>(outputFrame.getData<float>()+outputFrame.getSize(1)*outputFrame.getSize(0))[0];
+		}
+	static const unsigned int* getTileChangeIndices(const Kinect::FrameBuffer& outputFrame) // Returns the index of the most recent output frame that changed any pixel in each dirty tile of the given output frame, in row-major order
+		{
+		return reinterpret_cast<const unsigned int*>(outputFrame.getData<float>()+outputFrame.getSize(1)*outputFrame.getSize(0))+1;
+		}
 	void setValidDepthInterval(unsigned int newMinDepth,unsigned int newMaxDepth); // Sets the interval of depth values considered by the depth image filter
 	void setValidElevationInterval(const PTransform& depthProjection,const Plane& basePlane,double newMinElevation,double newMaxElevation); // Sets the interval of elevations relative to the given base plane considered by the depth image filter
 	void setStableParameters(unsigned int newMinNumSamples,unsigned int newMaxVariance); // Sets the statistical properties to consider a pixel stable
+	TemporalFilterType getTemporalFilterType(void) const // Returns the type of per-pixel temporal filter
+		{
+		return temporalFilterType;
+		}
+	void setTemporalFilterType(TemporalFilterType newTemporalFilterType); // Selects the per-pixel temporal filter; releases the previous filter's state and restarts filtering from scratch
+	size_t getTemporalFilterStateSize(void) const; // Returns the size of the current temporal filter's per-pixel state in bytes
+	void setAdaptiveParameters(float newMeasurementVariance,float newProcessVariance,float newChangeThreshold); // Sets the adaptive filter's measurement and process variances in squared raw depth units, and its outlier threshold in standard deviations
 	void setHysteresis(float newHysteresis); // Sets the stable value hysteresis envelope
 	void setRetainValids(bool newRetainValids); // Sets whether the filter retains previous stable values for instable pixels
 	void setInstableValue(float newInstableValue); // Sets the depth value to assign to instable pixels
 	void setSpatialFilter(bool newSpatialFilter); // Sets the spatial filtering flag
+	void setSpatialFilterType(SpatialFilterType newSpatialFilterType,unsigned int newSpatialFilterRadius); // Sets the type and kernel radius of the spatial filter; radius is ignored for the legacy filter
+	void setSpatialFilterRangeSigma(float newSpatialFilterRangeSigma); // Sets the standard deviation of the bilateral filter's range kernel in depth units
+	void setCompactStatistics(bool newCompactStatistics); // Selects the compact planar statistics layout of the averaging filter, with 8-bit sample counts, for filters with at most 255 averaging slots; throws exception if there are more slots
+	void setFilterKernel(FilterKernel newFilterKernel); // Selects the implementation of the per-pixel temporal filter; throws exception if the kernel is not supported
+	void setNumFilterThreads(unsigned int newNumFilterThreads); // Sets the total number of threads processing row bands of each frame received via receiveRawFrame; pipeline stage frames are processed by the pipeline's threads
 	void setOutputFrameFunction(OutputFrameFunction* newOutputFrameFunction); // Sets the output function; adopts given functor object
-	void receiveRawFrame(const Kinect::FrameBuffer& newFrame); // Called to receive a new raw depth frame
+	void receiveRawFrame(const Kinect::FrameBuffer& newFrame); // Called to receive a new raw depth frame; must not be mixed with use as a pipeline stage
+	Kinect::FrameBuffer createOutputFrame(void) const; // Allocates an output frame with room for the frame index and per-tile change indices following the depth values
+	void filterFrame(const Kinect::FrameBuffer& rawFrame,Kinect::FrameBuffer& outputFrame); // Runs the given raw depth frame through the filter in the calling thread and writes the result into the given output frame created by createOutputFrame(); must not be mixed with receiveRawFrame or use as a pipeline stage
 	bool lockNewFrame(void) // Locks the most recently produced output frame for reading; returns true if the locked frame is new
 		{
 		return outputFrames.lockNewValue();
@@ -0,0 +1,322 @@
+/***********************************************************************
+FrameFilterBench - Utility to replay a pre-recorded depth stream through
+the reference and an optimized frame filter kernel, to measure their
+performance and verify that they produce identical results.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+#include <Misc/Timer.h>
+#include <Misc/ValueCoder.h>
+#include <IO/File.h>
+#include <IO/OpenFile.h>
+#include <IO/ValueSource.h>
+#include <Math/Math.h>
+#include <Math/Constants.h>
+#include <Geometry/GeometryValueCoders.h>
+#include <Kinect/FrameBuffer.h>
+#include <Kinect/FrameSource.h>
+#include <Kinect/FileFrameSource.h>
+
+#include "Types.h"
+#include "FrameFilter.h"
+
+#include "Config.h"
+
+struct KernelStats // Structure to accumulate timing statistics for a filter kernel
+	{
+	/* Elements: */
+	public:
+	double totalTime; // Total processing time in seconds
+	double minTime,maxTime; // Minimum and maximum per-frame processing time in seconds
+	
+	/* Constructors and destructors: */
+	KernelStats(void)
+		:totalTime(0.0),minTime(Math::Constants<double>::max),maxTime(0.0)
+		{
+		}
+	
+	/* Methods: */
+	void addFrame(double time) // Adds a frame's processing time
+		{
+		totalTime+=time;
+		if(minTime>time)
+			minTime=time;
+		if(maxTime<time)
+			maxTime=time;
+		}
+	void print(size_t numFrames) const // Prints the accumulated statistics
+		{
+		std::cout<<"total "<<totalTime*1000.0<<" ms, min "<<minTime*1000.0<<" ms, mean "<<totalTime*1000.0/double(numFrames)<<" ms, max "<<maxTime*1000.0<<" ms per frame"<<std::endl;
+		}
+	};
+
+int main(int argc,char* argv[])
+	{
+	/* Parse the command line: */
+	const char* frameFilePrefix=0;
+	std::string sandboxLayoutFileName=CONFIG_CONFIGDIR;
+	sandboxLayoutFileName.push_back('/');
+	sandboxLayoutFileName.append(CONFIG_DEFAULTBOXLAYOUTFILENAME);
+	bool haveElevationRange=false;
+	double elevationMin=0.0,elevationMax=0.0;
+	unsigned int numAveragingSlots=30;
+	unsigned int minNumSamples=10;
+	unsigned int maxVariance=2;
+	float hysteresis=0.1f;
+	bool spatialFilter=true;
+	FrameFilter::SpatialFilterType spatialFilterType=FrameFilter::LEGACY_SPATIAL_FILTER;
+	unsigned int spatialFilterRadius=2;
+	float spatialFilterRangeSigma=2.0f;
+	FrameFilter::FilterKernel filterKernel=FrameFilter::getBestKernel();
+	unsigned int numFilterThreads=1;
+	bool compactStatistics=false;
+	size_t maxNumFrames=~size_t(0);
+	for(int i=1;i<argc;++i)
+		{
+		if(argv[i][0]=='-')
+			{
+			if(strcasecmp(argv[i]+1,"slf")==0)
+				{
+				++i;
+				sandboxLayoutFileName=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"er")==0)
+				{
+				haveElevationRange=true;
+				++i;
+				elevationMin=atof(argv[i]);
+				++i;
+				elevationMax=atof(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"nas")==0)
+				{
+				++i;
+				numAveragingSlots=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"sp")==0)
+				{
+				++i;
+				minNumSamples=atoi(argv[i]);
+				++i;
+				maxVariance=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"he")==0)
+				{
+				++i;
+				hysteresis=float(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"nsf")==0)
+				spatialFilter=false;
+			else if(strcasecmp(argv[i]+1,"sf")==0)
+				{
+				++i;
+				int type;
+				for(type=FrameFilter::LEGACY_SPATIAL_FILTER;type<=FrameFilter::BILATERAL_SPATIAL_FILTER;++type)
+					if(strcasecmp(argv[i],FrameFilter::getSpatialFilterTypeName(FrameFilter::SpatialFilterType(type)))==0)
+						break;
+				if(type>FrameFilter::BILATERAL_SPATIAL_FILTER)
+					{
+					std::cerr<<"Unknown spatial filter type "<<argv[i]<<std::endl;
+					return 1;
+					}
+				spatialFilterType=FrameFilter::SpatialFilterType(type);
+				++i;
+				spatialFilterRadius=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"sfrs")==0)
+				{
+				++i;
+				spatialFilterRangeSigma=float(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"ffk")==0)
+				{
+				++i;
+				int kernel;
+				for(kernel=FrameFilter::SCALAR_KERNEL;kernel<=FrameFilter::AVX2_KERNEL;++kernel)
+					if(strcasecmp(argv[i],FrameFilter::getKernelName(FrameFilter::FilterKernel(kernel)))==0)
+						break;
+				if(kernel>FrameFilter::AVX2_KERNEL||!FrameFilter::isKernelSupported(FrameFilter::FilterKernel(kernel)))
+					{
+					std::cerr<<"Unsupported frame filter kernel "<<argv[i]<<std::endl;
+					return 1;
+					}
+				filterKernel=FrameFilter::FilterKernel(kernel);
+				}
+			else if(strcasecmp(argv[i]+1,"fft")==0)
+				{
+				++i;
+				numFilterThreads=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"cfs")==0)
+				compactStatistics=true;
+			else if(strcasecmp(argv[i]+1,"n")==0)
+				{
+				++i;
+				maxNumFrames=size_t(atoi(argv[i]));
+				}
+			else
+				std::cerr<<"Ignoring unrecognized command line switch "<<argv[i]<<std::endl;
+			}
+		else if(frameFilePrefix==0)
+			frameFilePrefix=argv[i];
+		}
+	if(frameFilePrefix==0)
+		{
+		std::cerr<<"Usage: "<<argv[0]<<" <frame file name prefix> [-slf <sandbox layout file name>] [-er <min elevation> <max elevation>] [-nas <num averaging slots>] [-sp <min num samples> <max variance>] [-he <hysteresis envelope>] [-nsf] [-sf <spatial filter type> <spatial filter radius>] [-sfrs <range sigma>] [-ffk <filter kernel>] [-fft <num filter threads>] [-cfs] [-n <max num frames>]"<<std::endl;
+		return 1;
+		}
+	
+	try
+		{
+		/* Open the pre-recorded 3D video files: */
+		std::string colorFileName=frameFilePrefix;
+		colorFileName.append(".color");
+		std::string depthFileName=frameFilePrefix;
+		depthFileName.append(".depth");
+		Kinect::FileFrameSource frameSource(colorFileName.c_str(),depthFileName.c_str());
+		unsigned int frameSize[2];
+		for(int i=0;i<2;++i)
+			frameSize[i]=frameSource.getActualFrameSize(Kinect::FrameSource::DEPTH)[i];
+		
+		/* Get the per-pixel depth correction parameters: */
+		FrameFilter::PixelDepthCorrection* pixelDepthCorrection;
+		Kinect::FrameSource::DepthCorrection* depthCorrection=frameSource.getDepthCorrectionParameters();
+		if(depthCorrection!=0)
+			{
+			pixelDepthCorrection=depthCorrection->getPixelCorrection(frameSize);
+			delete depthCorrection;
+			}
+		else
+			{
+			/* Create dummy per-pixel depth correction parameters: */
+			pixelDepthCorrection=new FrameFilter::PixelDepthCorrection[frameSize[1]*frameSize[0]];
+			FrameFilter::PixelDepthCorrection* pdcPtr=pixelDepthCorrection;
+			for(unsigned int y=0;y<frameSize[1];++y)
+				for(unsigned int x=0;x<frameSize[0];++x,++pdcPtr)
+					{
+					pdcPtr->scale=1.0f;
+					pdcPtr->offset=0.0f;
+					}
+			}
+		Kinect::FrameSource::IntrinsicParameters ips=frameSource.getIntrinsicParameters();
+		
+		/* Read the base plane equation from the sandbox layout file: */
+		Plane basePlane;
+		{
+		IO::ValueSource layoutSource(IO::openFile(sandboxLayoutFileName.c_str()));
+		layoutSource.skipWs();
+		std::string s=layoutSource.readLine();
+		basePlane=Misc::ValueCoder<Plane>::decode(s.c_str(),s.c_str()+s.length());
+		basePlane.normalize();
+		}
+		
+		/* Read all depth frames into memory to exclude decompression from the measurements: */
+		std::vector<Kinect::FrameBuffer> frames;
+		while(frames.size()<maxNumFrames)
+			{
+			Kinect::FrameBuffer frame=frameSource.readNextDepthFrame();
+			if(frame.timeStamp==Math::Constants<double>::max)
+				break;
+			frames.push_back(frame);
+			}
+		std::cout<<"Replaying "<<frames.size()<<" depth frames of size "<<frameSize[0]<<'x'<<frameSize[1]<<std::endl;
+		
+		/* Create a reference filter and a filter using the selected kernel and thread count: */
+		FrameFilter* filters[2];
+		for(int i=0;i<2;++i)
+			{
+			filters[i]=new FrameFilter(frameSize,numAveragingSlots,pixelDepthCorrection,ips.depthProjection,basePlane);
+			if(haveElevationRange)
+				filters[i]->setValidElevationInterval(ips.depthProjection,basePlane,elevationMin,elevationMax);
+			filters[i]->setStableParameters(minNumSamples,maxVariance);
+			filters[i]->setHysteresis(hysteresis);
+			filters[i]->setSpatialFilter(spatialFilter);
+			filters[i]->setSpatialFilterType(spatialFilterType,spatialFilterRadius);
+			filters[i]->setSpatialFilterRangeSigma(spatialFilterRangeSigma);
+			}
+		filters[0]->setFilterKernel(FrameFilter::SCALAR_KERNEL);
+		filters[1]->setFilterKernel(filterKernel);
+		filters[1]->setNumFilterThreads(numFilterThreads);
+		filters[1]->setCompactStatistics(compactStatistics);
+		
+		/* Run all frames through both filters and compare the results: */
+		KernelStats stats[2];
+		size_t numMismatchedFrames=0;
+		size_t numMismatchedPixels=0;
+		size_t numPixels=size_t(frameSize[1])*size_t(frameSize[0]);
+		Kinect::FrameBuffer outputFrames[2];
+		for(int i=0;i<2;++i)
+			outputFrames[i]=filters[i]->createOutputFrame();
+		for(std::vector<Kinect::FrameBuffer>::iterator fIt=frames.begin();fIt!=frames.end();++fIt)
+			{
+			for(int i=0;i<2;++i)
+				{
+				Misc::Timer filterTimer;
+				filters[i]->filterFrame(*fIt,outputFrames[i]);
+				filterTimer.elapse();
+				stats[i].addFrame(filterTimer.getTime());
+				}
+			
+			/* Compare the two output frames bit by bit: */
+			const float* of0Ptr=outputFrames[0].getData<float>();
+			const float* of1Ptr=outputFrames[1].getData<float>();
+			size_t numFrameMismatches=0;
+			for(size_t i=0;i<numPixels;++i)
+				if(memcmp(of0Ptr+i,of1Ptr+i,sizeof(float))!=0)
+					++numFrameMismatches;
+			if(numFrameMismatches>0)
+				{
+				++numMismatchedFrames;
+				numMismatchedPixels+=numFrameMismatches;
+				}
+			}
+		
+		/* Print the results: */
+		if(!frames.empty())
+			{
+			std::cout<<"Scalar kernel, 1 thread: ";
+			stats[0].print(frames.size());
+			std::cout<<FrameFilter::getKernelName(filterKernel)<<" kernel, "<<numFilterThreads<<(numFilterThreads==1?" thread":" threads")<<(compactStatistics?", compact statistics: ":": ");
+			stats[1].print(frames.size());
+			std::cout<<"Speed-up: "<<stats[0].totalTime/stats[1].totalTime<<std::endl;
+			}
+		if(numMismatchedFrames>0)
+			std::cout<<"Results differ in "<<numMismatchedPixels<<" pixels in "<<numMismatchedFrames<<" frames"<<std::endl;
+		else
+			std::cout<<"Results are identical"<<std::endl;
+		
+		/* Clean up: */
+		for(int i=0;i<2;++i)
+			delete filters[i];
+		delete[] pixelDepthCorrection;
+		
+		return numMismatchedFrames>0?1:0;
+		}
+	catch(std::runtime_error err)
+		{
+		std::cerr<<"Caught exception "<<err.what()<<std::endl;
+		return 1;
+		}
+	}
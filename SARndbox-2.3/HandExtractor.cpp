@@ -32,39 +32,9 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 namespace {
 
-/**************
-Helper classes:
-**************/
-
-struct Span // Helper structure to extract foreground blobs from a depth image
-	{
-	/* Elements: */
-	public:
-	unsigned int y; // Row index of the span
-	unsigned int start; // Starting column of span
-	unsigned int end; // Ending column of span
-	unsigned int parent; // Span's parent span
-	unsigned int numPixels; // Number of pixels in the span's subtree
-	unsigned int blobId; // Blob ID of a root span
-	};
-
-struct BlobOrigin // Helper structure to store a point on the border of a foreground blob
-	{
-	/* Elements: */
-	public:
-	bool assigned; // Flag if the blob origin has already been assigned
-	unsigned int x,y; // Coordinates of blob origin in depth frame
-	const unsigned short* biPtr; // Pointer to blob origin in blob ID image
-	};
-
-struct Corner // Helper class to store corners in blob images
-	{
-	/* Elements: */
-	public:
-	int cornerType; // Corner type, +1: finger tip, -1: finger nook
-	unsigned start; // Boundary pixel index at which the corner started
-	int x,y; // Corner position in depth frame
-	};
+/*************
+Helper types:
+*************/
 
 typedef Math::Interval<float> Interval;
 typedef Geometry::Point<float,2> Point2;
@@ -270,12 +240,14 @@ void* HandExtractor::extractorThreadMethod(void)
 
 HandExtractor::HandExtractor(const unsigned int sDepthFrameSize[2],const HandExtractor::PixelDepthCorrection* sPixelDepthCorrection,const PTransform& sDepthProjection)
 	:pixelDepthCorrection(sPixelDepthCorrection),depthProjection(sDepthProjection),
-	 inputFrameVersion(0),runExtractorThread(false),
+	 inputFrameVersion(0),runExtractorThread(false),stageHandList(0),
 	 maxFgDepth(0x07ffU-1U),maxDepthDist(1),minBlobSize(1500),maxBlobSize(150000),
 	 blobIdImage(0),
 	 snakeLength(50),snake(0),
 	 maxCornerEnterDist(28),minCenterDist(10),minCornerExitDist(32),
 	 minHandProbability(0.15f),
+	 fullScanInterval(1),trackingRegionScale(1.5f),
+	 blobExtractor(sDepthFrameSize),framesToFullScan(0),
 	 handsExtractedFunction(0)
 	{
 	/* Copy the depth frame size: */
@@ -304,25 +276,60 @@ HandExtractor::HandExtractor(const unsigned int sDepthFrameSize[2],const HandExt
 	/* Initialize the edge walking snake: */
 	setSnakeLength(snakeLength);
 	
-	/* Start the hand extraction thread: */
-	runExtractorThread=true;
-	extractorThread.start(this,&HandExtractor::extractorThreadMethod);
+	/* Pre-size the extraction pools for typical frames; they only grow if a frame exceeds them: */
+	handBlobIds.reserve(64);
+	blobOrigins.reserve(64);
+	corners.reserve(64);
+	regions.reserve(8);
+	trackedHands.reserve(8);
+	newTrackedHands.reserve(8);
 	}
 
 HandExtractor::~HandExtractor(void)
 	{
-	/* Shut down the extraction thread: */
+	/* Shut down the extraction thread if it was started: */
 	{
 	Threads::MutexCond::Lock inputLock(inputCond);
 	runExtractorThread=false;
 	inputCond.signal();
 	}
-	extractorThread.join();
+	if(!extractorThread.isJoined())
+		extractorThread.join();
 	
 	delete[] blobIdImage;
 	delete[] snake;
 	}
 
+unsigned int HandExtractor::startFrame(const Kinect::FrameBuffer& frame,unsigned int numThreads)
+	{
+	/* Prepare a new output hand list: */
+	stageInputFrame=frame;
+	stageHandList=&extractedHands.startNewValue();
+	
+	return 1;
+	}
+
+void HandExtractor::processBand(unsigned int pass,unsigned int bandIndex,unsigned int numBands)
+	{
+	/* Extract hands from the entire input frame: */
+	extractHands(stageInputFrame.getData<DepthPixel>(),*stageHandList,0);
+	}
+
+Kinect::FrameBuffer HandExtractor::finishFrame(void)
+	{
+	/* Finalize the new extracted hands list in the output buffer: */
+	HandList& newHandList=*stageHandList;
+	extractedHands.postNewValue();
+	stageInputFrame=Kinect::FrameBuffer();
+	stageHandList=0;
+	
+	/* Pass the new hand list to the registered receiver: */
+	if(handsExtractedFunction!=0)
+		(*handsExtractedFunction)(newHandList);
+	
+	return Kinect::FrameBuffer();
+	}
+
 void HandExtractor::setMaxFgDepth(DepthPixel newMaxFgDepth)
 	{
 	maxFgDepth=newMaxFgDepth;
@@ -355,124 +362,128 @@ void HandExtractor::setCornerDists(int newMaxCornerEnterDist,int newMinCenterDis
 	minCornerExitDist=newMinCornerExitDist;
 	}
 
+void HandExtractor::setNumBlobExtractionThreads(unsigned int newNumBlobExtractionThreads)
+	{
+	blobExtractor.setNumThreads(newNumBlobExtractionThreads);
+	}
+
+void HandExtractor::setTracking(unsigned int newFullScanInterval,float newTrackingRegionScale)
+	{
+	fullScanInterval=newFullScanInterval>0?newFullScanInterval:1;
+	trackingRegionScale=newTrackingRegionScale;
+	
+	/* Scan the next frame in full: */
+	framesToFullScan=0;
+	}
+
 void HandExtractor::extractHands(const HandExtractor::DepthPixel* depthFrame,HandExtractor::HandList& hands,Images::RGBImage* blobImage)
 	{
-	Images::RGBImage::Color* imgPtr=0;
-	if(blobImage!=0)
+	/* Initialize the result list: */
+	hands.clear();
+	newTrackedHands.clear();
+	
+	/* Determine the regions in which to search for hands: */
+	regions.clear();
+	if(blobImage!=0||framesToFullScan==0)
 		{
-		/* Create the result image: */
-		blobImage->clear(Images::RGBImage::Color(0,0,0));
-		imgPtr=blobImage->replacePixels();
+		/* Scan the entire depth frame: */
+		Region fullFrame;
+		for(int i=0;i<2;++i)
+			{
+			fullFrame.min[i]=0;
+			fullFrame.max[i]=depthFrameSize[i];
+			}
+		regions.push_back(fullFrame);
+		framesToFullScan=fullScanInterval-1;
 		}
-	
-	/* Extract all four-connected foreground blobs from the given depth frame: */
-	std::vector<Span> spans;
-	unsigned int numSpans=0;
-	unsigned int lastRowSpan=0;
-	const DepthPixel* dfRowPtr=depthFrame;
-	for(unsigned int y=0;y<depthFrameSize[1];++y,dfRowPtr+=depthFrameSize[0])
+	else
 		{
-		const DepthPixel* dfPtr=dfRowPtr;
-		unsigned int rowSpan=numSpans;
-		unsigned int x=0;
-		while(true)
+		/* Scan regions of interest around the hands extracted from the previous frame: */
+		for(std::vector<TrackedHand>::iterator thIt=trackedHands.begin();thIt!=trackedHands.end();++thIt)
 			{
-			/* Find the beginning of the next foreground span: */
-			for(;x<depthFrameSize[0]&&*dfPtr>maxFgDepth;++x,++dfPtr)
-				;
-			if(x>=depthFrameSize[0])
-				break;
-			
-			/* Start a new foreground span: */
-			Span newSpan;
-			newSpan.y=y;
-			newSpan.start=x;
-			
-			/* Trace out the current foreground span: */
-			DepthPixel lastDepth=*dfPtr;
-			++x;
-			++dfPtr;
-			for(;x<depthFrameSize[0]&&*dfPtr<=maxFgDepth&&*dfPtr+maxDepthDist>=lastDepth&&*dfPtr<=lastDepth+maxDepthDist;++x,++dfPtr)
-				lastDepth=*dfPtr;
-			
-			/* Finalize and store the new foreground span: */
-			newSpan.end=x;
-			newSpan.parent=numSpans;
-			newSpan.numPixels=newSpan.end-newSpan.start;
-			newSpan.blobId=invalidBlobId;
-			spans.push_back(newSpan);
-			++numSpans;
-			
-			/* Skip any spans from the previous row that were just passed by: */
-			for(;lastRowSpan<rowSpan&&spans[lastRowSpan].end<newSpan.start;++lastRowSpan)
-				;
-			
-			/* Check if the current span links up with any from the previous row: */
-			for(unsigned int lrs=lastRowSpan;lrs<rowSpan&&spans[lrs].start<=newSpan.end;++lrs)
+			Region region;
+			float halfSize=thIt->radius*trackingRegionScale;
+			for(int i=0;i<2;++i)
 				{
-				/* Check if the two spans have depth in common: */
-				unsigned int o1=Misc::max(newSpan.start,spans[lrs].start);
-				unsigned int o2=Misc::min(newSpan.end,spans[lrs].end);
-				const DepthPixel* lrsPtr1=dfRowPtr+o1;
-				const DepthPixel* lrsPtr0=lrsPtr1-depthFrameSize[0];
-				bool canLink=false;
-				for(unsigned int o=o1;o<o2&&!canLink;++o,++lrsPtr0,++lrsPtr1)
-					canLink=*lrsPtr0+maxDepthDist>=*lrsPtr1&&*lrsPtr0<=*lrsPtr1+maxDepthDist;
-				
-				/* Merge the two spans if they can link: */
-				if(canLink)
+				float min=Math::floor(thIt->center[i]-halfSize);
+				float max=Math::ceil(thIt->center[i]+halfSize);
+				region.min[i]=min>0.0f?(min<float(depthFrameSize[i])?(unsigned int)(min):depthFrameSize[i]):0U;
+				region.max[i]=max>0.0f?(max<float(depthFrameSize[i])?(unsigned int)(max):depthFrameSize[i]):0U;
+				}
+			if(region.min[0]<region.max[0]&&region.min[1]<region.max[1])
+				regions.push_back(region);
+			}
+		
+		/* Merge overlapping regions so that no hand is extracted twice: */
+		for(size_t i=0;i<regions.size();++i)
+			{
+			for(size_t j=i+1;j<regions.size();++j)
+				{
+				Region& r0=regions[i];
+				Region& r1=regions[j];
+				if(r0.min[0]<r1.max[0]&&r1.min[0]<r0.max[0]&&r0.min[1]<r1.max[1]&&r1.min[1]<r0.max[1])
 					{
-					/* Find the roots of the two spans' respective subtrees: */
-					unsigned int root1=lrs;
-					while(root1!=spans[root1].parent)
-						root1=spans[root1].parent;
-					unsigned int root2=numSpans-1;
-					while(root2!=spans[root2].parent)
-						root2=spans[root2].parent;
-					
-					if(root1<root2)
+					/* Replace the first region with the union of both, and check it against all others again: */
+					for(int k=0;k<2;++k)
 						{
-						/* Make the first span the new root: */
-						spans[root2].parent=root1;
-						spans[root1].numPixels+=spans[root2].numPixels;
-						}
-					else if(root1>root2)
-						{
-						/* Make the second span the new root: */
-						spans[root1].parent=root2;
-						spans[root2].numPixels+=spans[root1].numPixels;
+						r0.min[k]=Misc::min(r0.min[k],r1.min[k]);
+						r0.max[k]=Misc::max(r0.max[k],r1.max[k]);
 						}
+					regions.erase(regions.begin()+j);
+					j=i;
 					}
 				}
 			}
 		
-		/* Skip any leftover spans from the previous row: */
-		lastRowSpan=rowSpan;
+		--framesToFullScan;
+		}
+	
+	if(blobImage!=0)
+		{
+		/* Create the result image: */
+		blobImage->clear(Images::RGBImage::Color(0,0,0));
 		}
 	
-	/* Assign consecutive blob IDs to all root spans: */
+	/* Extract hands from all regions: */
+	for(std::vector<Region>::iterator rIt=regions.begin();rIt!=regions.end();++rIt)
+		extractHandsInRegion(depthFrame,*rIt,hands,blobImage);
+	
+	/* Scan the next frame in full if any tracked hands were lost: */
+	if(newTrackedHands.size()<trackedHands.size())
+		framesToFullScan=0;
+	
+	/* Track the extracted hands in the next frame: */
+	trackedHands.swap(newTrackedHands);
+	}
+
+void HandExtractor::extractHandsInRegion(const HandExtractor::DepthPixel* depthFrame,const HandExtractor::Region& region,HandExtractor::HandList& hands,Images::RGBImage* blobImage)
+	{
+	Images::RGBImage::Color* imgPtr=0;
+	if(blobImage!=0)
+		imgPtr=blobImage->modifyPixels();
+	
+	/* Extract all four-connected foreground blobs from the given region of the given depth frame: */
+	ForegroundSelector fs;
+	fs.maxFgDepth=maxFgDepth;
+	DepthMergeChecker dmc;
+	dmc.maxDepthDist=maxDepthDist;
+	SizeBlob::Creator blobCreator;
+	const std::vector<SizeBlob>& blobs=blobExtractor.extractBlobs(region.min,region.max,depthFrame,fs,dmc,blobCreator);
+	const std::vector<HandBlobExtractor::Span>& spans=blobExtractor.getSpans();
+	unsigned int numSpans=spans.size();
+	
+	/* Assign consecutive blob IDs to all blobs in the hand size range: */
+	handBlobIds.clear();
 	unsigned int nextBlobId=0;
-	for(unsigned int i=0;i<numSpans;++i)
+	for(std::vector<SizeBlob>::const_iterator bIt=blobs.begin();bIt!=blobs.end();++bIt)
 		{
-		/* Check if the span is a root span: */
-		if(spans[i].parent==i)
+		if(bIt->numPixels>=minBlobSize&&bIt->numPixels<=maxBlobSize)
 			{
-			if(spans[i].numPixels>=minBlobSize&&spans[i].numPixels<=maxBlobSize)
-				{
-				spans[i].blobId=nextBlobId;
-				++nextBlobId;
-				}
+			handBlobIds.push_back(nextBlobId);
+			++nextBlobId;
 			}
 		else
-			{
-			/* Find the root of the span's subtree: */
-			unsigned int root=spans[i].parent;
-			while(root!=spans[root].parent)
-				root=spans[root].parent;
-			
-			/* Assign the span's blob ID from the root: */
-			spans[i].blobId=spans[root].blobId;
-			}
+			handBlobIds.push_back(invalidBlobId);
 		}
 	
 	#if 0
@@ -502,52 +513,64 @@ void HandExtractor::extractHands(const HandExtractor::DepthPixel* depthFrame,Han
 	
 	for(unsigned int i=0;i<numSpans;++i)
 		{
-		/* Find the span's root: */
-		int root=i;
-		while(spans[root].parent!=root)
-			root=spans[root].parent;
-		
-		if(spans[root].blobId!=invalidBlobId)
+		if(handBlobIds[spans[i].blobId]!=invalidBlobId)
 			{
 			/* Fill in the span: */
-			Images::RGBImage::Color* cPtr=result.modifyPixelRow(spans[i].y)+spans[i].start;
-			for(int x=spans[i].start;x<spans[i].end;++x,++cPtr)
-				*cPtr=blobColors[spans[root].blobId%18];
+			Images::RGBImage::Color* cPtr=result.modifyPixelRow(spans[i].y)+spans[i].x1;
+			for(int x=spans[i].x1;x<spans[i].x2;++x,++cPtr)
+				*cPtr=blobColors[handBlobIds[spans[i].blobId]%18];
 			}
 		}
 	
 	#endif
 	
-	/* Create an array of blob origin points: */
-	BlobOrigin* blobOrigins=new BlobOrigin[nextBlobId];
-	for(unsigned int i=0;i<nextBlobId;++i)
-		blobOrigins[i].assigned=false;
+	/* Reset the array of blob origin points: */
+	BlobOrigin unassigned;
+	unassigned.assigned=false;
+	blobOrigins.assign(nextBlobId,unassigned);
 	
-	/* Create the blob ID image: */
-	unsigned short* biRowPtr=blobIdImage+biStride+1;
+	/* Surround the region in the blob ID image with invalid blob IDs to stop edge walks from leaving it: */
+	unsigned int regionWidth=region.max[0]-region.min[0];
+	unsigned int regionHeight=region.max[1]-region.min[1];
+	unsigned short* biRowPtr=blobIdImage+region.min[1]*biStride+region.min[0];
+	unsigned short* biPtr=biRowPtr;
+	for(unsigned int x=0;x<regionWidth+2;++x,++biPtr)
+		*biPtr=invalidBlobId;
+	biPtr=biRowPtr+(regionHeight+1)*biStride;
+	for(unsigned int x=0;x<regionWidth+2;++x,++biPtr)
+		*biPtr=invalidBlobId;
+	biPtr=biRowPtr+biStride;
+	for(unsigned int y=0;y<regionHeight;++y,biPtr+=biStride)
+		{
+		biPtr[0]=invalidBlobId;
+		biPtr[regionWidth+1]=invalidBlobId;
+		}
+	
+	/* Fill in the region of the blob ID image: */
+	biRowPtr+=biStride+1;
 	unsigned int spanIndex=0;
-	for(unsigned int y=0;y<depthFrameSize[1];++y,biRowPtr+=biStride)
+	for(unsigned int y=region.min[1];y<region.max[1];++y,biRowPtr+=biStride)
 		{
 		/* Process all spans and spaces between spans in the current row: */
-		unsigned int x=0;
-		unsigned short* biPtr=biRowPtr;
+		unsigned int x=region.min[0];
+		biPtr=biRowPtr;
 		while(true)
 			{
 			/* Find the start of the next span in the current row: */
-			unsigned int nextSpanStart=depthFrameSize[0];
+			unsigned int nextSpanStart=region.max[0];
 			if(spanIndex<numSpans&&spans[spanIndex].y==y)
-				nextSpanStart=spans[spanIndex].start;
+				nextSpanStart=spans[spanIndex].x1;
 			
 			/* Assign the invalid blob IDs until the start of the next span: */
 			for(;x<nextSpanStart;++x,++biPtr)
 				*biPtr=invalidBlobId;
 			
 			/* Bail out if the current row is done: */
-			if(x==depthFrameSize[0])
+			if(x==region.max[0])
 				break;
 			
 			/* Check if the current span's blob is valid, and encountered for the first time: */
-			unsigned int blobId=spans[spanIndex].blobId;
+			unsigned short blobId=handBlobIds[spans[spanIndex].blobId];
 			if(blobId<nextBlobId&&!blobOrigins[blobId].assigned)
 				{
 				/* Store the beginning of the current span as the blob's origin: */
@@ -558,7 +581,7 @@ void HandExtractor::extractHands(const HandExtractor::DepthPixel* depthFrame,Han
 				}
 			
 			/* Assign the current span's blob ID: */
-			for(;x<spans[spanIndex].end;++x,++biPtr)
+			for(;x<spans[spanIndex].x2;++x,++biPtr)
 				*biPtr=blobId;
 			
 			/* Go to the next span: */
@@ -566,18 +589,15 @@ void HandExtractor::extractHands(const HandExtractor::DepthPixel* depthFrame,Han
 			}
 		}
 	
-	/* Initialize the result list: */
-	hands.clear();
-	
 	/* Walk around the edges of all foreground blobs in counter-clockwise order and decide whether they are hand-shaped: */
 	EdgePixel* snakeEnd=snake+snakeLength;
 	int enterDist2=Math::sqr(maxCornerEnterDist);
 	int centerDist2=Math::sqr(minCenterDist);
 	int exitDist2=Math::sqr(minCornerExitDist);
-	std::vector<Corner> corners;
-	corners.reserve(10);
 	for(unsigned int blobId=0;blobId<nextBlobId;++blobId)
 		{
+		corners.clear();
+		
 		/* Initialize the edge-walking snake: */
 		EdgePixel* snakeHead=snake;
 		snakeHead->x=int(blobOrigins[blobId].x);
@@ -876,14 +896,15 @@ void HandExtractor::extractHands(const HandExtractor::DepthPixel* depthFrame,Han
 			
 			// DEBUGGING
 			// std::cout<<"Hand in camera space: "<<newHand.center[0]<<", "<<newHand.center[1]<<", "<<newHand.center[2]<<", "<<newHand.radius<<std::endl;
+			
+			/* Remember the hand in depth image space to track it in the next frame: */
+			TrackedHand newTrackedHand;
+			for(int i=0;i<2;++i)
+				newTrackedHand.center[i]=center[i];
+			newTrackedHand.radius=radius;
+			newTrackedHands.push_back(newTrackedHand);
 			}
-		
-		/* Clean up: */
-		corners.clear();
 		}
-	
-	/* Clean up: */
-	delete[] blobOrigins;
 	}
 
 void HandExtractor::setHandsExtractedFunction(HandExtractor::HandsExtractedFunction* newHandsExtractedFunction)
@@ -900,6 +921,13 @@ void HandExtractor::receiveRawFrame(const Kinect::FrameBuffer& newFrame)
 	inputFrame=newFrame;
 	++inputFrameVersion;
 	
+	/* Start the hand extraction thread on the first frame: */
+	if(!runExtractorThread)
+		{
+		runExtractorThread=true;
+		extractorThread.start(this,&HandExtractor::extractorThreadMethod);
+		}
+	
 	/* Signal the background thread: */
 	inputCond.signal();
 	}
@@ -33,6 +33,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Kinect/FrameSource.h>
 
 #include "Types.h"
+#include "BlobExtractor.h"
+#include "DepthFramePipeline.h"
 
 /* Forward declarations: */
 namespace Misc {
@@ -40,7 +42,7 @@ template <class ParameterParam>
 class FunctionCall;
 }
 
-class HandExtractor
+class HandExtractor:public DepthFramePipeline::Stage
 	{
 	/* Embedded classes: */
 	public:
@@ -59,6 +61,44 @@ class HandExtractor
 	typedef Misc::FunctionCall<const HandList&> HandsExtractedFunction; // Type for functions called when a new hand list has been extracted
 	
 	private:
+	class ForegroundSelector // Functor class to select foreground pixels
+		{
+		/* Elements: */
+		public:
+		DepthPixel maxFgDepth; // Maximum depth value for foreground blobs
+		
+		/* Methods: */
+		bool operator()(unsigned int x,unsigned int y,const DepthPixel& pixel) const
+			{
+			return pixel<=maxFgDepth;
+			}
+		};
+	
+	class DepthMergeChecker // Functor class to check whether two neighboring pixels can belong to the same blob
+		{
+		/* Elements: */
+		public:
+		unsigned int maxDepthDist; // Maximum depth distance between adjacent pixels to belong to the same blob
+		
+		/* Methods: */
+		bool operator()(unsigned int x1,unsigned int y1,const DepthPixel& pixel1,unsigned int x2,unsigned int y2,const DepthPixel& pixel2) const
+			{
+			return pixel1+maxDepthDist>=pixel2&&pixel1<=pixel2+maxDepthDist;
+			}
+		};
+	
+	typedef Images::Blob<DepthPixel> SizeBlob; // Type for blobs tracking their number of pixels
+	typedef BlobExtractor<SizeBlob,ForegroundSelector,DepthMergeChecker> HandBlobExtractor; // Type for blob extractors finding hand candidates
+	
+	struct BlobOrigin // Helper structure to store a point on the border of a foreground blob
+		{
+		/* Elements: */
+		public:
+		bool assigned; // Flag if the blob origin has already been assigned
+		unsigned int x,y; // Coordinates of blob origin in depth frame
+		const unsigned short* biPtr; // Pointer to blob origin in blob ID image
+		};
+	
 	struct EdgePixel // Helper structure storing an edge pixel of a blob
 		{
 		/* Elements: */
@@ -66,7 +106,32 @@ class HandExtractor
 		int x,y; // Position of edge pixel in depth frame
 		const unsigned short* biPtr; // Pointer to edge pixel in blob ID image
 		};
-
+	
+	struct Corner // Helper class to store corners in blob images
+		{
+		/* Elements: */
+		public:
+		int cornerType; // Corner type, +1: finger tip, -1: finger nook
+		unsigned start; // Boundary pixel index at which the corner started
+		int x,y; // Corner position in depth frame
+		};
+	
+	struct Region // Helper structure describing a rectangular region of the depth frame
+		{
+		/* Elements: */
+		public:
+		unsigned int min[2]; // Inclusive lower corner of the region
+		unsigned int max[2]; // Exclusive upper corner of the region
+		};
+	
+	struct TrackedHand // Helper structure storing a hand extracted from a previous frame in depth image space
+		{
+		/* Elements: */
+		public:
+		float center[2]; // Hand's center in depth image space
+		float radius; // Hand's approximate radius in depth image space
+		};
+	
 	/* Elements: */
 	private:
 	unsigned int depthFrameSize[2]; // Size of incoming depth frames
@@ -77,7 +142,9 @@ class HandExtractor
 	Kinect::FrameBuffer inputFrame; // The most recent input frame
 	unsigned int inputFrameVersion; // Version number of input frame
 	volatile bool runExtractorThread; // Flag to keep the background extraction thread running
-	Threads::Thread extractorThread; // The background filtering thread
+	Threads::Thread extractorThread; // The background extraction thread, started when the first raw frame is received
+	Kinect::FrameBuffer stageInputFrame; // Raw input frame currently processed as a pipeline stage
+	HandList* stageHandList; // Output hand list currently written as a pipeline stage
 	
 	DepthPixel maxFgDepth; // Maximum depth value for foreground blobs
 	unsigned int maxDepthDist; // Maximum depth distance between adjacent pixels to belong to the same foreground blob
@@ -94,11 +161,23 @@ class HandExtractor
 	int minCenterDist; // Minimum distance from snake's center to line defined by its head and tail to enter corner state
 	int minCornerExitDist; // Minimum distance between snake's head and tail to leave corner state
 	float minHandProbability; // Minimum probability rating at which to accept a blob as a hand
+	unsigned int fullScanInterval; // Number of frames between full-frame scans; hands are only searched around previously extracted hands in between
+	float trackingRegionScale; // Half size of the regions of interest around previously extracted hands as a multiple of their radii
+	
+	HandBlobExtractor blobExtractor; // Blob extractor finding foreground blobs in the currently processed region
+	std::vector<unsigned short> handBlobIds; // Pool mapping the IDs of extracted blobs to the IDs of hand candidate blobs
+	std::vector<BlobOrigin> blobOrigins; // Pool of edge walking origins of the currently processed region's blobs
+	std::vector<Corner> corners; // Pool of corners of the currently processed blob
+	std::vector<Region> regions; // List of regions of the current depth frame to search for hands
+	std::vector<TrackedHand> trackedHands; // Hands extracted from the most recently processed depth frame
+	std::vector<TrackedHand> newTrackedHands; // Hands extracted from the currently processed depth frame
+	unsigned int framesToFullScan; // Number of frames to process before the next full-frame scan
 	
 	Threads::TripleBuffer<HandList> extractedHands; // Triple buffer of lists of extracted hands
 	HandsExtractedFunction* handsExtractedFunction; // Function called when a new list of extracted hands is ready
 	
 	/* Private methods: */
+	void extractHandsInRegion(const DepthPixel* depthFrame,const Region& region,HandList& hands,Images::RGBImage* blobImage); // Extracts hands from the given region of the given depth frame
 	void* extractorThreadMethod(void); // Method for the background hand extraction thread
 	
 	/* Constructors and destructors: */
@@ -108,9 +187,14 @@ class HandExtractor
 	HandExtractor(const HandExtractor& source); // Prohibit copy constructor
 	HandExtractor& operator=(const HandExtractor& source); // Prohibit assignment operator
 	public:
-	~HandExtractor(void);
+	virtual ~HandExtractor(void);
 	
-	/* Methods: */
+	/* Methods from DepthFramePipeline::Stage: */
+	virtual unsigned int startFrame(const Kinect::FrameBuffer& frame,unsigned int numThreads);
+	virtual void processBand(unsigned int pass,unsigned int bandIndex,unsigned int numBands);
+	virtual Kinect::FrameBuffer finishFrame(void);
+	
+	/* New methods: */
 	DepthPixel getMaxFgDepth(void) const // Returns the maximum depth value for foreground blobs
 		{
 		return maxFgDepth;
@@ -148,9 +232,23 @@ class HandExtractor
 		return minCornerExitDist;
 		}
 	void setCornerDists(int newMaxCornerEnterDist,int newMinCenterDist,int newMinCornerExitDist); // Sets distances between snake's head and tail to enter and exit corner state, respectively
+	unsigned int getFullScanInterval(void) const // Returns the number of frames between full-frame scans
+		{
+		return fullScanInterval;
+		}
+	float getTrackingRegionScale(void) const // Returns the half size of regions of interest around previously extracted hands as a multiple of their radii
+		{
+		return trackingRegionScale;
+		}
+	void setTracking(unsigned int newFullScanInterval,float newTrackingRegionScale); // Sets the number of frames between full-frame scans, with 1 scanning every frame in full, and the size of regions of interest around previously extracted hands
+	unsigned int getNumBlobExtractionThreads(void) const // Returns the number of threads extracting foreground blobs from each frame
+		{
+		return blobExtractor.getNumThreads();
+		}
+	void setNumBlobExtractionThreads(unsigned int newNumBlobExtractionThreads); // Sets the number of threads extracting foreground blobs from each frame; must be called before the first frame is received
 	void extractHands(const DepthPixel* depthFrame,HandList& hands,Images::RGBImage* blobImage); // Extracts hands from the given depth frame
 	void setHandsExtractedFunction(HandsExtractedFunction* newHandsExtractedFunction); // Sets the output function; adopts given functor object
-	void receiveRawFrame(const Kinect::FrameBuffer& newFrame); // Called to receive a new raw depth frame
+	void receiveRawFrame(const Kinect::FrameBuffer& newFrame); // Called to receive a new raw depth frame; must not be mixed with use as a pipeline stage
 	bool lockNewExtractedHands(void) // Locks the most recently produced output list of extracted hands for reading; returns true if the locked list is new
 		{
 		return extractedHands.lockNewValue();
@@ -0,0 +1,369 @@
+/***********************************************************************
+HeightMapFuser - Class to resample the filtered depth frames of multiple
+cameras into a single height map aligned with the sandbox's base plane,
+blending overlapping cameras with weights that fall off towards the
+edges of each camera's depth frames.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "HeightMapFuser.h"
+
+#include <string.h>
+#include <Misc/FunctionCalls.h>
+#include <Math/Math.h>
+#include <Math/Constants.h>
+#include <Geometry/Vector.h>
+
+#include "FrameFilter.h"
+
+/***************************************
+Methods of class HeightMapFuser::Camera:
+***************************************/
+
+HeightMapFuser::Camera::Camera(const unsigned int sFrameSize[2],const float sGridProjection[16],unsigned int gridSize)
+	:haveSplat(false),
+	 accumulation(new float[size_t(gridSize)*2])
+	{
+	for(int i=0;i<2;++i)
+		{
+		frameSize[i]=sFrameSize[i];
+		blendWeights[i]=new float[frameSize[i]];
+		}
+	for(int i=0;i<16;++i)
+		gridProjection[i]=sGridProjection[i];
+	}
+
+HeightMapFuser::Camera::~Camera(void)
+	{
+	for(int i=0;i<2;++i)
+		delete[] blendWeights[i];
+	delete[] accumulation;
+	}
+
+/*******************************
+Methods of class HeightMapFuser:
+*******************************/
+
+void HeightMapFuser::updateBlendWeights(HeightMapFuser::Camera& camera)
+	{
+	/* Ramp each column's and row's weight up linearly with its distance from the nearest frame edge: */
+	for(int i=0;i<2;++i)
+		for(unsigned int p=0;p<camera.frameSize[i];++p)
+			{
+			float edgeDist=float(p<camera.frameSize[i]-1-p?p:camera.frameSize[i]-1-p)+0.5f;
+			camera.blendWeights[i][p]=blendWidth>0.0f&&edgeDist<blendWidth?edgeDist/blendWidth:1.0f;
+			}
+	}
+
+void HeightMapFuser::splatFrame(HeightMapFuser::Camera& camera)
+	{
+	/* Clear the accumulation buffer: */
+	size_t gridSize=size_t(size[1])*size_t(size[0]);
+	memset(camera.accumulation,0,gridSize*2*sizeof(float));
+	
+	/* Transform each pixel's center into grid space and distribute its weighted elevation over the four nearest grid cells: */
+	const float* gp=camera.gridProjection;
+	const float* dPtr=camera.frame.getData<float>();
+	float gridMax[2];
+	for(int i=0;i<2;++i)
+		gridMax[i]=float(size[i]);
+	for(unsigned int y=0;y<camera.frameSize[1];++y)
+		{
+		/* Calculate the row's contribution to the transformed pixel centers: */
+		float py=float(y)+0.5f;
+		float row[4];
+		for(int i=0;i<4;++i)
+			row[i]=gp[i*4+1]*py+gp[i*4+3];
+		float rowWeight=camera.blendWeights[1][y];
+		
+		for(unsigned int x=0;x<camera.frameSize[0];++x,++dPtr)
+			{
+			float px=float(x)+0.5f;
+			float hw=gp[12]*px+gp[14]*(*dPtr)+row[3];
+			float gx=(gp[0]*px+gp[2]*(*dPtr)+row[0])/hw-0.5f;
+			float gy=(gp[4]*px+gp[6]*(*dPtr)+row[1])/hw-0.5f;
+			float elevation=(gp[8]*px+gp[10]*(*dPtr)+row[2])/hw;
+			
+			/* Skip pixels outside the grid; the negated test also rejects invalid pixels: */
+			if(!(gx>-1.0f&&gx<gridMax[0]&&gy>-1.0f&&gy<gridMax[1]))
+				continue;
+			
+			/* Calculate the pixel's bilinear weights: */
+			float weight=camera.blendWeights[0][x];
+			if(weight>rowWeight)
+				weight=rowWeight;
+			int cx=int(Math::floor(gx));
+			int cy=int(Math::floor(gy));
+			float wx[2],wy[2];
+			wx[1]=gx-float(cx);
+			wx[0]=1.0f-wx[1];
+			wy[1]=(gy-float(cy))*weight;
+			wy[0]=weight-wy[1];
+			
+			/* Accumulate into the grid cells: */
+			for(int j=0;j<2;++j)
+				{
+				int ay=cy+j;
+				if(ay<0||ay>=int(size[1]))
+					continue;
+				float* aRow=camera.accumulation+size_t(ay)*size_t(size[0])*2;
+				for(int i=0;i<2;++i)
+					{
+					int ax=cx+i;
+					if(ax<0||ax>=int(size[0]))
+						continue;
+					float w=wx[i]*wy[j];
+					aRow[ax*2+0]+=w;
+					aRow[ax*2+1]+=w*elevation;
+					}
+				}
+			}
+		}
+	}
+
+void HeightMapFuser::combineRows(unsigned int rowBegin,unsigned int rowEnd)
+	{
+	float* outputFrame=stageOutputFrame->getData<float>();
+	for(unsigned int y=rowBegin;y<rowEnd;++y)
+		{
+		size_t rowOffset=size_t(y)*size_t(size[0]);
+		float* hmRow=heightMap+rowOffset;
+		unsigned int* tciRow=tileChangeIndices+(y/FrameFilter::dirtyTileSize)*numDirtyTiles[0];
+		for(unsigned int x=0;x<size[0];++x)
+			{
+			/* Calculate the weighted average of all cameras' elevations in the cell: */
+			float weightSum=0.0f;
+			float elevationSum=0.0f;
+			for(std::vector<Camera*>::iterator cIt=cameras.begin();cIt!=cameras.end();++cIt)
+				if((*cIt)->haveSplat)
+					{
+					const float* aPtr=(*cIt)->accumulation+(rowOffset+x)*2;
+					weightSum+=aPtr[0];
+					elevationSum+=aPtr[1];
+					}
+			
+			/* Update the cell if any camera saw it, otherwise retain its previous elevation: */
+			if(weightSum>0.0f)
+				{
+				float elevation=elevationSum/weightSum;
+				if(hmRow[x]!=elevation)
+					{
+					hmRow[x]=elevation;
+					tciRow[x/FrameFilter::dirtyTileSize]=frameIndex;
+					}
+				}
+			}
+		
+		/* Copy the row into the output frame: */
+		memcpy(outputFrame+rowOffset,hmRow,size[0]*sizeof(float));
+		}
+	}
+
+HeightMapFuser::HeightMapFuser(const Plane& basePlane,const Point basePlaneCorners[4],Scalar cellSize)
+	:blendWidth(32.0f),
+	 heightMap(0),frameIndex(0),tileChangeIndices(0),
+	 numStageBands(1),stageOutputFrame(0),
+	 outputFrameFunction(0)
+	{
+	/* Set up a grid coordinate frame whose x axis follows the sandbox's long axis and whose z axis is the base plane normal: */
+	Vector z=basePlane.getNormal();
+	Scalar zMag=z.mag();
+	z/=zMag;
+	Scalar offset=basePlane.getOffset()/zMag;
+	Vector x=(basePlaneCorners[1]-basePlaneCorners[0])+(basePlaneCorners[3]-basePlaneCorners[2]);
+	x-=z*(x*z);
+	x.normalize();
+	Vector y=z^x;
+	
+	/* Find the extents of the base plane rectangle in the grid coordinate frame: */
+	Scalar min[2],max[2];
+	for(int i=0;i<2;++i)
+		{
+		min[i]=Math::Constants<Scalar>::max;
+		max[i]=-Math::Constants<Scalar>::max;
+		}
+	for(int i=0;i<4;++i)
+		{
+		Vector c=basePlaneCorners[i]-Point::origin;
+		Scalar uv[2];
+		uv[0]=c*x;
+		uv[1]=c*y;
+		for(int j=0;j<2;++j)
+			{
+			if(min[j]>uv[j])
+				min[j]=uv[j];
+			if(max[j]<uv[j])
+				max[j]=uv[j];
+			}
+		}
+	for(int i=0;i<2;++i)
+		size[i]=(unsigned int)(Math::ceil((max[i]-min[i])/cellSize));
+	
+	/* Create the transformation from camera space into grid space and its inverse: */
+	PTransform::Matrix& gtm=gridTransform.getMatrix();
+	for(int j=0;j<3;++j)
+		{
+		gtm(0,j)=x[j]/cellSize;
+		gtm(1,j)=y[j]/cellSize;
+		gtm(2,j)=z[j];
+		gtm(3,j)=Scalar(0);
+		}
+	gtm(0,3)=-min[0]/cellSize;
+	gtm(1,3)=-min[1]/cellSize;
+	gtm(2,3)=-offset;
+	gtm(3,3)=Scalar(1);
+	depthProjection=Geometry::invert(gridTransform);
+	
+	/* Initialize the height map to the base plane: */
+	size_t gridSize=size_t(size[1])*size_t(size[0]);
+	heightMap=new float[gridSize];
+	for(size_t i=0;i<gridSize;++i)
+		heightMap[i]=0.0f;
+	
+	/* Initialize the dirty tile grid: */
+	for(int i=0;i<2;++i)
+		numDirtyTiles[i]=(size[i]+FrameFilter::dirtyTileSize-1)/FrameFilter::dirtyTileSize;
+	size_t numTiles=size_t(numDirtyTiles[1])*size_t(numDirtyTiles[0]);
+	tileChangeIndices=new unsigned int[numTiles];
+	for(size_t i=0;i<numTiles;++i)
+		tileChangeIndices[i]=1U;
+	
+	/* Allocate the output frames, with room for the frame index and per-tile change indices following the elevations: */
+	for(int i=0;i<3;++i)
+		outputFrames.getBuffer(i)=Kinect::FrameBuffer(size[0],size[1],gridSize*sizeof(float)+(1+numTiles)*sizeof(unsigned int));
+	}
+
+HeightMapFuser::~HeightMapFuser(void)
+	{
+	for(std::vector<Camera*>::iterator cIt=cameras.begin();cIt!=cameras.end();++cIt)
+		delete *cIt;
+	delete[] heightMap;
+	delete[] tileChangeIndices;
+	delete outputFrameFunction;
+	}
+
+unsigned int HeightMapFuser::startFrame(const Kinect::FrameBuffer& frame,unsigned int numThreads)
+	{
+	/* Take the first camera's frame from the pipeline and the most recent new frames of all other cameras: */
+	for(unsigned int i=0;i<cameras.size();++i)
+		{
+		Camera& camera=*cameras[i];
+		if(i==0)
+			camera.frame=frame;
+		else if(camera.frames.lockNewValue())
+			camera.frame=camera.frames.getLockedValue();
+		}
+	
+	/* Split the combination pass into one band of dirty tile rows per pipeline thread: */
+	numStageBands=numThreads<numDirtyTiles[1]?numThreads:numDirtyTiles[1];
+	
+	/* Prepare a new output frame: */
+	++frameIndex;
+	stageOutputFrame=&outputFrames.startNewValue();
+	stageOutputFrame->timeStamp=frame.timeStamp;
+	
+	/* Splat all new camera frames in the first pass, and combine them in the second: */
+	return 2;
+	}
+
+unsigned int HeightMapFuser::getNumBands(unsigned int pass) const
+	{
+	/* Splat each camera's frame in its own band to keep accumulation buffers private: */
+	return pass==0?cameras.size():numStageBands;
+	}
+
+void HeightMapFuser::processBand(unsigned int pass,unsigned int bandIndex,unsigned int numBands)
+	{
+	if(pass==0)
+		{
+		/* Splat the camera's frame if it has a new one: */
+		Camera& camera=*cameras[bandIndex];
+		if(camera.frame.isValid())
+			{
+			splatFrame(camera);
+			camera.haveSplat=true;
+			camera.frame=Kinect::FrameBuffer();
+			}
+		}
+	else
+		{
+		/* Calculate the band's row range from its range of dirty tile rows and combine it: */
+		unsigned int rowBegin=((numDirtyTiles[1]*bandIndex)/numBands)*FrameFilter::dirtyTileSize;
+		unsigned int rowEnd=((numDirtyTiles[1]*(bandIndex+1))/numBands)*FrameFilter::dirtyTileSize;
+		if(rowEnd>size[1])
+			rowEnd=size[1];
+		combineRows(rowBegin,rowEnd);
+		}
+	}
+
+Kinect::FrameBuffer HeightMapFuser::finishFrame(void)
+	{
+	/* Store the frame index and the per-tile change indices following the output frame's elevations: */
+	unsigned int* trailer=reinterpret_cast<unsigned int*>(stageOutputFrame->getData<float>()+size[1]*size[0]);
+	trailer[0]=frameIndex;
+	memcpy(trailer+1,tileChangeIndices,numDirtyTiles[1]*numDirtyTiles[0]*sizeof(unsigned int));
+	
+	/* Finalize the new output frame in the output buffer: */
+	Kinect::FrameBuffer result=*stageOutputFrame;
+	outputFrames.postNewValue();
+	stageOutputFrame=0;
+	
+	/* Pass the new output frame to the registered receiver: */
+	if(outputFrameFunction!=0)
+		(*outputFrameFunction)(result);
+	
+	return result;
+	}
+
+void HeightMapFuser::setBlendWidth(float newBlendWidth)
+	{
+	blendWidth=newBlendWidth;
+	for(std::vector<Camera*>::iterator cIt=cameras.begin();cIt!=cameras.end();++cIt)
+		updateBlendWeights(**cIt);
+	}
+
+unsigned int HeightMapFuser::addCamera(const unsigned int frameSize[2],const PTransform& cameraDepthProjection)
+	{
+	/* Concatenate the camera's depth projection with the transformation into grid space: */
+	PTransform gp=gridTransform;
+	gp*=cameraDepthProjection;
+	float gridProjection[16];
+	for(int i=0;i<4;++i)
+		for(int j=0;j<4;++j)
+			gridProjection[i*4+j]=float(gp.getMatrix()(i,j));
+	
+	/* Add the new camera: */
+	Camera* newCamera=new Camera(frameSize,gridProjection,size[1]*size[0]);
+	updateBlendWeights(*newCamera);
+	cameras.push_back(newCamera);
+	
+	return cameras.size()-1;
+	}
+
+void HeightMapFuser::setOutputFrameFunction(HeightMapFuser::OutputFrameFunction* newOutputFrameFunction)
+	{
+	delete outputFrameFunction;
+	outputFrameFunction=newOutputFrameFunction;
+	}
+
+void HeightMapFuser::receiveFrame(const Kinect::FrameBuffer& newFrame,unsigned int cameraIndex)
+	{
+	/* Hand the frame to the next pipeline frame: */
+	cameras[cameraIndex]->frames.postNewValue(newFrame);
+	}
@@ -0,0 +1,115 @@
+/***********************************************************************
+HeightMapFuser - Class to resample the filtered depth frames of multiple
+cameras into a single height map aligned with the sandbox's base plane,
+blending overlapping cameras with weights that fall off towards the
+edges of each camera's depth frames.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef HEIGHTMAPFUSER_INCLUDED
+#define HEIGHTMAPFUSER_INCLUDED
+
+#include <vector>
+#include <Threads/TripleBuffer.h>
+#include <Kinect/FrameBuffer.h>
+
+#include "Types.h"
+#include "DepthFramePipeline.h"
+
+/* Forward declarations: */
+namespace Misc {
+template <class ParameterParam>
+class FunctionCall;
+}
+
+class HeightMapFuser:public DepthFramePipeline::Stage
+	{
+	/* Embedded classes: */
+	public:
+	typedef Misc::FunctionCall<const Kinect::FrameBuffer&> OutputFrameFunction; // Type for functions called when a new fused height map is ready
+	
+	private:
+	struct Camera // Structure holding the state of one of the fused cameras
+		{
+		/* Elements: */
+		public:
+		unsigned int frameSize[2]; // Width and height of the camera's filtered depth frames
+		float gridProjection[16]; // Projective transformation from the camera's depth image space into height map grid space, as a row-major 4x4 matrix
+		float* blendWeights[2]; // Blend weights of the columns and rows of the camera's depth frames
+		Threads::TripleBuffer<Kinect::FrameBuffer> frames; // Triple buffer of filtered frames received via receiveFrame
+		Kinect::FrameBuffer frame; // New filtered frame to be splatted in the current fused frame, or an invalid frame if the previous splat is still current
+		bool haveSplat; // Flag whether the accumulation buffer holds a splatted frame
+		float* accumulation; // Buffer of interleaved sums of weights and weighted elevations splatted into each height map cell
+		
+		/* Constructors and destructors: */
+		Camera(const unsigned int sFrameSize[2],const float sGridProjection[16],unsigned int gridSize);
+		~Camera(void);
+		};
+	
+	/* Elements: */
+	unsigned int size[2]; // Width and height of the height map grid
+	PTransform gridTransform; // Transformation from camera space into height map grid space, with the grid's x and y axes in the base plane and elevation above the base plane as z
+	PTransform depthProjection; // Transformation from height map grid space into camera space
+	float blendWidth; // Distance from the edges of each camera's depth frames in pixels over which blend weights ramp up from zero to one
+	std::vector<Camera*> cameras; // List of fused cameras; the first camera's frames are the stage's input frames
+	float* heightMap; // The current fused height map
+	unsigned int numDirtyTiles[2]; // Width and height of the grid of dirty tiles
+	unsigned int frameIndex; // Index of the most recently produced output frame
+	unsigned int* tileChangeIndices; // Index of the most recent output frame that changed any cell in each dirty tile
+	unsigned int numStageBands; // Number of bands of dirty tile rows into which the combination pass of the current frame is split
+	Kinect::FrameBuffer* stageOutputFrame; // Output frame currently written as a pipeline stage
+	Threads::TripleBuffer<Kinect::FrameBuffer> outputFrames; // Triple buffer of output frames
+	OutputFrameFunction* outputFrameFunction; // Function called when a new output frame is ready
+	
+	/* Private methods: */
+	void updateBlendWeights(Camera& camera); // Recalculates the given camera's per-column and per-row blend weights
+	void splatFrame(Camera& camera); // Splats the given camera's current frame into its accumulation buffer
+	void combineRows(unsigned int rowBegin,unsigned int rowEnd); // Combines all cameras' accumulation buffers into the given band of rows of the height map and the current output frame
+	
+	/* Constructors and destructors: */
+	public:
+	HeightMapFuser(const Plane& basePlane,const Point basePlaneCorners[4],Scalar cellSize); // Creates a fuser for a height map of the given cell size covering the base plane rectangle spanned by the given corners
+	private:
+	HeightMapFuser(const HeightMapFuser& source); // Prohibit copy constructor
+	HeightMapFuser& operator=(const HeightMapFuser& source); // Prohibit assignment operator
+	public:
+	virtual ~HeightMapFuser(void);
+	
+	/* Methods from DepthFramePipeline::Stage: */
+	virtual unsigned int startFrame(const Kinect::FrameBuffer& frame,unsigned int numThreads);
+	virtual unsigned int getNumBands(unsigned int pass) const;
+	virtual void processBand(unsigned int pass,unsigned int bandIndex,unsigned int numBands);
+	virtual Kinect::FrameBuffer finishFrame(void);
+	
+	/* New methods: */
+	const unsigned int* getSize(void) const // Returns the width and height of the height map grid
+		{
+		return size;
+		}
+	const PTransform& getDepthProjection(void) const // Returns the transformation from height map grid space, with elevations as depth values, into camera space
+		{
+		return depthProjection;
+		}
+	void setBlendWidth(float newBlendWidth); // Sets the distance from the edges of each camera's depth frames in pixels over which blend weights ramp up; must not be called while frames are processed
+	unsigned int addCamera(const unsigned int frameSize[2],const PTransform& cameraDepthProjection); // Adds a camera with the given frame size and transformation from its depth image space into camera space; returns the camera's index; must be called before frames are processed
+	void setOutputFrameFunction(OutputFrameFunction* newOutputFrameFunction); // Sets the output function; adopts given functor object
+	void receiveFrame(const Kinect::FrameBuffer& newFrame,unsigned int cameraIndex); // Called to receive a new filtered frame from the camera of the given index other than the first
+	};
+
+#endif
@@ -0,0 +1,131 @@
+/***********************************************************************
+LatencyMonitor - Class to collect per-frame latencies of the stages of
+the Augmented Reality Sandbox's processing pipeline from multiple threads
+without locking, and to calculate rolling statistics over them.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "LatencyMonitor.h"
+
+#include <algorithm>
+#include <iostream>
+#include <Math/Math.h>
+
+/*************************************
+Methods of class LatencyMonitor::Ring:
+*************************************/
+
+LatencyMonitor::Ring::Ring(void)
+	:numWrites(0),resetIndex(0)
+	{
+	for(unsigned int i=0;i<ringSize;++i)
+		{
+		samples[i].sequence=0;
+		samples[i].latency=0.0;
+		}
+	}
+
+/********************************
+Methods of class LatencyMonitor:
+********************************/
+
+LatencyMonitor::LatencyMonitor(void)
+	{
+	}
+
+const char* LatencyMonitor::getStageName(LatencyMonitor::Stage stage)
+	{
+	static const char* stageNames[NUM_STAGES]=
+		{
+		"Camera","Filter","Hand-off","Upload","Water","Swap","End-to-end"
+		};
+	return stageNames[stage];
+	}
+
+void LatencyMonitor::addSample(LatencyMonitor::Stage stage,double latency)
+	{
+	Ring& ring=rings[stage];
+	
+	/* Claim the next slot in the ring; concurrent writers get different slots: */
+	unsigned int index=ring.numWrites.postAdd(1U);
+	Sample& sample=ring.samples[index&(ringSize-1U)];
+	
+	/* Invalidate the slot while it is being written, so that readers skip it: */
+	sample.sequence=0U;
+	__sync_synchronize();
+	sample.latency=latency;
+	__sync_synchronize();
+	sample.sequence=index+1U;
+	}
+
+LatencyMonitor::Statistics LatencyMonitor::getStatistics(LatencyMonitor::Stage stage) const
+	{
+	const Ring& ring=rings[stage];
+	
+	/* Determine the range of samples still in the ring: */
+	unsigned int end=ring.numWrites.get();
+	unsigned int begin=end-ring.resetIndex<=ringSize?ring.resetIndex:end-ringSize;
+	
+	/* Copy all samples that are not currently being overwritten: */
+	double latencies[ringSize];
+	unsigned int numLatencies=0;
+	for(unsigned int index=begin;index!=end;++index)
+		{
+		const Sample& sample=ring.samples[index&(ringSize-1U)];
+		unsigned int sequence=sample.sequence;
+		__sync_synchronize();
+		double latency=sample.latency;
+		__sync_synchronize();
+		if(sequence==index+1U&&sample.sequence==sequence)
+			latencies[numLatencies++]=latency;
+		}
+	
+	/* Calculate the statistics: */
+	Statistics result;
+	result.numSamples=numLatencies;
+	result.min=result.mean=result.p99=0.0;
+	if(numLatencies>0)
+		{
+		std::sort(latencies,latencies+numLatencies);
+		result.min=latencies[0];
+		double sum=0.0;
+		for(unsigned int i=0;i<numLatencies;++i)
+			sum+=latencies[i];
+		result.mean=sum/double(numLatencies);
+		result.p99=latencies[(unsigned int)(Math::floor(0.99*double(numLatencies-1)+0.5))];
+		}
+	
+	return result;
+	}
+
+void LatencyMonitor::reset(void)
+	{
+	/* Ignore all samples written before now: */
+	for(int stage=0;stage<NUM_STAGES;++stage)
+		rings[stage].resetIndex=rings[stage].numWrites.get();
+	}
+
+void LatencyMonitor::printStatistics(std::ostream& os) const
+	{
+	for(int stage=0;stage<NUM_STAGES;++stage)
+		{
+		Statistics stats=getStatistics(Stage(stage));
+		os<<getStageName(Stage(stage))<<": "<<stats.numSamples<<" samples, min "<<stats.min*1000.0<<" ms, mean "<<stats.mean*1000.0<<" ms, 99% "<<stats.p99*1000.0<<" ms"<<std::endl;
+		}
+	}
@@ -0,0 +1,102 @@
+/***********************************************************************
+LatencyMonitor - Class to collect per-frame latencies of the stages of
+the Augmented Reality Sandbox's processing pipeline from multiple threads
+without locking, and to calculate rolling statistics over them.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef LATENCYMONITOR_INCLUDED
+#define LATENCYMONITOR_INCLUDED
+
+#include <iosfwd>
+#include <Threads/Atomic.h>
+#include <Realtime/Time.h>
+
+class LatencyMonitor
+	{
+	/* Embedded classes: */
+	public:
+	enum Stage // Enumerated type for monitored pipeline stages
+		{
+		CAMERA_DELIVERY=0, // From the camera's time stamp to the raw frame's arrival in the application
+		FRAME_FILTER, // From the raw frame's arrival to the frame filter's output
+		FRAME_HANDOFF, // From the frame filter's output to the main loop picking it up from the triple buffer
+		DEPTH_UPLOAD, // Uploading the new frame's changed parts into the depth texture
+		WATER_SIMULATION, // Updating the bathymetry and running the water simulation steps for one frame
+		PROJECTOR_SWAP, // From the end of rendering to the start of the next frame, including the buffer swap
+		END_TO_END, // From the raw frame's arrival to the end of the first buffer swap showing it
+		NUM_STAGES
+		};
+	
+	struct Statistics // Structure for rolling statistics over the most recent samples of a stage
+		{
+		/* Elements: */
+		public:
+		unsigned int numSamples; // Number of samples the statistics are based on
+		double min,mean,p99; // Minimum, mean, and 99th percentile latency in seconds
+		};
+	
+	static const unsigned int ringSize=256; // Number of most recent samples kept per stage; must be a power of two
+	
+	private:
+	struct Sample // Structure for a single latency sample in a ring
+		{
+		/* Elements: */
+		public:
+		volatile unsigned int sequence; // One plus the write index of the sample, or zero while the sample is being written
+		volatile double latency; // Sample's latency in seconds
+		};
+	
+	struct Ring // Structure for a ring of samples of a single stage
+		{
+		/* Elements: */
+		public:
+		Threads::Atomic<unsigned int> numWrites; // Total number of samples ever written into the ring
+		volatile unsigned int resetIndex; // Write index before which samples are ignored
+		Sample samples[ringSize]; // The ring's samples
+		
+		/* Constructors and destructors: */
+		Ring(void);
+		};
+	
+	/* Elements: */
+	Realtime::TimePointMonotonic timeBase; // Time point from which all times are measured; shared with the 3D camera
+	Ring rings[NUM_STAGES]; // One sample ring per monitored stage
+	
+	/* Constructors and destructors: */
+	public:
+	LatencyMonitor(void); // Creates an empty latency monitor with the current time as time base
+	
+	/* Methods: */
+	static const char* getStageName(Stage stage); // Returns a human-readable name for the given stage
+	const Realtime::TimePointMonotonic& getTimeBase(void) const // Returns the monitor's time base
+		{
+		return timeBase;
+		}
+	double getTime(void) const // Returns the current time in seconds since the time base
+		{
+		return double(Realtime::TimePointMonotonic()-timeBase);
+		}
+	void addSample(Stage stage,double latency); // Adds a latency sample to the given stage; can be called from any thread without locking
+	Statistics getStatistics(Stage stage) const; // Returns rolling statistics over the most recent samples of the given stage
+	void reset(void); // Discards all samples collected so far
+	void printStatistics(std::ostream& os) const; // Writes the current statistics of all stages to the given stream, one stage per line
+	};
+
+#endif
@@ -26,90 +26,6 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Geometry/HVector.h>
 #include <Geometry/Plane.h>
 
-#include "FindBlobs.h"
-
-template <>
-class BlobProperty<unsigned short> // Class to calculate the 3D centroid of a blob in depth image space
-	{
-	/* Elements: */
-	private:
-	double pxs,pys,pzs; // Accumulated components of centroid
-	size_t numPixels; // Number of accumulated pixels
-	
-	/* Constructors and destructors: */
-	public:
-	BlobProperty(void)
-		:pxs(0.0),pys(0.0),pzs(0.0),
-		 numPixels(0)
-		{
-		}
-	
-	/* Methods: */
-	void addPixel(unsigned int x,unsigned int y,const unsigned short& pixelValue)
-		{
-		pxs+=double(x);
-		pys+=double(y);
-		pzs+=double(pixelValue);
-		++numPixels;
-		}
-	void merge(const BlobProperty& other)
-		{
-		pxs+=other.pxs;
-		pys+=other.pys;
-		pzs+=other.pzs;
-		numPixels+=other.numPixels;
-		}
-	size_t getNumPixels(void) const
-		{
-		return numPixels;
-		}
-	Geometry::Point<double,3> calcCentroid(void) const // Returns the centroid of the blob in depth image space
-		{
-		return Geometry::Point<double,3>(pxs/double(numPixels),pys/double(numPixels),pzs/double(numPixels));
-		}
-	};
-
-template <>
-class BlobProperty<float> // Class to calculate the 3D centroid of a blob in depth image space
-	{
-	/* Elements: */
-	private:
-	double pxs,pys,pzs; // Accumulated components of centroid
-	size_t numPixels; // Number of accumulated pixels
-	
-	/* Constructors and destructors: */
-	public:
-	BlobProperty(void)
-		:pxs(0.0),pys(0.0),pzs(0.0),
-		 numPixels(0)
-		{
-		}
-	
-	/* Methods: */
-	void addPixel(unsigned int x,unsigned int y,const float& pixelValue)
-		{
-		pxs+=double(x);
-		pys+=double(y);
-		pzs+=double(pixelValue);
-		++numPixels;
-		}
-	void merge(const BlobProperty& other)
-		{
-		pxs+=other.pxs;
-		pys+=other.pys;
-		pzs+=other.pzs;
-		numPixels+=other.numPixels;
-		}
-	size_t getNumPixels(void) const
-		{
-		return numPixels;
-		}
-	Geometry::Point<double,3> calcCentroid(void) const // Returns the centroid of the blob in depth image space
-		{
-		return Geometry::Point<double,3>(pxs/double(numPixels),pys/double(numPixels),pzs/double(numPixels));
-		}
-	};
-
 class ValidPixelProperty // Functor class to identify valid pixels in raw depth frames
 	{
 	/* Elements: */
@@ -202,27 +118,31 @@ class ValidPixelProperty // Functor class to identify valid pixels in raw depth
 Methods of class RainMaker:
 **************************/
 
-template <class DepthPixelParam>
+template <class BlobExtractorParam>
 inline
-void RainMaker::extractBlobs(const Kinect::FrameBuffer& depthFrame,const ValidPixelProperty& vpp,RainMaker::BlobList& blobsCc)
+void RainMaker::extractBlobs(BlobExtractorParam& blobExtractor,const Kinect::FrameBuffer& depthFrame,const ValidPixelProperty& vpp,RainMaker::BlobList& blobsCc)
 	{
+	typedef typename BlobExtractorParam::Blob DepthBlob;
+	
 	/* Extract raw blobs from the depth frame: */
-	std::vector< ::Blob<DepthPixelParam> > blobsDic=findBlobs(depthSize,depthFrame.getData<DepthPixelParam>(),vpp);
+	typename DepthBlob::Creator blobCreator;
+	Images::BlobMergeChecker<typename DepthBlob::Pixel> mergeChecker;
+	const std::vector<DepthBlob>& blobsDic=blobExtractor.extractBlobs(depthFrame.getData<typename DepthBlob::Pixel>(),vpp,mergeChecker,blobCreator);
 	
 	/* Transform all blobs larger than the threshold to camera space: */
 	blobsCc.reserve(blobsDic.size());
-	for(typename std::vector< ::Blob<DepthPixelParam> >::const_iterator bIt=blobsDic.begin();bIt!=blobsDic.end();++bIt)
-		if(bIt->max[0]-bIt->min[0]>=minBlobSize&&bIt->max[1]-bIt->min[1]>=minBlobSize)
+	for(typename std::vector<DepthBlob>::const_iterator bIt=blobsDic.begin();bIt!=blobsDic.end();++bIt)
+		if(int(bIt->bbMax[0]-bIt->bbMin[0])+1>=minBlobSize&&int(bIt->bbMax[1]-bIt->bbMin[1])+1>=minBlobSize)
 			{
 			Blob blobCc;
-			Point centroidDic=bIt->blobProperty.calcCentroid();
+			Point centroidDic=bIt->calcCentroid();
 			blobCc.centroid=depthProjection.transform(centroidDic);
 			
 			/* Estimate the radius of the blob in camera space (this is admittedly ad-hoc): */
-			double radiusDic=double(bIt->max[0]-bIt->min[0])*0.5;
-			if(radiusDic>(bIt->max[1]-bIt->min[1])*0.5)
+			double radiusDic=double(bIt->bbMax[0]-bIt->bbMin[0]+1)*0.5;
+			if(radiusDic>double(bIt->bbMax[1]-bIt->bbMin[1]+1)*0.5)
 				{
-				radiusDic=(bIt->max[1]-bIt->min[1])*0.5;
+				radiusDic=double(bIt->bbMax[1]-bIt->bbMin[1]+1)*0.5;
 				blobCc.radius=Geometry::dist(depthProjection.transform(Point(centroidDic[0],centroidDic[1]+radiusDic,centroidDic[2])),blobCc.centroid);
 				}
 			else
@@ -233,13 +153,36 @@ void RainMaker::extractBlobs(const Kinect::FrameBuffer& depthFrame,const ValidPi
 			}
 	}
 
+void RainMaker::detectObjects(const Kinect::FrameBuffer& depthFrame,const Kinect::FrameBuffer& colorFrame,RainMaker::BlobList& blobsCc)
+	{
+	/* Create a pixel validity decider using the color frame, if any: */
+	ValidPixelProperty vpp(minPlane,maxPlane,colorDepthHomography,colorSize);
+	vpp.setColorFrame(colorFrame.getData<unsigned char>());
+	
+	/* Detect all objects in the depth frame between the min and max planes: */
+	if(depthIsFloat)
+		{
+		if(floatDepthBlobExtractor==0)
+			{
+			floatDepthBlobExtractor=new FloatDepthBlobExtractor(depthSize);
+			floatDepthBlobExtractor->setNumThreads(numBlobExtractionThreads);
+			}
+		extractBlobs(*floatDepthBlobExtractor,depthFrame,vpp,blobsCc);
+		}
+	else
+		{
+		if(rawDepthBlobExtractor==0)
+			{
+			rawDepthBlobExtractor=new RawDepthBlobExtractor(depthSize);
+			rawDepthBlobExtractor->setNumThreads(numBlobExtractionThreads);
+			}
+		extractBlobs(*rawDepthBlobExtractor,depthFrame,vpp,blobsCc);
+		}
+	}
+
 void* RainMaker::detectionThreadMethod(void)
 	{
 	unsigned int lastInputDepthFrameVersion=0;
-	unsigned int lastInputColorFrameVersion=0;
-	
-	/* Create a pixel validity decider: */
-	ValidPixelProperty vpp(minPlane,maxPlane,colorDepthHomography,colorSize);
 	
 	while(true)
 		{
@@ -247,8 +190,8 @@ void* RainMaker::detectionThreadMethod(void)
 		{
 		Threads::MutexCond::Lock inputLock(inputCond);
 		
-		/* Wait until a new depth and color frame arrive, or the program shuts down: */
-		while(runDetectionThread&&(lastInputDepthFrameVersion==inputDepthFrameVersion||lastInputColorFrameVersion==inputColorFrameVersion))
+		/* Wait until a new depth frame arrives, or the program shuts down: */
+		while(runDetectionThread&&lastInputDepthFrameVersion==inputDepthFrameVersion)
 			inputCond.wait(inputLock);
 		
 		/* Bail out if the program is shutting down: */
@@ -259,20 +202,13 @@ void* RainMaker::detectionThreadMethod(void)
 		depthFrame=inputDepthFrame;
 		colorFrame=inputColorFrame;
 		lastInputDepthFrameVersion=inputDepthFrameVersion;
-		lastInputColorFrameVersion=inputColorFrameVersion;
 		}
 		
 		if(outputBlobsFunction!=0)
 			{
-			/* Set the most recent color frame in the pixel validator: */
-			vpp.setColorFrame(colorFrame.getData<unsigned char>());
-			
-			/* Detect all objects in the depth frame between the min and max planes: */
+			/* Detect all objects in the depth frame: */
 			BlobList blobsCc;
-			if(depthIsFloat)
-				extractBlobs<float>(depthFrame,vpp,blobsCc);
-			else
-				extractBlobs<unsigned short>(depthFrame,vpp,blobsCc);
+			detectObjects(depthFrame,colorFrame,blobsCc);
 			
 			/* Call the callback function: */
 			(*outputBlobsFunction)(blobsCc);
@@ -284,6 +220,7 @@ void* RainMaker::detectionThreadMethod(void)
 
 RainMaker::RainMaker(const unsigned int sDepthSize[2],const unsigned int sColorSize[2],const RainMaker::PTransform& sDepthProjection,const RainMaker::PTransform& sColorProjection,const RainMaker::Plane& basePlane,double minElevation,double maxElevation,int sMinBlobSize)
 	:depthIsFloat(false),
+	 numBlobExtractionThreads(1),rawDepthBlobExtractor(0),floatDepthBlobExtractor(0),
 	 outputBlobsFunction(0)
 	{
 	/* Remember the frame sizes: */
@@ -330,30 +267,70 @@ RainMaker::RainMaker(const unsigned int sDepthSize[2],const unsigned int sColorS
 	/* Initialize the blob detector: */
 	minBlobSize=sMinBlobSize;
 	
-	/* Start the object detection thread: */
-	runDetectionThread=true;
-	detectionThread.start(this,&RainMaker::detectionThreadMethod);
+	/* The object detection thread is started when the first depth frame arrives: */
+	runDetectionThread=false;
 	}
 
 RainMaker::~RainMaker(void)
 	{
-	/* Shut down the object detection thread: */
+	/* Shut down the object detection thread if it was started: */
 	{
 	Threads::MutexCond::Lock inputLock(inputCond);
 	runDetectionThread=false;
 	inputCond.signal();
 	}
-	detectionThread.join();
+	if(!detectionThread.isJoined())
+		detectionThread.join();
 	
 	/* Release all allocated resources: */
+	delete rawDepthBlobExtractor;
+	delete floatDepthBlobExtractor;
 	delete outputBlobsFunction;
 	}
 
+unsigned int RainMaker::startFrame(const Kinect::FrameBuffer& frame,unsigned int numThreads)
+	{
+	/* Skip the frame if nobody is listening: */
+	if(outputBlobsFunction==0)
+		return 0;
+	
+	/* Work on the new depth frame and the most recent color frame: */
+	stageDepthFrame=frame;
+	{
+	Threads::MutexCond::Lock inputLock(inputCond);
+	stageColorFrame=inputColorFrame;
+	}
+	
+	return 1;
+	}
+
+void RainMaker::processBand(unsigned int pass,unsigned int bandIndex,unsigned int numBands)
+	{
+	/* Detect all objects in the entire depth frame: */
+	stageBlobs.clear();
+	detectObjects(stageDepthFrame,stageColorFrame,stageBlobs);
+	}
+
+Kinect::FrameBuffer RainMaker::finishFrame(void)
+	{
+	/* Release the input frames and call the callback function: */
+	stageDepthFrame=Kinect::FrameBuffer();
+	stageColorFrame=Kinect::FrameBuffer();
+	(*outputBlobsFunction)(stageBlobs);
+	
+	return Kinect::FrameBuffer();
+	}
+
 void RainMaker::setDepthIsFloat(bool newDepthIsFloat)
 	{
 	depthIsFloat=newDepthIsFloat;
 	}
 
+void RainMaker::setNumBlobExtractionThreads(unsigned int newNumBlobExtractionThreads)
+	{
+	numBlobExtractionThreads=newNumBlobExtractionThreads;
+	}
+
 void RainMaker::setOutputBlobsFunction(RainMaker::OutputBlobsFunction* newOutputBlobsFunction)
 	{
 	delete outputBlobsFunction;
@@ -368,6 +345,13 @@ void RainMaker::receiveRawDepthFrame(const Kinect::FrameBuffer& newDepthFrame)
 	inputDepthFrame=newDepthFrame;
 	++inputDepthFrameVersion;
 	
+	/* Start the object detection thread on the first depth frame: */
+	if(!runDetectionThread)
+		{
+		runDetectionThread=true;
+		detectionThread.start(this,&RainMaker::detectionThreadMethod);
+		}
+	
 	/* Signal the background thread: */
 	inputCond.signal();
 	}
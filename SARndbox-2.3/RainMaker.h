@@ -29,8 +29,12 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Geometry/Point.h>
 #include <Geometry/Matrix.h>
 #include <Geometry/ProjectiveTransformation.h>
+#include <Images/ExtractBlobs.h>
 #include <Kinect/FrameBuffer.h>
 
+#include "BlobExtractor.h"
+#include "DepthFramePipeline.h"
+
 /* Forward declarations: */
 namespace Misc {
 template <class ParameterParam>
@@ -42,7 +46,7 @@ class Plane;
 }
 class ValidPixelProperty;
 
-class RainMaker
+class RainMaker:public DepthFramePipeline::Stage
 	{
 	/* Embedded classes: */
 	public:
@@ -62,8 +66,52 @@ class RainMaker
 	typedef std::vector<Blob> BlobList; // Type for lists of detected objects
 	typedef Misc::FunctionCall<const BlobList&> OutputBlobsFunction; // Type for functions called when a new object list has been extracted
 	
-	/* Elements: */
 	private:
+	template <class DepthPixelParam>
+	struct DepthBlob:public Images::BboxBlob<Images::Blob<DepthPixelParam> > // Structure to calculate 3D centroids of blobs in depth image space
+		{
+		/* Embedded classes: */
+		public:
+		typedef Images::BboxBlob<Images::Blob<DepthPixelParam> > Base;
+		typedef typename Base::Pixel Pixel;
+		typedef typename Base::Creator Creator;
+		
+		/* Elements: */
+		double pxs,pys,pzs; // Accumulated components of centroid
+		
+		/* Constructors and destructors: */
+		DepthBlob(unsigned int x,unsigned int y,const Pixel& pixel,const Creator& creator)
+			:Base(x,y,pixel,creator),
+			 pxs(double(x)),pys(double(y)),pzs(double(pixel))
+			{
+			}
+		
+		/* Methods: */
+		void addPixel(unsigned int x,unsigned int y,const Pixel& pixel,const Creator& creator)
+			{
+			Base::addPixel(x,y,pixel,creator);
+			pxs+=double(x);
+			pys+=double(y);
+			pzs+=double(pixel);
+			}
+		void merge(const DepthBlob& other,const Creator& creator)
+			{
+			Base::merge(other,creator);
+			pxs+=other.pxs;
+			pys+=other.pys;
+			pzs+=other.pzs;
+			}
+		Point calcCentroid(void) const // Returns the centroid of the blob in depth image space
+			{
+			double numPixels=double(this->numPixels);
+			return Point(pxs/numPixels,pys/numPixels,pzs/numPixels);
+			}
+		};
+	
+	typedef BlobExtractor<DepthBlob<RawDepth>,ValidPixelProperty,Images::BlobMergeChecker<RawDepth> > RawDepthBlobExtractor; // Type for blob extractors processing raw depth frames
+	typedef BlobExtractor<DepthBlob<float>,ValidPixelProperty,Images::BlobMergeChecker<float> > FloatDepthBlobExtractor; // Type for blob extractors processing float depth frames
+	
+	/* Elements: */
 	unsigned int depthSize[2]; // Width and height of incoming depth frames
 	bool depthIsFloat; // Flag whether the incoming depth frames have float pixel values
 	unsigned int colorSize[2]; // Width and height of incoming color frames
@@ -73,30 +121,43 @@ class RainMaker
 	float minPlane[4]; // Plane equation of the lower bound of valid depth values in depth image space
 	float maxPlane[4]; // Plane equation of the upper bound of valid depth values in depth image space
 	int minBlobSize; // Minimum size of objects to be detected
+	unsigned int numBlobExtractionThreads; // Number of threads extracting blobs from each depth frame
+	RawDepthBlobExtractor* rawDepthBlobExtractor; // Blob extractor for raw depth frames, created on demand
+	FloatDepthBlobExtractor* floatDepthBlobExtractor; // Blob extractor for float depth frames, created on demand
 	Threads::MutexCond inputCond; // Condition variable to signal arrival of a new input frame
 	Kinect::FrameBuffer inputDepthFrame; // The most recent input depth frame
 	unsigned int inputDepthFrameVersion; // Version number of input depth frame
 	Kinect::FrameBuffer inputColorFrame; // The most recent input color frame
 	unsigned int inputColorFrameVersion; // Version number of input color frame
 	volatile bool runDetectionThread; // Flag to keep the background object detection thread running
-	Threads::Thread detectionThread; // The background object detection thread
+	Threads::Thread detectionThread; // The background object detection thread, started when the first raw depth frame is received
+	Kinect::FrameBuffer stageDepthFrame; // Raw depth frame currently processed as a pipeline stage
+	Kinect::FrameBuffer stageColorFrame; // Most recent color frame at the start of the current pipeline frame
+	BlobList stageBlobs; // List of objects detected in the current pipeline frame
 	OutputBlobsFunction* outputBlobsFunction; // Function called when a new (potentially empty) object list has been extracted
 	
 	/* Private methods: */
-	template <class DepthPixelParam>
-	void extractBlobs(const Kinect::FrameBuffer& depthFrame,const ValidPixelProperty& vpp,BlobList& blobsCc);
+	template <class BlobExtractorParam>
+	void extractBlobs(BlobExtractorParam& blobExtractor,const Kinect::FrameBuffer& depthFrame,const ValidPixelProperty& vpp,BlobList& blobsCc); // Extracts objects from the given depth frame and appends them to the given list in camera space
+	void detectObjects(const Kinect::FrameBuffer& depthFrame,const Kinect::FrameBuffer& colorFrame,BlobList& blobsCc); // Detects all objects in the given depth frame, using the given optional color frame, and appends them to the given list in camera space
 	void* detectionThreadMethod(void); // Method for the object detection thread
 	
 	/* Constructors and destructors: */
 	public:
 	RainMaker(const unsigned int sDepthSize[2],const unsigned int sColorSize[2],const PTransform& sDepthProjection,const PTransform& sColorProjection,const Plane& basePlane,double minElevation,double maxElevation,int sMinBlobSize); // Creates an object detector for frames of the given size and the given range of elevation values relative to the given base plane in camera space
-	~RainMaker(void); // Destroys the object detector
+	virtual ~RainMaker(void); // Destroys the object detector
+	
+	/* Methods from DepthFramePipeline::Stage: */
+	virtual unsigned int startFrame(const Kinect::FrameBuffer& frame,unsigned int numThreads);
+	virtual void processBand(unsigned int pass,unsigned int bandIndex,unsigned int numBands);
+	virtual Kinect::FrameBuffer finishFrame(void);
 	
-	/* Methods: */
+	/* New methods: */
 	void setDepthIsFloat(bool newDepthIsFloat); // Sets whether incoming depth frames have float pixel values
+	void setNumBlobExtractionThreads(unsigned int newNumBlobExtractionThreads); // Sets the number of threads extracting blobs from each depth frame; must be called before the first frame is received
 	void setOutputBlobsFunction(OutputBlobsFunction* newOutputBlobsFunction); // Sets the output function; adopts given functor object
-	void receiveRawDepthFrame(const Kinect::FrameBuffer& newDepthFrame); // Called to receive a new raw depth frame
-	void receiveRawColorFrame(const Kinect::FrameBuffer& newColorFrame); // Called to receive a new raw color frame
+	void receiveRawDepthFrame(const Kinect::FrameBuffer& newDepthFrame); // Called to receive a new raw depth frame; must not be mixed with use as a pipeline stage
+	void receiveRawColorFrame(const Kinect::FrameBuffer& newColorFrame); // Called to receive a new raw color frame; color frames are optional
 	};
 
 #endif
@@ -0,0 +1,759 @@
+/***********************************************************************
+SARndboxBench - Utility to replay a pre-recorded depth stream through
+the complete Augmented Reality Sandbox processing pipeline in an
+off-screen OpenGL context as fast as possible, to measure per-stage
+latencies and overall frame rates without a live camera or projector.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <X11/Xlib.h>
+#include <Misc/Timer.h>
+#include <Misc/ValueCoder.h>
+#include <Misc/FunctionCalls.h>
+#include <IO/File.h>
+#include <IO/OpenFile.h>
+#include <IO/ValueSource.h>
+#include <Math/Math.h>
+#include <Math/Constants.h>
+#include <Geometry/Point.h>
+#include <Geometry/Box.h>
+#include <Geometry/OrthonormalTransformation.h>
+#include <Geometry/GeometryValueCoders.h>
+#include <GL/gl.h>
+#include <GL/GLContext.h>
+#include <GL/GLContextData.h>
+#include <GL/GLGeometryWrappers.h>
+#include <GL/Extensions/GLARBVertexShader.h>
+#include <GL/Extensions/GLEXTFramebufferObject.h>
+#include <Kinect/FrameBuffer.h>
+#include <Kinect/FrameSource.h>
+#include <Kinect/FileFrameSource.h>
+
+#include "Types.h"
+#include "FrameFilter.h"
+#include "DepthImageRenderer.h"
+#include "SurfaceRenderer.h"
+#include "WaterTable2.h"
+
+#include "Config.h"
+
+typedef Geometry::Box<Scalar,3> Box;
+typedef Geometry::OrthonormalTransformation<Scalar,3> ONTransform;
+
+class StageStats // Class to accumulate per-frame latencies of a pipeline stage
+	{
+	/* Elements: */
+	private:
+	std::string name; // Name of the pipeline stage
+	std::vector<double> times; // Per-frame processing times in seconds
+	
+	/* Private methods: */
+	double getPercentile(const std::vector<double>& sortedTimes,double percentile) const // Returns the given percentile from the given sorted list of times
+		{
+		size_t index=size_t(Math::floor(percentile*double(sortedTimes.size()-1)+0.5));
+		return sortedTimes[index];
+		}
+	
+	/* Constructors and destructors: */
+	public:
+	StageStats(const char* sName)
+		:name(sName)
+		{
+		}
+	
+	/* Methods: */
+	void addFrame(double time) // Adds a frame's processing time
+		{
+		times.push_back(time);
+		}
+	double getTotalTime(void) const // Returns the total processing time of all frames
+		{
+		double result=0.0;
+		for(std::vector<double>::const_iterator tIt=times.begin();tIt!=times.end();++tIt)
+			result+=*tIt;
+		return result;
+		}
+	void print(void) const // Prints the accumulated statistics and a latency histogram with logarithmic bins
+		{
+		if(times.empty())
+			return;
+		
+		/* Calculate order statistics: */
+		std::vector<double> sortedTimes=times;
+		std::sort(sortedTimes.begin(),sortedTimes.end());
+		std::cout<<name<<": min "<<sortedTimes.front()*1000.0<<" ms, mean "<<getTotalTime()*1000.0/double(times.size())<<" ms, median "<<getPercentile(sortedTimes,0.5)*1000.0;
+		std::cout<<" ms, 95% "<<getPercentile(sortedTimes,0.95)*1000.0<<" ms, 99% "<<getPercentile(sortedTimes,0.99)*1000.0<<" ms, max "<<sortedTimes.back()*1000.0<<" ms"<<std::endl;
+		
+		/* Sort the times into bins of doubling width, starting at one microsecond: */
+		std::vector<size_t> bins;
+		for(std::vector<double>::const_iterator tIt=sortedTimes.begin();tIt!=sortedTimes.end();++tIt)
+			{
+			int bin=*tIt>1.0e-6?int(Math::floor(Math::log(*tIt*1.0e6)/Math::log(2.0))):0;
+			if(bins.size()<=size_t(bin))
+				bins.resize(bin+1,0);
+			++bins[bin];
+			}
+		size_t maxBinSize=*std::max_element(bins.begin(),bins.end());
+		
+		/* Print all bins between the minimum and maximum time: */
+		size_t firstBin;
+		for(firstBin=0;bins[firstBin]==0;++firstBin)
+			;
+		std::ios::fmtflags oldFlags=std::cout.flags();
+		std::cout.setf(std::ios::fixed);
+		std::streamsize oldPrecision=std::cout.precision(3);
+		for(size_t bin=firstBin;bin<bins.size();++bin)
+			{
+			std::cout<<"  ["<<std::setw(9)<<double(1U<<bin)*1.0e-3<<" ms, "<<std::setw(9)<<double(2U<<bin)*1.0e-3<<" ms): "<<std::setw(6)<<bins[bin]<<' ';
+			size_t barLength=(bins[bin]*50+maxBinSize-1)/maxBinSize;
+			for(size_t i=0;i<barLength;++i)
+				std::cout<<'#';
+			std::cout<<std::endl;
+			}
+		std::cout.precision(oldPrecision);
+		std::cout.flags(oldFlags);
+		}
+	};
+
+struct RainDisk // Structure describing a rain disk to continuously add water to the water table
+	{
+	/* Elements: */
+	public:
+	Point center; // Center of the rain disk in camera space
+	Vector x,y; // Axes of the rain disk, scaled by its radius
+	GLfloat strength; // Rain strength in water table units
+	};
+
+void addRain(GLContextData& contextData,const RainDisk* rain) // Render function to add water to the water table
+	{
+	glPushAttrib(GL_ENABLE_BIT);
+	glDisable(GL_CULL_FACE);
+	
+	glVertexAttrib1fARB(1,rain->strength);
+	glBegin(GL_POLYGON);
+	for(int i=0;i<32;++i)
+		{
+		Scalar angle=Scalar(2)*Math::Constants<Scalar>::pi*Scalar(i)/Scalar(32);
+		glVertex(rain->center+rain->x*Math::cos(angle)+rain->y*Math::sin(angle));
+		}
+	glEnd();
+	
+	glPopAttrib();
+	}
+
+int main(int argc,char* argv[])
+	{
+	/* Parse the command line: */
+	const char* frameFilePrefix=0;
+	const char* displayName=0;
+	std::string sandboxLayoutFileName=CONFIG_CONFIGDIR;
+	sandboxLayoutFileName.push_back('/');
+	sandboxLayoutFileName.append(CONFIG_DEFAULTBOXLAYOUTFILENAME);
+	double elevationMin=-1000.0,elevationMax=1000.0;
+	unsigned int numAveragingSlots=30;
+	unsigned int minNumSamples=10;
+	unsigned int maxVariance=2;
+	float hysteresis=0.1f;
+	bool spatialFilter=true;
+	FrameFilter::SpatialFilterType spatialFilterType=FrameFilter::LEGACY_SPATIAL_FILTER;
+	unsigned int spatialFilterRadius=2;
+	float spatialFilterRangeSigma=2.0f;
+	FrameFilter::FilterKernel filterKernel=FrameFilter::getBestKernel();
+	unsigned int numFilterThreads=1;
+	bool compactStatistics=false;
+	unsigned int numDepthUploadBuffers=2;
+	bool packDepthTexture=false;
+	bool useWater=true;
+	unsigned int wtSize[2]={640,480};
+	double waterSpeed=1.0;
+	unsigned int waterMaxSteps=30;
+	WaterTable2::SimulationBackend waterSimulationBackend=WaterTable2::GPU_BACKEND;
+	unsigned int numWaterSimulationThreads=1;
+	unsigned int waterMultiRateLevels=0;
+	unsigned int waterMultiRateTileSize=32;
+	unsigned int waterDryCullingTileSize=0;
+	GLfloat waterDryCullingThreshold=0.001f;
+	bool waterGpuStepSize=false;
+	GLfloat rainStrength=0.25f;
+	double rainRadius=10.0;
+	double evaporationRate=0.0;
+	bool useContourLines=true;
+	GLfloat contourLineSpacing=0.75f;
+	bool pixelCornerContourLines=false;
+	GLfloat waterOpacity=2.0f;
+	GLsizei renderSize[2]={1024,768};
+	double frameTime=1.0/30.0;
+	size_t maxNumFrames=~size_t(0);
+	size_t numWarmupFrames=1;
+	for(int i=1;i<argc;++i)
+		{
+		if(argv[i][0]=='-')
+			{
+			if(strcasecmp(argv[i]+1,"display")==0)
+				{
+				++i;
+				displayName=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"slf")==0)
+				{
+				++i;
+				sandboxLayoutFileName=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"er")==0)
+				{
+				++i;
+				elevationMin=atof(argv[i]);
+				++i;
+				elevationMax=atof(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"nas")==0)
+				{
+				++i;
+				numAveragingSlots=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"sp")==0)
+				{
+				++i;
+				minNumSamples=atoi(argv[i]);
+				++i;
+				maxVariance=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"he")==0)
+				{
+				++i;
+				hysteresis=float(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"nsf")==0)
+				spatialFilter=false;
+			else if(strcasecmp(argv[i]+1,"sf")==0)
+				{
+				++i;
+				int type;
+				for(type=FrameFilter::LEGACY_SPATIAL_FILTER;type<=FrameFilter::BILATERAL_SPATIAL_FILTER;++type)
+					if(strcasecmp(argv[i],FrameFilter::getSpatialFilterTypeName(FrameFilter::SpatialFilterType(type)))==0)
+						break;
+				if(type>FrameFilter::BILATERAL_SPATIAL_FILTER)
+					{
+					std::cerr<<"Unknown spatial filter type "<<argv[i]<<std::endl;
+					return 1;
+					}
+				spatialFilterType=FrameFilter::SpatialFilterType(type);
+				++i;
+				spatialFilterRadius=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"sfrs")==0)
+				{
+				++i;
+				spatialFilterRangeSigma=float(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"ffk")==0)
+				{
+				++i;
+				int kernel;
+				for(kernel=FrameFilter::SCALAR_KERNEL;kernel<=FrameFilter::AVX2_KERNEL;++kernel)
+					if(strcasecmp(argv[i],FrameFilter::getKernelName(FrameFilter::FilterKernel(kernel)))==0)
+						break;
+				if(kernel>FrameFilter::AVX2_KERNEL||!FrameFilter::isKernelSupported(FrameFilter::FilterKernel(kernel)))
+					{
+					std::cerr<<"Unsupported frame filter kernel "<<argv[i]<<std::endl;
+					return 1;
+					}
+				filterKernel=FrameFilter::FilterKernel(kernel);
+				}
+			else if(strcasecmp(argv[i]+1,"fft")==0)
+				{
+				++i;
+				numFilterThreads=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"cfs")==0)
+				compactStatistics=true;
+			else if(strcasecmp(argv[i]+1,"dub")==0)
+				{
+				++i;
+				numDepthUploadBuffers=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"pdt")==0)
+				packDepthTexture=true;
+			else if(strcasecmp(argv[i]+1,"nw")==0)
+				useWater=false;
+			else if(strcasecmp(argv[i]+1,"wts")==0)
+				{
+				for(int j=0;j<2;++j)
+					{
+					++i;
+					wtSize[j]=(unsigned int)(atoi(argv[i]));
+					}
+				}
+			else if(strcasecmp(argv[i]+1,"ws")==0)
+				{
+				++i;
+				waterSpeed=atof(argv[i]);
+				++i;
+				waterMaxSteps=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"wsb")==0)
+				{
+				++i;
+				int backend;
+				for(backend=WaterTable2::GPU_BACKEND;backend<=WaterTable2::CPU_BACKEND;++backend)
+					if(strcasecmp(argv[i],WaterTable2::getSimulationBackendName(WaterTable2::SimulationBackend(backend)))==0)
+						break;
+				if(backend>WaterTable2::CPU_BACKEND)
+					{
+					std::cerr<<"Unknown water simulation backend "<<argv[i]<<std::endl;
+					return 1;
+					}
+				waterSimulationBackend=WaterTable2::SimulationBackend(backend);
+				}
+			else if(strcasecmp(argv[i]+1,"wst")==0)
+				{
+				++i;
+				numWaterSimulationThreads=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"wmr")==0)
+				{
+				++i;
+				waterMultiRateLevels=atoi(argv[i]);
+				++i;
+				waterMultiRateTileSize=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"wdc")==0)
+				{
+				++i;
+				waterDryCullingTileSize=atoi(argv[i]);
+				++i;
+				waterDryCullingThreshold=GLfloat(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"wgs")==0)
+				waterGpuStepSize=true;
+			else if(strcasecmp(argv[i]+1,"rs")==0)
+				{
+				++i;
+				rainStrength=GLfloat(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"rr")==0)
+				{
+				++i;
+				rainRadius=atof(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"evr")==0)
+				{
+				++i;
+				evaporationRate=atof(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"ncl")==0)
+				useContourLines=false;
+			else if(strcasecmp(argv[i]+1,"ucl")==0)
+				{
+				useContourLines=true;
+				if(i+1<argc&&argv[i+1][0]!='-')
+					{
+					/* Read the contour line spacing: */
+					++i;
+					contourLineSpacing=GLfloat(atof(argv[i]));
+					}
+				}
+			else if(strcasecmp(argv[i]+1,"pcl")==0)
+				pixelCornerContourLines=true;
+			else if(strcasecmp(argv[i]+1,"wo")==0)
+				{
+				++i;
+				waterOpacity=GLfloat(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"rsz")==0)
+				{
+				for(int j=0;j<2;++j)
+					{
+					++i;
+					renderSize[j]=GLsizei(atoi(argv[i]));
+					}
+				}
+			else if(strcasecmp(argv[i]+1,"ft")==0)
+				{
+				++i;
+				frameTime=atof(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"n")==0)
+				{
+				++i;
+				maxNumFrames=size_t(atoi(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"wu")==0)
+				{
+				++i;
+				numWarmupFrames=size_t(atoi(argv[i]));
+				}
+			else
+				std::cerr<<"Ignoring unrecognized command line switch "<<argv[i]<<std::endl;
+			}
+		else if(frameFilePrefix==0)
+			frameFilePrefix=argv[i];
+		}
+	if(frameFilePrefix==0)
+		{
+		std::cerr<<"Usage: "<<argv[0]<<" <frame file name prefix> [-display <X display name>] [-slf <sandbox layout file name>] [-er <min elevation> <max elevation>]";
+		std::cerr<<" [-nas <num averaging slots>] [-sp <min num samples> <max variance>] [-he <hysteresis envelope>] [-nsf] [-sf <spatial filter type> <spatial filter radius>] [-sfrs <range sigma>] [-ffk <filter kernel>] [-fft <num filter threads>] [-cfs] [-dub <num depth upload buffers>] [-pdt]";
+		std::cerr<<" [-nw] [-wts <water grid width> <water grid height>] [-ws <water speed> <water max steps>] [-wsb <water simulation backend>] [-wst <num water simulation threads>] [-wmr <multi-rate levels> <multi-rate tile size>] [-wdc <dry culling tile size> <dry culling threshold>] [-wgs]";
+		std::cerr<<" [-rs <rain strength>] [-rr <rain radius>] [-evr <evaporation rate>] [-ncl] [-ucl [contour line spacing]] [-pcl] [-wo <water opacity>]";
+		std::cerr<<" [-rsz <render width> <render height>] [-ft <simulated frame time>] [-n <max num frames>] [-wu <num warm-up frames>]"<<std::endl;
+		return 1;
+		}
+	
+	try
+		{
+		/* Open the pre-recorded 3D video files: */
+		std::string colorFileName=frameFilePrefix;
+		colorFileName.append(".color");
+		std::string depthFileName=frameFilePrefix;
+		depthFileName.append(".depth");
+		Kinect::FileFrameSource frameSource(colorFileName.c_str(),depthFileName.c_str());
+		unsigned int frameSize[2];
+		for(int i=0;i<2;++i)
+			frameSize[i]=frameSource.getActualFrameSize(Kinect::FrameSource::DEPTH)[i];
+		
+		/* Get the per-pixel depth correction parameters: */
+		FrameFilter::PixelDepthCorrection* pixelDepthCorrection;
+		Kinect::FrameSource::DepthCorrection* depthCorrection=frameSource.getDepthCorrectionParameters();
+		if(depthCorrection!=0)
+			{
+			pixelDepthCorrection=depthCorrection->getPixelCorrection(frameSize);
+			delete depthCorrection;
+			}
+		else
+			{
+			/* Create dummy per-pixel depth correction parameters: */
+			pixelDepthCorrection=new FrameFilter::PixelDepthCorrection[frameSize[1]*frameSize[0]];
+			FrameFilter::PixelDepthCorrection* pdcPtr=pixelDepthCorrection;
+			for(unsigned int y=0;y<frameSize[1];++y)
+				for(unsigned int x=0;x<frameSize[0];++x,++pdcPtr)
+					{
+					pdcPtr->scale=1.0f;
+					pdcPtr->offset=0.0f;
+					}
+			}
+		Kinect::FrameSource::IntrinsicParameters ips=frameSource.getIntrinsicParameters();
+		
+		/* Read the sandbox layout file: */
+		Plane basePlane;
+		Point basePlaneCorners[4];
+		{
+		IO::ValueSource layoutSource(IO::openFile(sandboxLayoutFileName.c_str()));
+		layoutSource.skipWs();
+		std::string s=layoutSource.readLine();
+		basePlane=Misc::ValueCoder<Plane>::decode(s.c_str(),s.c_str()+s.length());
+		basePlane.normalize();
+		for(int i=0;i<4;++i)
+			{
+			layoutSource.skipWs();
+			s=layoutSource.readLine();
+			basePlaneCorners[i]=Misc::ValueCoder<Point>::decode(s.c_str(),s.c_str()+s.length());
+			}
+		}
+		
+		/* Read all depth frames into memory to exclude decompression from the measurements: */
+		std::vector<Kinect::FrameBuffer> frames;
+		while(frames.size()<maxNumFrames)
+			{
+			Kinect::FrameBuffer frame=frameSource.readNextDepthFrame();
+			if(frame.timeStamp==Math::Constants<double>::max)
+				break;
+			frames.push_back(frame);
+			}
+		if(frames.size()<=numWarmupFrames)
+			{
+			std::cerr<<"Depth stream contains "<<frames.size()<<" frames; need more than "<<numWarmupFrames<<" warm-up frames"<<std::endl;
+			return 1;
+			}
+		
+		/* Create an OpenGL context on an unmapped window; all rendering goes into a frame buffer object: */
+		GLContextPtr glContext=new GLContext(displayName);
+		glContext->initialize(-1);
+		Display* display=glContext->getDisplay();
+		int screen=glContext->getScreen();
+		XSetWindowAttributes swa;
+		swa.colormap=XCreateColormap(display,RootWindow(display,screen),glContext->getVisual(),AllocNone);
+		swa.border_pixel=0;
+		Window window=XCreateWindow(display,RootWindow(display,screen),0,0,16,16,0,glContext->getDepth(),InputOutput,glContext->getVisual(),CWColormap|CWBorderPixel,&swa);
+		glContext->init(window);
+		glContext->makeCurrent(window);
+		GLContextData& contextData=glContext->getContextData();
+		std::cout<<"Replaying "<<frames.size()<<" depth frames of size "<<frameSize[0]<<'x'<<frameSize[1]<<" on "<<glGetString(GL_RENDERER)<<(glContext->isDirect()?" (direct)":" (indirect)")<<std::endl;
+		
+		/* Create the frame filter: */
+		FrameFilter frameFilter(frameSize,numAveragingSlots,pixelDepthCorrection,ips.depthProjection,basePlane);
+		frameFilter.setValidElevationInterval(ips.depthProjection,basePlane,elevationMin,elevationMax);
+		frameFilter.setStableParameters(minNumSamples,maxVariance);
+		frameFilter.setHysteresis(hysteresis);
+		frameFilter.setSpatialFilter(spatialFilter);
+		frameFilter.setSpatialFilterType(spatialFilterType,spatialFilterRadius);
+		frameFilter.setSpatialFilterRangeSigma(spatialFilterRangeSigma);
+		frameFilter.setFilterKernel(filterKernel);
+		frameFilter.setNumFilterThreads(numFilterThreads);
+		frameFilter.setCompactStatistics(compactStatistics);
+		
+		/* Create the depth image renderer: */
+		DepthImageRenderer depthImageRenderer(frameSize);
+		depthImageRenderer.setDepthProjection(ips.depthProjection);
+		depthImageRenderer.setBasePlane(basePlane);
+		depthImageRenderer.setNumUploadBuffers(numDepthUploadBuffers);
+		if(packDepthTexture)
+			depthImageRenderer.setPackDepth(true,elevationMin,elevationMax);
+		
+		/* Calculate the transformation from camera space to sandbox space: */
+		ONTransform boxTransform;
+		{
+		ONTransform::Vector z=basePlane.getNormal();
+		ONTransform::Vector x=(basePlaneCorners[1]-basePlaneCorners[0])+(basePlaneCorners[3]-basePlaneCorners[2]);
+		ONTransform::Vector y=z^x;
+		boxTransform=ONTransform::rotate(Geometry::invert(ONTransform::Rotation::fromBaseVectors(x,y)));
+		ONTransform::Point center=Geometry::mid(Geometry::mid(basePlaneCorners[0],basePlaneCorners[1]),Geometry::mid(basePlaneCorners[2],basePlaneCorners[3]));
+		boxTransform*=ONTransform::translateToOriginFrom(basePlane.project(center));
+		}
+		
+		/* Create the water table and a rain disk in the middle of the sandbox: */
+		WaterTable2* waterTable=0;
+		RainDisk rain;
+		AddWaterFunction* addRainFunction=0;
+		if(useWater)
+			{
+			waterTable=new WaterTable2(wtSize[0],wtSize[1],&depthImageRenderer,basePlaneCorners);
+			waterTable->setElevationRange(elevationMin,elevationMax);
+			waterTable->setWaterDeposit(evaporationRate);
+			waterTable->setSimulationBackend(waterSimulationBackend,numWaterSimulationThreads);
+			waterTable->setMultiRate(waterMultiRateLevels,waterMultiRateTileSize);
+			waterTable->setDryCulling(waterDryCullingTileSize,waterDryCullingThreshold);
+			waterTable->setGpuStepSize(waterGpuStepSize);
+			
+			if(rainStrength!=0.0f&&rainRadius>0.0)
+				{
+				rain.center=basePlane.project(Geometry::mid(Geometry::mid(basePlaneCorners[0],basePlaneCorners[1]),Geometry::mid(basePlaneCorners[2],basePlaneCorners[3])));
+				Vector z=basePlane.getNormal();
+				rain.x=Geometry::normal(z);
+				rain.y=Geometry::cross(z,rain.x);
+				rain.x*=rainRadius/Geometry::mag(rain.x);
+				rain.y*=rainRadius/Geometry::mag(rain.y);
+				rain.strength=GLfloat(rainStrength/waterSpeed);
+				addRainFunction=Misc::createFunctionCall(addRain,static_cast<const RainDisk*>(&rain));
+				waterTable->addRenderFunction(addRainFunction);
+				}
+			}
+		
+		/* Create the surface renderer: */
+		SurfaceRenderer surfaceRenderer(&depthImageRenderer);
+		surfaceRenderer.setDrawContourLines(useContourLines);
+		surfaceRenderer.setContourLineDistance(contourLineSpacing);
+		surfaceRenderer.setPixelCornerContourLines(pixelCornerContourLines);
+		surfaceRenderer.setIlluminate(false);
+		if(waterTable!=0)
+			{
+			surfaceRenderer.setWaterTable(waterTable);
+			surfaceRenderer.setAdvectWaterTexture(true);
+			surfaceRenderer.setWaterOpacity(waterOpacity);
+			}
+		
+		/* Initialize all OpenGL objects: */
+		contextData.updateThings();
+		
+		/* Create the frame buffer standing in for the projector: */
+		GLEXTFramebufferObject::initExtension();
+		GLuint renderFramebufferObject;
+		GLuint renderBufferObjects[2];
+		glGenFramebuffersEXT(1,&renderFramebufferObject);
+		glGenRenderbuffersEXT(2,renderBufferObjects);
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,renderFramebufferObject);
+		glBindRenderbufferEXT(GL_RENDERBUFFER_EXT,renderBufferObjects[0]);
+		glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT,GL_RGBA8,renderSize[0],renderSize[1]);
+		glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT,GL_COLOR_ATTACHMENT0_EXT,GL_RENDERBUFFER_EXT,renderBufferObjects[0]);
+		glBindRenderbufferEXT(GL_RENDERBUFFER_EXT,renderBufferObjects[1]);
+		glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT,GL_DEPTH_COMPONENT24,renderSize[0],renderSize[1]);
+		glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT,GL_DEPTH_ATTACHMENT_EXT,GL_RENDERBUFFER_EXT,renderBufferObjects[1]);
+		glBindRenderbufferEXT(GL_RENDERBUFFER_EXT,0);
+		glThrowFramebufferStatusExceptionEXT("SARndboxBench");
+		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
+		glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+		int viewport[4]={0,0,renderSize[0],renderSize[1]};
+		glViewport(viewport[0],viewport[1],viewport[2],viewport[3]);
+		glEnable(GL_DEPTH_TEST);
+		glDepthFunc(GL_LEQUAL);
+		
+		/* Render the sandbox from straight above with an orthographic projection covering all potential surfaces: */
+		OGTransform modelview(boxTransform);
+		PTransform projection=PTransform::identity;
+		{
+		Box bbox=Box::empty;
+		for(int i=0;i<4;++i)
+			{
+			bbox.addPoint(boxTransform.transform(basePlane.project(basePlaneCorners[i])+basePlane.getNormal()*elevationMin));
+			bbox.addPoint(boxTransform.transform(basePlane.project(basePlaneCorners[i])+basePlane.getNormal()*elevationMax));
+			}
+		PTransform::Matrix& pm=projection.getMatrix();
+		for(int i=0;i<3;++i)
+			{
+			pm(i,i)=Scalar(2)/(bbox.max[i]-bbox.min[i]);
+			pm(i,3)=-(bbox.max[i]+bbox.min[i])/(bbox.max[i]-bbox.min[i]);
+			}
+		
+		/* Flip z so that higher elevations are closer to the viewer: */
+		pm(2,2)=-pm(2,2);
+		pm(2,3)=-pm(2,3);
+		}
+		
+		/* Push all frames through the pipeline: */
+		StageStats filterStats("Frame filter");
+		StageStats uploadStats("Depth upload");
+		StageStats bathymetryStats("Bathymetry update");
+		StageStats waterStats("Water simulation");
+		StageStats renderStats("Surface rendering");
+		StageStats frameStats("Complete frame");
+		size_t totalNumWaterSteps=0;
+		Kinect::FrameBuffer outputFrames[2];
+		for(int i=0;i<2;++i)
+			outputFrames[i]=frameFilter.createOutputFrame();
+		for(size_t frameIndex=0;frameIndex<frames.size();++frameIndex)
+			{
+			bool measure=frameIndex>=numWarmupFrames;
+			Misc::Timer frameTimer;
+			
+			/* Filter the raw depth frame into alternating output frames, like the live pipeline's frame buffers: */
+			Misc::Timer stageTimer;
+			Kinect::FrameBuffer& filteredFrame=outputFrames[frameIndex%2];
+			frameFilter.filterFrame(frames[frameIndex],filteredFrame);
+			stageTimer.elapse();
+			if(measure)
+				filterStats.addFrame(stageTimer.getTime());
+			
+			/* Upload the changed parts of the filtered frame into the depth texture: */
+			depthImageRenderer.setDepthImage(filteredFrame,FrameFilter::getFrameIndex(filteredFrame),FrameFilter::dirtyTileSize,FrameFilter::getTileChangeIndices(filteredFrame));
+			depthImageRenderer.bindDepthTexture(contextData);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+			glFinish();
+			stageTimer.elapse();
+			if(measure)
+				uploadStats.addFrame(stageTimer.getTime());
+			
+			if(waterTable!=0)
+				{
+				/* Update the water table's bathymetry grid: */
+				waterTable->updateBathymetry(contextData);
+				glFinish();
+				stageTimer.elapse();
+				if(measure)
+					bathymetryStats.addFrame(stageTimer.getTime());
+				
+				/* Advance the water simulation by one fixed frame time, exactly as the sandbox does: */
+				GLfloat totalTimeStep=GLfloat(frameTime*waterSpeed);
+				unsigned int numSteps=0;
+				if(waterTable->getGpuStepSize())
+					{
+					waterTable->setMaxStepSize(totalTimeStep);
+					numSteps=waterTable->runSimulationSteps(totalTimeStep,waterMaxSteps-1U,contextData);
+					}
+				else
+					{
+					while(numSteps<waterMaxSteps-1U&&totalTimeStep>1.0e-8f)
+						{
+						waterTable->setMaxStepSize(totalTimeStep);
+						GLfloat timeStep=waterTable->runSimulationStep(false,contextData);
+						totalTimeStep-=timeStep;
+						++numSteps;
+						}
+					}
+				glFinish();
+				stageTimer.elapse();
+				if(measure)
+					{
+					waterStats.addFrame(stageTimer.getTime());
+					totalNumWaterSteps+=numSteps;
+					}
+				}
+			
+			/* Render the surface into the off-screen frame buffer: */
+			glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,renderFramebufferObject);
+			glViewport(viewport[0],viewport[1],viewport[2],viewport[3]);
+			glClearColor(0.0f,0.0f,0.0f,1.0f);
+			glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+			surfaceRenderer.setAnimationTime(double(frameIndex)*frameTime);
+			surfaceRenderer.renderSinglePass(viewport,projection,modelview,contextData);
+			glFinish();
+			stageTimer.elapse();
+			if(measure)
+				renderStats.addFrame(stageTimer.getTime());
+			
+			frameTimer.elapse();
+			if(measure)
+				frameStats.addFrame(frameTimer.getTime());
+			}
+		
+		/* Calculate a checksum of the final rendered image to verify that replays are deterministic: */
+		std::vector<GLubyte> image(size_t(renderSize[1])*size_t(renderSize[0])*4);
+		glPixelStorei(GL_PACK_ALIGNMENT,1);
+		glReadPixels(0,0,renderSize[0],renderSize[1],GL_RGBA,GL_UNSIGNED_BYTE,&image[0]);
+		unsigned int checksum=2166136261U;
+		for(std::vector<GLubyte>::iterator iIt=image.begin();iIt!=image.end();++iIt)
+			checksum=(checksum^(*iIt))*16777619U;
+		
+		/* Print the results: */
+		size_t numFrames=frames.size()-numWarmupFrames;
+		std::cout<<"Measured "<<numFrames<<" frames after "<<numWarmupFrames<<" warm-up frames; "<<FrameFilter::getKernelName(filterKernel)<<" filter kernel with "<<numFilterThreads<<(numFilterThreads==1?" thread":" threads");
+		if(waterTable!=0)
+			std::cout<<", "<<WaterTable2::getSimulationBackendName(waterSimulationBackend)<<" water backend with "<<wtSize[0]<<'x'<<wtSize[1]<<" cells, "<<double(totalNumWaterSteps)/double(numFrames)<<" steps per frame";
+		std::cout<<", "<<renderSize[0]<<'x'<<renderSize[1]<<" render target"<<std::endl;
+		filterStats.print();
+		uploadStats.print();
+		bathymetryStats.print();
+		waterStats.print();
+		renderStats.print();
+		frameStats.print();
+		std::cout<<"Frame rate: "<<double(numFrames)/frameStats.getTotalTime()<<" fps"<<std::endl;
+		std::cout<<"Final image checksum: "<<std::hex<<std::setw(8)<<std::setfill('0')<<checksum<<std::dec<<std::endl;
+		
+		/* Clean up: */
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,0);
+		glDeleteFramebuffersEXT(1,&renderFramebufferObject);
+		glDeleteRenderbuffersEXT(2,renderBufferObjects);
+		if(waterTable!=0)
+			{
+			if(addRainFunction!=0)
+				waterTable->removeRenderFunction(addRainFunction);
+			delete addRainFunction;
+			delete waterTable;
+			}
+		contextData.updateThings();
+		glContext->deinit();
+		glContext->release();
+		XDestroyWindow(display,window);
+		XFreeColormap(display,swa.colormap);
+		delete[] pixelDepthCorrection;
+		
+		return 0;
+		}
+	catch(std::runtime_error err)
+		{
+		std::cerr<<"Caught exception "<<err.what()<<std::endl;
+		return 1;
+		}
+	}
@@ -32,16 +32,20 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <vector>
 #include <stdexcept>
 #include <iostream>
+#include <sstream>
 #include <Misc/SizedTypes.h>
 #include <Misc/SelfDestructPointer.h>
 #include <Misc/FixedArray.h>
 #include <Misc/FunctionCalls.h>
 #include <Misc/FileNameExtensions.h>
 #include <Misc/StandardValueCoders.h>
+#include <Misc/CompoundValueCoders.h>
 #include <Misc/ArrayValueCoders.h>
 #include <Misc/ConfigurationFile.h>
+#include <Misc/Time.h>
 #include <IO/File.h>
 #include <IO/ValueSource.h>
+#include <Cluster/OpenPipe.h>
 #include <Math/Math.h>
 #include <Math/Constants.h>
 #include <Math/Interval.h>
@@ -49,6 +53,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Geometry/Point.h>
 #include <Geometry/AffineCombiner.h>
 #include <Geometry/HVector.h>
+#include <Geometry/OrthogonalTransformation.h>
 #include <Geometry/Plane.h>
 #include <Geometry/LinearUnit.h>
 #include <Geometry/GeometryValueCoders.h>
@@ -88,6 +93,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Kinect/FileFrameSource.h>
 #include <Kinect/DirectFrameSource.h>
 #include <Kinect/OpenDirectFrameSource.h>
+#include <Kinect/MultiplexedFrameSource.h>
 
 #define SAVEDEPTH 0
 
@@ -97,17 +103,22 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #endif
 
 #include "FrameFilter.h"
+#include "HeightMapFuser.h"
 #include "DepthImageRenderer.h"
 #include "ElevationColorMap.h"
 #include "DEM.h"
 #include "SurfaceRenderer.h"
 #include "WaterTable2.h"
+#include "WaterStepScheduler.h"
+#include "DepthFramePipeline.h"
 #include "HandExtractor.h"
 #include "WaterRenderer.h"
+#include "WaterStateRecorder.h"
 #include "GlobalWaterTool.h"
 #include "LocalWaterTool.h"
 #include "DEMTool.h"
 #include "BathymetrySaverTool.h"
+#include "ShaderHelper.h"
 
 #include "Config.h"
 
@@ -115,8 +126,9 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 Methods of class Sandbox::DataItem:
 **********************************/
 
-Sandbox::DataItem::DataItem(void)
-	:waterTableTime(0.0),
+Sandbox::DataItem::DataItem(const Sandbox::ContextCounterPtr& sContextCounter)
+	:contextCounter(sContextCounter),
+	 waterTableTime(0.0),playbackFrame(~0U),
 	 shadowFramebufferObject(0),shadowDepthTextureObject(0)
 	{
 	/* Check if all required extensions are supported: */
@@ -142,10 +154,16 @@ Sandbox::DataItem::DataItem(void)
 	GLARBVertexShader::initExtension();
 	GLARBFragmentShader::initExtension();
 	GLARBMultitexture::initExtension();
+	
+	/* Count this context for the shared water simulation: */
+	contextCounter->numContexts.preAdd(1);
 	}
 
 Sandbox::DataItem::~DataItem(void)
 	{
+	/* Remove this context from the shared water simulation: */
+	contextCounter->numContexts.preSub(1);
+	
 	/* Delete all shaders, buffers, and texture objects: */
 	glDeleteFramebuffersEXT(1,&shadowFramebufferObject);
 	glDeleteTextures(1,&shadowDepthTextureObject);
@@ -160,7 +178,7 @@ Sandbox::RenderSettings::RenderSettings(void)
 	 hillshade(false),surfaceMaterial(GLMaterial::Color(1.0f,1.0f,1.0f)),
 	 useShadows(false),
 	 elevationColorMap(0),
-	 useContourLines(true),contourLineSpacing(0.75f),
+	 useContourLines(true),contourLineSpacing(0.75f),pixelCornerContourLines(false),vectorContourLines(false),
 	 renderWaterSurface(false),waterOpacity(2.0f),
 	 surfaceRenderer(0),waterRenderer(0)
 	{
@@ -173,7 +191,7 @@ Sandbox::RenderSettings::RenderSettings(const Sandbox::RenderSettings& source)
 	 hillshade(source.hillshade),surfaceMaterial(source.surfaceMaterial),
 	 useShadows(source.useShadows),
 	 elevationColorMap(source.elevationColorMap!=0?new ElevationColorMap(*source.elevationColorMap):0),
-	 useContourLines(source.useContourLines),contourLineSpacing(source.contourLineSpacing),
+	 useContourLines(source.useContourLines),contourLineSpacing(source.contourLineSpacing),pixelCornerContourLines(source.pixelCornerContourLines),vectorContourLines(source.vectorContourLines),
 	 renderWaterSurface(source.renderWaterSurface),waterOpacity(source.waterOpacity),
 	 surfaceRenderer(0),waterRenderer(0)
 	{
@@ -245,17 +263,54 @@ Methods of class Sandbox:
 
 void Sandbox::rawDepthFrameDispatcher(const Kinect::FrameBuffer& frameBuffer)
 	{
-	/* Pass the received frame to the frame filter and the hand extractor: */
-	if(frameFilter!=0&&!pauseUpdates)
-		frameFilter->receiveRawFrame(frameBuffer);
-	if(handExtractor!=0)
-		handExtractor->receiveRawFrame(frameBuffer);
+	/* Stamp the frame's arrival time: */
+	double arrivalTime=latencyMonitor.getTime();
+	if(monitorCameraDelivery)
+		latencyMonitor.addSample(LatencyMonitor::CAMERA_DELIVERY,arrivalTime-frameBuffer.timeStamp);
+	
+	/* Pass the received frame, time-stamped with its arrival time, to the processing pipeline; the frame filter and its dependents skip frames while updates are paused: */
+	if(depthFramePipeline!=0)
+		{
+		Kinect::FrameBuffer arrivedFrame(frameBuffer);
+		arrivedFrame.timeStamp=arrivalTime;
+		depthFramePipeline->setStageEnabled(frameFilterStage,!pauseUpdates);
+		depthFramePipeline->receiveRawFrame(arrivedFrame);
+		}
+	}
+
+void Sandbox::auxiliaryDepthFrameDispatcher(const Kinect::FrameBuffer& frameBuffer,unsigned int auxiliaryCameraIndex)
+	{
+	/* Pass the received frame to the auxiliary camera's frame filter unless updates are paused: */
+	if(!pauseUpdates)
+		auxiliaryCameras[auxiliaryCameraIndex].frameFilter->receiveRawFrame(frameBuffer);
 	}
 
 void Sandbox::receiveFilteredFrame(const Kinect::FrameBuffer& frameBuffer)
 	{
+	/* Record the time the frame spent in the frame filter since its arrival: */
+	double filterTime=latencyMonitor.getTime();
+	latencyMonitor.addSample(LatencyMonitor::FRAME_FILTER,filterTime-frameBuffer.timeStamp);
+	
 	/* Put the new frame into the frame input buffer: */
-	filteredFrames.postNewValue(frameBuffer);
+	FilteredFrame& newFrame=filteredFrames.startNewValue();
+	newFrame.frame=frameBuffer;
+	newFrame.filterTime=filterTime;
+	filteredFrames.postNewValue();
+	
+	/* Wake up the foreground thread: */
+	Vrui::requestUpdate();
+	}
+
+void Sandbox::receiveContourLines(const ContourLineExtractor::ContourLineSet& contourLines)
+	{
+	/* Wake up the foreground thread: */
+	Vrui::requestUpdate();
+	}
+
+void Sandbox::receiveRainObjects(const RainMaker::BlobList& newRainObjects)
+	{
+	/* Put the new object list into the triple buffer: */
+	rainObjects.postNewValue(newRainObjects);
 	
 	/* Wake up the foreground thread: */
 	Vrui::requestUpdate();
@@ -283,8 +338,10 @@ void Sandbox::toggleDEM(DEM* dem)
 
 void Sandbox::addWater(GLContextData& contextData) const
 	{
-	/* Check if the most recent rain object list is not empty: */
-	if(handExtractor!=0&&!handExtractor->getLockedExtractedHands().empty())
+	/* Check if the most recent hand or rain object lists are not empty: */
+	bool haveHands=handExtractor!=0&&!handExtractor->getLockedExtractedHands().empty();
+	bool haveRainObjects=rainMaker!=0&&!rainObjects.getLockedValue().empty();
+	if(haveHands||haveRainObjects)
 		{
 		/* Render all rain objects into the water table: */
 		glPushAttrib(GL_ENABLE_BIT);
@@ -298,16 +355,35 @@ void Sandbox::addWater(GLContextData& contextData) const
 		y.normalize();
 		
 		glVertexAttrib1fARB(1,rainStrength/waterSpeed);
-		for(HandExtractor::HandList::const_iterator hIt=handExtractor->getLockedExtractedHands().begin();hIt!=handExtractor->getLockedExtractedHands().end();++hIt)
+		if(haveHands)
+			{
+			for(HandExtractor::HandList::const_iterator hIt=handExtractor->getLockedExtractedHands().begin();hIt!=handExtractor->getLockedExtractedHands().end();++hIt)
+				{
+				/* Render a rain disk approximating the hand: */
+				glBegin(GL_POLYGON);
+				for(int i=0;i<32;++i)
+					{
+					Scalar angle=Scalar(2)*Math::Constants<Scalar>::pi*Scalar(i)/Scalar(32);
+					glVertex(hIt->center+x*(Math::cos(angle)*hIt->radius*0.75)+y*(Math::sin(angle)*hIt->radius*0.75));
+					}
+				glEnd();
+				}
+			}
+		if(haveRainObjects)
 			{
-			/* Render a rain disk approximating the hand: */
-			glBegin(GL_POLYGON);
-			for(int i=0;i<32;++i)
+			for(RainMaker::BlobList::const_iterator roIt=rainObjects.getLockedValue().begin();roIt!=rainObjects.getLockedValue().end();++roIt)
 				{
-				Scalar angle=Scalar(2)*Math::Constants<Scalar>::pi*Scalar(i)/Scalar(32);
-				glVertex(hIt->center+x*(Math::cos(angle)*hIt->radius*0.75)+y*(Math::sin(angle)*hIt->radius*0.75));
+				/* Render a rain disk approximating the object: */
+				Point center(roIt->centroid);
+				Scalar radius(roIt->radius);
+				glBegin(GL_POLYGON);
+				for(int i=0;i<32;++i)
+					{
+					Scalar angle=Scalar(2)*Math::Constants<Scalar>::pi*Scalar(i)/Scalar(32);
+					glVertex(center+x*(Math::cos(angle)*radius)+y*(Math::sin(angle)*radius));
+					}
+				glEnd();
 				}
-			glEnd();
 			}
 		
 		glPopAttrib();
@@ -332,6 +408,18 @@ void Sandbox::waterSpeedSliderCallback(GLMotif::TextFieldSlider::ValueChangedCal
 void Sandbox::waterMaxStepsSliderCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData)
 	{
 	waterMaxSteps=int(Math::floor(cbData->value+0.5));
+	waterStepScheduler->setMaxNumSteps(waterMaxSteps);
+	}
+
+void Sandbox::waterTargetFrameRateSliderCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData)
+	{
+	waterTargetFrameRate=cbData->value;
+	waterStepScheduler->setTargetFrameRate(waterTargetFrameRate);
+	}
+
+void Sandbox::waterGpuStepSizeToggleCallback(GLMotif::ToggleButton::ValueChangedCallbackData* cbData)
+	{
+	waterTable->setGpuStepSize(cbData->set);
 	}
 
 void Sandbox::waterAttenuationSliderCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData)
@@ -405,6 +493,17 @@ GLMotif::PopupWindow* Sandbox::createWaterControlDialog(void)
 	waterMaxStepsSlider->setValue(waterMaxSteps);
 	waterMaxStepsSlider->getValueChangedCallbacks().add(this,&Sandbox::waterMaxStepsSliderCallback);
 	
+	new GLMotif::Label("WaterTargetFrameRateLabel",waterControlDialog,"Target Rate");
+	
+	waterTargetFrameRateSlider=new GLMotif::TextFieldSlider("WaterTargetFrameRateSlider",waterControlDialog,8,ss.fontHeight*10.0f);
+	waterTargetFrameRateSlider->getTextField()->setFieldWidth(7);
+	waterTargetFrameRateSlider->getTextField()->setPrecision(0);
+	waterTargetFrameRateSlider->getTextField()->setFloatFormat(GLMotif::TextField::FIXED);
+	waterTargetFrameRateSlider->setSliderMapping(GLMotif::TextFieldSlider::LINEAR);
+	waterTargetFrameRateSlider->setValueRange(0.0,120.0,1.0);
+	waterTargetFrameRateSlider->setValue(waterTargetFrameRate);
+	waterTargetFrameRateSlider->getValueChangedCallbacks().add(this,&Sandbox::waterTargetFrameRateSliderCallback);
+	
 	new GLMotif::Label("FrameRateLabel",waterControlDialog,"Frame Rate");
 	
 	GLMotif::Margin* frameRateMargin=new GLMotif::Margin("FrameRateMargin",waterControlDialog,false);
@@ -418,6 +517,84 @@ GLMotif::PopupWindow* Sandbox::createWaterControlDialog(void)
 	
 	frameRateMargin->manageChild();
 	
+	for(int stage=0;stage<LatencyMonitor::NUM_STAGES;++stage)
+		{
+		/* Create a row of text fields showing minimum, mean, and 99th percentile latency of the pipeline stage: */
+		std::string stageName=LatencyMonitor::getStageName(LatencyMonitor::Stage(stage));
+		new GLMotif::Label((stageName+"LatencyLabel").c_str(),waterControlDialog,(stageName+" (ms)").c_str());
+		
+		GLMotif::RowColumn* latencyBox=new GLMotif::RowColumn((stageName+"LatencyBox").c_str(),waterControlDialog,false);
+		latencyBox->setOrientation(GLMotif::RowColumn::HORIZONTAL);
+		latencyBox->setPacking(GLMotif::RowColumn::PACK_GRID);
+		latencyBox->setNumMinorWidgets(1);
+		
+		static const char* statisticNames[3]={"Min","Mean","P99"};
+		for(int i=0;i<3;++i)
+			{
+			latencyTextFields[stage][i]=new GLMotif::TextField((stageName+statisticNames[i]+"TextField").c_str(),latencyBox,7);
+			latencyTextFields[stage][i]->setPrecision(1);
+			latencyTextFields[stage][i]->setFloatFormat(GLMotif::TextField::FIXED);
+			latencyTextFields[stage][i]->setValue(0.0);
+			}
+		
+		latencyBox->manageChild();
+		}
+	
+	new GLMotif::Label("WaterStepsLabel",waterControlDialog,"Steps/Frame");
+	
+	GLMotif::RowColumn* waterStepsBox=new GLMotif::RowColumn("WaterStepsBox",waterControlDialog,false);
+	waterStepsBox->setOrientation(GLMotif::RowColumn::HORIZONTAL);
+	waterStepsBox->setPacking(GLMotif::RowColumn::PACK_TIGHT);
+	waterStepsBox->setNumMinorWidgets(1);
+	
+	waterStepsTextField=new GLMotif::TextField("WaterStepsTextField",waterStepsBox,4);
+	waterStepsTextField->setValue(0);
+	
+	waterGpuStepSizeToggle=new GLMotif::ToggleButton("WaterGpuStepSizeToggle",waterStepsBox,"GPU Step Size");
+	waterGpuStepSizeToggle->setBorderWidth(0.0f);
+	waterGpuStepSizeToggle->setToggle(waterTable->getGpuStepSize());
+	waterGpuStepSizeToggle->getValueChangedCallbacks().add(this,&Sandbox::waterGpuStepSizeToggleCallback);
+	
+	waterStepsBox->manageChild();
+	
+	/* Create a row of text fields showing the measured cost per step, the per-frame budget, and the resulting step limit: */
+	new GLMotif::Label("WaterBudgetLabel",waterControlDialog,"Step Budget (ms)");
+	
+	GLMotif::RowColumn* waterBudgetBox=new GLMotif::RowColumn("WaterBudgetBox",waterControlDialog,false);
+	waterBudgetBox->setOrientation(GLMotif::RowColumn::HORIZONTAL);
+	waterBudgetBox->setPacking(GLMotif::RowColumn::PACK_GRID);
+	waterBudgetBox->setNumMinorWidgets(1);
+	
+	static const char* budgetNames[3]={"StepCost","Budget","MaxSteps"};
+	for(int i=0;i<3;++i)
+		{
+		waterBudgetTextFields[i]=new GLMotif::TextField((std::string("Water")+budgetNames[i]+"TextField").c_str(),waterBudgetBox,7);
+		waterBudgetTextFields[i]->setPrecision(i==0?3:i==1?1:0);
+		waterBudgetTextFields[i]->setFloatFormat(GLMotif::TextField::FIXED);
+		waterBudgetTextFields[i]->setValue(0.0);
+		}
+	
+	waterBudgetBox->manageChild();
+	
+	/* Create a row of text fields showing the simulation time carried over into the next frame and the total dropped simulation time: */
+	new GLMotif::Label("WaterBacklogLabel",waterControlDialog,"Backlog (s)");
+	
+	GLMotif::RowColumn* waterBacklogBox=new GLMotif::RowColumn("WaterBacklogBox",waterControlDialog,false);
+	waterBacklogBox->setOrientation(GLMotif::RowColumn::HORIZONTAL);
+	waterBacklogBox->setPacking(GLMotif::RowColumn::PACK_GRID);
+	waterBacklogBox->setNumMinorWidgets(1);
+	
+	static const char* backlogNames[2]={"Backlog","Dropped"};
+	for(int i=0;i<2;++i)
+		{
+		waterBacklogTextFields[i]=new GLMotif::TextField((std::string("Water")+backlogNames[i]+"TextField").c_str(),waterBacklogBox,7);
+		waterBacklogTextFields[i]->setPrecision(3);
+		waterBacklogTextFields[i]->setFloatFormat(GLMotif::TextField::FIXED);
+		waterBacklogTextFields[i]->setValue(0.0);
+		}
+	
+	waterBacklogBox->manageChild();
+	
 	new GLMotif::Label("WaterAttenuationLabel",waterControlDialog,"Attenuation");
 	
 	waterAttenuationSlider=new GLMotif::TextFieldSlider("WaterAttenuationSlider",waterControlDialog,8,ss.fontHeight*10.0f);
@@ -435,12 +612,88 @@ GLMotif::PopupWindow* Sandbox::createWaterControlDialog(void)
 	return waterControlDialogPopup;
 	}
 
+void Sandbox::updateLatencyDisplay(void)
+	{
+	for(int stage=0;stage<LatencyMonitor::NUM_STAGES;++stage)
+		{
+		LatencyMonitor::Statistics stats=latencyMonitor.getStatistics(LatencyMonitor::Stage(stage));
+		latencyTextFields[stage][0]->setValue(stats.min*1000.0);
+		latencyTextFields[stage][1]->setValue(stats.mean*1000.0);
+		latencyTextFields[stage][2]->setValue(stats.p99*1000.0);
+		}
+	}
+
+void Sandbox::updateWaterBudgetDisplay(void)
+	{
+	/* Show unmeasured step costs and inactive budgets as zero: */
+	WaterStepScheduler::Statistics stats=waterStepScheduler->getStatistics();
+	waterBudgetTextFields[0]->setValue(stats.stepCost>0.0?stats.stepCost*1000.0:0.0);
+	waterBudgetTextFields[1]->setValue(stats.budget>0.0?stats.budget*1000.0:0.0);
+	waterBudgetTextFields[2]->setValue(stats.maxNumSteps);
+	waterBacklogTextFields[0]->setValue(stats.backlog);
+	waterBacklogTextFields[1]->setValue(stats.droppedTime);
+	}
+
+void Sandbox::writeLatencyStatistics(const char* fileName) const
+	{
+	if(fileName[0]=='\0')
+		{
+		latencyMonitor.printStatistics(std::cout);
+		return;
+		}
+	
+	/* Open the reply file or named pipe without blocking if no process is reading from the pipe: */
+	int replyFd=open(fileName,O_WRONLY|O_CREAT|O_TRUNC|O_NONBLOCK,S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+	if(replyFd<0)
+		{
+		std::cerr<<"Unable to write latency statistics to "<<fileName<<std::endl;
+		return;
+		}
+	
+	/* Write the statistics: */
+	std::ostringstream reply;
+	latencyMonitor.printStatistics(reply);
+	std::string replyString=reply.str();
+	if(write(replyFd,replyString.data(),replyString.size())!=ssize_t(replyString.size()))
+		std::cerr<<"Unable to write latency statistics to "<<fileName<<std::endl;
+	close(replyFd);
+	}
+
 namespace {
 
+/**********
+Constants:
+**********/
+
+const double sharedWaterTimeout=0.1; // Time in seconds a context waits for another context's shared water simulation results before keeping its previous state
+
 /****************
 Helper functions:
 ****************/
 
+Kinect::FrameSource::DepthCorrection::PixelCorrection* createPixelDepthCorrection(Kinect::FrameSource* camera,const unsigned int frameSize[2])
+	{
+	/* Get the camera's per-pixel depth correction parameters and evaluate it on the depth frame's pixel grid: */
+	Kinect::FrameSource::DepthCorrection* depthCorrection=camera->getDepthCorrectionParameters();
+	if(depthCorrection!=0)
+		{
+		Kinect::FrameSource::DepthCorrection::PixelCorrection* result=depthCorrection->getPixelCorrection(frameSize);
+		delete depthCorrection;
+		return result;
+		}
+	
+	/* Create dummy per-pixel depth correction parameters: */
+	Kinect::FrameSource::DepthCorrection::PixelCorrection* result=new Kinect::FrameSource::DepthCorrection::PixelCorrection[frameSize[1]*frameSize[0]];
+	Kinect::FrameSource::DepthCorrection::PixelCorrection* pdcPtr=result;
+	for(unsigned int y=0;y<frameSize[1];++y)
+		for(unsigned int x=0;x<frameSize[0];++x,++pdcPtr)
+			{
+			pdcPtr->scale=1.0f;
+			pdcPtr->offset=0.0f;
+			}
+	return result;
+	}
+
 void printUsage(void)
 	{
 	std::cout<<"Usage: SARndbox [option 1] ... [option n]"<<std::endl;
@@ -454,6 +707,13 @@ void printUsage(void)
 	std::cout<<"  -f <frame file name prefix>"<<std::endl;
 	std::cout<<"     Reads a pre-recorded 3D video stream from a pair of color/depth"<<std::endl;
 	std::cout<<"     files of the given file name prefix"<<std::endl;
+	std::cout<<"  -ac <auxiliary camera section name>"<<std::endl;
+	std::cout<<"     Adds an auxiliary camera, defined in the configuration file section of"<<std::endl;
+	std::cout<<"     the given name, whose filtered depth frames are fused with the main"<<std::endl;
+	std::cout<<"     camera's into a single height map to cover a larger sandbox"<<std::endl;
+	std::cout<<"  -hmcs <height map cell size>"<<std::endl;
+	std::cout<<"     Sets the cell size of the fused height map of multiple cameras in cm"<<std::endl;
+	std::cout<<"     Default: 0.25"<<std::endl;
 	std::cout<<"  -s <scale factor>"<<std::endl;
 	std::cout<<"     Scale factor from real sandbox to simulated terrain"<<std::endl;
 	std::cout<<"     Default: 100.0 (1:100 scale, 1cm in sandbox is 1m in terrain"<<std::endl;
@@ -466,9 +726,20 @@ void printUsage(void)
 	std::cout<<"     Default: Range of elevation color map"<<std::endl;
 	std::cout<<"  -hmp <x> <y> <z> <offset>"<<std::endl;
 	std::cout<<"     Sets an explicit base plane equation to use for height color mapping"<<std::endl;
+	std::cout<<"  -tf <temporal filter type>"<<std::endl;
+	std::cout<<"     Selects the frame filter's per-pixel temporal filter (Averaging or"<<std::endl;
+	std::cout<<"     Adaptive); the adaptive filter reflects surface changes within two"<<std::endl;
+	std::cout<<"     frames and does not need averaging slots"<<std::endl;
+	std::cout<<"     Default: Averaging"<<std::endl;
+	std::cout<<"  -tfp <measurement variance> <process variance> <change threshold>"<<std::endl;
+	std::cout<<"     Sets the adaptive temporal filter's assumed variance of raw depth"<<std::endl;
+	std::cout<<"     measurements and of surface drift between frames, and the distance"<<std::endl;
+	std::cout<<"     from the current estimate in standard deviations beyond which a"<<std::endl;
+	std::cout<<"     measurement indicates a surface change"<<std::endl;
+	std::cout<<"     Default: 2.0 0.01 4.0"<<std::endl;
 	std::cout<<"  -nas <num averaging slots>"<<std::endl;
-	std::cout<<"     Sets the number of averaging slots in the frame filter; latency is"<<std::endl;
-	std::cout<<"     <num averaging slots> * 1/30 s"<<std::endl;
+	std::cout<<"     Sets the number of averaging slots in the averaging frame filter;"<<std::endl;
+	std::cout<<"     latency is <num averaging slots> * 1/30 s"<<std::endl;
 	std::cout<<"     Default: 30"<<std::endl;
 	std::cout<<"  -sp <min num samples> <max variance>"<<std::endl;
 	std::cout<<"     Sets the frame filter parameters minimum number of valid samples"<<std::endl;
@@ -477,6 +748,41 @@ void printUsage(void)
 	std::cout<<"  -he <hysteresis envelope>"<<std::endl;
 	std::cout<<"     Sets the size of the hysteresis envelope used for jitter removal"<<std::endl;
 	std::cout<<"     Default: 0.1"<<std::endl;
+	std::cout<<"  -sf <spatial filter type> <spatial filter radius>"<<std::endl;
+	std::cout<<"     Selects the spatial filter applied to time-averaged depth values"<<std::endl;
+	std::cout<<"     (None, Legacy, Box, Gaussian, or Bilateral) and its kernel radius in"<<std::endl;
+	std::cout<<"     pixels; the radius is ignored by the legacy filter"<<std::endl;
+	std::cout<<"     Default: Legacy 2"<<std::endl;
+	std::cout<<"  -sfrs <range sigma>"<<std::endl;
+	std::cout<<"     Sets the standard deviation of the bilateral spatial filter's range"<<std::endl;
+	std::cout<<"     kernel in depth units; depth differences much larger than this are"<<std::endl;
+	std::cout<<"     treated as edges and not smoothed"<<std::endl;
+	std::cout<<"     Default: 2.0"<<std::endl;
+	std::cout<<"  -ffk <filter kernel>"<<std::endl;
+	std::cout<<"     Selects the implementation of the frame filter's per-pixel kernel"<<std::endl;
+	std::cout<<"     (Scalar, SSE2, or AVX2); all kernels produce identical results"<<std::endl;
+	std::cout<<"     Default: "<<FrameFilter::getKernelName(FrameFilter::getBestKernel())<<std::endl;
+	std::cout<<"  -fft <num filter threads>"<<std::endl;
+	std::cout<<"     Sets the number of threads processing row bands of each depth frame"<<std::endl;
+	std::cout<<"     in the frame filter; one more thread is added to the shared pool if"<<std::endl;
+	std::cout<<"     hands, rain objects, or contour lines are extracted"<<std::endl;
+	std::cout<<"     Default: 1"<<std::endl;
+	std::cout<<"  -cfs"<<std::endl;
+	std::cout<<"     Stores the frame filter's per-pixel statistics in a compact planar"<<std::endl;
+	std::cout<<"     layout to reduce memory bandwidth; requires at most 255 averaging slots"<<std::endl;
+	std::cout<<"  -dub <num depth upload buffers>"<<std::endl;
+	std::cout<<"     Sets the number of pixel buffer objects per OpenGL context that stream"<<std::endl;
+	std::cout<<"     filtered depth frames into the depth texture; 0 uploads directly"<<std::endl;
+	std::cout<<"     Default: 2"<<std::endl;
+	std::cout<<"  -pdt"<<std::endl;
+	std::cout<<"     Packs depth texture values into 16 bits covering the elevation range"<<std::endl;
+	std::cout<<"     to halve the depth upload bandwidth"<<std::endl;
+	std::cout<<"  -scd <shader cache directory>"<<std::endl;
+	std::cout<<"     Sets the directory in which linked shader programs are cached to speed"<<std::endl;
+	std::cout<<"     up subsequent start-ups"<<std::endl;
+	std::cout<<"     Default: $HOME/.cache/SARndbox-2.3/Shaders"<<std::endl;
+	std::cout<<"  -nsc"<<std::endl;
+	std::cout<<"     Disables the shader program cache"<<std::endl;
 	std::cout<<"  -wts <water grid width> <water grid height>"<<std::endl;
 	std::cout<<"     Sets the width and height of the water flow simulation grid"<<std::endl;
 	std::cout<<"     Default: 640 480"<<std::endl;
@@ -484,10 +790,45 @@ void printUsage(void)
 	std::cout<<"     Sets the relative speed of the water simulation and the maximum"<<std::endl;
 	std::cout<<"     number of simulation steps per frame"<<std::endl;
 	std::cout<<"     Default: 1.0 30"<<std::endl;
+	std::cout<<"  -wtfr <water target frame rate>"<<std::endl;
+	std::cout<<"     Adapts the number of water simulation steps per frame, up to the maximum"<<std::endl;
+	std::cout<<"     set with -ws, to the measured cost of previous steps to hold the given"<<std::endl;
+	std::cout<<"     frame rate; 0 always allows the maximum number of steps"<<std::endl;
+	std::cout<<"     Default: 0"<<std::endl;
+	std::cout<<"  -wsb <water simulation backend>"<<std::endl;
+	std::cout<<"     Selects the implementation of the water flow simulation (GPU or CPU)"<<std::endl;
+	std::cout<<"     Default: GPU"<<std::endl;
+	std::cout<<"  -wst <num water simulation threads>"<<std::endl;
+	std::cout<<"     Sets the number of threads used by the CPU water simulation backend"<<std::endl;
+	std::cout<<"     Default: 1"<<std::endl;
+	std::cout<<"  -wmr <num multi-rate levels> <multi-rate tile size>"<<std::endl;
+	std::cout<<"     Lets the CPU water simulation backend advance tiles of the given size"<<std::endl;
+	std::cout<<"     in cells with up to 2^<num multi-rate levels> sub-steps per step"<<std::endl;
+	std::cout<<"     depending on their local wave speeds, so that calm regions take"<<std::endl;
+	std::cout<<"     larger steps; 0 levels disables multi-rate integration"<<std::endl;
+	std::cout<<"     Default: 0 32"<<std::endl;
+	std::cout<<"  -wdc <dry culling tile size> <dry culling threshold>"<<std::endl;
+	std::cout<<"     Lets the GPU water simulation backend skip tiles of the given size in"<<std::endl;
+	std::cout<<"     cells whose water column stayed below the given height in cm during"<<std::endl;
+	std::cout<<"     the previous frame; 0 tile size disables dry tile culling"<<std::endl;
+	std::cout<<"     Default: 0 0.001"<<std::endl;
+	std::cout<<"  -cwb"<<std::endl;
+	std::cout<<"     Runs both water simulation backends side-by-side from identical"<<std::endl;
+	std::cout<<"     states, and prints their differences and timings on exit"<<std::endl;
+	std::cout<<"  -wgs"<<std::endl;
+	std::cout<<"     Calculates water simulation step sizes on the GPU instead of reading"<<std::endl;
+	std::cout<<"     them back after every step; only used with the GPU backend"<<std::endl;
+	std::cout<<"  -nsws"<<std::endl;
+	std::cout<<"     Runs the water simulation separately in each OpenGL context instead"<<std::endl;
+	std::cout<<"     of once per frame in one context whose results are shared with all"<<std::endl;
+	std::cout<<"     others; only relevant with multiple windows on separate displays"<<std::endl;
 	std::cout<<"  -rer <min rain elevation> <max rain elevation>"<<std::endl;
 	std::cout<<"     Sets the elevation range of the rain cloud level relative to the"<<std::endl;
 	std::cout<<"     ground plane in cm"<<std::endl;
 	std::cout<<"     Default: Above range of elevation color map"<<std::endl;
+	std::cout<<"  -ro"<<std::endl;
+	std::cout<<"     Detects physical objects held inside the rain elevation range and"<<std::endl;
+	std::cout<<"     makes rain fall below them"<<std::endl;
 	std::cout<<"  -rs <rain strength>"<<std::endl;
 	std::cout<<"     Sets the strength of global or local rainfall in cm/s"<<std::endl;
 	std::cout<<"     Default: 0.25"<<std::endl;
@@ -526,6 +867,12 @@ void printUsage(void)
 	std::cout<<"     Enables topographic contour lines and sets the elevation distance between"<<std::endl;
 	std::cout<<"     adjacent contour lines to the given value in cm"<<std::endl;
 	std::cout<<"     Default contour line spacing: 0.75"<<std::endl;
+	std::cout<<"  -pcl"<<std::endl;
+	std::cout<<"     Extracts topographic contour lines from a separate pixel-corner elevation"<<std::endl;
+	std::cout<<"     rendering pass instead of the surface rendering pass itself"<<std::endl;
+	std::cout<<"  -vcl"<<std::endl;
+	std::cout<<"     Draws topographic contour lines as simplified vector polylines extracted"<<std::endl;
+	std::cout<<"     from each filtered depth frame in a background thread"<<std::endl;
 	std::cout<<"  -rws"<<std::endl;
 	std::cout<<"     Renders water surface as geometric surface"<<std::endl;
 	std::cout<<"  -rwt"<<std::endl;
@@ -533,8 +880,16 @@ void printUsage(void)
 	std::cout<<"  -wo <water opacity>"<<std::endl;
 	std::cout<<"     Sets the water depth at which water appears opaque in cm"<<std::endl;
 	std::cout<<"     Default: 2.0"<<std::endl;
+	std::cout<<"  -rec <recording file name>"<<std::endl;
+	std::cout<<"     Records the water table's bathymetry and water level grids to the given"<<std::endl;
+	std::cout<<"     file at the rate set by the waterRecordingInterval configuration setting"<<std::endl;
+	std::cout<<"  -play <recording file name>"<<std::endl;
+	std::cout<<"     Plays back the bathymetry and water level grids recorded in the given"<<std::endl;
+	std::cout<<"     file into the water table instead of using the live bathymetry"<<std::endl;
 	std::cout<<"  -cp <control pipe name>"<<std::endl;
-	std::cout<<"     Sets the name of a named POSIX pipe from which to read control commands"<<std::endl;
+	std::cout<<"     Sets the name of a named POSIX pipe from which to read control commands;"<<std::endl;
+	std::cout<<"     \"latency [file name]\" writes per-stage latency statistics to the given"<<std::endl;
+	std::cout<<"     file or named pipe, or to stdout, and \"resetLatency\" discards them"<<std::endl;
 	}
 
 }
@@ -542,16 +897,26 @@ void printUsage(void)
 Sandbox::Sandbox(int& argc,char**& argv)
 	:Vrui::Application(argc,argv),
 	 camera(0),pixelDepthCorrection(0),
-	 frameFilter(0),pauseUpdates(false),
+	 depthFramePipeline(0),frameFilter(0),frameFilterStage(0),heightMapFuser(0),pauseUpdates(false),
 	 depthImageRenderer(0),
-	 waterTable(0),
-	 handExtractor(0),addWaterFunction(0),addWaterFunctionRegistered(false),
+	 waterTable(0),waterStepScheduler(0),numWaterSteps(0),
+	 shareWaterSimulation(true),contextCounter(new ContextCounter),sharedWaterClaimTime(-1.0),sharedWaterTime(-1.0),
+	 handExtractor(0),rainMaker(0),contourLineExtractor(0),waterStateRecorder(0),waterStatePlayer(0),addWaterFunction(0),addWaterFunctionRegistered(false),
 	 sun(0),
 	 activeDem(0),
 	 mainMenu(0),pauseUpdatesToggle(0),waterControlDialog(0),
-	 waterSpeedSlider(0),waterMaxStepsSlider(0),frameRateTextField(0),waterAttenuationSlider(0),
-	 controlPipeFd(-1)
+	 waterSpeedSlider(0),waterMaxStepsSlider(0),frameRateTextField(0),waterTargetFrameRateSlider(0),waterStepsTextField(0),waterGpuStepSizeToggle(0),waterAttenuationSlider(0),
+	 controlPipeFd(-1),
+	 monitorCameraDelivery(false),newFrameArrivalTime(-1.0),displayedFrameArrivalTime(-1.0),displayEndTime(-1.0)
 	{
+	for(int i=0;i<LatencyMonitor::NUM_STAGES;++i)
+		for(int j=0;j<3;++j)
+			latencyTextFields[i][j]=0;
+	for(int i=0;i<3;++i)
+		waterBudgetTextFields[i]=0;
+	for(int i=0;i<2;++i)
+		waterBacklogTextFields[i]=0;
+	
 	/* Read the sandbox's default configuration parameters: */
 	std::string sandboxConfigFileName=CONFIG_CONFIGDIR;
 	sandboxConfigFileName.push_back('/');
@@ -560,6 +925,9 @@ Sandbox::Sandbox(int& argc,char**& argv)
 	Misc::ConfigurationFileSection cfg=sandboxConfigFile.getSection("/SARndbox");
 	unsigned int cameraIndex=cfg.retrieveValue<int>("./cameraIndex",0);
 	std::string cameraConfiguration=cfg.retrieveString("./cameraConfiguration","Camera");
+	std::vector<std::string> auxiliaryCameraNames=cfg.retrieveValue<std::vector<std::string> >("./auxiliaryCameras",std::vector<std::string>());
+	double heightMapCellSize=cfg.retrieveValue<double>("./heightMapCellSize",0.25);
+	float heightMapBlendWidth=cfg.retrieveValue<float>("./heightMapBlendWidth",32.0f);
 	double scale=cfg.retrieveValue<double>("./scaleFactor",100.0);
 	std::string sandboxLayoutFileName=CONFIG_CONFIGDIR;
 	sandboxLayoutFileName.push_back('/');
@@ -570,21 +938,62 @@ Sandbox::Sandbox(int& argc,char**& argv)
 	Plane heightMapPlane;
 	if(haveHeightMapPlane)
 		heightMapPlane=cfg.retrieveValue<Plane>("./heightMapPlane");
+	std::string temporalFilterTypeName=cfg.retrieveString("./temporalFilterType","Averaging");
+	float adaptiveMeasurementVariance=cfg.retrieveValue<float>("./adaptiveMeasurementVariance",2.0f);
+	float adaptiveProcessVariance=cfg.retrieveValue<float>("./adaptiveProcessVariance",0.01f);
+	float adaptiveChangeThreshold=cfg.retrieveValue<float>("./adaptiveChangeThreshold",4.0f);
 	unsigned int numAveragingSlots=cfg.retrieveValue<unsigned int>("./numAveragingSlots",30);
 	unsigned int minNumSamples=cfg.retrieveValue<unsigned int>("./minNumSamples",10);
 	unsigned int maxVariance=cfg.retrieveValue<unsigned int>("./maxVariance",2);
 	float hysteresis=cfg.retrieveValue<float>("./hysteresis",0.1f);
+	std::string spatialFilterTypeName=cfg.retrieveString("./spatialFilterType","Legacy");
+	unsigned int spatialFilterRadius=cfg.retrieveValue<unsigned int>("./spatialFilterRadius",2);
+	float spatialFilterRangeSigma=cfg.retrieveValue<float>("./spatialFilterRangeSigma",2.0f);
+	std::string filterKernelName=cfg.retrieveString("./filterKernel",FrameFilter::getKernelName(FrameFilter::getBestKernel()));
+	unsigned int numFilterThreads=cfg.retrieveValue<unsigned int>("./numFilterThreads",1);
+	bool compactFilterStatistics=cfg.retrieveValue<bool>("./compactFilterStatistics",false);
+	unsigned int numDepthUploadBuffers=cfg.retrieveValue<unsigned int>("./numDepthUploadBuffers",2);
+	bool packDepthTexture=cfg.retrieveValue<bool>("./packDepthTexture",false);
+	std::string shaderCacheDirectory;
+	if(getenv("HOME")!=0)
+		{
+		shaderCacheDirectory=getenv("HOME");
+		shaderCacheDirectory.append("/.cache/SARndbox-2.3/Shaders");
+		}
+	shaderCacheDirectory=cfg.retrieveString("./shaderCacheDirectory",shaderCacheDirectory);
 	Misc::FixedArray<unsigned int,2> wtSize;
 	wtSize[0]=640;
 	wtSize[1]=480;
 	wtSize=cfg.retrieveValue<Misc::FixedArray<unsigned int,2> >("./waterTableSize",wtSize);
 	waterSpeed=cfg.retrieveValue<double>("./waterSpeed",1.0);
 	waterMaxSteps=cfg.retrieveValue<unsigned int>("./waterMaxSteps",30U);
+	waterTargetFrameRate=cfg.retrieveValue<double>("./waterTargetFrameRate",0.0);
+	double waterMaxBacklog=cfg.retrieveValue<double>("./waterMaxBacklog",4.0);
+	std::string waterSimulationBackendName=cfg.retrieveString("./waterSimulationBackend","GPU");
+	unsigned int numWaterSimulationThreads=cfg.retrieveValue<unsigned int>("./numWaterSimulationThreads",1);
+	unsigned int waterMultiRateLevels=cfg.retrieveValue<unsigned int>("./waterMultiRateLevels",0);
+	unsigned int waterMultiRateTileSize=cfg.retrieveValue<unsigned int>("./waterMultiRateTileSize",32);
+	unsigned int waterDryCullingTileSize=cfg.retrieveValue<unsigned int>("./waterDryCullingTileSize",0);
+	GLfloat waterDryCullingThreshold=cfg.retrieveValue<GLfloat>("./waterDryCullingThreshold",0.001f);
+	bool compareWaterBackends=cfg.retrieveValue<bool>("./compareWaterBackends",false);
+	bool waterGpuStepSize=cfg.retrieveValue<bool>("./waterGpuStepSize",false);
+	shareWaterSimulation=cfg.retrieveValue<bool>("./shareWaterSimulation",true);
 	Math::Interval<double> rainElevationRange=cfg.retrieveValue<Math::Interval<double> >("./rainElevationRange",Math::Interval<double>(-1000.0,1000.0));
 	rainStrength=cfg.retrieveValue<GLfloat>("./rainStrength",0.25f);
 	double evaporationRate=cfg.retrieveValue<double>("./evaporationRate",0.0);
+	unsigned int handFullScanInterval=cfg.retrieveValue<unsigned int>("./handFullScanInterval",1);
+	float handTrackingRegionScale=cfg.retrieveValue<float>("./handTrackingRegionScale",1.5f);
+	bool useRainObjects=cfg.retrieveValue<bool>("./useRainObjects",false);
+	int rainMinObjectSize=cfg.retrieveValue<int>("./rainMinObjectSize",20);
+	unsigned int numBlobExtractionThreads=cfg.retrieveValue<unsigned int>("./numBlobExtractionThreads",1);
 	float demDistScale=cfg.retrieveValue<float>("./demDistScale",1.0f);
+	double contourLineTolerance=cfg.retrieveValue<double>("./contourLineTolerance",0.05);
+	float contourLineWidth=cfg.retrieveValue<float>("./contourLineWidth",1.5f);
 	std::string controlPipeName=cfg.retrieveString("./controlPipeName","");
+	double waterRecordingInterval=cfg.retrieveValue<double>("./waterRecordingInterval",1.0/15.0);
+	unsigned int waterRecordingKeyframeInterval=cfg.retrieveValue<unsigned int>("./waterRecordingKeyframeInterval",30);
+	std::string waterRecordingFileName;
+	std::string waterPlaybackFileName;
 	
 	/* Process command line parameters: */
 	bool printHelp=false;
@@ -607,6 +1016,16 @@ Sandbox::Sandbox(int& argc,char**& argv)
 				++i;
 				frameFilePrefix=argv[i];
 				}
+			else if(strcasecmp(argv[i]+1,"ac")==0)
+				{
+				++i;
+				auxiliaryCameraNames.push_back(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"hmcs")==0)
+				{
+				++i;
+				heightMapCellSize=atof(argv[i]);
+				}
 			else if(strcasecmp(argv[i]+1,"s")==0)
 				{
 				++i;
@@ -638,6 +1057,20 @@ Sandbox::Sandbox(int& argc,char**& argv)
 				heightMapPlane=Plane(Plane::Vector(hmp),hmp[3]);
 				heightMapPlane.normalize();
 				}
+			else if(strcasecmp(argv[i]+1,"tf")==0)
+				{
+				++i;
+				temporalFilterTypeName=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"tfp")==0)
+				{
+				++i;
+				adaptiveMeasurementVariance=float(atof(argv[i]));
+				++i;
+				adaptiveProcessVariance=float(atof(argv[i]));
+				++i;
+				adaptiveChangeThreshold=float(atof(argv[i]));
+				}
 			else if(strcasecmp(argv[i]+1,"nas")==0)
 				{
 				++i;
@@ -655,6 +1088,44 @@ Sandbox::Sandbox(int& argc,char**& argv)
 				++i;
 				hysteresis=float(atof(argv[i]));
 				}
+			else if(strcasecmp(argv[i]+1,"sf")==0)
+				{
+				++i;
+				spatialFilterTypeName=argv[i];
+				++i;
+				spatialFilterRadius=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"sfrs")==0)
+				{
+				++i;
+				spatialFilterRangeSigma=float(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"ffk")==0)
+				{
+				++i;
+				filterKernelName=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"fft")==0)
+				{
+				++i;
+				numFilterThreads=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"cfs")==0)
+				compactFilterStatistics=true;
+			else if(strcasecmp(argv[i]+1,"dub")==0)
+				{
+				++i;
+				numDepthUploadBuffers=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"pdt")==0)
+				packDepthTexture=true;
+			else if(strcasecmp(argv[i]+1,"scd")==0)
+				{
+				++i;
+				shaderCacheDirectory=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"nsc")==0)
+				shaderCacheDirectory.clear();
 			else if(strcasecmp(argv[i]+1,"wts")==0)
 				{
 				for(int j=0;j<2;++j)
@@ -670,6 +1141,41 @@ Sandbox::Sandbox(int& argc,char**& argv)
 				++i;
 				waterMaxSteps=atoi(argv[i]);
 				}
+			else if(strcasecmp(argv[i]+1,"wtfr")==0)
+				{
+				++i;
+				waterTargetFrameRate=atof(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"wsb")==0)
+				{
+				++i;
+				waterSimulationBackendName=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"wst")==0)
+				{
+				++i;
+				numWaterSimulationThreads=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"wmr")==0)
+				{
+				++i;
+				waterMultiRateLevels=atoi(argv[i]);
+				++i;
+				waterMultiRateTileSize=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"wdc")==0)
+				{
+				++i;
+				waterDryCullingTileSize=atoi(argv[i]);
+				++i;
+				waterDryCullingThreshold=GLfloat(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"cwb")==0)
+				compareWaterBackends=true;
+			else if(strcasecmp(argv[i]+1,"wgs")==0)
+				waterGpuStepSize=true;
+			else if(strcasecmp(argv[i]+1,"nsws")==0)
+				shareWaterSimulation=false;
 			else if(strcasecmp(argv[i]+1,"rer")==0)
 				{
 				++i;
@@ -678,6 +1184,8 @@ Sandbox::Sandbox(int& argc,char**& argv)
 				double rainElevationMax=atof(argv[i]);
 				rainElevationRange=Math::Interval<double>(rainElevationMin,rainElevationMax);
 				}
+			else if(strcasecmp(argv[i]+1,"ro")==0)
+				useRainObjects=true;
 			else if(strcasecmp(argv[i]+1,"rs")==0)
 				{
 				++i;
@@ -754,6 +1262,10 @@ Sandbox::Sandbox(int& argc,char**& argv)
 					renderSettings.back().contourLineSpacing=GLfloat(atof(argv[i]));
 					}
 				}
+			else if(strcasecmp(argv[i]+1,"pcl")==0)
+				renderSettings.back().pixelCornerContourLines=true;
+			else if(strcasecmp(argv[i]+1,"vcl")==0)
+				renderSettings.back().vectorContourLines=true;
 			else if(strcasecmp(argv[i]+1,"rws")==0)
 				renderSettings.back().renderWaterSurface=true;
 			else if(strcasecmp(argv[i]+1,"rwt")==0)
@@ -768,6 +1280,16 @@ Sandbox::Sandbox(int& argc,char**& argv)
 				++i;
 				controlPipeName=argv[i];
 				}
+			else if(strcasecmp(argv[i]+1,"rec")==0)
+				{
+				++i;
+				waterRecordingFileName=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"play")==0)
+				{
+				++i;
+				waterPlaybackFileName=argv[i];
+				}
 			else
 				std::cerr<<"Ignoring unrecognized command line switch "<<argv[i]<<std::endl;
 			}
@@ -777,6 +1299,9 @@ Sandbox::Sandbox(int& argc,char**& argv)
 	if(printHelp)
 		printUsage();
 	
+	/* Enable the shader program cache: */
+	setShaderCacheDirectory(shaderCacheDirectory.c_str());
+	
 	if(frameFilePrefix!=0)
 		{
 		/* Open the selected pre-recorded 3D video files: */
@@ -792,34 +1317,68 @@ Sandbox::Sandbox(int& argc,char**& argv)
 		Kinect::DirectFrameSource* realCamera=Kinect::openDirectFrameSource(cameraIndex);
 		Misc::ConfigurationFileSection cameraConfigurationSection=cfg.getSection(cameraConfiguration.c_str());
 		realCamera->configure(cameraConfigurationSection);
+		
+		/* Let the camera time-stamp frames relative to the latency monitor's time base to measure delivery latency: */
+		realCamera->setTimeBase(latencyMonitor.getTimeBase());
+		monitorCameraDelivery=true;
+		
 		camera=realCamera;
 		}
 	for(int i=0;i<2;++i)
 		frameSize[i]=camera->getActualFrameSize(Kinect::FrameSource::DEPTH)[i];
 	
-	/* Get the camera's per-pixel depth correction parameters and evaluate it on the depth frame's pixel grid: */
-	Kinect::FrameSource::DepthCorrection* depthCorrection=camera->getDepthCorrectionParameters();
-	if(depthCorrection!=0)
-		{
-		pixelDepthCorrection=depthCorrection->getPixelCorrection(frameSize);
-		delete depthCorrection;
-		}
-	else
+	/* Get the camera's per-pixel depth correction parameters and intrinsic parameters: */
+	pixelDepthCorrection=createPixelDepthCorrection(camera,frameSize);
+	cameraIps=camera->getIntrinsicParameters();
+	
+	/* Open all auxiliary cameras: */
+	for(std::vector<std::string>::iterator acnIt=auxiliaryCameraNames.begin();acnIt!=auxiliaryCameraNames.end();++acnIt)
 		{
-		/* Create dummy per-pixel depth correction parameters: */
-		pixelDepthCorrection=new PixelDepthCorrection[frameSize[1]*frameSize[0]];
-		PixelDepthCorrection* pdcPtr=pixelDepthCorrection;
-		for(unsigned int y=0;y<frameSize[1];++y)
-			for(unsigned int x=0;x<frameSize[0];++x,++pdcPtr)
-				{
-				pdcPtr->scale=1.0f;
-				pdcPtr->offset=0.0f;
-				}
+		Misc::ConfigurationFileSection auxiliaryCameraSection=cfg.getSection(acnIt->c_str());
+		AuxiliaryCamera ac;
+		if(auxiliaryCameraSection.hasTag("./serverHostName"))
+			{
+			/* Open a multiplexed frame source for the given server host name and port number: */
+			std::string serverHostName=auxiliaryCameraSection.retrieveString("./serverHostName");
+			int serverPort=auxiliaryCameraSection.retrieveValue<int>("./serverPort",26000);
+			unsigned int streamIndex=auxiliaryCameraSection.retrieveValue<unsigned int>("./streamIndex",0);
+			Kinect::MultiplexedFrameSource* source=Kinect::MultiplexedFrameSource::create(Cluster::openTCPPipe(Vrui::getClusterMultiplexer(),serverHostName.c_str(),serverPort));
+			if(streamIndex>=source->getNumStreams())
+				throw std::runtime_error("Sandbox: Auxiliary camera stream index out of range");
+			
+			/* Keep the selected stream and release all others: */
+			for(unsigned int i=0;i<source->getNumStreams();++i)
+				if(i!=streamIndex)
+					delete source->getStream(i);
+			ac.camera=source->getStream(streamIndex);
+			}
+		else
+			{
+			/* Open the 3D camera device of the given index: */
+			Kinect::DirectFrameSource* realCamera=Kinect::openDirectFrameSource(auxiliaryCameraSection.retrieveValue<unsigned int>("./cameraIndex"));
+			Misc::ConfigurationFileSection cameraConfigurationSection=cfg.getSection(auxiliaryCameraSection.retrieveString("./cameraConfiguration",cameraConfiguration).c_str());
+			realCamera->configure(cameraConfigurationSection);
+			ac.camera=realCamera;
+			}
+		for(int i=0;i<2;++i)
+			ac.frameSize[i]=ac.camera->getActualFrameSize(Kinect::FrameSource::DEPTH)[i];
+		ac.pixelDepthCorrection=createPixelDepthCorrection(ac.camera,ac.frameSize);
+		
+		/* Get the transformation from the auxiliary camera's space into the main camera's space, either explicitly or from both cameras' extrinsic parameters: */
+		PTransform cameraTransform;
+		if(auxiliaryCameraSection.hasTag("./cameraTransform"))
+			cameraTransform=PTransform(auxiliaryCameraSection.retrieveValue<OGTransform>("./cameraTransform"));
+		else
+			{
+			cameraTransform=Geometry::invert(PTransform(camera->getExtrinsicParameters()));
+			cameraTransform*=PTransform(ac.camera->getExtrinsicParameters());
+			}
+		ac.depthProjection=cameraTransform;
+		ac.depthProjection*=ac.camera->getIntrinsicParameters().depthProjection;
+		ac.frameFilter=0;
+		auxiliaryCameras.push_back(ac);
 		}
 	
-	/* Get the camera's intrinsic parameters: */
-	cameraIps=camera->getIntrinsicParameters();
-	
 	/* Read the sandbox layout file: */
 	Geometry::Plane<double,3> basePlane;
 	Geometry::Point<double,3> basePlaneCorners[4];
@@ -849,7 +1408,11 @@ Sandbox::Sandbox(int& argc,char**& argv)
 	double sf=scale/100.0; // Scale factor from cm to final units
 	for(int i=0;i<3;++i)
 		for(int j=0;j<4;++j)
+			{
 			cameraIps.depthProjection.getMatrix()(i,j)*=sf;
+			for(std::vector<AuxiliaryCamera>::iterator acIt=auxiliaryCameras.begin();acIt!=auxiliaryCameras.end();++acIt)
+				acIt->depthProjection.getMatrix()(i,j)*=sf;
+			}
 	basePlane=Geometry::Plane<double,3>(basePlane.getNormal(),basePlane.getOffset()*sf);
 	for(int i=0;i<4;++i)
 		for(int j=0;j<3;++j)
@@ -867,31 +1430,167 @@ Sandbox::Sandbox(int& argc,char**& argv)
 		for(int i=0;i<4;++i)
 			rsIt->projectorTransform.getMatrix()(i,3)*=sf;
 		}
+	heightMapCellSize*=sf;
 	rainStrength*=sf;
 	evaporationRate*=sf;
 	demDistScale*=sf;
+	contourLineTolerance*=sf;
 	
-	/* Create the frame filter object: */
+	/* Create the frame filter objects of the main camera and all auxiliary cameras: */
 	frameFilter=new FrameFilter(frameSize,numAveragingSlots,pixelDepthCorrection,cameraIps.depthProjection,basePlane);
 	frameFilter->setValidElevationInterval(cameraIps.depthProjection,basePlane,elevationRange.getMin(),elevationRange.getMax());
-	frameFilter->setStableParameters(minNumSamples,maxVariance);
-	frameFilter->setHysteresis(hysteresis);
-	frameFilter->setSpatialFilter(true);
-	frameFilter->setOutputFrameFunction(Misc::createFunctionCall(this,&Sandbox::receiveFilteredFrame));
+	std::vector<FrameFilter*> frameFilters;
+	frameFilters.push_back(frameFilter);
+	for(std::vector<AuxiliaryCamera>::iterator acIt=auxiliaryCameras.begin();acIt!=auxiliaryCameras.end();++acIt)
+		{
+		acIt->frameFilter=new FrameFilter(acIt->frameSize,numAveragingSlots,acIt->pixelDepthCorrection,acIt->depthProjection,basePlane);
+		acIt->frameFilter->setValidElevationInterval(acIt->depthProjection,basePlane,elevationRange.getMin(),elevationRange.getMax());
+		frameFilters.push_back(acIt->frameFilter);
+		}
+	
+	/* Select the frame filters' per-pixel temporal filter: */
+	int temporalFilterType;
+	for(temporalFilterType=FrameFilter::AVERAGING_TEMPORAL_FILTER;temporalFilterType<=FrameFilter::ADAPTIVE_TEMPORAL_FILTER;++temporalFilterType)
+		if(strcasecmp(temporalFilterTypeName.c_str(),FrameFilter::getTemporalFilterTypeName(FrameFilter::TemporalFilterType(temporalFilterType)))==0)
+			break;
+	if(temporalFilterType>FrameFilter::ADAPTIVE_TEMPORAL_FILTER)
+		{
+		std::cerr<<"Unknown temporal filter type "<<temporalFilterTypeName<<"; using averaging temporal filter"<<std::endl;
+		temporalFilterType=FrameFilter::AVERAGING_TEMPORAL_FILTER;
+		}
+	
+	/* Select the frame filters' spatial filter type: */
+	bool useSpatialFilter=strcasecmp(spatialFilterTypeName.c_str(),"None")!=0;
+	int spatialFilterType=FrameFilter::LEGACY_SPATIAL_FILTER;
+	if(useSpatialFilter)
+		{
+		for(spatialFilterType=FrameFilter::LEGACY_SPATIAL_FILTER;spatialFilterType<=FrameFilter::BILATERAL_SPATIAL_FILTER;++spatialFilterType)
+			if(strcasecmp(spatialFilterTypeName.c_str(),FrameFilter::getSpatialFilterTypeName(FrameFilter::SpatialFilterType(spatialFilterType)))==0)
+				break;
+		if(spatialFilterType>FrameFilter::BILATERAL_SPATIAL_FILTER)
+			{
+			std::cerr<<"Unknown spatial filter type "<<spatialFilterTypeName<<"; using legacy spatial filter"<<std::endl;
+			spatialFilterType=FrameFilter::LEGACY_SPATIAL_FILTER;
+			}
+		}
+	
+	/* Select the frame filters' per-pixel kernel: */
+	int filterKernel;
+	for(filterKernel=FrameFilter::SCALAR_KERNEL;filterKernel<=FrameFilter::AVX2_KERNEL;++filterKernel)
+		if(strcasecmp(filterKernelName.c_str(),FrameFilter::getKernelName(FrameFilter::FilterKernel(filterKernel)))==0)
+			break;
+	if(filterKernel>FrameFilter::AVX2_KERNEL||!FrameFilter::isKernelSupported(FrameFilter::FilterKernel(filterKernel)))
+		{
+		std::cerr<<"Unsupported frame filter kernel "<<filterKernelName<<"; using "<<FrameFilter::getKernelName(FrameFilter::getBestKernel())<<" kernel"<<std::endl;
+		filterKernel=FrameFilter::getBestKernel();
+		}
+	
+	if(compactFilterStatistics&&numAveragingSlots>255U)
+		{
+		std::cerr<<"Compact frame filter statistics not supported for more than 255 averaging slots"<<std::endl;
+		compactFilterStatistics=false;
+		}
+	
+	/* Configure all frame filters identically: */
+	for(std::vector<FrameFilter*>::iterator ffIt=frameFilters.begin();ffIt!=frameFilters.end();++ffIt)
+		{
+		FrameFilter* ff=*ffIt;
+		ff->setTemporalFilterType(FrameFilter::TemporalFilterType(temporalFilterType));
+		ff->setAdaptiveParameters(adaptiveMeasurementVariance,adaptiveProcessVariance,adaptiveChangeThreshold);
+		ff->setStableParameters(minNumSamples,maxVariance);
+		ff->setHysteresis(hysteresis);
+		if(useSpatialFilter)
+			{
+			ff->setSpatialFilterType(FrameFilter::SpatialFilterType(spatialFilterType),spatialFilterRadius);
+			ff->setSpatialFilterRangeSigma(spatialFilterRangeSigma);
+			}
+		ff->setSpatialFilter(useSpatialFilter);
+		ff->setFilterKernel(FrameFilter::FilterKernel(filterKernel));
+		if(compactFilterStatistics)
+			ff->setCompactStatistics(true);
+		}
+	
+	/* Get the size and projection of the depth images from which the sand surface is rendered: */
+	const unsigned int* surfaceSize=frameSize;
+	PTransform surfaceProjection=cameraIps.depthProjection;
+	if(!auxiliaryCameras.empty())
+		{
+		/* Fuse the filtered frames of the main and all auxiliary cameras into a single height map aligned with the base plane: */
+		heightMapFuser=new HeightMapFuser(basePlane,basePlaneCorners,heightMapCellSize);
+		heightMapFuser->setBlendWidth(heightMapBlendWidth);
+		heightMapFuser->addCamera(frameSize,cameraIps.depthProjection);
+		for(std::vector<AuxiliaryCamera>::iterator acIt=auxiliaryCameras.begin();acIt!=auxiliaryCameras.end();++acIt)
+			{
+			/* Filter the auxiliary camera's frames in its own threads and hand them to the height map fuser: */
+			unsigned int fuserCameraIndex=heightMapFuser->addCamera(acIt->frameSize,acIt->depthProjection);
+			acIt->frameFilter->setNumFilterThreads(numFilterThreads);
+			acIt->frameFilter->setOutputFrameFunction(Misc::createFunctionCall(heightMapFuser,&HeightMapFuser::receiveFrame,fuserCameraIndex));
+			}
+		heightMapFuser->setOutputFrameFunction(Misc::createFunctionCall(this,&Sandbox::receiveFilteredFrame));
+		surfaceSize=heightMapFuser->getSize();
+		surfaceProjection=heightMapFuser->getDepthProjection();
+		}
+	else
+		frameFilter->setOutputFrameFunction(Misc::createFunctionCall(this,&Sandbox::receiveFilteredFrame));
 	
 	if(waterSpeed>0.0)
 		{
 		/* Create the hand extractor object: */
 		handExtractor=new HandExtractor(frameSize,pixelDepthCorrection,cameraIps.depthProjection);
+		handExtractor->setTracking(handFullScanInterval,handTrackingRegionScale);
+		handExtractor->setNumBlobExtractionThreads(numBlobExtractionThreads);
+		
+		if(useRainObjects)
+			{
+			/* Create the rain maker object to detect physical objects inside the rain elevation range: */
+			rainMaker=new RainMaker(frameSize,camera->getActualFrameSize(Kinect::FrameSource::COLOR),cameraIps.depthProjection,cameraIps.colorProjection,basePlane,rainElevationRange.getMin(),rainElevationRange.getMax(),rainMinObjectSize);
+			rainMaker->setNumBlobExtractionThreads(numBlobExtractionThreads);
+			rainMaker->setOutputBlobsFunction(Misc::createFunctionCall(this,&Sandbox::receiveRainObjects));
+			}
 		}
 	
+	for(std::vector<RenderSettings>::iterator rsIt=renderSettings.begin();rsIt!=renderSettings.end();++rsIt)
+		if(rsIt->useContourLines&&rsIt->vectorContourLines)
+			{
+			/* Create the contour line extractor using the first such window's contour line spacing: */
+			contourLineExtractor=new ContourLineExtractor(surfaceSize,surfaceProjection,basePlane);
+			contourLineExtractor->setContourLineSpacing(rsIt->contourLineSpacing);
+			contourLineExtractor->setSimplificationTolerance(contourLineTolerance);
+			contourLineExtractor->setLineWidth(contourLineWidth);
+			contourLineExtractor->setLineLift(0.1*sf);
+			contourLineExtractor->setContourLinesExtractedFunction(Misc::createFunctionCall(this,&Sandbox::receiveContourLines));
+			break;
+			}
+	
+	/* Run the frame filter, the height map fuser, and all frame analysis stages in a shared pool of threads; contour lines are extracted from filtered or fused frames: */
+	depthFramePipeline=new DepthFramePipeline;
+	frameFilterStage=depthFramePipeline->addStage(frameFilter);
+	unsigned int surfaceStage=frameFilterStage;
+	if(heightMapFuser!=0)
+		surfaceStage=depthFramePipeline->addStage(heightMapFuser,frameFilterStage);
+	if(handExtractor!=0)
+		depthFramePipeline->addStage(handExtractor);
+	if(rainMaker!=0)
+		depthFramePipeline->addStage(rainMaker);
+	if(contourLineExtractor!=0)
+		depthFramePipeline->addStage(contourLineExtractor,surfaceStage);
+	unsigned int numPipelineThreads=numFilterThreads>0?numFilterThreads:1;
+	if(handExtractor!=0||rainMaker!=0||contourLineExtractor!=0)
+		++numPipelineThreads;
+	depthFramePipeline->start(numPipelineThreads);
+	
 	/* Start streaming depth frames: */
 	camera->startStreaming(0,Misc::createFunctionCall(this,&Sandbox::rawDepthFrameDispatcher));
+	for(unsigned int i=0;i<auxiliaryCameras.size();++i)
+		auxiliaryCameras[i].camera->startStreaming(0,Misc::createFunctionCall(this,&Sandbox::auxiliaryDepthFrameDispatcher,i));
 	
 	/* Create the depth image renderer: */
-	depthImageRenderer=new DepthImageRenderer(frameSize);
-	depthImageRenderer->setDepthProjection(cameraIps.depthProjection);
+	depthImageRenderer=new DepthImageRenderer(surfaceSize);
+	depthImageRenderer->setDepthProjection(surfaceProjection);
 	depthImageRenderer->setBasePlane(basePlane);
+	depthImageRenderer->setNumUploadBuffers(numDepthUploadBuffers);
+	if(packDepthTexture)
+		depthImageRenderer->setPackDepth(true,elevationRange.getMin(),elevationRange.getMax());
 	
 	/* Calculate the transformation from camera space to sandbox space: */
 	{
@@ -918,10 +1617,62 @@ Sandbox::Sandbox(int& argc,char**& argv)
 		waterTable->setElevationRange(elevationRange.getMin(),rainElevationRange.getMax());
 		waterTable->setWaterDeposit(evaporationRate);
 		
+		/* Select the water flow simulation backend: */
+		int backend;
+		for(backend=WaterTable2::GPU_BACKEND;backend<=WaterTable2::CPU_BACKEND;++backend)
+			if(strcasecmp(waterSimulationBackendName.c_str(),WaterTable2::getSimulationBackendName(WaterTable2::SimulationBackend(backend)))==0)
+				break;
+		if(backend>WaterTable2::CPU_BACKEND)
+			{
+			std::cerr<<"Unknown water simulation backend "<<waterSimulationBackendName<<"; using GPU backend"<<std::endl;
+			backend=WaterTable2::GPU_BACKEND;
+			}
+		waterTable->setSimulationBackend(WaterTable2::SimulationBackend(backend),numWaterSimulationThreads);
+		waterTable->setMultiRate(waterMultiRateLevels,waterMultiRateTileSize);
+		waterTable->setDryCulling(waterDryCullingTileSize,waterDryCullingThreshold);
+		waterTable->setCompareBackends(compareWaterBackends);
+		waterTable->setGpuStepSize(waterGpuStepSize);
+		
+		/* Create the scheduler deciding how many simulation steps to run per frame: */
+		waterStepScheduler=new WaterStepScheduler;
+		waterStepScheduler->setMaxNumSteps(waterMaxSteps);
+		waterStepScheduler->setTargetFrameRate(waterTargetFrameRate);
+		waterStepScheduler->setMaxBacklog(waterMaxBacklog);
+		waterStepScheduler->setShared(shareWaterSimulation);
+		
+		/* Allocate the buffer to hand water simulation results between OpenGL contexts: */
+		if(shareWaterSimulation)
+			sharedWaterQuantity.resize(size_t(wtSize[0])*size_t(wtSize[1])*3,0.0f);
+		
 		/* Register a render function with the water table: */
 		addWaterFunction=Misc::createFunctionCall(this,&Sandbox::addWater);
 		waterTable->addRenderFunction(addWaterFunction);
 		addWaterFunctionRegistered=true;
+		
+		if(!waterRecordingFileName.empty())
+			{
+			/* Create the water state recorder: */
+			waterStateRecorder=new WaterStateRecorder(waterTable,waterRecordingFileName.c_str(),waterRecordingInterval,waterRecordingKeyframeInterval);
+			}
+		
+		if(!waterPlaybackFileName.empty())
+			{
+			try
+				{
+				/* Open the water state recording and check that it matches the water table: */
+				waterStatePlayer=new WaterStatePlayer(waterPlaybackFileName.c_str());
+				if((unsigned int)(waterStatePlayer->getWaterSize(0))!=wtSize[0]||(unsigned int)(waterStatePlayer->getWaterSize(1))!=wtSize[1])
+					{
+					std::cerr<<"Water state recording "<<waterPlaybackFileName<<" does not match the water table size; ignoring"<<std::endl;
+					delete waterStatePlayer;
+					waterStatePlayer=0;
+					}
+				}
+			catch(const std::runtime_error& err)
+				{
+				std::cerr<<"Unable to play water state recording "<<waterPlaybackFileName<<" due to exception "<<err.what()<<"; ignoring"<<std::endl;
+				}
+			}
 		}
 	
 	/* Initialize all surface renderers: */
@@ -938,8 +1689,9 @@ Sandbox::Sandbox(int& argc,char**& argv)
 		
 		/* Initialize the surface renderer: */
 		rsIt->surfaceRenderer=new SurfaceRenderer(depthImageRenderer);
-		rsIt->surfaceRenderer->setDrawContourLines(rsIt->useContourLines);
+		rsIt->surfaceRenderer->setDrawContourLines(rsIt->useContourLines&&!rsIt->vectorContourLines);
 		rsIt->surfaceRenderer->setContourLineDistance(rsIt->contourLineSpacing);
+		rsIt->surfaceRenderer->setPixelCornerContourLines(rsIt->pixelCornerContourLines);
 		rsIt->surfaceRenderer->setElevationColorMap(rsIt->elevationColorMap);
 		rsIt->surfaceRenderer->setIlluminate(rsIt->hillshade);
 		if(waterTable!=0)
@@ -1016,12 +1768,44 @@ Sandbox::~Sandbox(void)
 	/* Stop streaming depth frames: */
 	camera->stopStreaming();
 	delete camera;
+	for(std::vector<AuxiliaryCamera>::iterator acIt=auxiliaryCameras.begin();acIt!=auxiliaryCameras.end();++acIt)
+		{
+		acIt->camera->stopStreaming();
+		delete acIt->camera;
+		}
+	delete depthFramePipeline;
+	for(std::vector<AuxiliaryCamera>::iterator acIt=auxiliaryCameras.begin();acIt!=auxiliaryCameras.end();++acIt)
+		{
+		delete acIt->frameFilter;
+		delete[] acIt->pixelDepthCorrection;
+		}
 	delete frameFilter;
+	delete heightMapFuser;
+	
+	/* Print the differences between the water simulation backends: */
+	if(waterTable!=0&&waterTable->getCompareBackends())
+		{
+		const WaterTable2::BackendComparison& bc=waterTable->getBackendComparison();
+		std::cout<<"Compared "<<bc.numSteps<<" water simulation steps"<<std::endl;
+		if(bc.numSteps>0)
+			{
+			std::cout<<"Mean step time: GPU "<<bc.gpuTime*1000.0/double(bc.numSteps)<<" ms, CPU "<<bc.cpuTime*1000.0/double(bc.numSteps)<<" ms"<<std::endl;
+			std::cout<<"Maximum step size difference: "<<bc.maxStepSizeDifference<<std::endl;
+			static const char* quantityNames[3]={"w","hu","hv"};
+			for(int i=0;i<3;++i)
+				std::cout<<"Quantity "<<quantityNames[i]<<": maximum difference "<<bc.maxQuantityDifference[i]<<", RMS difference "<<bc.getRmsQuantityDifference(i)<<std::endl;
+			}
+		}
 	
 	/* Delete helper objects: */
+	delete waterStateRecorder;
+	delete waterStatePlayer;
+	delete waterStepScheduler;
 	delete waterTable;
 	delete depthImageRenderer;
 	delete handExtractor;
+	delete rainMaker;
+	delete contourLineExtractor;
 	delete addWaterFunction;
 	delete[] pixelDepthCorrection;
 	
@@ -1043,11 +1827,29 @@ void Sandbox::toolDestructionCallback(Vrui::ToolManager::ToolDestructionCallback
 
 void Sandbox::frame(void)
 	{
+	/* Vrui swapped the buffers of all windows after the previous display pass; record the swap and end-to-end latencies: */
+	double frameStartTime=latencyMonitor.getTime();
+	if(displayEndTime>=0.0)
+		{
+		latencyMonitor.addSample(LatencyMonitor::PROJECTOR_SWAP,frameStartTime-displayEndTime);
+		displayEndTime=-1.0;
+		}
+	if(displayedFrameArrivalTime>=0.0)
+		{
+		latencyMonitor.addSample(LatencyMonitor::END_TO_END,frameStartTime-displayedFrameArrivalTime);
+		displayedFrameArrivalTime=-1.0;
+		}
+	
 	/* Check if the filtered frame has been updated: */
 	if(filteredFrames.lockNewValue())
 		{
-		/* Update the depth image renderer's depth image: */
-		depthImageRenderer->setDepthImage(filteredFrames.getLockedValue());
+		/* Update the depth image renderer's depth image, along with the frame filter's record of changed tiles: */
+		const FilteredFrame& filteredFrame=filteredFrames.getLockedValue();
+		depthImageRenderer->setDepthImage(filteredFrame.frame,FrameFilter::getFrameIndex(filteredFrame.frame),FrameFilter::dirtyTileSize,FrameFilter::getTileChangeIndices(filteredFrame.frame));
+		
+		/* Record the time the frame waited in the triple buffer: */
+		latencyMonitor.addSample(LatencyMonitor::FRAME_HANDOFF,frameStartTime-filteredFrame.filterTime);
+		newFrameArrivalTime=filteredFrame.frame.timeStamp;
 		}
 	
 	if(handExtractor!=0)
@@ -1071,6 +1873,24 @@ void Sandbox::frame(void)
 		#endif
 		}
 	
+	if(rainMaker!=0)
+		{
+		/* Lock the most recent detected rain object list: */
+		rainObjects.lockNewValue();
+		}
+	
+	if(contourLineExtractor!=0)
+		{
+		/* Lock the most recent extracted contour lines: */
+		contourLineExtractor->lockNewContourLines();
+		}
+	
+	if(waterStatePlayer!=0)
+		{
+		/* Advance the water state recording in step with the application time: */
+		waterStatePlayer->seek(waterStatePlayer->findFrame(waterStatePlayer->getFrameTime(0)+Vrui::getApplicationTime()));
+		}
+	
 	/* Update all surface renderers: */
 	for(std::vector<RenderSettings>::iterator rsIt=renderSettings.begin();rsIt!=renderSettings.end();++rsIt)
 		rsIt->surfaceRenderer->setAnimationTime(Vrui::getApplicationTime());
@@ -1114,9 +1934,19 @@ void Sandbox::frame(void)
 			else if(strcasecmp(command,"waterMaxSteps")==0)
 				{
 				waterMaxSteps=atoi(parameter);
+				if(waterStepScheduler!=0)
+					waterStepScheduler->setMaxNumSteps(waterMaxSteps);
 				if(waterMaxStepsSlider!=0)
 					waterMaxStepsSlider->setValue(waterMaxSteps);
 				}
+			else if(strcasecmp(command,"waterTargetFrameRate")==0)
+				{
+				waterTargetFrameRate=atof(parameter);
+				if(waterStepScheduler!=0)
+					waterStepScheduler->setTargetFrameRate(waterTargetFrameRate);
+				if(waterTargetFrameRateSlider!=0)
+					waterTargetFrameRateSlider->setValue(waterTargetFrameRate);
+				}
 			else if(strcasecmp(command,"waterAttenuation")==0)
 				{
 				double attenuation=atof(parameter);
@@ -1154,6 +1984,10 @@ void Sandbox::frame(void)
 					if(rsIt->elevationColorMap!=0)
 						rsIt->elevationColorMap->calcTexturePlane(heightMapPlane);
 				}
+			else if(strcasecmp(command,"latency")==0)
+				writeLatencyStatistics(parameter);
+			else if(strcasecmp(command,"resetLatency")==0)
+				latencyMonitor.reset();
 			}
 		}
 	
@@ -1161,6 +1995,9 @@ void Sandbox::frame(void)
 		{
 		/* Update the frame rate display: */
 		frameRateTextField->setValue(1.0/Vrui::getCurrentFrameTime());
+		waterStepsTextField->setValue(numWaterSteps);
+		updateWaterBudgetDisplay();
+		updateLatencyDisplay();
 		}
 	
 	if(pauseUpdates)
@@ -1180,41 +2017,117 @@ void Sandbox::display(GLContextData& contextData) const
 		;
 	const RenderSettings& rs=windowIndex<int(renderSettings.size())?renderSettings[windowIndex]:renderSettings.back();
 	
+	if(windowIndex==0&&newFrameArrivalTime>=0.0)
+		{
+		/* Upload the new depth image into the depth texture up-front to measure the upload latency: */
+		double uploadStartTime=latencyMonitor.getTime();
+		depthImageRenderer->bindDepthTexture(contextData);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		latencyMonitor.addSample(LatencyMonitor::DEPTH_UPLOAD,latencyMonitor.getTime()-uploadStartTime);
+		
+		/* Remember that the new depth image is shown after this display pass: */
+		displayedFrameArrivalTime=newFrameArrivalTime;
+		newFrameArrivalTime=-1.0;
+		}
+	
 	/* Check if the water simulation state needs to be updated: */
 	if(waterTable!=0&&dataItem->waterTableTime!=Vrui::getApplicationTime())
 		{
-		/* Update the water table's bathymetry grid: */
-		waterTable->updateBathymetry(contextData);
+		double waterStartTime=latencyMonitor.getTime();
 		
-		/* Run the water flow simulation's main pass: */
-		GLfloat totalTimeStep=GLfloat(Vrui::getFrameTime()*waterSpeed);
-		unsigned int numSteps=0;
-		while(numSteps<waterMaxSteps-1U&&totalTimeStep>1.0e-8f)
+		if(waterStatePlayer!=0)
 			{
-			/* Run with a self-determined time step to maintain stability: */
-			waterTable->setMaxStepSize(totalTimeStep);
-			GLfloat timeStep=waterTable->runSimulationStep(false,contextData);
-			totalTimeStep-=timeStep;
-			++numSteps;
+			/* Replace the water table's bathymetry and water level with the current recorded frame when it changes: */
+			if(dataItem->playbackFrame!=waterStatePlayer->getCurrentFrame())
+				{
+				waterStatePlayer->apply(waterTable,contextData);
+				dataItem->playbackFrame=waterStatePlayer->getCurrentFrame();
+				}
 			}
-		#if 0
-		if(totalTimeStep>1.0e-8f)
+		else
 			{
-			std::cout<<'.'<<std::flush;
-			/* Force the final step to avoid simulation slow-down: */
-			waterTable->setMaxStepSize(totalTimeStep);
-			GLfloat timeStep=waterTable->runSimulationStep(true,contextData);
-			totalTimeStep-=timeStep;
-			++numSteps;
+			/* Update the water table's bathymetry grid: */
+			waterTable->updateBathymetry(contextData);
+			}
+		
+		/* Check whether this OpenGL context runs the simulation for the current frame, or adopts another context's results: */
+		bool share=shareWaterSimulation&&contextCounter->numContexts.get()>1;
+		bool simulate=true;
+		if(share)
+			{
+			/* Claim the simulation if no other context has claimed it for the current frame yet: */
+			Threads::MutexCond::Lock sharedWaterLock(sharedWaterCond);
+			simulate=sharedWaterClaimTime!=Vrui::getApplicationTime();
+			sharedWaterClaimTime=Vrui::getApplicationTime();
+			}
+		
+		if(simulate)
+			{
+			/* Ask the step scheduler how much simulation time to advance, including previous frames' backlog, and how many steps to spend on it: */
+			GLfloat totalTimeStep;
+			unsigned int maxNumSteps=waterStepScheduler->startSteps(GLfloat(Vrui::getFrameTime()*waterSpeed),Vrui::getCurrentFrameTime(),totalTimeStep,contextData);
+			
+			/* Run the water flow simulation's main pass: */
+			unsigned int numSteps=0;
+			if(waterTable->getGpuStepSize())
+				{
+				/* Run a batch of steps whose step sizes are calculated and accumulated on the GPU: */
+				waterTable->setMaxStepSize(totalTimeStep);
+				numSteps=waterTable->runSimulationSteps(totalTimeStep,maxNumSteps,contextData);
+				
+				/* Check how much time the previous frame failed to simulate; it is only reported again after issuing more steps: */
+				totalTimeStep=numSteps>0?waterTable->getUnsimulatedTime(contextData):0.0f;
+				}
+			else
+				{
+				while(numSteps<maxNumSteps&&totalTimeStep>1.0e-8f)
+					{
+					/* Run with a self-determined time step to maintain stability: */
+					waterTable->setMaxStepSize(totalTimeStep);
+					GLfloat timeStep=waterTable->runSimulationStep(false,contextData);
+					totalTimeStep-=timeStep;
+					++numSteps;
+					}
+				}
+			numWaterSteps=numSteps;
+			
+			/* Carry the unsimulated time over into the next frame: */
+			waterStepScheduler->finishSteps(numSteps,totalTimeStep,contextData);
+			
+			if(share)
+				{
+				/* Hand the new conserved quantities to all other OpenGL contexts; the read-back waits for this frame's steps to finish on the GPU and copies the full grid to client memory, a cost only paid while several contexts are live: */
+				
+				/* Hold the lock while writing the buffer, as contexts still adopting the previous frame read from it: */
+				Threads::MutexCond::Lock sharedWaterLock(sharedWaterCond);
+				waterTable->readQuantity(&sharedWaterQuantity.front(),contextData);
+				sharedWaterTime=Vrui::getApplicationTime();
+				sharedWaterCond.broadcast();
+				}
+			}
+		else
+			{
+			/* Wait until the claiming context has published the current frame's results; it does so during its own display call: */
+			Threads::MutexCond::Lock sharedWaterLock(sharedWaterCond);
+			Misc::Time timeout=Misc::Time::now()+Misc::Time(sharedWaterTimeout);
+			while(sharedWaterTime!=Vrui::getApplicationTime())
+				if(!sharedWaterCond.timedWait(sharedWaterLock,timeout))
+					break;
+			
+			/* Adopt the shared conserved quantities, or keep the previously adopted ones if the claiming context did not publish in time: */
+			if(sharedWaterTime==Vrui::getApplicationTime())
+				waterTable->setQuantity(&sharedWaterQuantity.front(),contextData);
+			}
+		
+		if(waterStateRecorder!=0)
+			{
+			/* Record the new water simulation state: */
+			waterStateRecorder->capture(Vrui::getApplicationTime(),contextData);
 			}
-		#else
-		if(totalTimeStep>1.0e-8f)
-		//ERIC: frequently hitting this so commented out, see why
-			//std::cout<<"Ran out of time by "<<totalTimeStep<<std::endl;
-		#endif
 		
 		/* Mark the water simulation state as up-to-date for this frame: */
 		dataItem->waterTableTime=Vrui::getApplicationTime();
+		latencyMonitor.addSample(LatencyMonitor::WATER_SIMULATION,latencyMonitor.getTime()-waterStartTime);
 		}
 	
 	/* Calculate the projection matrix: */
@@ -1405,6 +2318,12 @@ void Sandbox::display(GLContextData& contextData) const
 		rs.surfaceRenderer->renderSinglePass(ds.viewport,projection,ds.modelviewNavigational,contextData);
 		}
 	
+	if(rs.useContourLines&&rs.vectorContourLines)
+		{
+		/* Draw the extracted contour lines on top of the surface: */
+		contourLineExtractor->glRenderAction(projection,ds.modelviewNavigational,contextData);
+		}
+	
 	if(rs.waterRenderer!=0)
 		{
 		/* Draw the water surface: */
@@ -1413,6 +2332,12 @@ void Sandbox::display(GLContextData& contextData) const
 		glMaterialShininess(GLMaterialEnums::FRONT,64.0f);
 		rs.waterRenderer->render(projection,ds.modelviewNavigational,contextData);
 		}
+	
+	if(windowIndex==0)
+		{
+		/* Record the end of the display pass to measure the following buffer swap: */
+		displayEndTime=latencyMonitor.getTime();
+		}
 	}
 
 void Sandbox::resetNavigation(void)
@@ -1442,7 +2367,7 @@ void Sandbox::eventCallback(Vrui::Application::EventID eventId,Vrui::InputDevice
 void Sandbox::initContext(GLContextData& contextData) const
 	{
 	/* Create a data item and add it to the context: */
-	DataItem* dataItem=new DataItem;
+	DataItem* dataItem=new DataItem(contextCounter);
 	contextData.addDataItem(this,dataItem);
 	
 	{
@@ -22,6 +22,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef SANDBOX_INCLUDED
 #define SANDBOX_INCLUDED
 
+#include <vector>
+#include <Misc/Autopointer.h>
+#include <Threads/Atomic.h>
+#include <Threads/RefCounted.h>
+#include <Threads/MutexCond.h>
 #include <Threads/TripleBuffer.h>
 #include <Geometry/Box.h>
 #include <Geometry/OrthonormalTransformation.h>
@@ -41,6 +46,9 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <Kinect/FrameSource.h>
 
 #include "Types.h"
+#include "LatencyMonitor.h"
+#include "ContourLineExtractor.h"
+#include "RainMaker.h"
 
 /* Forward declarations: */
 namespace Misc {
@@ -59,15 +67,20 @@ class Lightsource;
 namespace Kinect {
 class Camera;
 }
+class DepthFramePipeline;
 class FrameFilter;
+class HeightMapFuser;
 class DepthImageRenderer;
 class ElevationColorMap;
 class DEM;
 class SurfaceRenderer;
 class WaterTable2;
+class WaterStepScheduler;
 class HandExtractor;
 typedef Misc::FunctionCall<GLContextData&> AddWaterFunction;
 class WaterRenderer;
+class WaterStateRecorder;
+class WaterStatePlayer;
 
 class Sandbox:public Vrui::Application,public GLObject
 	{
@@ -77,20 +90,56 @@ class Sandbox:public Vrui::Application,public GLObject
 	typedef Geometry::OrthonormalTransformation<Scalar,3> ONTransform; // Type for rigid body transformations
 	typedef Kinect::FrameSource::DepthCorrection::PixelCorrection PixelDepthCorrection; // Type for per-pixel depth correction factors
 	
+	struct ContextCounter:public Threads::RefCounted // Reference-counted counter of live OpenGL contexts; held by all contexts' data items because those can outlive the sandbox during shutdown
+		{
+		/* Elements: */
+		public:
+		Threads::Atomic<unsigned int> numContexts; // Number of OpenGL contexts that have been initialized and not yet destroyed
+		
+		/* Constructors and destructors: */
+		ContextCounter(void)
+			:numContexts(0)
+			{
+			}
+		};
+	
+	typedef Misc::Autopointer<ContextCounter> ContextCounterPtr; // Type for pointers to context counters
+	
 	struct DataItem:public GLObject::DataItem
 		{
 		/* Elements: */
 		public:
+		ContextCounterPtr contextCounter; // Counter of live OpenGL contexts, decremented when this context is destroyed
 		double waterTableTime; // Simulation time stamp of the water table in this OpenGL context
+		unsigned int playbackFrame; // Index of the recorded frame most recently applied to the water table in this OpenGL context
 		GLsizei shadowBufferSize[2]; // Size of the shadow rendering frame buffer
 		GLuint shadowFramebufferObject; // Frame buffer object to render shadow maps
 		GLuint shadowDepthTextureObject; // Depth texture for the shadow rendering frame buffer
 		
 		/* Constructors and destructors: */
-		DataItem(void);
+		DataItem(const ContextCounterPtr& sContextCounter);
 		virtual ~DataItem(void);
 		};
 	
+	struct AuxiliaryCamera // Structure holding an additional camera whose filtered depth frames are fused with the main camera's
+		{
+		/* Elements: */
+		public:
+		Kinect::FrameSource* camera; // The camera device or stream
+		unsigned int frameSize[2]; // Width and height of the camera's depth frames
+		PixelDepthCorrection* pixelDepthCorrection; // Buffer of per-pixel depth correction coefficients
+		PTransform depthProjection; // Projection from the camera's depth image space into the main camera's 3D camera space
+		FrameFilter* frameFilter; // Processing object to filter raw depth frames from the camera in its own threads
+		};
+	
+	struct FilteredFrame // Structure to hand filtered depth frames from the frame filter to the main loop
+		{
+		/* Elements: */
+		public:
+		Kinect::FrameBuffer frame; // The filtered depth frame; its time stamp is the arrival time of the raw frame it was filtered from
+		double filterTime; // Time at which the frame filter finished the frame
+		};
+	
 	struct RenderSettings // Structure to hold per-window rendering settings
 		{
 		/* Elements: */
@@ -104,6 +153,8 @@ class Sandbox:public Vrui::Application,public GLObject
 		ElevationColorMap* elevationColorMap; // Pointer to an elevation color map
 		bool useContourLines; // Flag whether to draw elevation contour lines
 		GLfloat contourLineSpacing; // Spacing between adjacent contour lines in cm
+		bool pixelCornerContourLines; // Flag whether to extract contour lines in a separate pixel-corner elevation pass
+		bool vectorContourLines; // Flag whether to draw contour lines as vector polylines extracted in a background thread
 		bool renderWaterSurface; // Flag whether to render the water surface as a geometric surface
 		GLfloat waterOpacity; // Opacity factor for water when rendered as texture
 		SurfaceRenderer* surfaceRenderer; // Surface rendering object for this window
@@ -129,17 +180,35 @@ class Sandbox:public Vrui::Application,public GLObject
 	unsigned int frameSize[2]; // Width and height of the camera's depth frames
 	PixelDepthCorrection* pixelDepthCorrection; // Buffer of per-pixel depth correction coefficients
 	Kinect::FrameSource::IntrinsicParameters cameraIps; // Intrinsic parameters of the Kinect camera
+	DepthFramePipeline* depthFramePipeline; // Processing graph running all depth frame processing stages on a shared pool of threads
 	FrameFilter* frameFilter; // Processing object to filter raw depth frames from the Kinect camera
+	unsigned int frameFilterStage; // Index of the frame filter in the depth frame processing pipeline
+	std::vector<AuxiliaryCamera> auxiliaryCameras; // List of additional cameras covering parts of a large sandbox
+	HeightMapFuser* heightMapFuser; // Processing object to fuse the filtered frames of the main and auxiliary cameras into a single height map, or null with a single camera
 	bool pauseUpdates; // Pauses updates of the topography
-	Threads::TripleBuffer<Kinect::FrameBuffer> filteredFrames; // Triple buffer for incoming filtered depth frames
+	Threads::TripleBuffer<FilteredFrame> filteredFrames; // Triple buffer for incoming filtered depth frames
 	DepthImageRenderer* depthImageRenderer; // Object managing the current filtered depth image
 	ONTransform boxTransform; // Transformation from camera space to baseplane space (x along long sandbox axis, z up)
 	Box bbox; // Bounding box around the surface
 	WaterTable2* waterTable; // Water flow simulation object
 	double waterSpeed; // Relative speed of water flow simulation
 	unsigned int waterMaxSteps; // Maximum number of water simulation steps per frame
+	double waterTargetFrameRate; // Frame rate to be held by adapting the number of water simulation steps per frame, or zero to always run up to the maximum
+	WaterStepScheduler* waterStepScheduler; // Object deciding how many water simulation steps to run per frame
+	mutable unsigned int numWaterSteps; // Number of water simulation steps run during the most recent frame
+	bool shareWaterSimulation; // Flag whether to run the water simulation in only one OpenGL context per frame and hand its results to all others
+	mutable Threads::MutexCond sharedWaterCond; // Condition variable protecting the shared water simulation state and signaling new results
+	ContextCounterPtr contextCounter; // Counter of live OpenGL contexts
+	mutable double sharedWaterClaimTime; // Application time of the most recent frame for which an OpenGL context claimed the water simulation
+	mutable double sharedWaterTime; // Application time of the most recent frame whose water simulation results are in the shared quantity buffer, or negative
+	mutable std::vector<GLfloat> sharedWaterQuantity; // Interleaved (w, hu, hv) conserved quantity grid handed from the simulating OpenGL context to all others
 	GLfloat rainStrength; // Amount of water deposited by rain tools and objects on each water simulation step
 	HandExtractor* handExtractor; // Object to detect splayed hands above the sand surface to make rain
+	RainMaker* rainMaker; // Object to detect physical objects inside the rain elevation range to make rain
+	Threads::TripleBuffer<RainMaker::BlobList> rainObjects; // Triple buffer of lists of detected rain objects
+	ContourLineExtractor* contourLineExtractor; // Object to extract topographic contour lines as vector polylines in a background thread
+	WaterStateRecorder* waterStateRecorder; // Object to record the water table's bathymetry and water level grids to a file
+	WaterStatePlayer* waterStatePlayer; // Object to play back recorded bathymetry and water level grids into the water table
 	const AddWaterFunction* addWaterFunction; // Render function registered with the water table
 	bool addWaterFunctionRegistered; // Flag if the water adding function is currently registered with the water table
 	std::vector<RenderSettings> renderSettings; // List of per-window rendering settings
@@ -154,21 +223,40 @@ class Sandbox:public Vrui::Application,public GLObject
 	GLMotif::TextFieldSlider* waterSpeedSlider;
 	GLMotif::TextFieldSlider* waterMaxStepsSlider;
 	GLMotif::TextField* frameRateTextField;
+	GLMotif::TextFieldSlider* waterTargetFrameRateSlider;
+	GLMotif::TextField* waterStepsTextField;
+	GLMotif::TextField* waterBudgetTextFields[3]; // Text fields showing the measured cost of a water simulation step, the per-frame water simulation budget, and the resulting step limit
+	GLMotif::TextField* waterBacklogTextFields[2]; // Text fields showing the water simulation time carried over into the next frame and the total dropped simulation time
+	GLMotif::ToggleButton* waterGpuStepSizeToggle;
 	GLMotif::TextFieldSlider* waterAttenuationSlider;
+	GLMotif::TextField* latencyTextFields[LatencyMonitor::NUM_STAGES][3]; // Text fields showing minimum, mean, and 99th percentile latency of each pipeline stage
 	int controlPipeFd; // File descriptor of an optional named pipe to send control commands to a running AR Sandbox
+	mutable LatencyMonitor latencyMonitor; // Collector of per-frame latencies of all pipeline stages
+	bool monitorCameraDelivery; // Flag whether the camera's frame time stamps are relative to the latency monitor's time base
+	mutable double newFrameArrivalTime; // Arrival time of the most recently locked filtered frame if it has not been rendered yet, or negative
+	mutable double displayedFrameArrivalTime; // Arrival time of the filtered frame first rendered during the most recent display pass, or negative
+	mutable double displayEndTime; // Time at which the most recent display pass ended, or negative
 	
 	/* Private methods: */
 	void rawDepthFrameDispatcher(const Kinect::FrameBuffer& frameBuffer); // Callback receiving raw depth frames from the Kinect camera; forwards them to the frame filter and rain maker objects
-	void receiveFilteredFrame(const Kinect::FrameBuffer& frameBuffer); // Callback receiving filtered depth frames from the filter object
+	void auxiliaryDepthFrameDispatcher(const Kinect::FrameBuffer& frameBuffer,unsigned int auxiliaryCameraIndex); // Callback receiving raw depth frames from the auxiliary camera of the given index; forwards them to the camera's frame filter
+	void receiveFilteredFrame(const Kinect::FrameBuffer& frameBuffer); // Callback receiving filtered depth frames from the filter object, or fused height maps from the height map fuser
+	void receiveContourLines(const ContourLineExtractor::ContourLineSet& contourLines); // Callback receiving newly extracted contour lines from the contour line extractor
+	void receiveRainObjects(const RainMaker::BlobList& newRainObjects); // Callback receiving newly detected rain objects from the rain maker
 	void toggleDEM(DEM* dem); // Sets or toggles the currently active DEM
 	void addWater(GLContextData& contextData) const; // Function to render geometry that adds water to the water table
 	void pauseUpdatesCallback(GLMotif::ToggleButton::ValueChangedCallbackData* cbData);
 	void showWaterControlDialogCallback(Misc::CallbackData* cbData);
 	void waterSpeedSliderCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData);
 	void waterMaxStepsSliderCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData);
+	void waterTargetFrameRateSliderCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData);
+	void waterGpuStepSizeToggleCallback(GLMotif::ToggleButton::ValueChangedCallbackData* cbData);
 	void waterAttenuationSliderCallback(GLMotif::TextFieldSlider::ValueChangedCallbackData* cbData);
 	GLMotif::PopupMenu* createMainMenu(void);
 	GLMotif::PopupWindow* createWaterControlDialog(void);
+	void updateLatencyDisplay(void); // Updates the latency text fields in the water control dialog
+	void updateWaterBudgetDisplay(void); // Updates the water step budget text fields in the water control dialog
+	void writeLatencyStatistics(const char* fileName) const; // Writes current latency statistics to the given file or named pipe, or to stdout if the file name is empty
 	
 	/* Constructors and destructors: */
 	public:
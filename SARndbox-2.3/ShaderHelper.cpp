@@ -1,6 +1,7 @@
 /***********************************************************************
-ShaderHelper - Helper functions to create GLSL shaders from text files.
-Copyright (c) 2014 Oliver Kreylos
+ShaderHelper - Helper functions to create GLSL shaders from text files,
+with an optional on-disk cache of linked shader program binaries.
+Copyright (c) 2014-2016 Oliver Kreylos
 
 This file is part of the Augmented Reality Sandbox (SARndbox).
 
@@ -21,14 +22,232 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "ShaderHelper.h"
 
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <string>
+#include <vector>
+#include <stdexcept>
+#include <Misc/ThrowStdErr.h>
+#include <IO/File.h>
+#include <IO/OpenFile.h>
 #include <GL/gl.h>
+#include <GL/GLExtensionManager.h>
 #include <GL/Extensions/GLARBFragmentShader.h>
 #include <GL/Extensions/GLARBShaderObjects.h>
 #include <GL/Extensions/GLARBVertexShader.h>
 
 #include "Config.h"
 
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+
+namespace {
+
+/*****************************************
+Entry points of GL_ARB_get_program_binary:
+*****************************************/
+
+typedef void (APIENTRY *GetProgramBinaryProc)(GLuint program,GLsizei bufSize,GLsizei* length,GLenum* binaryFormat,void* binary);
+typedef void (APIENTRY *ProgramBinaryProc)(GLuint program,GLenum binaryFormat,const void* binary,GLsizei length);
+typedef void (APIENTRY *ProgramParameteriProc)(GLuint program,GLenum pname,GLint value);
+typedef void (APIENTRY *GetProgramivProc)(GLuint program,GLenum pname,GLint* params);
+
+struct ProgramBinaryFunctions // Structure holding the entry points required to cache shader program binaries in the current OpenGL context
+	{
+	/* Elements: */
+	public:
+	GetProgramBinaryProc getProgramBinary;
+	ProgramBinaryProc programBinary;
+	ProgramParameteriProc programParameteri;
+	GetProgramivProc getProgramiv;
+	
+	/* Methods: */
+	bool init(void) // Retrieves the entry points; returns false if the current OpenGL context does not support program binaries
+		{
+		if(!GLExtensionManager::isExtensionSupported("GL_ARB_get_program_binary"))
+			return false;
+		getProgramBinary=GLExtensionManager::getFunction<GetProgramBinaryProc>("glGetProgramBinary");
+		programBinary=GLExtensionManager::getFunction<ProgramBinaryProc>("glProgramBinary");
+		programParameteri=GLExtensionManager::getFunction<ProgramParameteriProc>("glProgramParameteri");
+		getProgramiv=GLExtensionManager::getFunction<GetProgramivProc>("glGetProgramiv");
+		return getProgramBinary!=0&&programBinary!=0&&programParameteri!=0&&getProgramiv!=0;
+		}
+	};
+
+/**************
+Helper objects:
+**************/
+
+std::string shaderCacheDirectory; // Directory holding cached shader program binaries; empty if the cache is disabled
+const Misc::UInt32 programBinaryFileMagic=0x53414230U; // Identifier at the beginning of each cached program binary file
+
+/****************
+Helper functions:
+****************/
+
+std::string readShaderSource(const char* shaderFileName,const char* extension)
+	{
+	/* Construct the full shader source file name: */
+	std::string fullShaderFileName=CONFIG_SHADERDIR;
+	fullShaderFileName.push_back('/');
+	fullShaderFileName.append(shaderFileName);
+	fullShaderFileName.append(extension);
+	
+	/* Read the entire shader source file: */
+	IO::FilePtr shaderSourceFile=IO::openFile(fullShaderFileName.c_str());
+	std::string result;
+	char buffer[4096];
+	size_t numBytesRead;
+	while((numBytesRead=shaderSourceFile->readUpTo(buffer,sizeof(buffer)))>0)
+		result.append(buffer,numBytesRead);
+	
+	return result;
+	}
+
+inline void hashBytes(Misc::UInt64& hash,const void* bytes,size_t numBytes)
+	{
+	/* Accumulate the bytes using 64-bit FNV-1a: */
+	const unsigned char* bPtr=static_cast<const unsigned char*>(bytes);
+	for(size_t i=0;i<numBytes;++i,++bPtr)
+		{
+		hash^=Misc::UInt64(*bPtr);
+		hash*=0x100000001b3ULL;
+		}
+	}
+
+inline void hashString(Misc::UInt64& hash,const char* string)
+	{
+	/* Hash the string including its terminator to separate adjacent strings: */
+	if(string==0)
+		string="";
+	hashBytes(hash,string,strlen(string)+1);
+	}
+
+std::string getProgramBinaryFileName(const std::vector<std::string>& vertexShaderSources,const std::vector<std::string>& fragmentShaderSources)
+	{
+	/* Combine the hash of the shader sources with a hash identifying the OpenGL driver: */
+	Misc::UInt64 hash=hashShaderSources(vertexShaderSources,fragmentShaderSources);
+	hashString(hash,reinterpret_cast<const char*>(glGetString(GL_VENDOR)));
+	hashString(hash,reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+	hashString(hash,reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+	
+	/* Construct the cache file name: */
+	char hashBuffer[20];
+	snprintf(hashBuffer,sizeof(hashBuffer),"%016llx",(unsigned long long)hash);
+	std::string result=shaderCacheDirectory;
+	result.push_back('/');
+	result.append(hashBuffer);
+	result.append(".bin");
+	
+	return result;
+	}
+
+GLhandleARB loadProgramBinary(const std::string& programBinaryFileName,const ProgramBinaryFunctions& pbf)
+	{
+	GLhandleARB result=0;
+	try
+		{
+		/* Read the program binary file: */
+		IO::FilePtr file=IO::openFile(programBinaryFileName.c_str());
+		if(file->read<Misc::UInt32>()!=programBinaryFileMagic)
+			return 0;
+		GLenum binaryFormat=GLenum(file->read<Misc::UInt32>());
+		Misc::UInt32 binaryLength=file->read<Misc::UInt32>();
+		std::vector<char> binary(binaryLength);
+		file->readRaw(&binary.front(),binaryLength);
+		
+		/* Create a shader program from the binary: */
+		result=glCreateProgramObjectARB();
+		pbf.programBinary(GLuint(result),binaryFormat,&binary.front(),GLsizei(binaryLength));
+		
+		/* Reject the binary if the driver did not accept it, e.g., after a driver update: */
+		GLint linkStatus;
+		glGetObjectParameterivARB(result,GL_OBJECT_LINK_STATUS_ARB,&linkStatus);
+		if(!linkStatus)
+			{
+			glDeleteObjectARB(result);
+			result=0;
+			}
+		}
+	catch(const std::runtime_error&)
+		{
+		/* Treat missing or truncated cache files as cache misses: */
+		if(result!=0)
+			glDeleteObjectARB(result);
+		result=0;
+		}
+	
+	return result;
+	}
+
+void createDirectories(const std::string& directory)
+	{
+	/* Create all missing directories along the given path: */
+	for(std::string::size_type slash=directory.find('/',1);slash!=std::string::npos;slash=directory.find('/',slash+1))
+		mkdir(directory.substr(0,slash).c_str(),0755);
+	mkdir(directory.c_str(),0755);
+	}
+
+void saveProgramBinary(GLhandleARB program,const std::string& programBinaryFileName,const ProgramBinaryFunctions& pbf)
+	{
+	/* Retrieve the program binary from the driver: */
+	GLint binaryLength=0;
+	pbf.getProgramiv(GLuint(program),GL_PROGRAM_BINARY_LENGTH,&binaryLength);
+	if(binaryLength<=0)
+		return;
+	std::vector<char> binary(binaryLength);
+	GLsizei actualLength=0;
+	GLenum binaryFormat=0;
+	pbf.getProgramBinary(GLuint(program),binaryLength,&actualLength,&binaryFormat,&binary.front());
+	if(actualLength<=0)
+		return;
+	
+	/* Write the binary to a temporary file and move it into place to never expose partial files to concurrent readers: */
+	createDirectories(shaderCacheDirectory);
+	char suffix[32];
+	snprintf(suffix,sizeof(suffix),".%d.%u.tmp",int(getpid()),(unsigned int)(program));
+	std::string tempFileName=programBinaryFileName+suffix;
+	try
+		{
+		{
+		IO::FilePtr file=IO::openFile(tempFileName.c_str(),IO::File::WriteOnly);
+		file->write<Misc::UInt32>(programBinaryFileMagic);
+		file->write<Misc::UInt32>(Misc::UInt32(binaryFormat));
+		file->write<Misc::UInt32>(Misc::UInt32(actualLength));
+		file->writeRaw(&binary.front(),size_t(actualLength));
+		}
+		if(rename(tempFileName.c_str(),programBinaryFileName.c_str())!=0)
+			unlink(tempFileName.c_str());
+		}
+	catch(const std::runtime_error&)
+		{
+		/* Caching is best-effort; ignore unwritable cache directories: */
+		unlink(tempFileName.c_str());
+		}
+	}
+
+}
+
+/****************************************
+Functions to create GLSL shader programs:
+****************************************/
+
+void setShaderCacheDirectory(const char* newShaderCacheDirectory)
+	{
+	shaderCacheDirectory=newShaderCacheDirectory!=0?newShaderCacheDirectory:"";
+	
+	/* Strip trailing slashes: */
+	while(shaderCacheDirectory.length()>1&&shaderCacheDirectory[shaderCacheDirectory.length()-1]=='/')
+		shaderCacheDirectory.erase(shaderCacheDirectory.length()-1);
+	}
+
 GLhandleARB compileVertexShader(const char* vertexShaderFileName)
 	{
 	/* Construct the full shader source file name: */
@@ -53,18 +272,118 @@ GLhandleARB compileFragmentShader(const char* fragmentShaderFileName)
 	return glCompileFragmentShaderFromFile(fullShaderFileName.c_str());
 	}
 
-GLhandleARB linkVertexAndFragmentShader(const char* shaderFileName)
+std::string readVertexShaderSource(const char* vertexShaderFileName)
+	{
+	return readShaderSource(vertexShaderFileName,".vs");
+	}
+
+std::string readFragmentShaderSource(const char* fragmentShaderFileName)
+	{
+	return readShaderSource(fragmentShaderFileName,".fs");
+	}
+
+Misc::UInt64 hashShaderSources(const std::vector<std::string>& vertexShaderSources,const std::vector<std::string>& fragmentShaderSources)
 	{
-	/* Compile the vertex and fragment shaders: */
-	GLhandleARB vertexShader=compileVertexShader(shaderFileName);
-	GLhandleARB fragmentShader=compileFragmentShader(shaderFileName);
+	/* Hash the number and contents of each stage's compilation units: */
+	Misc::UInt64 hash=0xcbf29ce484222325ULL;
+	const std::vector<std::string>* stages[2]={&vertexShaderSources,&fragmentShaderSources};
+	for(int stage=0;stage<2;++stage)
+		{
+		Misc::UInt32 numSources=Misc::UInt32(stages[stage]->size());
+		hashBytes(hash,&numSources,sizeof(numSources));
+		for(std::vector<std::string>::const_iterator sIt=stages[stage]->begin();sIt!=stages[stage]->end();++sIt)
+			{
+			Misc::UInt32 length=Misc::UInt32(sIt->length());
+			hashBytes(hash,&length,sizeof(length));
+			hashBytes(hash,sIt->data(),sIt->length());
+			}
+		}
 	
-	/* Link the shader program: */
-	GLhandleARB shaderProgram=glLinkShader(vertexShader,fragmentShader);
+	return hash;
+	}
+
+GLhandleARB linkShaderFromSources(const std::vector<std::string>& vertexShaderSources,const std::vector<std::string>& fragmentShaderSources)
+	{
+	/* Check if program binaries can be cached in the current OpenGL context: */
+	ProgramBinaryFunctions pbf;
+	bool useCache=!shaderCacheDirectory.empty()&&pbf.init();
+	std::string programBinaryFileName;
+	if(useCache)
+		{
+		/* Try loading the program from the cache: */
+		programBinaryFileName=getProgramBinaryFileName(vertexShaderSources,fragmentShaderSources);
+		GLhandleARB result=loadProgramBinary(programBinaryFileName,pbf);
+		if(result!=0)
+			return result;
+		}
+	
+	/* Compile all compilation units: */
+	std::vector<GLhandleARB> shaders;
+	GLhandleARB result=0;
+	try
+		{
+		for(std::vector<std::string>::const_iterator sIt=vertexShaderSources.begin();sIt!=vertexShaderSources.end();++sIt)
+			{
+			shaders.push_back(glCreateShaderObjectARB(GL_VERTEX_SHADER_ARB));
+			glCompileShaderFromString(shaders.back(),sIt->c_str());
+			}
+		for(std::vector<std::string>::const_iterator sIt=fragmentShaderSources.begin();sIt!=fragmentShaderSources.end();++sIt)
+			{
+			shaders.push_back(glCreateShaderObjectARB(GL_FRAGMENT_SHADER_ARB));
+			glCompileShaderFromString(shaders.back(),sIt->c_str());
+			}
+		
+		/* Create the program object and attach all shaders: */
+		result=glCreateProgramObjectARB();
+		for(std::vector<GLhandleARB>::iterator shIt=shaders.begin();shIt!=shaders.end();++shIt)
+			glAttachObjectARB(result,*shIt);
+		
+		/* Ask the driver to keep the program's binary retrievable, and link the program: */
+		if(useCache)
+			pbf.programParameteri(GLuint(result),GL_PROGRAM_BINARY_RETRIEVABLE_HINT,GL_TRUE);
+		glLinkProgramARB(result);
+		
+		/* Check if the program linked successfully: */
+		GLint linkStatus;
+		glGetObjectParameterivARB(result,GL_OBJECT_LINK_STATUS_ARB,&linkStatus);
+		if(!linkStatus)
+			{
+			/* Get some more detailed information: */
+			GLcharARB linkLogBuffer[2048];
+			GLsizei linkLogSize;
+			glGetInfoLogARB(result,sizeof(linkLogBuffer),&linkLogSize,linkLogBuffer);
+			
+			/* Signal an error: */
+			Misc::throwStdErr("linkShaderFromSources: Error \"%s\" while linking shader program",linkLogBuffer);
+			}
+		}
+	catch(...)
+		{
+		/* Clean up and re-throw the exception: */
+		if(result!=0)
+			glDeleteObjectARB(result);
+		for(std::vector<GLhandleARB>::iterator shIt=shaders.begin();shIt!=shaders.end();++shIt)
+			glDeleteObjectARB(*shIt);
+		throw;
+		}
 	
 	/* Release the compiled shaders (won't get deleted until shader program is released): */
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	for(std::vector<GLhandleARB>::iterator shIt=shaders.begin();shIt!=shaders.end();++shIt)
+		glDeleteObjectARB(*shIt);
+	
+	/* Store the linked program in the cache: */
+	if(useCache)
+		saveProgramBinary(result,programBinaryFileName,pbf);
+	
+	return result;
+	}
+
+GLhandleARB linkVertexAndFragmentShader(const char* shaderFileName)
+	{
+	/* Read the vertex and fragment shader sources: */
+	std::vector<std::string> vertexShaderSources(1,readVertexShaderSource(shaderFileName));
+	std::vector<std::string> fragmentShaderSources(1,readFragmentShaderSource(shaderFileName));
 	
-	return shaderProgram;
+	/* Link the shader program: */
+	return linkShaderFromSources(vertexShaderSources,fragmentShaderSources);
 	}
@@ -1,6 +1,7 @@
 /***********************************************************************
-ShaderHelper - Helper functions to create GLSL shaders from text files.
-Copyright (c) 2014 Oliver Kreylos
+ShaderHelper - Helper functions to create GLSL shaders from text files,
+with an optional on-disk cache of linked shader program binaries.
+Copyright (c) 2014-2016 Oliver Kreylos
 
 This file is part of the Augmented Reality Sandbox (SARndbox).
 
@@ -22,11 +23,19 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef SHADERHELPER_INCLUDED
 #define SHADERHELPER_INCLUDED
 
+#include <string>
+#include <vector>
+#include <Misc/SizedTypes.h>
 #include <GL/gl.h>
 #include <GL/Extensions/GLARBShaderObjects.h>
 
+void setShaderCacheDirectory(const char* newShaderCacheDirectory); // Sets the directory in which linked shader program binaries are cached across runs; NULL or empty string disables the cache
 GLhandleARB compileVertexShader(const char* vertexShaderFileName); // Returns a handle to a vertex shader compiled from the given source file in the SARndbox's shader directory
 GLhandleARB compileFragmentShader(const char* fragmentShaderFileName); // Returns a handle to a fragment shader compiled from the given source file in the SARndbox's shader directory
+std::string readVertexShaderSource(const char* vertexShaderFileName); // Returns the contents of the given vertex shader source file in the SARndbox's shader directory
+std::string readFragmentShaderSource(const char* fragmentShaderFileName); // Returns the contents of the given fragment shader source file in the SARndbox's shader directory
+Misc::UInt64 hashShaderSources(const std::vector<std::string>& vertexShaderSources,const std::vector<std::string>& fragmentShaderSources); // Returns a hash identifying a shader program built from the given compilation units
+GLhandleARB linkShaderFromSources(const std::vector<std::string>& vertexShaderSources,const std::vector<std::string>& fragmentShaderSources); // Returns a handle to a shader program linked from the given vertex and fragment shader compilation units, loading it from the shader cache if possible
 GLhandleARB linkVertexAndFragmentShader(const char* shaderFileName); // Returns a handle to a shader program linked from a vertex shader and a fragment shader compiled from the given source files in the SARndbox's shader directory
 
 #endif
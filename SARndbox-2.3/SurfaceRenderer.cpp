@@ -75,7 +75,8 @@ SurfaceRenderer::DataItem::~DataItem(void)
 	glDeleteFramebuffersEXT(1,&contourLineFramebufferObject);
 	glDeleteRenderbuffersEXT(1,&contourLineDepthBufferObject);
 	glDeleteTextures(1,&contourLineColorTextureObject);
-	glDeleteObjectARB(heightMapShader);
+	for(std::vector<SurfaceShader>::iterator ssIt=surfaceShaders.begin();ssIt!=surfaceShaders.end();++ssIt)
+		glDeleteObjectARB(ssIt->shader);
 	glDeleteObjectARB(globalAmbientHeightMapShader);
 	glDeleteObjectARB(shadowedIlluminatedHeightMapShader);
 	}
@@ -90,340 +91,382 @@ void SurfaceRenderer::shaderSourceFileChanged(const IO::FileMonitor::Event& even
 	++surfaceSettingsVersion;
 	}
 
-GLhandleARB SurfaceRenderer::createSinglePassSurfaceShader(const GLLightTracker& lt,GLint* uniformLocations) const
+void SurfaceRenderer::createSinglePassSurfaceShader(const GLLightTracker& lt,SurfaceRenderer::DataItem* dataItem) const
 	{
-	GLhandleARB result=0;
+	/*********************************************************************
+	Assemble the surface rendering vertex shader:
+	*********************************************************************/
 	
-	std::vector<GLhandleARB> shaders;
-	try
+	/* Assemble the function and declaration strings: */
+	std::string vertexFunctions="\
+		#extension GL_ARB_texture_rectangle : enable\n";
+	
+	std::string vertexUniforms="\
+		uniform sampler2DRect depthSampler; // Sampler for the depth image-space elevation texture\n\
+		uniform mat4 depthProjection; // Transformation from depth image space to camera space\n\
+		uniform mat4 projectionModelviewDepthProjection; // Transformation from depth image space to clip space\n";
+	
+	std::string vertexVaryings;
+	
+	/* Assemble the vertex shader's main function: */
+	std::string vertexMain="\
+		void main()\n\
+			{\n\
+			/* Get the vertex' depth image-space z coordinate from the texture: */\n\
+			vec4 vertexDic=gl_Vertex;\n\
+			vertexDic.z=texture2DRect(depthSampler,gl_Vertex.xy).r;\n\
+			\n\
+			/* Transform the vertex from depth image space to camera space and normalize it: */\n\
+			vec4 vertexCc=depthProjection*vertexDic;\n\
+			vertexCc/=vertexCc.w;\n\
+			\n";
+	
+	if(dem!=0)
 		{
-		/*********************************************************************
-		Assemble and compile the surface rendering vertex shader:
-		*********************************************************************/
+		/* Add declarations for DEM matching: */
+		vertexUniforms+="\
+			uniform mat4 demTransform; // Transformation from camera space to DEM space\n\
+			uniform sampler2DRect demSampler; // Sampler for the DEM texture\n\
+			uniform float demDistScale; // Distance from surface to DEM at which the color map saturates\n";
 		
-		/* Assemble the function and declaration strings: */
-		std::string vertexFunctions="\
-			#extension GL_ARB_texture_rectangle : enable\n";
+		vertexVaryings+="\
+			varying float demDist; // Scaled signed distance from surface to DEM\n";
 		
-		std::string vertexUniforms="\
-			uniform sampler2DRect depthSampler; // Sampler for the depth image-space elevation texture\n\
-			uniform mat4 depthProjection; // Transformation from depth image space to camera space\n\
-			uniform mat4 projectionModelviewDepthProjection; // Transformation from depth image space to clip space\n";
+		/* Add DEM matching code to vertex shader's main function: */
+		vertexMain+="\
+			/* Transform the camera-space vertex to scaled DEM space: */\n\
+			vec4 vertexDem=demTransform*vertexCc;\n\
+			\n\
+			/* Calculate scaled DEM-surface distance: */\n\
+			demDist=(vertexDem.z-texture2DRect(demSampler,vertexDem.xy).r)*demDistScale;\n\
+			\n";
+		}
+	else if(elevationColorMap!=0)
+		{
+		/* Add declarations for height mapping: */
+		vertexUniforms+="\
+			uniform vec4 heightColorMapPlaneEq; // Plane equation of the base plane in camera space, scaled for height map textures\n";
 		
-		std::string vertexVaryings;
+		vertexVaryings+="\
+			varying float heightColorMapTexCoord; // Texture coordinate for the height color map\n";
 		
-		/* Assemble the vertex shader's main function: */
-		std::string vertexMain="\
-			void main()\n\
-				{\n\
-				/* Get the vertex' depth image-space z coordinate from the texture: */\n\
-				vec4 vertexDic=gl_Vertex;\n\
-				vertexDic.z=texture2DRect(depthSampler,gl_Vertex.xy).r;\n\
-				\n\
-				/* Transform the vertex from depth image space to camera space and normalize it: */\n\
-				vec4 vertexCc=depthProjection*vertexDic;\n\
-				vertexCc/=vertexCc.w;\n\
-				\n";
+		/* Add height mapping code to vertex shader's main function: */
+		vertexMain+="\
+			/* Plug camera-space vertex into the scaled and offset base plane equation: */\n\
+			heightColorMapTexCoord=dot(heightColorMapPlaneEq,vertexCc);\n\
+			\n";
+		}
+	
+	if(drawContourLines&&!pixelCornerContourLines)
+		{
+		/* Add declarations for fused contour line rendering: */
+		vertexUniforms+="\
+			uniform vec4 contourLinePlaneEq; // Plane equation of the base plane in camera space\n";
 		
-		if(dem!=0)
-			{
-			/* Add declarations for DEM matching: */
-			vertexUniforms+="\
-				uniform mat4 demTransform; // Transformation from camera space to DEM space\n\
-				uniform sampler2DRect demSampler; // Sampler for the DEM texture\n\
-				uniform float demDistScale; // Distance from surface to DEM at which the color map saturates\n";
-			
-			vertexVaryings+="\
-				varying float demDist; // Scaled signed distance from surface to DEM\n";
-			
-			/* Add DEM matching code to vertex shader's main function: */
-			vertexMain+="\
-				/* Transform the camera-space vertex to scaled DEM space: */\n\
-				vec4 vertexDem=demTransform*vertexCc;\n\
-				\n\
-				/* Calculate scaled DEM-surface distance: */\n\
-				demDist=(vertexDem.z-texture2DRect(demSampler,vertexDem.xy).r)*demDistScale;\n\
-				\n";
-			}
-		else if(elevationColorMap!=0)
-			{
-			/* Add declarations for height mapping: */
-			vertexUniforms+="\
-				uniform vec4 heightColorMapPlaneEq; // Plane equation of the base plane in camera space, scaled for height map textures\n";
-			
-			vertexVaryings+="\
-				varying float heightColorMapTexCoord; // Texture coordinate for the height color map\n";
-			
-			/* Add height mapping code to vertex shader's main function: */
-			vertexMain+="\
-				/* Plug camera-space vertex into the scaled and offset base plane equation: */\n\
-				heightColorMapTexCoord=dot(heightColorMapPlaneEq,vertexCc);\n\
-				\n";
-			}
+		vertexVaryings+="\
+			varying float contourLineElevation; // Elevation relative to the base plane for contour line extraction\n";
 		
-		if(illuminate)
-			{
-			/* Add declarations for illumination: */
-			vertexUniforms+="\
-				uniform mat4 modelview; // Transformation from camera space to eye space\n\
-				uniform mat4 tangentModelviewDepthProjection; // Transformation from depth image space to eye space for tangent planes\n";
-			
-			vertexVaryings+="\
-				varying vec4 diffColor,specColor; // Diffuse and specular colors, interpolated separately for correct highlights\n";
-			
-			/* Add illumination code to vertex shader's main function: */
-			vertexMain+="\
-				/* Calculate the vertex' tangent plane equation in depth image space: */\n\
-				vec4 tangentDic;\n\
-				tangentDic.x=texture2DRect(depthSampler,vec2(vertexDic.x-1.0,vertexDic.y)).r-texture2DRect(depthSampler,vec2(vertexDic.x+1.0,vertexDic.y)).r;\n\
-				tangentDic.y=texture2DRect(depthSampler,vec2(vertexDic.x,vertexDic.y-1.0)).r-texture2DRect(depthSampler,vec2(vertexDic.x,vertexDic.y+1.0)).r;\n\
-				tangentDic.z=2.0;\n\
-				tangentDic.w=-dot(vertexDic.xyz,tangentDic.xyz)/vertexDic.w;\n\
-				\n\
-				/* Transform the vertex and its tangent plane from depth image space to eye space: */\n\
-				vec4 vertexEc=modelview*vertexCc;\n\
-				vec3 normalEc=normalize((tangentModelviewDepthProjection*tangentDic).xyz);\n\
-				\n\
-				/* Initialize the color accumulators: */\n\
-				diffColor=gl_LightModel.ambient*gl_FrontMaterial.ambient;\n\
-				specColor=vec4(0.0,0.0,0.0,0.0);\n\
-				\n";
-			
-			/* Call the appropriate light accumulation function for every enabled light source: */
-			bool firstLight=true;
-			for(int lightIndex=0;lightIndex<lt.getMaxNumLights();++lightIndex)
-				if(lt.getLightState(lightIndex).isEnabled())
+		/* Add elevation calculation code to vertex shader's main function: */
+		vertexMain+="\
+			/* Plug camera-space vertex into the base plane equation: */\n\
+			contourLineElevation=dot(contourLinePlaneEq,vertexCc);\n\
+			\n";
+		}
+	
+	if(illuminate)
+		{
+		/* Add declarations for illumination: */
+		vertexUniforms+="\
+			uniform mat4 modelview; // Transformation from camera space to eye space\n\
+			uniform mat4 tangentModelviewDepthProjection; // Transformation from depth image space to eye space for tangent planes\n";
+		
+		vertexVaryings+="\
+			varying vec4 diffColor,specColor; // Diffuse and specular colors, interpolated separately for correct highlights\n";
+		
+		/* Add illumination code to vertex shader's main function: */
+		vertexMain+="\
+			/* Calculate the vertex' tangent plane equation in depth image space: */\n\
+			vec4 tangentDic;\n\
+			tangentDic.x=texture2DRect(depthSampler,vec2(vertexDic.x-1.0,vertexDic.y)).r-texture2DRect(depthSampler,vec2(vertexDic.x+1.0,vertexDic.y)).r;\n\
+			tangentDic.y=texture2DRect(depthSampler,vec2(vertexDic.x,vertexDic.y-1.0)).r-texture2DRect(depthSampler,vec2(vertexDic.x,vertexDic.y+1.0)).r;\n\
+			tangentDic.z=2.0;\n\
+			tangentDic.w=-dot(vertexDic.xyz,tangentDic.xyz)/vertexDic.w;\n\
+			\n\
+			/* Transform the vertex and its tangent plane from depth image space to eye space: */\n\
+			vec4 vertexEc=modelview*vertexCc;\n\
+			vec3 normalEc=normalize((tangentModelviewDepthProjection*tangentDic).xyz);\n\
+			\n\
+			/* Initialize the color accumulators: */\n\
+			diffColor=gl_LightModel.ambient*gl_FrontMaterial.ambient;\n\
+			specColor=vec4(0.0,0.0,0.0,0.0);\n\
+			\n";
+		
+		/* Call the appropriate light accumulation function for every enabled light source: */
+		bool firstLight=true;
+		for(int lightIndex=0;lightIndex<lt.getMaxNumLights();++lightIndex)
+			if(lt.getLightState(lightIndex).isEnabled())
+				{
+				/* Create the light accumulation function: */
+				vertexFunctions.push_back('\n');
+				vertexFunctions+=lt.createAccumulateLightFunction(lightIndex);
+				
+				if(firstLight)
 					{
-					/* Create the light accumulation function: */
-					vertexFunctions.push_back('\n');
-					vertexFunctions+=lt.createAccumulateLightFunction(lightIndex);
-					
-					if(firstLight)
-						{
-						vertexMain+="\
-							/* Call the light accumulation functions for all enabled light sources: */\n";
-						firstLight=false;
-						}
-					
-					/* Call the light accumulation function from vertex shader's main function: */
 					vertexMain+="\
-						accumulateLight";
-					char liBuffer[12];
-					vertexMain.append(Misc::print(lightIndex,liBuffer+11));
-					vertexMain+="(vertexEc,normalEc,gl_FrontMaterial.ambient,gl_FrontMaterial.diffuse,gl_FrontMaterial.specular,gl_FrontMaterial.shininess,diffColor,specColor);\n";
+						/* Call the light accumulation functions for all enabled light sources: */\n";
+					firstLight=false;
 					}
-			if(!firstLight)
+				
+				/* Call the light accumulation function from vertex shader's main function: */
 				vertexMain+="\
-					\n";
-			}
-		
-		if(waterTable!=0&&dem==0)
-			{
-			/* Add declarations for water handling: */
-			vertexUniforms+="\
-				uniform mat4 waterTransform; // Transformation from camera space to water level texture coordinate space\n";
-			vertexVaryings+="\
-				varying vec2 waterTexCoord; // Texture coordinate for water level texture\n";
-			
-			/* Add water handling code to vertex shader's main function: */
+					accumulateLight";
+				char liBuffer[12];
+				vertexMain.append(Misc::print(lightIndex,liBuffer+11));
+				vertexMain+="(vertexEc,normalEc,gl_FrontMaterial.ambient,gl_FrontMaterial.diffuse,gl_FrontMaterial.specular,gl_FrontMaterial.shininess,diffColor,specColor);\n";
+				}
+		if(!firstLight)
 			vertexMain+="\
-				/* Transform the vertex from camera space to water level texture coordinate space: */\n\
-				waterTexCoord=(waterTransform*vertexCc).xy;\n\
 				\n";
-			}
+		}
+	
+	if(waterTable!=0&&dem==0)
+		{
+		/* Add declarations for water handling: */
+		vertexUniforms+="\
+			uniform mat4 waterTransform; // Transformation from camera space to water level texture coordinate space\n";
+		vertexVaryings+="\
+			varying vec2 waterTexCoord; // Texture coordinate for water level texture\n";
 		
-		/* Finish the vertex shader's main function: */
+		/* Add water handling code to vertex shader's main function: */
 		vertexMain+="\
-				/* Transform vertex from depth image space to clip space: */\n\
-				gl_Position=projectionModelviewDepthProjection*vertexDic;\n\
-				}\n";
-		
-		/* Compile the vertex shader: */
-		shaders.push_back(glCompileVertexShaderFromStrings(7,vertexFunctions.c_str(),"\t\t\n",vertexUniforms.c_str(),"\t\t\n",vertexVaryings.c_str(),"\t\t\n",vertexMain.c_str()));
-		
-		/*********************************************************************
-		Assemble and compile the surface rendering fragment shaders:
-		*********************************************************************/
-		
-		/* Assemble the fragment shader's function declarations: */
-		std::string fragmentDeclarations;
-		
-		/* Assemble the fragment shader's uniform and varying variables: */
-		std::string fragmentUniforms;
-		std::string fragmentVaryings;
+			/* Transform the vertex from camera space to water level texture coordinate space: */\n\
+			waterTexCoord=(waterTransform*vertexCc).xy;\n\
+			\n";
+		}
+	
+	/* Finish the vertex shader's main function: */
+	vertexMain+="\
+			/* Transform vertex from depth image space to clip space: */\n\
+			gl_Position=projectionModelviewDepthProjection*vertexDic;\n\
+			}\n";
+	
+	/* Assemble the vertex shader: */
+	std::vector<std::string> vertexShaderSources;
+	vertexShaderSources.push_back(vertexFunctions+"\t\t\n"+vertexUniforms+"\t\t\n"+vertexVaryings+"\t\t\n"+vertexMain);
+	
+	/*********************************************************************
+	Assemble the surface rendering fragment shaders:
+	*********************************************************************/
+	
+	std::vector<std::string> fragmentShaderSources;
+	
+	/* Assemble the fragment shader's function declarations: */
+	std::string fragmentDeclarations;
+	
+	/* Assemble the fragment shader's uniform and varying variables: */
+	std::string fragmentUniforms;
+	std::string fragmentVaryings;
+	
+	/* Assemble the fragment shader's main function: */
+	std::string fragmentMain="\
+		void main()\n\
+			{\n";
+	
+	if(dem!=0)
+		{
+		/* Add declarations for DEM matching: */
+		fragmentVaryings+="\
+			varying float demDist; // Scaled signed distance from surface to DEM\n";
 		
-		/* Assemble the fragment shader's main function: */
-		std::string fragmentMain="\
-			void main()\n\
-				{\n";
+		/* Add DEM matching code to the fragment shader's main function: */
+		fragmentMain+="\
+			/* Calculate the fragment's color from a double-ramp function: */\n\
+			vec4 baseColor;\n\
+			if(demDist<0.0)\n\
+				baseColor=mix(vec4(1.0,1.0,1.0,1.0),vec4(1.0,0.0,0.0,1.0),min(-demDist,1.0));\n\
+			else\n\
+				baseColor=mix(vec4(1.0,1.0,1.0,1.0),vec4(0.0,0.0,1.0,1.0),min(demDist,1.0));\n\
+			\n";
+		}
+	else if(elevationColorMap!=0)
+		{
+		/* Add declarations for height mapping: */
+		fragmentUniforms+="\
+			uniform sampler1D heightColorMapSampler;\n";
+		fragmentVaryings+="\
+			varying float heightColorMapTexCoord; // Texture coordinate for the height color map\n";
 		
-		if(dem!=0)
-			{
-			/* Add declarations for DEM matching: */
-			fragmentVaryings+="\
-				varying float demDist; // Scaled signed distance from surface to DEM\n";
-			
-			/* Add DEM matching code to the fragment shader's main function: */
-			fragmentMain+="\
-				/* Calculate the fragment's color from a double-ramp function: */\n\
-				vec4 baseColor;\n\
-				if(demDist<0.0)\n\
-					baseColor=mix(vec4(1.0,1.0,1.0,1.0),vec4(1.0,0.0,0.0,1.0),min(-demDist,1.0));\n\
-				else\n\
-					baseColor=mix(vec4(1.0,1.0,1.0,1.0),vec4(0.0,0.0,1.0,1.0),min(demDist,1.0));\n\
-				\n";
-			}
-		else if(elevationColorMap!=0)
-			{
-			/* Add declarations for height mapping: */
-			fragmentUniforms+="\
-				uniform sampler1D heightColorMapSampler;\n";
-			fragmentVaryings+="\
-				varying float heightColorMapTexCoord; // Texture coordinate for the height color map\n";
-			
-			/* Add height mapping code to the fragment shader's main function: */
-			fragmentMain+="\
-				/* Get the fragment's color from the height color map: */\n\
-				vec4 baseColor=texture1D(heightColorMapSampler,heightColorMapTexCoord);\n\
-				\n";
-			}
-		else
-			{
-			fragmentMain+="\
-				/* Set the surface's base color to white: */\n\
-				vec4 baseColor=vec4(1.0,1.0,1.0,1.0);\n\
-				\n";
-			}
+		/* Add height mapping code to the fragment shader's main function: */
+		fragmentMain+="\
+			/* Get the fragment's color from the height color map: */\n\
+			vec4 baseColor=texture1D(heightColorMapSampler,heightColorMapTexCoord);\n\
+			\n";
+		}
+	else
+		{
+		fragmentMain+="\
+			/* Set the surface's base color to white: */\n\
+			vec4 baseColor=vec4(1.0,1.0,1.0,1.0);\n\
+			\n";
+		}
+	
+	if(drawContourLines)
+		{
+		/* Add the contour line shader: */
+		fragmentShaderSources.push_back(readFragmentShaderSource("SurfaceAddContourLines"));
 		
-		if(drawContourLines)
+		if(pixelCornerContourLines)
 			{
 			/* Declare the contour line function: */
 			fragmentDeclarations+="\
 				void addContourLines(in vec2,inout vec4);\n";
 			
-			/* Compile the contour line shader: */
-			shaders.push_back(compileFragmentShader("SurfaceAddContourLines"));
-			
 			/* Call contour line function from fragment shader's main function: */
 			fragmentMain+="\
 				/* Modulate the base color by contour line color: */\n\
 				addContourLines(gl_FragCoord.xy,baseColor);\n\
 				\n";
 			}
-		
-		if(illuminate)
+		else
 			{
-			/* Declare the illumination function: */
+			/* Declare the fused contour line function: */
 			fragmentDeclarations+="\
-				void illuminate(inout vec4);\n";
-			
-			/* Compile the illumination shader: */
-			shaders.push_back(compileFragmentShader("SurfaceIlluminate"));
+				void addContourLinesFromElevation(in vec2,in float,inout vec4);\n";
+			fragmentVaryings+="\
+				varying float contourLineElevation; // Elevation relative to the base plane for contour line extraction\n";
 			
-			/* Call illumination function from fragment shader's main function: */
+			/* Call contour line function from fragment shader's main function: */
 			fragmentMain+="\
-				/* Apply illumination to the base color: */\n\
-				illuminate(baseColor);\n\
+				/* Modulate the base color by contour line color using the interpolated surface elevation: */\n\
+				addContourLinesFromElevation(gl_FragCoord.xy,contourLineElevation,baseColor);\n\
 				\n";
 			}
+		}
+	
+	if(illuminate)
+		{
+		/* Declare the illumination function: */
+		fragmentDeclarations+="\
+			void illuminate(inout vec4);\n";
 		
-		if(waterTable!=0&&dem==0)
-			{
-			/* Declare the water handling functions: */
-			fragmentDeclarations+="\
-				void addWaterColor(in vec2,inout vec4);\n\
-				void addWaterColorAdvected(inout vec4);\n";
-			
-			/* Compile the water handling shader: */
-			shaders.push_back(compileFragmentShader("SurfaceAddWaterColor"));
-			
-			/* Call water coloring function from fragment shader's main function: */
-			if(advectWaterTexture)
-				{
-				fragmentMain+="\
-					/* Modulate the base color with water color: */\n\
-					addWaterColorAdvected(baseColor);\n\
-					\n";
-				}
-			else
-				{
-				fragmentMain+="\
-					/* Modulate the base color with water color: */\n\
-					addWaterColor(gl_FragCoord.xy,baseColor);\n\
-					\n";
-				}
-			}
+		/* Add the illumination shader: */
+		fragmentShaderSources.push_back(readFragmentShaderSource("SurfaceIlluminate"));
 		
-		/* Finish the fragment shader's main function: */
+		/* Call illumination function from fragment shader's main function: */
 		fragmentMain+="\
-			/* Assign the final color to the fragment: */\n\
-			gl_FragColor=baseColor;\n\
-			}\n";
-		
-		/* Compile the fragment shader: */
-		shaders.push_back(glCompileFragmentShaderFromStrings(7,fragmentDeclarations.c_str(),"\t\t\n",fragmentUniforms.c_str(),"\t\t\n",fragmentVaryings.c_str(),"\t\t\n",fragmentMain.c_str()));
-		
-		/* Link the shader program: */
-		result=glLinkShader(shaders);
-		
-		/* Release all compiled shaders: */
-		for(std::vector<GLhandleARB>::iterator shIt=shaders.begin();shIt!=shaders.end();++shIt)
-			glDeleteObjectARB(*shIt);
-		
-		/*******************************************************************
-		Query the shader program's uniform locations:
-		*******************************************************************/
+			/* Apply illumination to the base color: */\n\
+			illuminate(baseColor);\n\
+			\n";
+		}
+	
+	if(waterTable!=0&&dem==0)
+		{
+		/* Declare the water handling functions: */
+		fragmentDeclarations+="\
+			void addWaterColor(in vec2,inout vec4);\n\
+			void addWaterColorAdvected(inout vec4);\n";
 		
-		GLint* ulPtr=uniformLocations;
+		/* Add the water handling shader: */
+		fragmentShaderSources.push_back(readFragmentShaderSource("SurfaceAddWaterColor"));
 		
-		/* Query common uniform variables: */
-		*(ulPtr++)=glGetUniformLocationARB(result,"depthSampler");
-		*(ulPtr++)=glGetUniformLocationARB(result,"depthProjection");
-		if(dem!=0)
+		/* Call water coloring function from fragment shader's main function: */
+		if(advectWaterTexture)
 			{
-			/* Query DEM matching uniform variables: */
-			*(ulPtr++)=glGetUniformLocationARB(result,"demTransform");
-			*(ulPtr++)=glGetUniformLocationARB(result,"demSampler");
-			*(ulPtr++)=glGetUniformLocationARB(result,"demDistScale");
-			}
-		else if(elevationColorMap!=0)
-			{
-			/* Query height color mapping uniform variables: */
-			*(ulPtr++)=glGetUniformLocationARB(result,"heightColorMapPlaneEq");
-			*(ulPtr++)=glGetUniformLocationARB(result,"heightColorMapSampler");
-			}
-		if(drawContourLines)
-			{
-			*(ulPtr++)=glGetUniformLocationARB(result,"pixelCornerElevationSampler");
-			*(ulPtr++)=glGetUniformLocationARB(result,"contourLineFactor");
+			fragmentMain+="\
+				/* Modulate the base color with water color: */\n\
+				addWaterColorAdvected(baseColor);\n\
+				\n";
 			}
-		if(illuminate)
+		else
 			{
-			/* Query illumination uniform variables: */
-			*(ulPtr++)=glGetUniformLocationARB(result,"modelview");
-			*(ulPtr++)=glGetUniformLocationARB(result,"tangentModelviewDepthProjection");
+			fragmentMain+="\
+				/* Modulate the base color with water color: */\n\
+				addWaterColor(gl_FragCoord.xy,baseColor);\n\
+				\n";
 			}
-		if(waterTable!=0&&dem==0)
+		}
+	
+	/* Finish the fragment shader's main function: */
+	fragmentMain+="\
+		/* Assign the final color to the fragment: */\n\
+		gl_FragColor=baseColor;\n\
+		}\n";
+	
+	/* Assemble the fragment shader's main compilation unit: */
+	fragmentShaderSources.push_back(fragmentDeclarations+"\t\t\n"+fragmentUniforms+"\t\t\n"+fragmentVaryings+"\t\t\n"+fragmentMain);
+	
+	/* Check if this variant of the surface shader was already built in this OpenGL context: */
+	Misc::UInt64 sourceHash=hashShaderSources(vertexShaderSources,fragmentShaderSources);
+	for(std::vector<DataItem::SurfaceShader>::iterator ssIt=dataItem->surfaceShaders.begin();ssIt!=dataItem->surfaceShaders.end();++ssIt)
+		if(ssIt->sourceHash==sourceHash)
 			{
-			/* Query water handling uniform variables: */
-			*(ulPtr++)=glGetUniformLocationARB(result,"waterTransform");
-			*(ulPtr++)=glGetUniformLocationARB(result,"bathymetrySampler");
-			*(ulPtr++)=glGetUniformLocationARB(result,"quantitySampler");
-			*(ulPtr++)=glGetUniformLocationARB(result,"waterCellSize");
-			*(ulPtr++)=glGetUniformLocationARB(result,"waterOpacity");
-			*(ulPtr++)=glGetUniformLocationARB(result,"waterAnimationTime");
+			/* Select the existing variant: */
+			dataItem->heightMapShader=ssIt->shader;
+			for(int i=0;i<16;++i)
+				dataItem->heightMapShaderUniforms[i]=ssIt->uniforms[i];
+			return;
 			}
-		*(ulPtr++)=glGetUniformLocationARB(result,"projectionModelviewDepthProjection");
+	
+	/* Link the shader program, or load it from the shader cache: */
+	DataItem::SurfaceShader surfaceShader;
+	surfaceShader.sourceHash=sourceHash;
+	GLhandleARB result=linkShaderFromSources(vertexShaderSources,fragmentShaderSources);
+	surfaceShader.shader=result;
+	
+	/*******************************************************************
+	Query the shader program's uniform locations:
+	*******************************************************************/
+	
+	GLint* ulPtr=surfaceShader.uniforms;
+	
+	/* Query common uniform variables: */
+	*(ulPtr++)=glGetUniformLocationARB(result,"depthSampler");
+	*(ulPtr++)=glGetUniformLocationARB(result,"depthProjection");
+	if(dem!=0)
+		{
+		/* Query DEM matching uniform variables: */
+		*(ulPtr++)=glGetUniformLocationARB(result,"demTransform");
+		*(ulPtr++)=glGetUniformLocationARB(result,"demSampler");
+		*(ulPtr++)=glGetUniformLocationARB(result,"demDistScale");
+		}
+	else if(elevationColorMap!=0)
+		{
+		/* Query height color mapping uniform variables: */
+		*(ulPtr++)=glGetUniformLocationARB(result,"heightColorMapPlaneEq");
+		*(ulPtr++)=glGetUniformLocationARB(result,"heightColorMapSampler");
+		}
+	if(drawContourLines)
+		{
+		/* Query contour line uniform variables: */
+		if(pixelCornerContourLines)
+			*(ulPtr++)=glGetUniformLocationARB(result,"pixelCornerElevationSampler");
+		else
+			*(ulPtr++)=glGetUniformLocationARB(result,"contourLinePlaneEq");
+		*(ulPtr++)=glGetUniformLocationARB(result,"contourLineFactor");
 		}
-	catch(...)
+	if(illuminate)
 		{
-		/* Clean up and re-throw the exception: */
-		for(std::vector<GLhandleARB>::iterator shIt=shaders.begin();shIt!=shaders.end();++shIt)
-			glDeleteObjectARB(*shIt);
-		throw;
+		/* Query illumination uniform variables: */
+		*(ulPtr++)=glGetUniformLocationARB(result,"modelview");
+		*(ulPtr++)=glGetUniformLocationARB(result,"tangentModelviewDepthProjection");
 		}
+	if(waterTable!=0&&dem==0)
+		{
+		/* Query water handling uniform variables: */
+		*(ulPtr++)=glGetUniformLocationARB(result,"waterTransform");
+		*(ulPtr++)=glGetUniformLocationARB(result,"bathymetrySampler");
+		*(ulPtr++)=glGetUniformLocationARB(result,"quantitySampler");
+		*(ulPtr++)=glGetUniformLocationARB(result,"waterCellSize");
+		*(ulPtr++)=glGetUniformLocationARB(result,"waterOpacity");
+		*(ulPtr++)=glGetUniformLocationARB(result,"waterAnimationTime");
+		}
+	*(ulPtr++)=glGetUniformLocationARB(result,"projectionModelviewDepthProjection");
 	
-	return result;
+	/* Add the new variant to the context's list and select it: */
+	dataItem->surfaceShaders.push_back(surfaceShader);
+	dataItem->heightMapShader=surfaceShader.shader;
+	for(int i=0;i<16;++i)
+		dataItem->heightMapShaderUniforms[i]=surfaceShader.uniforms[i];
 	}
 
 void SurfaceRenderer::renderPixelCornerElevations(const int viewport[4],const PTransform& projectionModelview,GLContextData& contextData,SurfaceRenderer::DataItem* dataItem) const
@@ -510,7 +553,7 @@ void SurfaceRenderer::renderPixelCornerElevations(const int viewport[4],const PT
 
 SurfaceRenderer::SurfaceRenderer(const DepthImageRenderer* sDepthImageRenderer)
 	:depthImageRenderer(sDepthImageRenderer),
-	 drawContourLines(true),contourLineFactor(1.0f),
+	 drawContourLines(true),contourLineFactor(1.0f),pixelCornerContourLines(false),
 	 elevationColorMap(0),
 	 dem(0),demDistScale(1.0f),
 	 illuminate(false),
@@ -522,8 +565,8 @@ SurfaceRenderer::SurfaceRenderer(const DepthImageRenderer* sDepthImageRenderer)
 	for(int i=0;i<2;++i)
 		depthImageSize[i]=depthImageRenderer->getDepthImageSize(i);
 	
-	/* Check if the depth projection matrix retains right-handedness: */
-	const PTransform& depthProjection=depthImageRenderer->getDepthProjection();
+	/* Check if the depth texture projection matrix retains right-handedness: */
+	const PTransform& depthProjection=depthImageRenderer->getTextureDepthProjection();
 	Point p1=depthProjection.transform(Point(0,0,0));
 	Point p2=depthProjection.transform(Point(1,0,0));
 	Point p3=depthProjection.transform(Point(0,1,0));
@@ -549,7 +592,7 @@ void SurfaceRenderer::initContext(GLContextData& contextData) const
 	contextData.addDataItem(this,dataItem);
 	
 	/* Create the height map render shader: */
-	dataItem->heightMapShader=createSinglePassSurfaceShader(*contextData.getLightTracker(),dataItem->heightMapShaderUniforms);
+	createSinglePassSurfaceShader(*contextData.getLightTracker(),dataItem);
 	dataItem->surfaceSettingsVersion=surfaceSettingsVersion;
 	dataItem->lightTrackerVersion=contextData.getLightTracker()->getVersion();
 	
@@ -589,6 +632,12 @@ void SurfaceRenderer::setDrawContourLines(bool newDrawContourLines)
 	++surfaceSettingsVersion;
 	}
 
+void SurfaceRenderer::setPixelCornerContourLines(bool newPixelCornerContourLines)
+	{
+	pixelCornerContourLines=newPixelCornerContourLines;
+	++surfaceSettingsVersion;
+	}
+
 void SurfaceRenderer::setContourLineDistance(GLfloat newContourLineDistance)
 	{
 	/* Set the new contour line factor: */
@@ -662,8 +711,8 @@ void SurfaceRenderer::renderSinglePass(const int viewport[4],const PTransform& p
 	PTransform projectionModelview=projection;
 	projectionModelview*=modelview;
 	
-	/* Check if contour line rendering is enabled: */
-	if(drawContourLines)
+	/* Check if contour lines are extracted from a separate pixel-corner elevation pass: */
+	if(drawContourLines&&pixelCornerContourLines)
 		{
 		/* Run the first rendering pass to create a half-pixel offset texture of surface elevations: */
 		renderPixelCornerElevations(viewport,projectionModelview,contextData,dataItem);
@@ -685,9 +734,7 @@ void SurfaceRenderer::renderSinglePass(const int viewport[4],const PTransform& p
 		/* Rebuild the shader: */
 		try
 			{
-			GLhandleARB newShader=createSinglePassSurfaceShader(*contextData.getLightTracker(),dataItem->heightMapShaderUniforms);
-			glDeleteObjectARB(dataItem->heightMapShader);
-			dataItem->heightMapShader=newShader;
+			createSinglePassSurfaceShader(*contextData.getLightTracker(),dataItem);
 			}
 		catch(std::runtime_error err)
 			{
@@ -737,10 +784,23 @@ void SurfaceRenderer::renderSinglePass(const int viewport[4],const PTransform& p
 	
 	if(drawContourLines)
 		{
-		/* Bind the pixel corner elevation texture: */
-		glActiveTextureARB(GL_TEXTURE2_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->contourLineColorTextureObject);
-		glUniform1iARB(*(ulPtr++),2);
+		if(pixelCornerContourLines)
+			{
+			/* Bind the pixel corner elevation texture: */
+			glActiveTextureARB(GL_TEXTURE2_ARB);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->contourLineColorTextureObject);
+			glUniform1iARB(*(ulPtr++),2);
+			}
+		else
+			{
+			/* Upload the camera-space base plane equation: */
+			const Plane& basePlane=depthImageRenderer->getBasePlane();
+			GLfloat planeEq[4];
+			for(int i=0;i<3;++i)
+				planeEq[i]=GLfloat(basePlane.getNormal()[i]);
+			planeEq[3]=GLfloat(-basePlane.getOffset());
+			glUniformARB<4>(*(ulPtr++),1,planeEq);
+			}
 		
 		/* Upload the contour line distance factor: */
 		glUniform1fARB(*(ulPtr++),contourLineFactor);
@@ -797,7 +857,7 @@ void SurfaceRenderer::renderSinglePass(const int viewport[4],const PTransform& p
 	
 	/* Upload the combined projection, modelview, and depth unprojection matrix: */
 	PTransform projectionModelviewDepthProjection=projectionModelview;
-	projectionModelviewDepthProjection*=depthImageRenderer->getDepthProjection();
+	projectionModelviewDepthProjection*=depthImageRenderer->getTextureDepthProjection();
 	glUniformARB(*(ulPtr++),projectionModelviewDepthProjection);
 	
 	/* Draw the surface: */
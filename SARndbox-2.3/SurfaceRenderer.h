@@ -23,6 +23,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #ifndef SURFACERENDERER_INCLUDED
 #define SURFACERENDERER_INCLUDED
 
+#include <vector>
+#include <Misc/SizedTypes.h>
 #include <IO/FileMonitor.h>
 #include <Geometry/ProjectiveTransformation.h>
 #include <GL/gl.h>
@@ -45,15 +47,26 @@ class SurfaceRenderer:public GLObject
 	private:
 	struct DataItem:public GLObject::DataItem
 		{
-		/* Elements: */
+		/* Embedded classes: */
 		public:
+		struct SurfaceShader // Structure for a previously built variant of the single-pass surface shader
+			{
+			/* Elements: */
+			public:
+			Misc::UInt64 sourceHash; // Hash of the variant's complete shader source code
+			GLhandleARB shader; // The variant's shader program
+			GLint uniforms[16]; // Locations of the variant's uniform variables
+			};
+		
+		/* Elements: */
 		GLuint contourLineFramebufferSize[2]; // Current width and height of contour line rendering frame buffer
 		GLuint contourLineFramebufferObject; // Frame buffer object used to render topographic contour lines
 		GLuint contourLineDepthBufferObject; // Depth render buffer for topographic contour line frame buffer
 		GLuint contourLineColorTextureObject; // Color texture object for topographic contour line frame buffer
 		unsigned int contourLineVersion; // Version number of depth image used for contour line generation
-		GLhandleARB heightMapShader; // Shader program to render the surface using a height color map
-		GLint heightMapShaderUniforms[16]; // Locations of the height map shader's uniform variables
+		std::vector<SurfaceShader> surfaceShaders; // List of all single-pass surface shader variants built in this OpenGL context
+		GLhandleARB heightMapShader; // Currently selected single-pass surface shader variant
+		GLint heightMapShaderUniforms[16]; // Locations of the selected variant's uniform variables
 		unsigned int surfaceSettingsVersion; // Version number of surface settings for which the height map shader was built
 		unsigned int lightTrackerVersion; // Version number of light tracker state for which the height map shader was built
 		GLhandleARB globalAmbientHeightMapShader; // Shader program to render the global ambient component of the surface using a height color map
@@ -74,6 +87,7 @@ class SurfaceRenderer:public GLObject
 	
 	bool drawContourLines; // Flag if topographic contour lines are enabled
 	GLfloat contourLineFactor; // Inverse elevation distance between adjacent topographic contour lines
+	bool pixelCornerContourLines; // Flag whether topographic contour lines are extracted from a separate pixel-corner elevation pass instead of the surface pass itself
 	
 	ElevationColorMap* elevationColorMap; // Pointer to a color map for topographic elevation map coloring
 	
@@ -91,7 +105,7 @@ class SurfaceRenderer:public GLObject
 	
 	/* Private methods: */
 	void shaderSourceFileChanged(const IO::FileMonitor::Event& event); // Callback called when one of the external shader source files is changed
-	GLhandleARB createSinglePassSurfaceShader(const GLLightTracker& lt,GLint* uniformLocations) const; // Creates a single-pass surface rendering shader based on current renderer settings
+	void createSinglePassSurfaceShader(const GLLightTracker& lt,DataItem* dataItem) const; // Selects a single-pass surface rendering shader based on current renderer settings, reusing a previously built variant if possible
 	void renderPixelCornerElevations(const int viewport[4],const PTransform& projectionModelview,GLContextData& contextData,DataItem* dataItem) const; // Creates texture containing pixel-corner elevations based on the current depth image
 	
 	/* Constructors and destructors: */
@@ -103,6 +117,7 @@ class SurfaceRenderer:public GLObject
 	
 	/* New methods: */
 	void setDrawContourLines(bool newDrawContourLines); // Enables or disables topographic contour lines
+	void setPixelCornerContourLines(bool newPixelCornerContourLines); // Selects between the separate pixel-corner elevation pass and fused extraction in the surface pass for topographic contour lines
 	void setContourLineDistance(GLfloat newContourLineDistance); // Sets the elevation distance between adjacent topographic contour lines
 	void setElevationColorMap(ElevationColorMap* newElevationColorMap); // Sets an elevation color map
 	void setDem(DEM* newDem); // Sets a pre-made digital elevation model to create a zero surface for height color mapping
@@ -0,0 +1,412 @@
+/***********************************************************************
+TemporalFilterBench - Utility to replay a pre-recorded depth stream with
+a synthetic surface change through the frame filter's averaging and
+adaptive temporal filters, to compare how quickly they converge to the
+changed surface and how much noise they let through on static surfaces.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <Misc/Timer.h>
+#include <Misc/ValueCoder.h>
+#include <IO/File.h>
+#include <IO/OpenFile.h>
+#include <IO/ValueSource.h>
+#include <Math/Math.h>
+#include <Math/Constants.h>
+#include <Geometry/GeometryValueCoders.h>
+#include <Kinect/FrameBuffer.h>
+#include <Kinect/FrameSource.h>
+#include <Kinect/FileFrameSource.h>
+
+#include "Types.h"
+#include "FrameFilter.h"
+
+#include "Config.h"
+
+int main(int argc,char* argv[])
+	{
+	/* Parse the command line: */
+	const char* frameFilePrefix=0;
+	std::string sandboxLayoutFileName=CONFIG_CONFIGDIR;
+	sandboxLayoutFileName.push_back('/');
+	sandboxLayoutFileName.append(CONFIG_DEFAULTBOXLAYOUTFILENAME);
+	bool haveElevationRange=false;
+	double elevationMin=0.0,elevationMax=0.0;
+	unsigned int numAveragingSlots=30;
+	unsigned int minNumSamples=10;
+	unsigned int maxVariance=2;
+	float adaptiveMeasurementVariance=2.0f;
+	float adaptiveProcessVariance=0.01f;
+	float adaptiveChangeThreshold=4.0f;
+	float hysteresis=0.1f;
+	bool spatialFilter=true;
+	FrameFilter::SpatialFilterType spatialFilterType=FrameFilter::LEGACY_SPATIAL_FILTER;
+	unsigned int spatialFilterRadius=2;
+	float spatialFilterRangeSigma=2.0f;
+	size_t stepFrame=~size_t(0);
+	int stepOffset=-20;
+	bool haveStepRegion=false;
+	unsigned int stepRegion[4]={0,0,0,0};
+	double tolerance=0.2;
+	size_t maxNumFrames=~size_t(0);
+	for(int i=1;i<argc;++i)
+		{
+		if(argv[i][0]=='-')
+			{
+			if(strcasecmp(argv[i]+1,"slf")==0)
+				{
+				++i;
+				sandboxLayoutFileName=argv[i];
+				}
+			else if(strcasecmp(argv[i]+1,"er")==0)
+				{
+				haveElevationRange=true;
+				++i;
+				elevationMin=atof(argv[i]);
+				++i;
+				elevationMax=atof(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"nas")==0)
+				{
+				++i;
+				numAveragingSlots=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"sp")==0)
+				{
+				++i;
+				minNumSamples=atoi(argv[i]);
+				++i;
+				maxVariance=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"tfp")==0)
+				{
+				++i;
+				adaptiveMeasurementVariance=float(atof(argv[i]));
+				++i;
+				adaptiveProcessVariance=float(atof(argv[i]));
+				++i;
+				adaptiveChangeThreshold=float(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"he")==0)
+				{
+				++i;
+				hysteresis=float(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"nsf")==0)
+				spatialFilter=false;
+			else if(strcasecmp(argv[i]+1,"sf")==0)
+				{
+				++i;
+				int type;
+				for(type=FrameFilter::LEGACY_SPATIAL_FILTER;type<=FrameFilter::BILATERAL_SPATIAL_FILTER;++type)
+					if(strcasecmp(argv[i],FrameFilter::getSpatialFilterTypeName(FrameFilter::SpatialFilterType(type)))==0)
+						break;
+				if(type>FrameFilter::BILATERAL_SPATIAL_FILTER)
+					{
+					std::cerr<<"Unknown spatial filter type "<<argv[i]<<std::endl;
+					return 1;
+					}
+				spatialFilterType=FrameFilter::SpatialFilterType(type);
+				++i;
+				spatialFilterRadius=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"sfrs")==0)
+				{
+				++i;
+				spatialFilterRangeSigma=float(atof(argv[i]));
+				}
+			else if(strcasecmp(argv[i]+1,"step")==0)
+				{
+				++i;
+				stepFrame=size_t(atoi(argv[i]));
+				++i;
+				stepOffset=atoi(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"sr")==0)
+				{
+				haveStepRegion=true;
+				for(int j=0;j<4;++j)
+					{
+					++i;
+					stepRegion[j]=(unsigned int)(atoi(argv[i]));
+					}
+				}
+			else if(strcasecmp(argv[i]+1,"tol")==0)
+				{
+				++i;
+				tolerance=atof(argv[i]);
+				}
+			else if(strcasecmp(argv[i]+1,"n")==0)
+				{
+				++i;
+				maxNumFrames=size_t(atoi(argv[i]));
+				}
+			else
+				std::cerr<<"Ignoring unrecognized command line switch "<<argv[i]<<std::endl;
+			}
+		else if(frameFilePrefix==0)
+			frameFilePrefix=argv[i];
+		}
+	if(frameFilePrefix==0)
+		{
+		std::cerr<<"Usage: "<<argv[0]<<" <frame file name prefix> [-slf <sandbox layout file name>] [-er <min elevation> <max elevation>] [-nas <num averaging slots>] [-sp <min num samples> <max variance>] [-tfp <measurement variance> <process variance> <change threshold>] [-he <hysteresis envelope>] [-nsf] [-sf <spatial filter type> <spatial filter radius>] [-sfrs <range sigma>] [-step <step frame index> <raw depth offset>] [-sr <min x> <min y> <max x> <max y>] [-tol <relative tolerance>] [-n <max num frames>]"<<std::endl;
+		return 1;
+		}
+	if(stepOffset==0)
+		{
+		std::cerr<<"Step offset must not be zero"<<std::endl;
+		return 1;
+		}
+	
+	try
+		{
+		/* Open the pre-recorded 3D video files: */
+		std::string colorFileName=frameFilePrefix;
+		colorFileName.append(".color");
+		std::string depthFileName=frameFilePrefix;
+		depthFileName.append(".depth");
+		Kinect::FileFrameSource frameSource(colorFileName.c_str(),depthFileName.c_str());
+		unsigned int frameSize[2];
+		for(int i=0;i<2;++i)
+			frameSize[i]=frameSource.getActualFrameSize(Kinect::FrameSource::DEPTH)[i];
+		
+		/* Get the per-pixel depth correction parameters: */
+		FrameFilter::PixelDepthCorrection* pixelDepthCorrection;
+		Kinect::FrameSource::DepthCorrection* depthCorrection=frameSource.getDepthCorrectionParameters();
+		if(depthCorrection!=0)
+			{
+			pixelDepthCorrection=depthCorrection->getPixelCorrection(frameSize);
+			delete depthCorrection;
+			}
+		else
+			{
+			/* Create dummy per-pixel depth correction parameters: */
+			pixelDepthCorrection=new FrameFilter::PixelDepthCorrection[frameSize[1]*frameSize[0]];
+			FrameFilter::PixelDepthCorrection* pdcPtr=pixelDepthCorrection;
+			for(unsigned int y=0;y<frameSize[1];++y)
+				for(unsigned int x=0;x<frameSize[0];++x,++pdcPtr)
+					{
+					pdcPtr->scale=1.0f;
+					pdcPtr->offset=0.0f;
+					}
+			}
+		Kinect::FrameSource::IntrinsicParameters ips=frameSource.getIntrinsicParameters();
+		
+		/* Read the base plane equation from the sandbox layout file: */
+		Plane basePlane;
+		{
+		IO::ValueSource layoutSource(IO::openFile(sandboxLayoutFileName.c_str()));
+		layoutSource.skipWs();
+		std::string s=layoutSource.readLine();
+		basePlane=Misc::ValueCoder<Plane>::decode(s.c_str(),s.c_str()+s.length());
+		basePlane.normalize();
+		}
+		
+		/* Read all depth frames into memory to exclude decompression from the measurements: */
+		std::vector<Kinect::FrameBuffer> frames;
+		while(frames.size()<maxNumFrames)
+			{
+			Kinect::FrameBuffer frame=frameSource.readNextDepthFrame();
+			if(frame.timeStamp==Math::Constants<double>::max)
+				break;
+			frames.push_back(frame);
+			}
+		size_t numFrames=frames.size();
+		if(numFrames<2)
+			{
+			std::cerr<<"Depth stream contains fewer than two frames"<<std::endl;
+			return 1;
+			}
+		if(stepFrame>=numFrames)
+			stepFrame=numFrames/2;
+		double frameInterval=(frames.back().timeStamp-frames.front().timeStamp)/double(numFrames-1);
+		
+		/* Default to a step in the central quarter of the frame: */
+		if(!haveStepRegion)
+			{
+			for(int i=0;i<2;++i)
+				{
+				stepRegion[i]=frameSize[i]/4;
+				stepRegion[2+i]=(frameSize[i]*3)/4;
+				}
+			}
+		for(int i=0;i<2;++i)
+			{
+			if(stepRegion[2+i]>frameSize[i])
+				stepRegion[2+i]=frameSize[i];
+			if(stepRegion[i]>stepRegion[2+i])
+				stepRegion[i]=stepRegion[2+i];
+			}
+		
+		/* Create a copy of the depth stream in which the surface inside the step region moves by the step offset at the step frame: */
+		std::vector<Kinect::FrameBuffer> steppedFrames;
+		for(size_t frameIndex=0;frameIndex<numFrames;++frameIndex)
+			{
+			if(frameIndex<stepFrame)
+				{
+				steppedFrames.push_back(frames[frameIndex]);
+				continue;
+				}
+			
+			const Kinect::FrameBuffer& frame=frames[frameIndex];
+			size_t frameDataSize=size_t(frameSize[1])*size_t(frameSize[0])*sizeof(FrameFilter::RawDepth);
+			Kinect::FrameBuffer steppedFrame(frameSize[0],frameSize[1],frameDataSize);
+			steppedFrame.timeStamp=frame.timeStamp;
+			memcpy(steppedFrame.getData<void>(),frame.getData<void>(),frameDataSize);
+			FrameFilter::RawDepth* sfPtr=steppedFrame.getData<FrameFilter::RawDepth>();
+			for(unsigned int y=stepRegion[1];y<stepRegion[3];++y)
+				for(unsigned int x=stepRegion[0];x<stepRegion[2];++x)
+					{
+					/* Only move valid samples, and keep them in the valid range: */
+					FrameFilter::RawDepth& d=sfPtr[y*frameSize[0]+x];
+					int newD=int(d)+stepOffset;
+					if(d>0U&&d<2047U&&newD>0&&newD<2047)
+						d=FrameFilter::RawDepth(newD);
+					}
+			steppedFrames.push_back(steppedFrame);
+			}
+		
+		/* Measure convergence inside the step region, away from its edges which are blurred by the spatial filter: */
+		unsigned int margin=1;
+		if(spatialFilter)
+			margin+=spatialFilterType==FrameFilter::LEGACY_SPATIAL_FILTER?2:spatialFilterRadius;
+		std::vector<unsigned int> measuredPixels;
+		const FrameFilter::RawDepth* sfPtr=frames[stepFrame].getData<FrameFilter::RawDepth>();
+		for(unsigned int y=stepRegion[1]+margin;y+margin<stepRegion[3];++y)
+			for(unsigned int x=stepRegion[0]+margin;x+margin<stepRegion[2];++x)
+				{
+				/* Only measure pixels whose sample at the step frame was moved: */
+				unsigned int pixelIndex=y*frameSize[0]+x;
+				int newD=int(sfPtr[pixelIndex])+stepOffset;
+				if(sfPtr[pixelIndex]>0U&&sfPtr[pixelIndex]<2047U&&newD>0&&newD<2047)
+					measuredPixels.push_back(pixelIndex);
+				}
+		std::cout<<"Replaying "<<numFrames<<" depth frames of size "<<frameSize[0]<<'x'<<frameSize[1]<<" at "<<1.0/frameInterval<<" Hz"<<std::endl;
+		std::cout<<"Moving region ["<<stepRegion[0]<<", "<<stepRegion[2]<<")x["<<stepRegion[1]<<", "<<stepRegion[3]<<") by "<<stepOffset<<" raw depth units at frame "<<stepFrame<<"; measuring "<<measuredPixels.size()<<" pixels"<<std::endl;
+		
+		/* Run the original and the stepped depth stream through both temporal filters: */
+		size_t numPixels=size_t(frameSize[1])*size_t(frameSize[0]);
+		for(int filterType=FrameFilter::AVERAGING_TEMPORAL_FILTER;filterType<=FrameFilter::ADAPTIVE_TEMPORAL_FILTER;++filterType)
+			{
+			/* Create identically configured filters for the original and the stepped stream: */
+			FrameFilter* filters[2];
+			Kinect::FrameBuffer outputFrames[2];
+			for(int i=0;i<2;++i)
+				{
+				filters[i]=new FrameFilter(frameSize,numAveragingSlots,pixelDepthCorrection,ips.depthProjection,basePlane);
+				filters[i]->setTemporalFilterType(FrameFilter::TemporalFilterType(filterType));
+				if(haveElevationRange)
+					filters[i]->setValidElevationInterval(ips.depthProjection,basePlane,elevationMin,elevationMax);
+				filters[i]->setStableParameters(minNumSamples,maxVariance);
+				filters[i]->setAdaptiveParameters(adaptiveMeasurementVariance,adaptiveProcessVariance,adaptiveChangeThreshold);
+				filters[i]->setHysteresis(hysteresis);
+				filters[i]->setSpatialFilter(spatialFilter);
+				filters[i]->setSpatialFilterType(spatialFilterType,spatialFilterRadius);
+				filters[i]->setSpatialFilterRangeSigma(spatialFilterRangeSigma);
+				outputFrames[i]=filters[i]->createOutputFrame();
+				}
+			
+			/* Track the last frame at which each measured pixel was outside the tolerance around the expected change: */
+			std::vector<size_t> lastOutsideFrames(measuredPixels.size(),stepFrame);
+			std::vector<float> previousOutput(numPixels,0.0f);
+			double totalTime=0.0;
+			size_t numChangedPixels=0;
+			double totalChange=0.0;
+			size_t numNoiseFrames=0;
+			for(size_t frameIndex=0;frameIndex<numFrames;++frameIndex)
+				{
+				Misc::Timer filterTimer;
+				filters[0]->filterFrame(frames[frameIndex],outputFrames[0]);
+				filterTimer.elapse();
+				totalTime+=filterTimer.getTime();
+				filters[1]->filterFrame(steppedFrames[frameIndex],outputFrames[1]);
+				
+				const float* of0=outputFrames[0].getData<float>();
+				const float* of1=outputFrames[1].getData<float>();
+				
+				/* Measure output noise on the static original stream once the averaging filter had time to fill its slots: */
+				if(frameIndex>numAveragingSlots)
+					{
+					for(size_t i=0;i<numPixels;++i)
+						if(of0[i]!=previousOutput[i])
+							{
+							++numChangedPixels;
+							totalChange+=Math::abs(double(of0[i])-double(previousOutput[i]));
+							}
+					++numNoiseFrames;
+					}
+				memcpy(&previousOutput[0],of0,numPixels*sizeof(float));
+				
+				/* Compare the measured pixels' change between the two streams against the expected change: */
+				if(frameIndex>=stepFrame)
+					{
+					for(size_t i=0;i<measuredPixels.size();++i)
+						{
+						unsigned int pixelIndex=measuredPixels[i];
+						double expected=double(pixelDepthCorrection[pixelIndex].scale)*double(stepOffset);
+						double change=double(of1[pixelIndex])-double(of0[pixelIndex]);
+						if(Math::abs(change-expected)>tolerance*Math::abs(expected))
+							lastOutsideFrames[i]=frameIndex;
+						}
+					}
+				}
+			
+			/* Calculate convergence latencies of all measured pixels that converged before the end of the stream: */
+			std::vector<size_t> latencies;
+			for(size_t i=0;i<measuredPixels.size();++i)
+				if(lastOutsideFrames[i]+1<numFrames)
+					latencies.push_back(lastOutsideFrames[i]+1-stepFrame);
+			std::sort(latencies.begin(),latencies.end());
+			
+			/* Print the results: */
+			std::cout<<FrameFilter::getTemporalFilterTypeName(FrameFilter::TemporalFilterType(filterType))<<" filter:"<<std::endl;
+			std::cout<<"  Per-pixel state: "<<double(filters[0]->getTemporalFilterStateSize())/(1024.0*1024.0)<<" MB, processing time: "<<totalTime*1000.0/double(numFrames)<<" ms per frame"<<std::endl;
+			std::cout<<"  Converged pixels: "<<latencies.size()<<" of "<<measuredPixels.size()<<std::endl;
+			if(!latencies.empty())
+				{
+				size_t median=latencies[latencies.size()/2];
+				size_t p95=latencies[((latencies.size()-1)*95)/100];
+				size_t max=latencies.back();
+				std::cout<<"  Convergence latency: median "<<median<<" frames ("<<double(median)*frameInterval*1000.0<<" ms), 95% "<<p95<<" frames ("<<double(p95)*frameInterval*1000.0<<" ms), max "<<max<<" frames ("<<double(max)*frameInterval*1000.0<<" ms)"<<std::endl;
+				}
+			if(numNoiseFrames>0)
+				std::cout<<"  Static noise: "<<double(numChangedPixels)*100.0/(double(numNoiseFrames)*double(numPixels))<<"% of pixels changed per frame, mean change "<<(numChangedPixels>0?totalChange/double(numChangedPixels):0.0)<<" depth units"<<std::endl;
+			
+			for(int i=0;i<2;++i)
+				delete filters[i];
+			}
+		
+		/* Clean up: */
+		delete[] pixelDepthCorrection;
+		
+		return 0;
+		}
+	catch(std::runtime_error err)
+		{
+		std::cerr<<"Caught exception "<<err.what()<<std::endl;
+		return 1;
+		}
+	}
@@ -0,0 +1,508 @@
+/***********************************************************************
+WaterStateRecorder - Classes to record time series of a water table's
+bathymetry and water level grids to a seekable, delta-compressed binary
+file using asynchronous GPU readback and a background writer thread, and
+to play such recordings back into a water table.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "WaterStateRecorder.h"
+
+#include <algorithm>
+#include <Misc/ThrowStdErr.h>
+#include <IO/OpenFile.h>
+#include <GL/gl.h>
+#include <GL/Extensions/GLARBMultitexture.h>
+#include <GL/Extensions/GLARBTextureRectangle.h>
+#include <GL/Extensions/GLARBVertexBufferObject.h>
+#include <GL/GLExtensionManager.h>
+#include <GL/GLContextData.h>
+
+#include "WaterTable2.h"
+
+#ifndef GL_PIXEL_PACK_BUFFER_ARB
+#define GL_PIXEL_PACK_BUFFER_ARB 0x88EB
+#endif
+
+/*
+Recording file layout, all values little-endian:
+  Header: UInt32 magic, UInt32 format version, UInt32 bathymetry grid
+  size[2], UInt32 water level grid size[2], Float32 cell size[2],
+  Float64 capture interval, UInt32 keyframe interval
+  Frames: Float64 time stamp, UInt32 flags (bit 0: keyframe), UInt32
+  payload size in 32-bit words, payload
+  Payload: encoded bathymetry grid followed by encoded water level grid;
+  each grid is a sequence of (UInt32 number of unchanged values, UInt32
+  number of changed values, changed values XORed with the previous
+  frame's bit patterns) runs; keyframes are XORed with zero
+*/
+
+namespace {
+
+/****************
+Helper constants:
+****************/
+
+const Misc::UInt32 fileMagic=0x53415753U; // "SAWS" for SARndbox water state
+const Misc::UInt32 fileFormatVersion=1U;
+const Misc::UInt32 keyframeFlag=0x1U;
+
+/****************
+Helper functions:
+****************/
+
+bool retrieveGrid(GLuint bufferObject,std::vector<GLfloat>& grid)
+	{
+	/* Copy the grid out of the given pixel buffer object: */
+	glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,bufferObject);
+	const GLfloat* bufferGrid=static_cast<const GLfloat*>(glMapBufferARB(GL_PIXEL_PACK_BUFFER_ARB,GL_READ_ONLY_ARB));
+	if(bufferGrid!=0)
+		{
+		std::copy(bufferGrid,bufferGrid+grid.size(),grid.begin());
+		glUnmapBufferARB(GL_PIXEL_PACK_BUFFER_ARB);
+		}
+	glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+	
+	return bufferGrid!=0;
+	}
+
+void decodeGrid(const Misc::UInt32*& dPtr,const Misc::UInt32* dEnd,std::vector<Misc::UInt32>& grid)
+	{
+	/* Apply all runs of unchanged and changed values to the grid: */
+	size_t numValues=grid.size();
+	size_t i=0;
+	while(i<numValues)
+		{
+		if(dEnd-dPtr<2)
+			Misc::throwStdErr("WaterStatePlayer: Truncated frame");
+		size_t numUnchanged=*(dPtr++);
+		size_t numChanged=*(dPtr++);
+		if(numUnchanged>numValues-i||numChanged>numValues-i-numUnchanged||size_t(dEnd-dPtr)<numChanged)
+			Misc::throwStdErr("WaterStatePlayer: Corrupted frame");
+		i+=numUnchanged;
+		for(size_t j=0;j<numChanged;++j,++i,++dPtr)
+			grid[i]^=*dPtr;
+		}
+	}
+
+}
+
+/*********************************************
+Methods of class WaterStateRecorder::DataItem:
+*********************************************/
+
+WaterStateRecorder::DataItem::DataItem(void)
+	:haveAsyncReadback(false),
+	 readbackPending(false),readbackTime(0.0)
+	{
+	bufferObjects[0]=bufferObjects[1]=0;
+	
+	/* Initialize all required extensions: */
+	GLARBMultitexture::initExtension();
+	GLARBTextureRectangle::initExtension();
+	
+	/* Initialize the optional extensions to read back grids asynchronously: */
+	haveAsyncReadback=GLARBVertexBufferObject::isSupported()&&GLExtensionManager::isExtensionSupported("GL_ARB_pixel_buffer_object");
+	if(haveAsyncReadback)
+		{
+		GLARBVertexBufferObject::initExtension();
+		glGenBuffersARB(2,bufferObjects);
+		}
+	}
+
+WaterStateRecorder::DataItem::~DataItem(void)
+	{
+	/* Release all allocated buffers: */
+	if(haveAsyncReadback)
+		glDeleteBuffersARB(2,bufferObjects);
+	}
+
+/***********************************
+Methods of class WaterStateRecorder:
+***********************************/
+
+WaterStateRecorder::Frame* WaterStateRecorder::getFreeFrame(void) const
+	{
+	Threads::MutexCond::Lock queueLock(queueCond);
+	
+	Frame* result=0;
+	if(!freeFrames.empty())
+		{
+		/* Reuse a frame from the pool: */
+		result=freeFrames.back();
+		freeFrames.pop_back();
+		}
+	else if(frameQueue.size()<maxQueuedFrames)
+		{
+		/* Grow the pool by a new frame: */
+		result=new Frame;
+		result->bathymetry.resize(bathymetrySize[1]*bathymetrySize[0]);
+		result->water.resize(waterSize[1]*waterSize[0]);
+		}
+	else
+		{
+		/* Drop the frame; the writer thread is too far behind: */
+		++numDroppedFrames;
+		}
+	
+	return result;
+	}
+
+void WaterStateRecorder::releaseFrame(WaterStateRecorder::Frame* frame) const
+	{
+	Threads::MutexCond::Lock queueLock(queueCond);
+	freeFrames.push_back(frame);
+	}
+
+void WaterStateRecorder::postFrame(WaterStateRecorder::Frame* frame) const
+	{
+	Threads::MutexCond::Lock queueLock(queueCond);
+	
+	/* Append the frame to the queue and wake up the writer thread: */
+	frameQueue.push_back(frame);
+	queueCond.signal();
+	}
+
+void WaterStateRecorder::encodeGrid(const GLfloat* grid,std::vector<Misc::UInt32>& previous,bool keyframe)
+	{
+	/* Encode keyframes relative to an all-zero grid: */
+	if(keyframe)
+		std::fill(previous.begin(),previous.end(),Misc::UInt32(0));
+	
+	const Misc::UInt32* bits=reinterpret_cast<const Misc::UInt32*>(grid);
+	size_t numValues=previous.size();
+	size_t i=0;
+	while(i<numValues)
+		{
+		/* Skip the run of unchanged values: */
+		size_t unchangedStart=i;
+		while(i<numValues&&bits[i]==previous[i])
+			++i;
+		
+		/* Collect the following changed values, absorbing isolated unchanged values: */
+		size_t changedStart=i;
+		while(i<numValues&&(bits[i]!=previous[i]||(i+1<numValues&&bits[i+1]!=previous[i+1])))
+			++i;
+		
+		/* Write the run: */
+		encodeBuffer.push_back(Misc::UInt32(changedStart-unchangedStart));
+		encodeBuffer.push_back(Misc::UInt32(i-changedStart));
+		for(size_t j=changedStart;j<i;++j)
+			{
+			encodeBuffer.push_back(bits[j]^previous[j]);
+			previous[j]=bits[j];
+			}
+		}
+	}
+
+void WaterStateRecorder::writeFrame(const WaterStateRecorder::Frame& frame)
+	{
+	/* Encode both grids: */
+	bool keyframe=numWrittenFrames%keyframeInterval==0;
+	encodeBuffer.clear();
+	encodeGrid(&frame.bathymetry.front(),previousBathymetry,keyframe);
+	encodeGrid(&frame.water.front(),previousWater,keyframe);
+	
+	/* Write the frame: */
+	file->write<Misc::Float64>(frame.time);
+	file->write<Misc::UInt32>(keyframe?keyframeFlag:0U);
+	file->write<Misc::UInt32>(Misc::UInt32(encodeBuffer.size()));
+	file->write<Misc::UInt32>(&encodeBuffer.front(),encodeBuffer.size());
+	++numWrittenFrames;
+	}
+
+void* WaterStateRecorder::writerThreadMethod(void)
+	{
+	while(true)
+		{
+		Frame* frame;
+		{
+		Threads::MutexCond::Lock queueLock(queueCond);
+		
+		/* Wait until a new frame arrives or the recorder shuts down: */
+		while(runWriterThread&&frameQueue.empty())
+			queueCond.wait(queueLock);
+		
+		/* Bail out if the recorder is shutting down and all frames have been written: */
+		if(frameQueue.empty())
+			break;
+		
+		/* Work on the oldest frame: */
+		frame=frameQueue.front();
+		frameQueue.pop_front();
+		}
+		
+		/* Compress and write the frame, and return it to the pool: */
+		writeFrame(*frame);
+		releaseFrame(frame);
+		}
+	
+	return 0;
+	}
+
+WaterStateRecorder::WaterStateRecorder(const WaterTable2* sWaterTable,const char* fileName,double sCaptureInterval,unsigned int sKeyframeInterval)
+	:waterTable(sWaterTable),
+	 captureInterval(sCaptureInterval),keyframeInterval(sKeyframeInterval>0?sKeyframeInterval:1),
+	 captureContext(0),nextCaptureTime(0.0),numDroppedFrames(0),
+	 file(IO::openFile(fileName,IO::File::WriteOnly)),
+	 maxQueuedFrames(8),runWriterThread(false),
+	 numWrittenFrames(0)
+	{
+	/* Retrieve the grid sizes: */
+	for(int i=0;i<2;++i)
+		{
+		bathymetrySize[i]=waterTable->getBathymetrySize(i);
+		waterSize[i]=waterTable->getSize()[i];
+		}
+	previousBathymetry.resize(bathymetrySize[1]*bathymetrySize[0],0U);
+	previousWater.resize(waterSize[1]*waterSize[0],0U);
+	
+	/* Write the file header: */
+	file->setEndianness(Misc::LittleEndian);
+	file->write<Misc::UInt32>(fileMagic);
+	file->write<Misc::UInt32>(fileFormatVersion);
+	for(int i=0;i<2;++i)
+		file->write<Misc::UInt32>(Misc::UInt32(bathymetrySize[i]));
+	for(int i=0;i<2;++i)
+		file->write<Misc::UInt32>(Misc::UInt32(waterSize[i]));
+	for(int i=0;i<2;++i)
+		file->write<Misc::Float32>(waterTable->getCellSize()[i]);
+	file->write<Misc::Float64>(captureInterval);
+	file->write<Misc::UInt32>(keyframeInterval);
+	
+	/* Start the writer thread: */
+	runWriterThread=true;
+	writerThread.start(this,&WaterStateRecorder::writerThreadMethod);
+	}
+
+WaterStateRecorder::~WaterStateRecorder(void)
+	{
+	/* Shut down the writer thread after it wrote all pending frames: */
+	{
+	Threads::MutexCond::Lock queueLock(queueCond);
+	runWriterThread=false;
+	queueCond.signal();
+	}
+	writerThread.join();
+	
+	/* Delete all frames: */
+	for(std::vector<Frame*>::iterator fIt=freeFrames.begin();fIt!=freeFrames.end();++fIt)
+		delete *fIt;
+	}
+
+void WaterStateRecorder::initContext(GLContextData& contextData) const
+	{
+	/* Create a data item and add it to the context: */
+	DataItem* dataItem=new DataItem;
+	contextData.addDataItem(this,dataItem);
+	
+	if(dataItem->haveAsyncReadback)
+		{
+		/* Allocate the pixel buffer objects: */
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,dataItem->bufferObjects[0]);
+		glBufferDataARB(GL_PIXEL_PACK_BUFFER_ARB,bathymetrySize[1]*bathymetrySize[0]*sizeof(GLfloat),0,GL_STREAM_READ_ARB);
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,dataItem->bufferObjects[1]);
+		glBufferDataARB(GL_PIXEL_PACK_BUFFER_ARB,waterSize[1]*waterSize[0]*sizeof(GLfloat),0,GL_STREAM_READ_ARB);
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+		}
+	}
+
+void WaterStateRecorder::capture(double time,GLContextData& contextData) const
+	{
+	/* Capture grids from a single OpenGL context only: */
+	if(captureContext==0)
+		captureContext=&contextData;
+	if(captureContext!=&contextData)
+		return;
+	
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	
+	if(dataItem->readbackPending)
+		{
+		/* Retrieve the grids read back during a previous capture; the transfer has finished in the meantime: */
+		Frame* frame=getFreeFrame();
+		if(frame!=0)
+			{
+			if(retrieveGrid(dataItem->bufferObjects[0],frame->bathymetry)&&retrieveGrid(dataItem->bufferObjects[1],frame->water))
+				{
+				frame->time=dataItem->readbackTime;
+				postFrame(frame);
+				}
+			else
+				releaseFrame(frame);
+			}
+		dataItem->readbackPending=false;
+		}
+	
+	/* Bail out if the next frame is not due yet: */
+	if(time<nextCaptureTime)
+		return;
+	nextCaptureTime+=captureInterval;
+	if(nextCaptureTime<=time)
+		nextCaptureTime=time+captureInterval;
+	
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	if(dataItem->haveAsyncReadback)
+		{
+		/* Start reading back the bathymetry and water level grids into the pixel buffer objects, to be retrieved during the next capture: */
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,dataItem->bufferObjects[0]);
+		waterTable->bindBathymetryTexture(contextData);
+		glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RED,GL_FLOAT,0);
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,dataItem->bufferObjects[1]);
+		waterTable->bindQuantityTexture(contextData);
+		glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RED,GL_FLOAT,0);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+		dataItem->readbackPending=true;
+		dataItem->readbackTime=time;
+		}
+	else
+		{
+		/* Read back the grids immediately: */
+		Frame* frame=getFreeFrame();
+		if(frame!=0)
+			{
+			waterTable->bindBathymetryTexture(contextData);
+			glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RED,GL_FLOAT,&frame->bathymetry.front());
+			waterTable->bindQuantityTexture(contextData);
+			glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RED,GL_FLOAT,&frame->water.front());
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+			frame->time=time;
+			postFrame(frame);
+			}
+		}
+	}
+
+/*********************************
+Methods of class WaterStatePlayer:
+*********************************/
+
+void WaterStatePlayer::readFrame(unsigned int frameIndex)
+	{
+	/* Read the frame's payload: */
+	const FrameIndex& fi=frames[frameIndex];
+	file->setReadPosAbs(fi.offset);
+	decodeBuffer.resize(fi.payloadSize);
+	if(fi.payloadSize>0)
+		file->read<Misc::UInt32>(&decodeBuffer.front(),fi.payloadSize);
+	
+	/* Keyframes are encoded relative to all-zero grids: */
+	if(fi.keyframe)
+		{
+		std::fill(bathymetry.begin(),bathymetry.end(),Misc::UInt32(0));
+		std::fill(water.begin(),water.end(),Misc::UInt32(0));
+		}
+	
+	/* Apply the payload to both grids: */
+	const Misc::UInt32* dPtr=decodeBuffer.empty()?0:&decodeBuffer.front();
+	const Misc::UInt32* dEnd=dPtr+decodeBuffer.size();
+	decodeGrid(dPtr,dEnd,bathymetry);
+	decodeGrid(dPtr,dEnd,water);
+	}
+
+WaterStatePlayer::WaterStatePlayer(const char* fileName)
+	:file(IO::openSeekableFile(fileName)),
+	 currentFrame(0)
+	{
+	/* Read and check the file header: */
+	file->setEndianness(Misc::LittleEndian);
+	if(file->read<Misc::UInt32>()!=fileMagic)
+		Misc::throwStdErr("WaterStatePlayer: %s is not a water state recording",fileName);
+	if(file->read<Misc::UInt32>()!=fileFormatVersion)
+		Misc::throwStdErr("WaterStatePlayer: %s has an unsupported format version",fileName);
+	for(int i=0;i<2;++i)
+		bathymetrySize[i]=GLsizei(file->read<Misc::UInt32>());
+	for(int i=0;i<2;++i)
+		waterSize[i]=GLsizei(file->read<Misc::UInt32>());
+	file->skip<Misc::Float32>(2);
+	file->skip<Misc::Float64>(1);
+	file->skip<Misc::UInt32>(1);
+	
+	/* Index all complete frames; a recording cut short ends with a partial frame: */
+	IO::SeekableFile::Offset fileSize=file->getSize();
+	IO::SeekableFile::Offset framePos=file->getReadPos();
+	const IO::SeekableFile::Offset frameHeaderSize=sizeof(Misc::Float64)+2*sizeof(Misc::UInt32);
+	while(framePos+frameHeaderSize<=fileSize)
+		{
+		FrameIndex fi;
+		fi.time=file->read<Misc::Float64>();
+		fi.keyframe=(file->read<Misc::UInt32>()&keyframeFlag)!=0U;
+		fi.payloadSize=file->read<Misc::UInt32>();
+		fi.offset=framePos+frameHeaderSize;
+		framePos=fi.offset+IO::SeekableFile::Offset(fi.payloadSize*sizeof(Misc::UInt32));
+		if(framePos>fileSize||(frames.empty()&&!fi.keyframe))
+			break;
+		frames.push_back(fi);
+		file->setReadPosAbs(framePos);
+		}
+	if(frames.empty())
+		Misc::throwStdErr("WaterStatePlayer: %s does not contain any frames",fileName);
+	
+	/* Decode the first frame: */
+	bathymetry.resize(bathymetrySize[1]*bathymetrySize[0],0U);
+	water.resize(waterSize[1]*waterSize[0],0U);
+	readFrame(0);
+	}
+
+unsigned int WaterStatePlayer::findFrame(double time) const
+	{
+	/* Find the last frame whose time stamp is not after the given time by binary search: */
+	unsigned int l=0;
+	unsigned int r=frames.size();
+	while(r-l>1)
+		{
+		unsigned int m=(l+r)>>1;
+		if(frames[m].time<=time)
+			l=m;
+		else
+			r=m;
+		}
+	
+	return l;
+	}
+
+void WaterStatePlayer::seek(unsigned int frameIndex)
+	{
+	if(frameIndex>=frames.size())
+		frameIndex=frames.size()-1;
+	if(frameIndex==currentFrame)
+		return;
+	
+	/* Find the closest keyframe at or before the requested frame: */
+	unsigned int start=frameIndex;
+	while(!frames[start].keyframe)
+		--start;
+	
+	/* Continue from the current frame instead if it lies between the keyframe and the requested frame: */
+	if(currentFrame>=start&&currentFrame<frameIndex)
+		start=currentFrame+1;
+	
+	/* Apply all frames up to the requested one: */
+	for(unsigned int i=start;i<=frameIndex;++i)
+		readFrame(i);
+	currentFrame=frameIndex;
+	}
+
+void WaterStatePlayer::apply(const WaterTable2* waterTable,GLContextData& contextData) const
+	{
+	/* Replace the water table's bathymetry, then adapt the recorded water level to it: */
+	waterTable->updateBathymetry(getBathymetry(),contextData);
+	waterTable->setWaterLevel(getWater(),contextData);
+	}
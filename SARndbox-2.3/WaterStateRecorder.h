@@ -0,0 +1,184 @@
+/***********************************************************************
+WaterStateRecorder - Classes to record time series of a water table's
+bathymetry and water level grids to a seekable, delta-compressed binary
+file using asynchronous GPU readback and a background writer thread, and
+to play such recordings back into a water table.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef WATERSTATERECORDER_INCLUDED
+#define WATERSTATERECORDER_INCLUDED
+
+#include <deque>
+#include <vector>
+#include <Misc/SizedTypes.h>
+#include <IO/File.h>
+#include <IO/SeekableFile.h>
+#include <Threads/Thread.h>
+#include <Threads/MutexCond.h>
+#include <GL/gl.h>
+#include <GL/GLObject.h>
+
+/* Forward declarations: */
+class WaterTable2;
+
+class WaterStateRecorder:public GLObject
+	{
+	/* Embedded classes: */
+	private:
+	struct DataItem:public GLObject::DataItem
+		{
+		/* Elements: */
+		public:
+		bool haveAsyncReadback; // Flag whether grids can be read back asynchronously via pixel buffer objects
+		GLuint bufferObjects[2]; // Pixel buffer objects receiving the bathymetry and water level grids
+		bool readbackPending; // Flag whether the pixel buffer objects hold grids that have not been retrieved yet
+		double readbackTime; // Time stamp of the grids in the pixel buffer objects
+		
+		/* Constructors and destructors: */
+		DataItem(void);
+		virtual ~DataItem(void);
+		};
+	
+	struct Frame // Structure holding a pair of grids read back from the water table
+		{
+		/* Elements: */
+		public:
+		double time; // Time stamp of the grids
+		std::vector<GLfloat> bathymetry; // Vertex-centered bathymetry grid
+		std::vector<GLfloat> water; // Cell-centered water level grid
+		};
+	
+	/* Elements: */
+	const WaterTable2* waterTable; // The recorded water table
+	GLsizei bathymetrySize[2]; // Width and height of the bathymetry grid
+	GLsizei waterSize[2]; // Width and height of the water level grid
+	double captureInterval; // Time between captured frames
+	unsigned int keyframeInterval; // Number of frames between self-contained keyframes
+	mutable const GLContextData* captureContext; // The OpenGL context in which grids are captured
+	mutable double nextCaptureTime; // Time at or after which to capture the next frame
+	mutable unsigned int numDroppedFrames; // Number of frames dropped because the writer thread fell behind
+	
+	IO::FilePtr file; // The recording file
+	mutable Threads::MutexCond queueCond; // Condition variable protecting the frame queue and signaling new frames
+	mutable std::deque<Frame*> frameQueue; // Queue of frames waiting to be written
+	mutable std::vector<Frame*> freeFrames; // Pool of frames available for capturing
+	unsigned int maxQueuedFrames; // Maximum number of frames waiting to be written before new frames are dropped
+	volatile bool runWriterThread; // Flag to keep the background writer thread running
+	Threads::Thread writerThread; // The background writer thread
+	
+	std::vector<Misc::UInt32> previousBathymetry; // Bit patterns of the most recently written bathymetry grid
+	std::vector<Misc::UInt32> previousWater; // Bit patterns of the most recently written water level grid
+	std::vector<Misc::UInt32> encodeBuffer; // Buffer holding the encoded payload of the frame being written
+	unsigned int numWrittenFrames; // Number of frames written to the file
+	
+	/* Private methods: */
+	Frame* getFreeFrame(void) const; // Returns a frame from the pool, or null if the writer thread is too far behind
+	void releaseFrame(Frame* frame) const; // Returns the given frame to the pool
+	void postFrame(Frame* frame) const; // Hands a captured frame to the writer thread
+	void encodeGrid(const GLfloat* grid,std::vector<Misc::UInt32>& previous,bool keyframe); // Appends the delta-compressed given grid to the encode buffer
+	void writeFrame(const Frame& frame); // Writes the given frame to the file
+	void* writerThreadMethod(void); // Method for the background writer thread
+	
+	/* Constructors and destructors: */
+	public:
+	WaterStateRecorder(const WaterTable2* sWaterTable,const char* fileName,double sCaptureInterval,unsigned int sKeyframeInterval); // Creates a recorder writing to the given file
+	private:
+	WaterStateRecorder(const WaterStateRecorder& source); // Prohibit copy constructor
+	WaterStateRecorder& operator=(const WaterStateRecorder& source); // Prohibit assignment operator
+	public:
+	virtual ~WaterStateRecorder(void); // Writes all pending frames and closes the recording file
+	
+	/* Methods from GLObject: */
+	virtual void initContext(GLContextData& contextData) const;
+	
+	/* New methods: */
+	void capture(double time,GLContextData& contextData) const; // Retrieves the grids read back during a previous call and starts reading back the water table's current grids if the capture interval has elapsed; only acts in the first OpenGL context from which it is called
+	unsigned int getNumDroppedFrames(void) const // Returns the number of frames dropped so far
+		{
+		return numDroppedFrames;
+		}
+	};
+
+class WaterStatePlayer
+	{
+	/* Embedded classes: */
+	private:
+	struct FrameIndex // Structure to locate a frame in the recording file
+		{
+		/* Elements: */
+		public:
+		IO::SeekableFile::Offset offset; // Position of the frame's payload in the file
+		double time; // Time stamp of the frame
+		bool keyframe; // Flag whether the frame is self-contained
+		size_t payloadSize; // Number of 32-bit words in the frame's payload
+		};
+	
+	/* Elements: */
+	IO::SeekableFilePtr file; // The recording file
+	GLsizei bathymetrySize[2]; // Width and height of the bathymetry grid
+	GLsizei waterSize[2]; // Width and height of the water level grid
+	std::vector<FrameIndex> frames; // Index of all complete frames in the file
+	unsigned int currentFrame; // Index of the frame currently held in the grid buffers
+	std::vector<Misc::UInt32> bathymetry; // Bit patterns of the current frame's bathymetry grid
+	std::vector<Misc::UInt32> water; // Bit patterns of the current frame's water level grid
+	std::vector<Misc::UInt32> decodeBuffer; // Buffer holding the encoded payload of the frame being read
+	
+	/* Private methods: */
+	void readFrame(unsigned int frameIndex); // Applies the given frame's payload to the grid buffers
+	
+	/* Constructors and destructors: */
+	public:
+	WaterStatePlayer(const char* fileName); // Opens the given recording file and indexes its frames
+	
+	/* Methods: */
+	GLsizei getBathymetrySize(int index) const // Returns the width or height of the bathymetry grid
+		{
+		return bathymetrySize[index];
+		}
+	GLsizei getWaterSize(int index) const // Returns the width or height of the water level grid
+		{
+		return waterSize[index];
+		}
+	unsigned int getNumFrames(void) const // Returns the number of recorded frames
+		{
+		return frames.size();
+		}
+	double getFrameTime(unsigned int frameIndex) const // Returns the time stamp of the given frame
+		{
+		return frames[frameIndex].time;
+		}
+	unsigned int findFrame(double time) const; // Returns the index of the last frame recorded at or before the given time, or the first frame
+	void seek(unsigned int frameIndex); // Decodes the given frame into the grid buffers
+	unsigned int getCurrentFrame(void) const // Returns the index of the currently decoded frame
+		{
+		return currentFrame;
+		}
+	const GLfloat* getBathymetry(void) const // Returns the current frame's bathymetry grid
+		{
+		return reinterpret_cast<const GLfloat*>(&bathymetry.front());
+		}
+	const GLfloat* getWater(void) const // Returns the current frame's water level grid
+		{
+		return reinterpret_cast<const GLfloat*>(&water.front());
+		}
+	void apply(const WaterTable2* waterTable,GLContextData& contextData) const; // Replaces the given water table's bathymetry and water level with the current frame's grids
+	};
+
+#endif
@@ -0,0 +1,272 @@
+/***********************************************************************
+WaterStepScheduler - Class to decide how many water simulation steps to
+run per frame from the measured GPU cost of previous steps, carrying
+unsimulated time over between frames and adapting a per-frame time
+budget to hold a target frame rate.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "WaterStepScheduler.h"
+
+#include <Math/Math.h>
+#include <GL/GLContextData.h>
+#include <GL/GLExtensionManager.h>
+
+/* Constants from GL_ARB_timer_query and OpenGL 1.5 in case the system headers predate them: */
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+
+namespace {
+
+/***********************************
+Controller parameters of the budget:
+***********************************/
+
+const double stepCostWeight=0.2; // Weight of a new measurement in the running average of step costs
+const double frameTimeTolerance=1.05; // Factor by which the frame time may exceed the target before the budget shrinks
+const double minBudgetFactor=0.5; // Smallest factor by which the budget shrinks in a single frame
+const double budgetIncrease=0.02; // Amount by which the budget grows per frame while the simulation falls behind, as a fraction of the target frame time
+
+}
+
+/*********************************************
+Methods of class WaterStepScheduler::DataItem:
+*********************************************/
+
+WaterStepScheduler::DataItem::DataItem(void)
+	:haveTimerQuery(false),
+	 glGenQueriesProc(0),glDeleteQueriesProc(0),glBeginQueryProc(0),glEndQueryProc(0),
+	 glGetQueryObjectivProc(0),glGetQueryObjectui64vProc(0),
+	 firstPendingQuery(0),numPendingQueries(0),queryActive(false)
+	{
+	/* Check for timer queries, which are core in OpenGL 3.3 and exposed by two extensions before that: */
+	bool arb=GLExtensionManager::isExtensionSupported("GL_ARB_timer_query");
+	if(arb||GLExtensionManager::isExtensionSupported("GL_EXT_timer_query"))
+		{
+		/* Get the query object entry points from OpenGL 1.5: */
+		glGenQueriesProc=GLExtensionManager::getFunction<GenQueriesProc>("glGenQueries");
+		glDeleteQueriesProc=GLExtensionManager::getFunction<DeleteQueriesProc>("glDeleteQueries");
+		glBeginQueryProc=GLExtensionManager::getFunction<BeginQueryProc>("glBeginQuery");
+		glEndQueryProc=GLExtensionManager::getFunction<EndQueryProc>("glEndQuery");
+		glGetQueryObjectivProc=GLExtensionManager::getFunction<GetQueryObjectivProc>("glGetQueryObjectiv");
+		glGetQueryObjectui64vProc=GLExtensionManager::getFunction<GetQueryObjectui64vProc>(arb?"glGetQueryObjectui64v":"glGetQueryObjectui64vEXT");
+		haveTimerQuery=glGenQueriesProc!=0&&glDeleteQueriesProc!=0&&glBeginQueryProc!=0&&glEndQueryProc!=0&&glGetQueryObjectivProc!=0&&glGetQueryObjectui64vProc!=0;
+		}
+	
+	if(haveTimerQuery)
+		glGenQueriesProc(numQueries,queryObjects);
+	for(unsigned int i=0;i<numQueries;++i)
+		{
+		if(!haveTimerQuery)
+			queryObjects[i]=0;
+		queryNumSteps[i]=0;
+		}
+	}
+
+WaterStepScheduler::DataItem::~DataItem(void)
+	{
+	if(haveTimerQuery)
+		glDeleteQueriesProc(numQueries,queryObjects);
+	}
+
+/***********************************
+Methods of class WaterStepScheduler:
+***********************************/
+
+const unsigned int WaterStepScheduler::numQueries;
+
+void WaterStepScheduler::addMeasurement(WaterStepScheduler::SimulationState& state,double elapsedTime,unsigned int numSteps)
+	{
+	/* Ignore frames that did not run any steps: */
+	if(numSteps==0)
+		return;
+	
+	/* Fold the measured cost per step into the running average: */
+	double stepCost=elapsedTime/double(numSteps);
+	if(state.stepCost<0.0)
+		state.stepCost=stepCost;
+	else
+		state.stepCost+=(stepCost-state.stepCost)*stepCostWeight;
+	}
+
+void WaterStepScheduler::readQueries(WaterStepScheduler::DataItem* dataItem,WaterStepScheduler::SimulationState& state) const
+	{
+	/* Read finished timer queries in the order in which they were issued: */
+	while(dataItem->numPendingQueries>0)
+		{
+		GLuint query=dataItem->queryObjects[dataItem->firstPendingQuery];
+		GLint available=0;
+		dataItem->glGetQueryObjectivProc(query,GL_QUERY_RESULT_AVAILABLE,&available);
+		if(!available)
+			break;
+		
+		Misc::UInt64 elapsedNs=0;
+		dataItem->glGetQueryObjectui64vProc(query,GL_QUERY_RESULT,&elapsedNs);
+		addMeasurement(state,double(elapsedNs)*1.0e-9,dataItem->queryNumSteps[dataItem->firstPendingQuery]);
+		
+		dataItem->firstPendingQuery=(dataItem->firstPendingQuery+1)%numQueries;
+		--dataItem->numPendingQueries;
+		}
+	}
+
+WaterStepScheduler::WaterStepScheduler(void)
+	:targetFrameTime(0.0),maxNumSteps(30),maxBacklog(4.0),shared(false)
+	{
+	statistics.gpuTimed=false;
+	statistics.stepCost=-1.0;
+	statistics.budget=-1.0;
+	statistics.maxNumSteps=maxNumSteps;
+	statistics.backlog=0.0;
+	statistics.droppedTime=0.0;
+	}
+
+void WaterStepScheduler::initContext(GLContextData& contextData) const
+	{
+	DataItem* dataItem=new DataItem;
+	contextData.addDataItem(this,dataItem);
+	}
+
+void WaterStepScheduler::setTargetFrameRate(double newTargetFrameRate)
+	{
+	targetFrameTime=newTargetFrameRate>0.0?1.0/newTargetFrameRate:0.0;
+	}
+
+void WaterStepScheduler::setMaxNumSteps(unsigned int newMaxNumSteps)
+	{
+	maxNumSteps=newMaxNumSteps;
+	}
+
+void WaterStepScheduler::setMaxBacklog(double newMaxBacklog)
+	{
+	maxBacklog=newMaxBacklog>0.0?newMaxBacklog:0.0;
+	}
+
+void WaterStepScheduler::setShared(bool newShared)
+	{
+	shared=newShared;
+	}
+
+unsigned int WaterStepScheduler::startSteps(GLfloat newTime,double frameTime,GLfloat& totalTimeStep,GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	
+	/* Lock and get the scheduling state of the simulation run in this context: */
+	Threads::Mutex::Lock stateLock(stateMutex);
+	SimulationState& state=getState(dataItem);
+	
+	/* Collect the results of previous frames' timer queries that the GPU has finished by now: */
+	if(dataItem->haveTimerQuery)
+		readQueries(dataItem,state);
+	
+	state.maxNumSteps=maxNumSteps;
+	if(targetFrameTime>0.0&&state.stepCost>0.0)
+		{
+		/* Start from the fixed step limit the first time a step cost is known: */
+		if(state.budget<0.0)
+			state.budget=double(maxNumSteps)*state.stepCost;
+		
+		if(frameTime>targetFrameTime*frameTimeTolerance)
+			{
+			/* Shrink the budget in proportion to how far the previous frame missed the target: */
+			double factor=targetFrameTime/frameTime;
+			state.budget*=factor>minBudgetFactor?factor:minBudgetFactor;
+			}
+		else if(frameTime>0.0&&state.stepLimited)
+			{
+			/* The target was met, but the simulation fell behind; probe for a larger budget: */
+			state.budget+=targetFrameTime*budgetIncrease;
+			}
+		
+		/* Keep the budget between a single step and the entire frame: */
+		state.budget=Math::clamp(state.budget,state.stepCost,targetFrameTime);
+		
+		/* Convert the budget to a number of steps, running at least one step per frame: */
+		double budgetSteps=Math::floor(state.budget/state.stepCost);
+		if(budgetSteps<double(maxNumSteps))
+			state.maxNumSteps=budgetSteps>1.0?(unsigned int)(budgetSteps):1U;
+		}
+	
+	/* Add the backlog of previous frames to the new simulation time: */
+	state.newTime=newTime;
+	totalTimeStep=newTime+state.backlog;
+	
+	if(dataItem->haveTimerQuery)
+		{
+		/* Start a timer query unless all query objects are still in flight: */
+		if(dataItem->numPendingQueries<numQueries)
+			{
+			dataItem->glBeginQueryProc(GL_TIME_ELAPSED,dataItem->queryObjects[(dataItem->firstPendingQuery+dataItem->numPendingQueries)%numQueries]);
+			dataItem->queryActive=true;
+			}
+		}
+	else
+		{
+		/* Fall back to wall-clock time, which only measures command submission if the steps do not read results back from the GPU: */
+		dataItem->stepsStartTime.set();
+		}
+	
+	return state.maxNumSteps;
+	}
+
+void WaterStepScheduler::finishSteps(unsigned int numSteps,GLfloat unsimulatedTime,GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	
+	if(dataItem->queryActive)
+		{
+		/* Finish the timer query; its result will be read during a later frame: */
+		dataItem->glEndQueryProc(GL_TIME_ELAPSED);
+		dataItem->queryNumSteps[(dataItem->firstPendingQuery+dataItem->numPendingQueries)%numQueries]=numSteps;
+		++dataItem->numPendingQueries;
+		dataItem->queryActive=false;
+		}
+	
+	/* Lock and get the scheduling state of the simulation run in this context: */
+	Threads::Mutex::Lock stateLock(stateMutex);
+	SimulationState& state=getState(dataItem);
+	
+	if(!dataItem->haveTimerQuery)
+		addMeasurement(state,double(Realtime::TimePointMonotonic()-dataItem->stepsStartTime),numSteps);
+	
+	/* Carry the unsimulated time over into the next frame, but drop whatever exceeds the backlog limit: */
+	state.stepLimited=unsimulatedTime>1.0e-8f;
+	GLfloat maxBacklogTime=GLfloat(maxBacklog)*state.newTime;
+	if(unsimulatedTime>maxBacklogTime)
+		{
+		statistics.droppedTime+=double(unsimulatedTime-maxBacklogTime);
+		unsimulatedTime=maxBacklogTime;
+		}
+	state.backlog=unsimulatedTime>0.0f?unsimulatedTime:0.0f;
+	
+	/* Report the state of the simulation: */
+	statistics.gpuTimed=dataItem->haveTimerQuery;
+	statistics.stepCost=state.stepCost;
+	statistics.budget=targetFrameTime>0.0&&state.stepCost>0.0?state.budget:-1.0;
+	statistics.maxNumSteps=state.maxNumSteps;
+	statistics.backlog=state.backlog;
+	}
@@ -0,0 +1,143 @@
+/***********************************************************************
+WaterStepScheduler - Class to decide how many water simulation steps to
+run per frame from the measured GPU cost of previous steps, carrying
+unsimulated time over between frames and adapting a per-frame time
+budget to hold a target frame rate.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#ifndef WATERSTEPSCHEDULER_INCLUDED
+#define WATERSTEPSCHEDULER_INCLUDED
+
+#include <Misc/SizedTypes.h>
+#include <Realtime/Time.h>
+#include <Threads/Mutex.h>
+#include <GL/gl.h>
+#include <GL/GLObject.h>
+
+/* Forward declarations: */
+class GLContextData;
+
+class WaterStepScheduler:public GLObject
+	{
+	/* Embedded classes: */
+	public:
+	struct Statistics // Structure reporting the scheduler's state after the most recent frame
+		{
+		/* Elements: */
+		public:
+		bool gpuTimed; // Flag whether step costs are measured with GPU timer queries instead of CPU wall-clock time
+		double stepCost; // Average time of a single simulation step in seconds, or negative if not measured yet
+		double budget; // Time allotted to the water simulation per frame in seconds, or negative if not adapting
+		unsigned int maxNumSteps; // Number of steps the most recent frame was allowed to run
+		double backlog; // Simulation time carried over into the next frame
+		double droppedTime; // Total simulation time dropped because the backlog exceeded its limit
+		};
+	
+	private:
+	typedef void (APIENTRY* GenQueriesProc)(GLsizei n,GLuint* ids);
+	typedef void (APIENTRY* DeleteQueriesProc)(GLsizei n,const GLuint* ids);
+	typedef void (APIENTRY* BeginQueryProc)(GLenum target,GLuint id);
+	typedef void (APIENTRY* EndQueryProc)(GLenum target);
+	typedef void (APIENTRY* GetQueryObjectivProc)(GLuint id,GLenum pname,GLint* params);
+	typedef void (APIENTRY* GetQueryObjectui64vProc)(GLuint id,GLenum pname,Misc::UInt64* params);
+	
+	static const unsigned int numQueries=4; // Number of timer queries that can be in flight at the same time
+	
+	struct SimulationState // Structure holding the scheduling state of one water simulation, shared by all OpenGL contexts if they share the simulation
+		{
+		/* Elements: */
+		public:
+		double stepCost; // Running average of the time of a single simulation step in seconds, or negative if not measured yet
+		double budget; // Time allotted to the water simulation per frame in seconds, or negative if not initialized yet
+		GLfloat newTime; // Simulation time newly added in the current frame
+		GLfloat backlog; // Simulation time carried over from the previous frame
+		bool stepLimited; // Flag whether the previous frame ran out of steps before simulating all of its time
+		unsigned int maxNumSteps; // Number of steps the current frame is allowed to run
+		
+		/* Constructors and destructors: */
+		SimulationState(void)
+			:stepCost(-1.0),budget(-1.0),newTime(0.0f),backlog(0.0f),stepLimited(false),maxNumSteps(0)
+			{
+			}
+		};
+	
+	struct DataItem:public GLObject::DataItem
+		{
+		/* Elements: */
+		public:
+		bool haveTimerQuery; // Flag whether the OpenGL context supports timer queries
+		GenQueriesProc glGenQueriesProc;
+		DeleteQueriesProc glDeleteQueriesProc;
+		BeginQueryProc glBeginQueryProc;
+		EndQueryProc glEndQueryProc;
+		GetQueryObjectivProc glGetQueryObjectivProc;
+		GetQueryObjectui64vProc glGetQueryObjectui64vProc;
+		GLuint queryObjects[numQueries]; // Ring buffer of timer query objects
+		unsigned int queryNumSteps[numQueries]; // Number of simulation steps measured by each timer query
+		unsigned int firstPendingQuery; // Index of the oldest timer query whose result has not been read yet
+		unsigned int numPendingQueries; // Number of timer queries whose results have not been read yet
+		bool queryActive; // Flag whether a timer query was started for the current frame
+		Realtime::TimePointMonotonic stepsStartTime; // Wall-clock time at which the current frame's steps started, used without timer queries
+		SimulationState state; // Scheduling state of this OpenGL context's own water simulation if contexts do not share the simulation
+		
+		/* Constructors and destructors: */
+		DataItem(void);
+		virtual ~DataItem(void);
+		};
+	
+	/* Elements: */
+	double targetFrameTime; // Frame time to be held by adapting the water simulation's time budget, or zero to always allow the maximum number of steps
+	unsigned int maxNumSteps; // Hard limit on the number of simulation steps per frame
+	double maxBacklog; // Maximum simulation time carried over between frames, in multiples of the time added per frame
+	bool shared; // Flag whether all OpenGL contexts share a single water simulation, run by whichever context claims each frame
+	mutable Threads::Mutex stateMutex; // Mutex protecting the shared scheduling state and the statistics
+	mutable SimulationState sharedState; // Scheduling state of the water simulation shared by all OpenGL contexts
+	mutable Statistics statistics; // The scheduler's state after the most recent frame in any OpenGL context
+	
+	/* Private methods: */
+	SimulationState& getState(DataItem* dataItem) const // Returns the scheduling state of the water simulation run in the given OpenGL context
+		{
+		return shared?sharedState:dataItem->state;
+		}
+	static void addMeasurement(SimulationState& state,double elapsedTime,unsigned int numSteps); // Folds the measured time of the given number of steps into the step cost average
+	void readQueries(DataItem* dataItem,SimulationState& state) const; // Reads the results of all finished timer queries without blocking
+	
+	/* Constructors and destructors: */
+	public:
+	WaterStepScheduler(void); // Creates a scheduler that does not adapt to a target frame rate
+	
+	/* Methods from GLObject: */
+	virtual void initContext(GLContextData& contextData) const;
+	
+	/* New methods: */
+	void setTargetFrameRate(double newTargetFrameRate); // Sets the frame rate to be held; zero disables adaptation
+	void setMaxNumSteps(unsigned int newMaxNumSteps); // Sets the hard limit on the number of simulation steps per frame
+	void setMaxBacklog(double newMaxBacklog); // Sets the maximum simulation time carried over between frames, in multiples of the time added per frame
+	void setShared(bool newShared); // Sets whether all OpenGL contexts share a single water simulation; must be called before any frames are simulated
+	unsigned int startSteps(GLfloat newTime,double frameTime,GLfloat& totalTimeStep,GLContextData& contextData) const; // Starts the current frame's simulation steps, given the simulation time to add and the duration of the previous frame; returns the total time step to simulate including the backlog, and the number of steps allowed to simulate it
+	void finishSteps(unsigned int numSteps,GLfloat unsimulatedTime,GLContextData& contextData) const; // Finishes the current frame's simulation steps after running the given number of steps; carries the given unsimulated time over into the next frame
+	Statistics getStatistics(void) const // Returns the scheduler's state after the most recent frame
+		{
+		Threads::Mutex::Lock stateLock(stateMutex);
+		return statistics;
+		}
+	};
+
+#endif
@@ -26,7 +26,10 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <stdarg.h>
 #include <stdio.h>
 #include <string>
+#include <vector>
+#include <Misc/Timer.h>
 #include <Math/Math.h>
+#include <Math/Constants.h>
 #include <Geometry/AffineCombiner.h>
 #include <Geometry/Vector.h>
 #include <GL/gl.h>
@@ -37,23 +40,38 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <GL/Extensions/GLARBTextureFloat.h>
 #include <GL/Extensions/GLARBTextureRectangle.h>
 #include <GL/Extensions/GLARBTextureRg.h>
+#include <GL/Extensions/GLARBVertexBufferObject.h>
 #include <GL/Extensions/GLARBVertexShader.h>
 #include <GL/Extensions/GLEXTFramebufferObject.h>
+#include <GL/GLExtensionManager.h>
 #include <GL/GLContextData.h>
 #include <GL/GLTransformationWrappers.h>
 
 #include "DepthImageRenderer.h"
 #include "ShaderHelper.h"
+#include "CPUWaterSolver.h"
 
 // DEBUGGING
 // #include <iostream>
 
+#ifndef GL_PIXEL_PACK_BUFFER_ARB
+#define GL_PIXEL_PACK_BUFFER_ARB 0x88EB
+#endif
+
 namespace {
 
 /****************
 Helper functions:
 ****************/
 
+GLhandleARB linkGridShader(const char* vertexShaderSource,const char* fragmentShaderFileName)
+	{
+	/* Link the given pixel-space vertex shader with a fragment shader from the SARndbox's shader directory: */
+	std::vector<std::string> vertexShaderSources(1,std::string(vertexShaderSource));
+	std::vector<std::string> fragmentShaderSources(1,readFragmentShaderSource(fragmentShaderFileName));
+	return linkShaderFromSources(vertexShaderSources,fragmentShaderSources);
+	}
+
 GLfloat* makeBuffer(int width,int height,int numComponents,...)
 	{
 	va_list ap;
@@ -81,17 +99,27 @@ Methods of class WaterTable2::DataItem:
 
 WaterTable2::DataItem::DataItem(void)
 	:currentBathymetry(0),bathymetryVersion(0),currentQuantity(0),
-	 derivativeTextureObject(0),waterTextureObject(0),
-	 bathymetryFramebufferObject(0),derivativeFramebufferObject(0),maxStepSizeFramebufferObject(0),integrationFramebufferObject(0),waterFramebufferObject(0),
-	 bathymetryShader(0),waterAdaptShader(0),derivativeShader(0),maxStepSizeShader(0),boundaryShader(0),eulerStepShader(0),rungeKuttaStepShader(0),waterAddShader(0),waterShader(0)
+	 derivativeTextureObject(0),waterTextureObject(0),currentStepSize(0),
+	 bathymetryFramebufferObject(0),derivativeFramebufferObject(0),maxStepSizeFramebufferObject(0),integrationFramebufferObject(0),waterFramebufferObject(0),stepSizeFramebufferObject(0),
+	 bathymetryShader(0),waterAdaptShader(0),derivativeShader(0),maxStepSizeShader(0),stepSizeShader(0),boundaryShader(0),eulerStepShader(0),rungeKuttaStepShader(0),waterAddShader(0),waterShader(0),
+	 cpuSolver(0),cpuSolverVersion(0),
+	 haveStepSizeReadback(false),stepSizeBufferObject(0),stepSizeReadbackPending(false),
+	 lastStableStepSize(0.0f),lastUnsimulatedTime(0.0f),
+	 wetTileTextureObject(0),wetTileFramebufferObject(0),wetTileShader(0),quantityCopyShader(0),
+	 wetTileSize(0),wetTileBufferObject(0),wetTileReadbackPending(false),haveActiveTiles(false),numActiveTiles(0),
+	 cullPasses(false)
 	{
 	for(int i=0;i<2;++i)
 		{
 		bathymetryTextureObjects[i]=0;
 		maxStepSizeTextureObjects[i]=0;
+		stepSizeTextureObjects[i]=0;
+		transferBuffers[i]=0;
 		}
 	for(int i=0;i<3;++i)
 		quantityTextureObjects[i]=0;
+	for(int i=0;i<2;++i)
+		numWetTiles[i]=0;
 	
 	/* Initialize all required OpenGL extensions: */
 	GLARBDrawBuffers::initExtension();
@@ -103,6 +131,11 @@ WaterTable2::DataItem::DataItem(void)
 	GLARBTextureRg::initExtension();
 	GLARBVertexShader::initExtension();
 	GLEXTFramebufferObject::initExtension();
+	
+	/* Initialize the optional extensions to read back the step size state asynchronously: */
+	haveStepSizeReadback=GLARBVertexBufferObject::isSupported()&&GLExtensionManager::isExtensionSupported("GL_ARB_pixel_buffer_object");
+	if(haveStepSizeReadback)
+		GLARBVertexBufferObject::initExtension();
 	}
 
 WaterTable2::DataItem::~DataItem(void)
@@ -113,20 +146,55 @@ WaterTable2::DataItem::~DataItem(void)
 	glDeleteTextures(1,&derivativeTextureObject);
 	glDeleteTextures(2,maxStepSizeTextureObjects);
 	glDeleteTextures(1,&waterTextureObject);
+	glDeleteTextures(2,stepSizeTextureObjects);
+	glDeleteTextures(1,&wetTileTextureObject);
 	glDeleteFramebuffersEXT(1,&bathymetryFramebufferObject);
 	glDeleteFramebuffersEXT(1,&derivativeFramebufferObject);
 	glDeleteFramebuffersEXT(1,&maxStepSizeFramebufferObject);
 	glDeleteFramebuffersEXT(1,&integrationFramebufferObject);
 	glDeleteFramebuffersEXT(1,&waterFramebufferObject);
+	glDeleteFramebuffersEXT(1,&stepSizeFramebufferObject);
+	glDeleteFramebuffersEXT(1,&wetTileFramebufferObject);
 	glDeleteObjectARB(bathymetryShader);
 	glDeleteObjectARB(waterAdaptShader);
 	glDeleteObjectARB(derivativeShader);
 	glDeleteObjectARB(maxStepSizeShader);
+	glDeleteObjectARB(stepSizeShader);
 	glDeleteObjectARB(boundaryShader);
 	glDeleteObjectARB(eulerStepShader);
 	glDeleteObjectARB(rungeKuttaStepShader);
 	glDeleteObjectARB(waterAddShader);
 	glDeleteObjectARB(waterShader);
+	glDeleteObjectARB(wetTileShader);
+	glDeleteObjectARB(quantityCopyShader);
+	if(haveStepSizeReadback)
+		{
+		glDeleteBuffersARB(1,&stepSizeBufferObject);
+		glDeleteBuffersARB(1,&wetTileBufferObject);
+		}
+	
+	/* Delete the CPU solver: */
+	delete cpuSolver;
+	for(int i=0;i<2;++i)
+		delete[] transferBuffers[i];
+	}
+
+/***********************************************
+Methods of class WaterTable2::BackendComparison:
+***********************************************/
+
+void WaterTable2::BackendComparison::reset(void)
+	{
+	numSteps=0;
+	gpuTime=0.0;
+	cpuTime=0.0;
+	maxStepSizeDifference=0.0f;
+	for(int i=0;i<3;++i)
+		{
+		maxQuantityDifference[i]=0.0f;
+		sumSqQuantityDifference[i]=0.0;
+		}
+	numQuantityValues=0.0;
 	}
 
 /****************************
@@ -221,13 +289,21 @@ GLfloat WaterTable2::calcDerivative(WaterTable2::DataItem* dataItem,GLuint quant
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,quantityTextureObject);
 	glUniform1iARB(dataItem->derivativeShaderUniformLocations[5],1);
 	
+	if(dataItem->cullPasses)
+		{
+		/* Reset the maximum step size texture so that culled tiles do not limit the step size: */
+		GLfloat currentClearColor[4];
+		glGetFloatv(GL_COLOR_CLEAR_VALUE,currentClearColor);
+		glDrawBuffer(GL_COLOR_ATTACHMENT1_EXT);
+		glClearColor(10000.0f,0.0f,0.0f,0.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		GLenum drawBuffers[2]={GL_COLOR_ATTACHMENT0_EXT,GL_COLOR_ATTACHMENT1_EXT};
+		glDrawBuffersARB(2,drawBuffers);
+		glClearColor(currentClearColor[0],currentClearColor[1],currentClearColor[2],currentClearColor[3]);
+		}
+	
 	/* Run the temporal derivative computation: */
-	glBegin(GL_QUADS);
-	glVertex2i(0,0);
-	glVertex2i(size[0],0);
-	glVertex2i(size[0],size[1]);
-	glVertex2i(0,size[1]);
-	glEnd();
+	drawActiveTiles(dataItem);
 	
 	/* Unbind unneeded textures: */
 	glActiveTextureARB(GL_TEXTURE1_ARB);
@@ -242,60 +318,84 @@ GLfloat WaterTable2::calcDerivative(WaterTable2::DataItem* dataItem,GLuint quant
 	
 	if(calcMaxStepSize)
 		{
-		/* Set up the maximum step size reduction shader: */
-		glUseProgramObjectARB(dataItem->maxStepSizeShader);
+		/* Reduce the maximum step size texture to a single pixel: */
+		int currentMaxStepSizeTexture=reduceMaxStepSize(dataItem);
+		
+		/* Read the final value written into the last reduced 1x1 frame buffer: */
+		glReadBuffer(GL_COLOR_ATTACHMENT0_EXT+currentMaxStepSizeTexture);
+		glReadPixels(0,0,1,1,GL_LUMINANCE,GL_FLOAT,&stepSize);
+		
+		/* Limit the step size to the client-specified range: */
+		stepSize=Math::min(stepSize,maxStepSize);
+		}
+	
+	return stepSize;
+	}
+
+int WaterTable2::reduceMaxStepSize(WaterTable2::DataItem* dataItem) const
+	{
+	/* Set up the maximum step size reduction shader: */
+	glUseProgramObjectARB(dataItem->maxStepSizeShader);
+	
+	/* Bind the maximum step size computation frame buffer: */
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->maxStepSizeFramebufferObject);
+	
+	/* Reduce the maximum step size texture in a sequence of half-reduction steps: */
+	int reducedWidth=size[0];
+	int reducedHeight=size[1];
+	int currentMaxStepSizeTexture=0;
+	while(reducedWidth>1||reducedHeight>1)
+		{
+		/* Set up the simulation frame buffer for maximum step size reduction: */
+		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-currentMaxStepSizeTexture));
+		
+		/* Reduce the viewport by a factor of two: */
+		glViewport(0,0,(reducedWidth+1)/2,(reducedHeight+1)/2);
+		glUniformARB(dataItem->maxStepSizeShaderUniformLocations[0],GLfloat(reducedWidth-1),GLfloat(reducedHeight-1));
 		
-		/* Bind the maximum step size computation frame buffer: */
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->maxStepSizeFramebufferObject);
+		/* Bind the current max step size texture: */
+		glActiveTextureARB(GL_TEXTURE0_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->maxStepSizeTextureObjects[currentMaxStepSizeTexture]);
+		glUniform1iARB(dataItem->maxStepSizeShaderUniformLocations[1],0);
 		
-		/* Reduce the maximum step size texture in a sequence of half-reduction steps: */
-		int reducedWidth=size[0];
-		int reducedHeight=size[1];
-		int currentMaxStepSizeTexture=0;
-		while(reducedWidth>1||reducedHeight>1)
+		/* Run the reduction step: */
+		if(dataItem->cullPasses&&reducedWidth==size[0]&&reducedHeight==size[1])
+			{
+			/* Only reduce the active tiles in the first step, extended to cover partially active reduced pixels: */
+			GLfloat currentClearColor[4];
+			glGetFloatv(GL_COLOR_CLEAR_VALUE,currentClearColor);
+			glClearColor(10000.0f,0.0f,0.0f,0.0f);
+			glClear(GL_COLOR_BUFFER_BIT);
+			glClearColor(currentClearColor[0],currentClearColor[1],currentClearColor[2],currentClearColor[3]);
+			drawActiveTiles(dataItem,1);
+			}
+		else
 			{
-			/* Set up the simulation frame buffer for maximum step size reduction: */
-			glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-currentMaxStepSizeTexture));
-			
-			/* Reduce the viewport by a factor of two: */
-			glViewport(0,0,(reducedWidth+1)/2,(reducedHeight+1)/2);
-			glUniformARB(dataItem->maxStepSizeShaderUniformLocations[0],GLfloat(reducedWidth-1),GLfloat(reducedHeight-1));
-			
-			/* Bind the current max step size texture: */
-			glActiveTextureARB(GL_TEXTURE0_ARB);
-			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->maxStepSizeTextureObjects[currentMaxStepSizeTexture]);
-			glUniform1iARB(dataItem->maxStepSizeShaderUniformLocations[1],0);
-			
-			/* Run the reduction step: */
 			glBegin(GL_QUADS);
 			glVertex2i(0,0);
 			glVertex2i(size[0],0);
 			glVertex2i(size[0],size[1]);
 			glVertex2i(0,size[1]);
 			glEnd();
-			
-			/* Go to the next step: */
-			reducedWidth=(reducedWidth+1)/2;
-			reducedHeight=(reducedHeight+1)/2;
-			currentMaxStepSizeTexture=1-currentMaxStepSizeTexture;
 			}
 		
-		/* Read the final value written into the last reduced 1x1 frame buffer: */
-		glReadBuffer(GL_COLOR_ATTACHMENT0_EXT+currentMaxStepSizeTexture);
-		glReadPixels(0,0,1,1,GL_LUMINANCE,GL_FLOAT,&stepSize);
-		
-		/* Limit the step size to the client-specified range: */
-		stepSize=Math::min(stepSize,maxStepSize);
+		/* Go to the next step: */
+		reducedWidth=(reducedWidth+1)/2;
+		reducedHeight=(reducedHeight+1)/2;
+		currentMaxStepSizeTexture=1-currentMaxStepSizeTexture;
 		}
 	
-	return stepSize;
+	return currentMaxStepSizeTexture;
 	}
 
 WaterTable2::WaterTable2(GLsizei width,GLsizei height,const GLfloat sCellSize[2])
 	:depthImageRenderer(0),
 	 baseTransform(ONTransform::identity),
 	 dryBoundary(true),
-	 readBathymetryRequest(0U),readBathymetryBuffer(0),readBathymetryReply(0U)
+	 readBathymetryRequest(0U),readBathymetryBuffer(0),readBathymetryReply(0U),
+	 simulationBackend(GPU_BACKEND),numCpuThreads(1),multiRateLevels(0),multiRateTileSize(32),compareBackends(false),backendVersion(1U),
+	 gpuStepSize(false),
+	 dryCullingTileSize(0),dryCullingThreshold(0.001f)
 	{
 	/* Initialize the water table size and cell size: */
 	size[0]=width;
@@ -327,7 +427,10 @@ WaterTable2::WaterTable2(GLsizei width,GLsizei height,const GLfloat sCellSize[2]
 WaterTable2::WaterTable2(GLsizei width,GLsizei height,const DepthImageRenderer* sDepthImageRenderer,const Point basePlaneCorners[4])
 	:depthImageRenderer(sDepthImageRenderer),
 	 dryBoundary(true),
-	 readBathymetryRequest(0U),readBathymetryBuffer(0),readBathymetryReply(0U)
+	 readBathymetryRequest(0U),readBathymetryBuffer(0),readBathymetryReply(0U),
+	 simulationBackend(GPU_BACKEND),numCpuThreads(1),multiRateLevels(0),multiRateTileSize(32),compareBackends(false),backendVersion(1U),
+	 gpuStepSize(false),
+	 dryCullingTileSize(0),dryCullingThreshold(0.001f)
 	{
 	/* Initialize the water table size: */
 	size[0]=width;
@@ -467,6 +570,31 @@ void WaterTable2::initContext(GLContextData& contextData) const
 	delete[] w;
 	}
 	
+	{
+	/* Create the 1x1 step size state textures: */
+	glGenTextures(2,dataItem->stepSizeTextureObjects);
+	GLfloat ss[4]={0.0f,1.0f,0.0f,0.0f};
+	for(int i=0;i<2;++i)
+		{
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->stepSizeTextureObjects[i]);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_S,GL_CLAMP);
+		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_T,GL_CLAMP);
+		glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_RGBA32F,1,1,0,GL_RGBA,GL_FLOAT,ss);
+		}
+	}
+	
+	{
+	/* Create the wet tile texture; its storage is allocated when dry tile culling is first used: */
+	glGenTextures(1,&dataItem->wetTileTextureObject);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->wetTileTextureObject);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_S,GL_CLAMP);
+	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB,GL_TEXTURE_WRAP_T,GL_CLAMP);
+	}
+	
 	/* Protect the newly-created textures: */
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
 	
@@ -534,6 +662,21 @@ void WaterTable2::initContext(GLContextData& contextData) const
 	glReadBuffer(GL_NONE);
 	}
 	
+	{
+	/* Create the step size state frame buffer: */
+	glGenFramebuffersEXT(1,&dataItem->stepSizeFramebufferObject);
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->stepSizeFramebufferObject);
+	
+	/* Attach the step size state textures to the step size state frame buffer: */
+	for(int i=0;i<2;++i)
+		glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,GL_COLOR_ATTACHMENT0_EXT+i,GL_TEXTURE_RECTANGLE_ARB,dataItem->stepSizeTextureObjects[i],0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	}
+	
+	/* Create the wet tile frame buffer; the wet tile texture is attached when its storage is allocated: */
+	glGenFramebuffersEXT(1,&dataItem->wetTileFramebufferObject);
+	
 	/* Restore the previously bound frame buffer: */
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,currentFrameBuffer);
 	
@@ -544,11 +687,7 @@ void WaterTable2::initContext(GLContextData& contextData) const
 	
 	/* Create the bathymetry update shader: */
 	{
-	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource);
-	GLhandleARB fragmentShader=compileFragmentShader("Water2BathymetryUpdateShader");
-	dataItem->bathymetryShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	dataItem->bathymetryShader=linkGridShader(vertexShaderSource,"Water2BathymetryUpdateShader");
 	dataItem->bathymetryShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->bathymetryShader,"oldBathymetrySampler");
 	dataItem->bathymetryShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->bathymetryShader,"newBathymetrySampler");
 	dataItem->bathymetryShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->bathymetryShader,"quantitySampler");
@@ -556,22 +695,14 @@ void WaterTable2::initContext(GLContextData& contextData) const
 	
 	/* Create the water adaptation shader: */
 	{
-	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource);
-	GLhandleARB fragmentShader=compileFragmentShader("Water2WaterAdaptShader");
-	dataItem->waterAdaptShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	dataItem->waterAdaptShader=linkGridShader(vertexShaderSource,"Water2WaterAdaptShader");
 	dataItem->waterAdaptShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->waterAdaptShader,"bathymetrySampler");
 	dataItem->waterAdaptShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->waterAdaptShader,"newQuantitySampler");
 	}
 	
 	/* Create the temporal derivative computation shader: */
 	{
-	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource);
-	GLhandleARB fragmentShader=compileFragmentShader("Water2SlopeAndFluxAndDerivativeShader");
-	dataItem->derivativeShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	dataItem->derivativeShader=linkGridShader(vertexShaderSource,"Water2SlopeAndFluxAndDerivativeShader");
 	dataItem->derivativeShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->derivativeShader,"cellSize");
 	dataItem->derivativeShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->derivativeShader,"theta");
 	dataItem->derivativeShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->derivativeShader,"g");
@@ -582,59 +713,46 @@ void WaterTable2::initContext(GLContextData& contextData) const
 	
 	/* Create the maximum step size gathering shader: */
 	{
-	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource);
-	GLhandleARB fragmentShader=compileFragmentShader("Water2MaxStepSizeShader");
-	dataItem->maxStepSizeShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	dataItem->maxStepSizeShader=linkGridShader(vertexShaderSource,"Water2MaxStepSizeShader");
 	dataItem->maxStepSizeShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->maxStepSizeShader,"fullTextureSize");
 	dataItem->maxStepSizeShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->maxStepSizeShader,"maxStepSizeSampler");
 	}
 	
+	/* Create the step size calculation shader: */
+	{
+	dataItem->stepSizeShader=linkGridShader(vertexShaderSource,"Water2StepSizeShader");
+	dataItem->stepSizeShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->stepSizeShader,"maxStepSize");
+	dataItem->stepSizeShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->stepSizeShader,"attenuation");
+	dataItem->stepSizeShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->stepSizeShader,"maxStepSizeSampler");
+	dataItem->stepSizeShaderUniformLocations[3]=glGetUniformLocationARB(dataItem->stepSizeShader,"stepSizeSampler");
+	}
+	
 	/* Create the boundary condition shader: */
 	{
-	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource);
-	GLhandleARB fragmentShader=compileFragmentShader("Water2BoundaryShader");
-	dataItem->boundaryShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	dataItem->boundaryShader=linkGridShader(vertexShaderSource,"Water2BoundaryShader");
 	dataItem->boundaryShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->boundaryShader,"bathymetrySampler");
 	}
 	
 	/* Create the Euler integration step shader: */
 	{
-	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource);
-	GLhandleARB fragmentShader=compileFragmentShader("Water2EulerStepShader");
-	dataItem->eulerStepShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
-	dataItem->eulerStepShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->eulerStepShader,"stepSize");
-	dataItem->eulerStepShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->eulerStepShader,"attenuation");
-	dataItem->eulerStepShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->eulerStepShader,"quantitySampler");
-	dataItem->eulerStepShaderUniformLocations[3]=glGetUniformLocationARB(dataItem->eulerStepShader,"derivativeSampler");
+	dataItem->eulerStepShader=linkGridShader(vertexShaderSource,"Water2EulerStepShader");
+	dataItem->eulerStepShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->eulerStepShader,"stepSizeSampler");
+	dataItem->eulerStepShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->eulerStepShader,"quantitySampler");
+	dataItem->eulerStepShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->eulerStepShader,"derivativeSampler");
 	}
 	
 	/* Create the Runge-Kutta integration step shader: */
 	{
-	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource);
-	GLhandleARB fragmentShader=compileFragmentShader("Water2RungeKuttaStepShader");
-	dataItem->rungeKuttaStepShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
-	dataItem->rungeKuttaStepShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->rungeKuttaStepShader,"stepSize");
-	dataItem->rungeKuttaStepShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->rungeKuttaStepShader,"attenuation");
-	dataItem->rungeKuttaStepShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->rungeKuttaStepShader,"quantitySampler");
-	dataItem->rungeKuttaStepShaderUniformLocations[3]=glGetUniformLocationARB(dataItem->rungeKuttaStepShader,"quantityStarSampler");
-	dataItem->rungeKuttaStepShaderUniformLocations[4]=glGetUniformLocationARB(dataItem->rungeKuttaStepShader,"derivativeSampler");
+	dataItem->rungeKuttaStepShader=linkGridShader(vertexShaderSource,"Water2RungeKuttaStepShader");
+	dataItem->rungeKuttaStepShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->rungeKuttaStepShader,"stepSizeSampler");
+	dataItem->rungeKuttaStepShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->rungeKuttaStepShader,"quantitySampler");
+	dataItem->rungeKuttaStepShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->rungeKuttaStepShader,"quantityStarSampler");
+	dataItem->rungeKuttaStepShaderUniformLocations[3]=glGetUniformLocationARB(dataItem->rungeKuttaStepShader,"derivativeSampler");
 	}
 	
 	/* Create the water adder rendering shader: */
 	{
-	GLhandleARB vertexShader=compileVertexShader("Water2WaterAddShader");
-	GLhandleARB fragmentShader=compileFragmentShader("Water2WaterAddShader");
-	dataItem->waterAddShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	dataItem->waterAddShader=linkVertexAndFragmentShader("Water2WaterAddShader");
 	dataItem->waterAddShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->waterAddShader,"pmv");
 	dataItem->waterAddShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->waterAddShader,"stepSize");
 	dataItem->waterAddShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->waterAddShader,"waterSampler");
@@ -642,15 +760,43 @@ void WaterTable2::initContext(GLContextData& contextData) const
 	
 	/* Create the water shader: */
 	{
-	GLhandleARB vertexShader=glCompileVertexShaderFromString(vertexShaderSource);
-	GLhandleARB fragmentShader=compileFragmentShader("Water2WaterUpdateShader");
-	dataItem->waterShader=glLinkShader(vertexShader,fragmentShader);
-	glDeleteObjectARB(vertexShader);
-	glDeleteObjectARB(fragmentShader);
+	dataItem->waterShader=linkGridShader(vertexShaderSource,"Water2WaterUpdateShader");
 	dataItem->waterShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->waterShader,"bathymetrySampler");
 	dataItem->waterShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->waterShader,"quantitySampler");
 	dataItem->waterShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->waterShader,"waterSampler");
+	dataItem->waterShaderUniformLocations[3]=glGetUniformLocationARB(dataItem->waterShader,"stepSizeSampler");
+	dataItem->waterShaderUniformLocations[4]=glGetUniformLocationARB(dataItem->waterShader,"waterTimeStep");
+	}
+	
+	/* Create the wet tile reduction shader: */
+	{
+	dataItem->wetTileShader=linkGridShader(vertexShaderSource,"Water2WetTileShader");
+	dataItem->wetTileShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->wetTileShader,"tileSize");
+	dataItem->wetTileShaderUniformLocations[1]=glGetUniformLocationARB(dataItem->wetTileShader,"gridSize");
+	dataItem->wetTileShaderUniformLocations[2]=glGetUniformLocationARB(dataItem->wetTileShader,"bathymetrySampler");
+	dataItem->wetTileShaderUniformLocations[3]=glGetUniformLocationARB(dataItem->wetTileShader,"quantity0Sampler");
+	dataItem->wetTileShaderUniformLocations[4]=glGetUniformLocationARB(dataItem->wetTileShader,"quantity1Sampler");
+	dataItem->wetTileShaderUniformLocations[5]=glGetUniformLocationARB(dataItem->wetTileShader,"quantity2Sampler");
+	dataItem->wetTileShaderUniformLocations[6]=glGetUniformLocationARB(dataItem->wetTileShader,"waterSampler");
+	}
+	
+	/* Create the quantity copy shader: */
+	{
+	dataItem->quantityCopyShader=linkGridShader(vertexShaderSource,"Water2QuantityCopyShader");
+	dataItem->quantityCopyShaderUniformLocations[0]=glGetUniformLocationARB(dataItem->quantityCopyShader,"quantitySampler");
 	}
+	
+	if(dataItem->haveStepSizeReadback)
+		{
+		/* Create a pixel buffer object to read back the step size state without stalling the pipeline: */
+		glGenBuffersARB(1,&dataItem->stepSizeBufferObject);
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,dataItem->stepSizeBufferObject);
+		glBufferDataARB(GL_PIXEL_PACK_BUFFER_ARB,4*sizeof(GLfloat),0,GL_STREAM_READ_ARB);
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+		
+		/* Create a pixel buffer object to read back the wet tile grid; its storage is allocated when dry tile culling is first used: */
+		glGenBuffersARB(1,&dataItem->wetTileBufferObject);
+		}
 	}
 
 void WaterTable2::setElevationRange(Scalar newMin,Scalar newMax)
@@ -701,85 +847,368 @@ void WaterTable2::setDryBoundary(bool newDryBoundary)
 	dryBoundary=newDryBoundary;
 	}
 
+const char* WaterTable2::getSimulationBackendName(WaterTable2::SimulationBackend backend)
+	{
+	switch(backend)
+		{
+		case GPU_BACKEND:
+			return "GPU";
+		
+		case CPU_BACKEND:
+			return "CPU";
+		
+		default:
+			return "Unknown";
+		}
+	}
+
+void WaterTable2::setSimulationBackend(WaterTable2::SimulationBackend newSimulationBackend,unsigned int newNumCpuThreads)
+	{
+	simulationBackend=newSimulationBackend;
+	numCpuThreads=newNumCpuThreads;
+	
+	/* Invalidate all per-context CPU solvers to re-synchronize them with the GPU state on the next simulation step: */
+	++backendVersion;
+	}
+
+void WaterTable2::setMultiRate(unsigned int newMultiRateLevels,unsigned int newMultiRateTileSize)
+	{
+	multiRateLevels=newMultiRateLevels;
+	multiRateTileSize=newMultiRateTileSize;
+	++backendVersion;
+	}
+
+void WaterTable2::setCompareBackends(bool newCompareBackends)
+	{
+	compareBackends=newCompareBackends;
+	++backendVersion;
+	}
+
+void WaterTable2::resetBackendComparison(void)
+	{
+	backendComparison.reset();
+	}
+
+void WaterTable2::setDryCulling(GLsizei newDryCullingTileSize,GLfloat newDryCullingThreshold)
+	{
+	/* Round the tile size up to an even number of cells to align tiles with the maximum step size reduction: */
+	dryCullingTileSize=newDryCullingTileSize>0?(newDryCullingTileSize+1)&~GLsizei(1):0;
+	dryCullingThreshold=newDryCullingThreshold;
+	}
+
+bool WaterTable2::calcBathymetryUpdateRegion(WaterTable2::DataItem* dataItem,GLint region[4]) const
+	{
+	/* Access the depth image and its tile grid: */
+	const unsigned int* diSize=depthImageRenderer->getDepthImageSize();
+	const float* depthImage=depthImageRenderer->getDepthImage().getData<float>();
+	unsigned int tileSize=depthImageRenderer->getTileSize();
+	const unsigned int* numTiles=depthImageRenderer->getNumTiles();
+	const unsigned int* tileVersions=depthImageRenderer->getTileVersions();
+	
+	/* Update the entire grid on the first update, or if the tile grid changed: */
+	bool fullUpdate=dataItem->bathymetryVersion==0||dataItem->bathymetryTileRanges.size()!=numTiles[1]*numTiles[0]*2;
+	if(fullUpdate)
+		dataItem->bathymetryTileRanges.resize(numTiles[1]*numTiles[0]*2);
+	
+	/* Calculate the transformation from depth image space into bathymetry grid clip space: */
+	PTransform dic=bathymetryPmv;
+	dic*=depthImageRenderer->getDepthProjection();
+	
+	/* Accumulate the bathymetry grid footprints of all changed tiles: */
+	Scalar min[2],max[2];
+	for(int i=0;i<2;++i)
+		{
+		min[i]=Math::Constants<Scalar>::max;
+		max[i]=-Math::Constants<Scalar>::max;
+		}
+	GLfloat* trPtr=&dataItem->bathymetryTileRanges.front();
+	const unsigned int* tvPtr=tileVersions;
+	for(unsigned int ty=0;ty<numTiles[1];++ty)
+		for(unsigned int tx=0;tx<numTiles[0];++tx,++tvPtr,trPtr+=2)
+			if(fullUpdate||*tvPtr>dataItem->bathymetryVersion)
+				{
+				/* Calculate the tile's depth range, including the neighboring pixels sharing triangles with the tile's pixels: */
+				unsigned int x0=tx*tileSize>0?tx*tileSize-1:0;
+				unsigned int x1=Math::min((tx+1)*tileSize+1,diSize[0]);
+				unsigned int y0=ty*tileSize>0?ty*tileSize-1:0;
+				unsigned int y1=Math::min((ty+1)*tileSize+1,diSize[1]);
+				GLfloat dMin=Math::Constants<GLfloat>::max;
+				GLfloat dMax=-Math::Constants<GLfloat>::max;
+				for(unsigned int y=y0;y<y1;++y)
+					{
+					const float* diRow=depthImage+y*diSize[0];
+					for(unsigned int x=x0;x<x1;++x)
+						{
+						if(dMin>diRow[x])
+							dMin=diRow[x];
+						if(dMax<diRow[x])
+							dMax=diRow[x];
+						}
+					}
+				
+				/* Cover both the previous and the new surface inside the tile: */
+				GLfloat newRange[2]={dMin,dMax};
+				if(!fullUpdate)
+					{
+					dMin=Math::min(dMin,trPtr[0]);
+					dMax=Math::max(dMax,trPtr[1]);
+					}
+				trPtr[0]=newRange[0];
+				trPtr[1]=newRange[1];
+				
+				if(!fullUpdate)
+					{
+					/* Add the projections of the corners of the tile's depth image-space bounding box to the footprint: */
+					for(int corner=0;corner<8;++corner)
+						{
+						Point c(Scalar((corner&0x1)?x1:x0),Scalar((corner&0x2)?y1:y0),Scalar((corner&0x4)?dMax:dMin));
+						Point cc=dic.transform(c);
+						for(int i=0;i<2;++i)
+							{
+							if(min[i]>cc[i])
+								min[i]=cc[i];
+							if(max[i]<cc[i])
+								max[i]=cc[i];
+							}
+						}
+					}
+				}
+	if(fullUpdate)
+		return false;
+	
+	/* Check if any tiles changed: */
+	if(min[0]>max[0])
+		{
+		region[2]=region[0];
+		region[3]=region[1];
+		return true;
+		}
+	
+	/* Convert the footprint from clip space to bathymetry grid pixels, with a safety margin of two pixels: */
+	for(int i=0;i<2;++i)
+		{
+		Scalar scale=Math::div2(Scalar(size[i]-1));
+		GLint rMin=GLint(Math::floor((min[i]+Scalar(1))*scale))-2;
+		GLint rMax=GLint(Math::ceil((max[i]+Scalar(1))*scale))+2;
+		region[i]=Math::max(rMin,0);
+		region[2+i]=Math::min(rMax,GLint(size[i]-1));
+		if(region[2+i]<region[i])
+			region[2+i]=region[i];
+		}
+	
+	/* Update the entire grid if the footprint covers most of it: */
+	return GLsizei(region[2]-region[0])*GLsizei(region[3]-region[1])*2<=(size[0]-1)*(size[1]-1);
+	}
+
+void WaterTable2::calcBathymetryUpdateRows(const WaterTable2::DataItem* dataItem,const GLint region[4],unsigned int rows[2]) const
+	{
+	/* Access the depth image's tile grid: */
+	const unsigned int* diSize=depthImageRenderer->getDepthImageSize();
+	unsigned int tileSize=depthImageRenderer->getTileSize();
+	const unsigned int* numTiles=depthImageRenderer->getNumTiles();
+	
+	/* Calculate the transformation from depth image space into bathymetry grid clip space: */
+	PTransform dic=bathymetryPmv;
+	dic*=depthImageRenderer->getDepthProjection();
+	
+	/* Check the conservative bounding box of each row of tiles against the update region: */
+	rows[0]=diSize[1];
+	rows[1]=0;
+	const GLfloat* trPtr=&dataItem->bathymetryTileRanges.front();
+	for(unsigned int ty=0;ty<numTiles[1];++ty)
+		{
+		/* Calculate the depth range of the tile row's current surface: */
+		GLfloat dMin=Math::Constants<GLfloat>::max;
+		GLfloat dMax=-Math::Constants<GLfloat>::max;
+		for(unsigned int tx=0;tx<numTiles[0];++tx,trPtr+=2)
+			{
+			if(dMin>trPtr[0])
+				dMin=trPtr[0];
+			if(dMax<trPtr[1])
+				dMax=trPtr[1];
+			}
+		
+		/* Calculate the tile row's range of depth image rows, including the row shared with the previous tile row: */
+		unsigned int y0=ty*tileSize>0?ty*tileSize-1:0;
+		unsigned int y1=Math::min((ty+1)*tileSize,diSize[1]);
+		
+		/* Project the corners of the tile row's depth image-space bounding box into the bathymetry grid: */
+		Scalar min[2],max[2];
+		for(int i=0;i<2;++i)
+			{
+			min[i]=Math::Constants<Scalar>::max;
+			max[i]=-Math::Constants<Scalar>::max;
+			}
+		for(int corner=0;corner<8;++corner)
+			{
+			Point c(Scalar((corner&0x1)?diSize[0]:0),Scalar((corner&0x2)?y1+1:y0),Scalar((corner&0x4)?dMax:dMin));
+			Point cc=dic.transform(c);
+			for(int i=0;i<2;++i)
+				{
+				if(min[i]>cc[i])
+					min[i]=cc[i];
+				if(max[i]<cc[i])
+					max[i]=cc[i];
+				}
+			}
+		
+		/* Add the tile row's depth image rows to the result if its footprint overlaps the region, with a safety margin of one pixel: */
+		bool overlaps=true;
+		for(int i=0;i<2;++i)
+			{
+			Scalar scale=Math::div2(Scalar(size[i]-1));
+			if((max[i]+Scalar(1))*scale<Scalar(region[i]-1)||(min[i]+Scalar(1))*scale>Scalar(region[2+i]+1))
+				overlaps=false;
+			}
+		if(overlaps)
+			{
+			rows[0]=Math::min(rows[0],y0);
+			rows[1]=Math::max(rows[1],y1);
+			}
+		}
+	}
+
 void WaterTable2::updateBathymetry(GLContextData& contextData) const
 	{
 	/* Get the data item: */
 	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
 	
+	/* Update the set of active tiles once per frame: */
+	updateWetTiles(dataItem);
+	
 	/* Check if the current bathymetry texture is outdated: */
 	if(dataItem->bathymetryVersion!=depthImageRenderer->getDepthImageVersion())
 		{
-		/* Save relevant OpenGL state: */
-		glPushAttrib(GL_VIEWPORT_BIT);
-		GLint currentFrameBuffer;
-		glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
-		GLfloat currentClearColor[4];
-		glGetFloatv(GL_COLOR_CLEAR_VALUE,currentClearColor);
-		
-		/* Bind the bathymetry rendering frame buffer and clear it: */
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->bathymetryFramebufferObject);
-		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentBathymetry));
-		glViewport(0,0,size[0]-1,size[1]-1);
-		glClearColor(GLfloat(domain.min[2]),0.0f,0.0f,1.0f);
-		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-		
-		/* Render the surface into the bathymetry grid: */
-		depthImageRenderer->renderElevation(bathymetryPmv,contextData);
-		
-		/* Set up the integration frame buffer to update the conserved quantities based on bathymetry changes: */
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
-		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentQuantity));
-		glViewport(0,0,size[0],size[1]);
-		
-		/* Set up the bathymetry update shader: */
-		glUseProgramObjectARB(dataItem->bathymetryShader);
-		glActiveTextureARB(GL_TEXTURE0_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
-		glUniform1iARB(dataItem->bathymetryShaderUniformLocations[0],0);
-		glActiveTextureARB(GL_TEXTURE1_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[1-dataItem->currentBathymetry]);
-		glUniform1iARB(dataItem->bathymetryShaderUniformLocations[1],1);
+		/* Find the region of the bathymetry grid affected by the depth image tiles that changed since the last update: */
+		GLint region[4];
+		bool incremental=calcBathymetryUpdateRegion(dataItem,region);
+		bool changed=!incremental||(region[2]>region[0]&&region[3]>region[1]);
 		
-		/* Check if the current bathymetry grid was requested: */
-		if(readBathymetryReply!=readBathymetryRequest)
+		if(changed)
 			{
-			/* Read back the bathymetry grid into the supplied buffer: */
-			glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,GL_RED,GL_FLOAT,readBathymetryBuffer);
+			/* Save relevant OpenGL state: */
+			glPushAttrib(GL_VIEWPORT_BIT|GL_SCISSOR_BIT);
+			GLint currentFrameBuffer;
+			glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
+			GLfloat currentClearColor[4];
+			glGetFloatv(GL_COLOR_CLEAR_VALUE,currentClearColor);
+			
+			/* Bind the bathymetry rendering frame buffer: */
+			glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->bathymetryFramebufferObject);
+			glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentBathymetry));
+			glViewport(0,0,size[0]-1,size[1]-1);
+			glClearColor(GLfloat(domain.min[2]),0.0f,0.0f,1.0f);
+			
+			/* Clear the affected region, or the entire bathymetry grid: */
+			if(incremental)
+				{
+				glEnable(GL_SCISSOR_TEST);
+				glScissor(region[0],region[1],region[2]-region[0],region[3]-region[1]);
+				}
+			glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+			
+			/* Render the surface into the bathymetry grid, skipping depth image rows that cannot reach the affected region: */
+			if(incremental)
+				{
+				unsigned int rows[2];
+				calcBathymetryUpdateRows(dataItem,region,rows);
+				depthImageRenderer->renderElevation(bathymetryPmv,rows[0],rows[1],contextData);
+				glDisable(GL_SCISSOR_TEST);
+				}
+			else
+				depthImageRenderer->renderElevation(bathymetryPmv,contextData);
+			
+			/* Set up the integration frame buffer to update the conserved quantities based on bathymetry changes; incremental updates go through the intermediate quantity texture: */
+			glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
+			glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(incremental?2:1-dataItem->currentQuantity));
+			glViewport(0,0,size[0],size[1]);
+			
+			/* Set up the bathymetry update shader: */
+			glUseProgramObjectARB(dataItem->bathymetryShader);
+			glActiveTextureARB(GL_TEXTURE0_ARB);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
+			glUniform1iARB(dataItem->bathymetryShaderUniformLocations[0],0);
+			glActiveTextureARB(GL_TEXTURE1_ARB);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[1-dataItem->currentBathymetry]);
+			glUniform1iARB(dataItem->bathymetryShaderUniformLocations[1],1);
+			glActiveTextureARB(GL_TEXTURE2_ARB);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+			glUniform1iARB(dataItem->bathymetryShaderUniformLocations[2],2);
+			
+			/* Run the bathymetry update on all cells whose four vertices lie in the affected region, or on the entire grid: */
+			GLint cells[4]={0,0,size[0],size[1]};
+			if(incremental)
+				{
+				cells[0]=region[0]+1;
+				cells[1]=region[1]+1;
+				cells[2]=region[2];
+				cells[3]=region[3];
+				}
+			glBegin(GL_QUADS);
+			glVertex2i(cells[0],cells[1]);
+			glVertex2i(cells[2],cells[1]);
+			glVertex2i(cells[2],cells[3]);
+			glVertex2i(cells[0],cells[3]);
+			glEnd();
+			
+			/* Unbind all shaders and textures: */
+			glUseProgramObjectARB(0);
+			glActiveTextureARB(GL_TEXTURE2_ARB);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+			glActiveTextureARB(GL_TEXTURE1_ARB);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+			glActiveTextureARB(GL_TEXTURE0_ARB);
+			
+			if(incremental)
+				{
+				/* Copy the updated cells back into the current conserved quantity texture: */
+				glReadBuffer(GL_COLOR_ATTACHMENT2_EXT);
+				glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+				glCopyTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,cells[0],cells[1],cells[0],cells[1],cells[2]-cells[0],cells[3]-cells[1]);
+				glReadBuffer(GL_NONE);
+				
+				/* Copy the re-rendered region back into the current bathymetry texture: */
+				glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->bathymetryFramebufferObject);
+				glReadBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentBathymetry));
+				glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
+				glCopyTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,region[0],region[1],region[0],region[1],region[2]-region[0],region[3]-region[1]);
+				glReadBuffer(GL_NONE);
+				}
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
 			
-			/* Finish the request: */
-			readBathymetryReply=readBathymetryRequest;
+			/* Restore OpenGL state: */
+			glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,currentFrameBuffer);
+			glClearColor(currentClearColor[0],currentClearColor[1],currentClearColor[2],currentClearColor[3]);
+			glPopAttrib();
+			
+			if(!incremental)
+				{
+				/* Update the bathymetry and quantity grids: */
+				dataItem->currentBathymetry=1-dataItem->currentBathymetry;
+				dataItem->currentQuantity=1-dataItem->currentQuantity;
+				}
+			
+			if(isCpuSolverCurrent(dataItem))
+				{
+				/* Apply the same bathymetry update to the CPU solver: */
+				readTexture(dataItem->bathymetryTextureObjects[dataItem->currentBathymetry],GL_RED,dataItem->transferBuffers[0]);
+				dataItem->cpuSolver->updateBathymetry(dataItem->transferBuffers[0]);
+				if(simulationBackend==CPU_BACKEND)
+					uploadCpuQuantity(dataItem);
+				}
 			}
 		
-		glActiveTextureARB(GL_TEXTURE2_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
-		glUniform1iARB(dataItem->bathymetryShaderUniformLocations[2],2);
-		
-		/* Run the bathymetry update: */
-		glBegin(GL_QUADS);
-		glVertex2i(0,0);
-		glVertex2i(size[0],0);
-		glVertex2i(size[0],size[1]);
-		glVertex2i(0,size[1]);
-		glEnd();
-		
-		/* Unbind all shaders and textures: */
-		glUseProgramObjectARB(0);
-		glActiveTextureARB(GL_TEXTURE2_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
-		glActiveTextureARB(GL_TEXTURE1_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
-		glActiveTextureARB(GL_TEXTURE0_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
-		
-		/* Restore OpenGL state: */
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,currentFrameBuffer);
-		glClearColor(currentClearColor[0],currentClearColor[1],currentClearColor[2],currentClearColor[3]);
-		glPopAttrib();
-		
-		/* Update the bathymetry and quantity grids: */
-		dataItem->currentBathymetry=1-dataItem->currentBathymetry;
 		dataItem->bathymetryVersion=depthImageRenderer->getDepthImageVersion();
-		dataItem->currentQuantity=1-dataItem->currentQuantity;
+		}
+	
+	/* Check if the current bathymetry grid was requested: */
+	if(readBathymetryReply!=readBathymetryRequest)
+		{
+		/* Read back the bathymetry grid into the supplied buffer: */
+		readTexture(dataItem->bathymetryTextureObjects[dataItem->currentBathymetry],GL_RED,readBathymetryBuffer);
+		
+		/* Finish the request: */
+		readBathymetryReply=readBathymetryRequest;
 		}
 	}
 
@@ -788,6 +1217,9 @@ void WaterTable2::updateBathymetry(const GLfloat* bathymetryGrid,GLContextData&
 	/* Get the data item: */
 	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
 	
+	/* Update the set of active tiles once per bathymetry update: */
+	updateWetTiles(dataItem);
+	
 	/* Set up the integration frame buffer to update the conserved quantities based on bathymetry changes: */
 	glPushAttrib(GL_VIEWPORT_BIT);
 	GLint currentFrameBuffer;
@@ -836,6 +1268,14 @@ void WaterTable2::updateBathymetry(const GLfloat* bathymetryGrid,GLContextData&
 	/* Update the bathymetry and quantity grids: */
 	dataItem->currentBathymetry=1-dataItem->currentBathymetry;
 	dataItem->currentQuantity=1-dataItem->currentQuantity;
+	
+	if(isCpuSolverCurrent(dataItem))
+		{
+		/* Apply the same bathymetry update to the CPU solver: */
+		dataItem->cpuSolver->updateBathymetry(bathymetryGrid);
+		if(simulationBackend==CPU_BACKEND)
+			uploadCpuQuantity(dataItem);
+		}
 	}
 
 void WaterTable2::setWaterLevel(const GLfloat* waterGrid,GLContextData& contextData) const
@@ -888,60 +1328,332 @@ void WaterTable2::setWaterLevel(const GLfloat* waterGrid,GLContextData& contextD
 
 	/* Update the quantity grid: */
 	dataItem->currentQuantity=1-dataItem->currentQuantity;
+	
+	/* Process the entire grid until the new water level has been reduced to a wet tile grid: */
+	dataItem->wetTileReadbackPending=false;
+	dataItem->haveActiveTiles=false;
+	
+	if(isCpuSolverCurrent(dataItem))
+		{
+		/* Apply the same water level to the CPU solver: */
+		dataItem->cpuSolver->setWaterLevel(waterGrid);
+		if(simulationBackend==CPU_BACKEND)
+			uploadCpuQuantity(dataItem);
+		}
 	}
 
-GLfloat WaterTable2::runSimulationStep(bool forceStepSize,GLContextData& contextData) const
+void WaterTable2::readQuantity(GLfloat* quantityGrid,GLContextData& contextData) const
 	{
 	/* Get the data item: */
 	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
 	
-	/* Save relevant OpenGL state: */
-	glPushAttrib(GL_COLOR_BUFFER_BIT|GL_VIEWPORT_BIT);
-	GLint currentFrameBuffer;
-	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
+	if(simulationBackend==CPU_BACKEND&&isCpuSolverCurrent(dataItem))
+		{
+		/* Read the conserved quantities directly from the CPU solver: */
+		dataItem->cpuSolver->getQuantity(quantityGrid);
+		}
+	else
+		{
+		/* Read back the current quantity texture: */
+		readTexture(dataItem->quantityTextureObjects[dataItem->currentQuantity],GL_RGB,quantityGrid);
+		}
+	}
+
+void WaterTable2::setQuantity(const GLfloat* quantityGrid,GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
 	
-	/*********************************************************************
-	Step 1: Calculate temporal derivative of most recent quantities.
-	*********************************************************************/
+	/* Upload the new conserved quantities into the current quantity texture: */
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+	glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,0,0,size[0],size[1],GL_RGB,GL_FLOAT,quantityGrid);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
 	
-	GLfloat stepSize=calcDerivative(dataItem,dataItem->quantityTextureObjects[dataItem->currentQuantity],!forceStepSize);
+	/* Process the entire grid until the new quantities have been reduced to a wet tile grid: */
+	dataItem->wetTileReadbackPending=false;
+	dataItem->haveActiveTiles=false;
 	
-	/*********************************************************************
-	Step 2: Perform the tentative Euler integration step.
-	*********************************************************************/
+	if(isCpuSolverCurrent(dataItem))
+		{
+		/* Apply the same quantities to the CPU solver: */
+		dataItem->cpuSolver->setQuantity(quantityGrid);
+		}
+	}
+
+void WaterTable2::renderWater(WaterTable2::DataItem* dataItem,GLfloat stepSize,GLContextData& contextData) const
+	{
+	/* Save OpenGL state: */
+	GLfloat currentClearColor[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE,currentClearColor);
 	
-	/* Set up the Euler step integration frame buffer: */
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
-	glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+2);
+	/* Set up and clear the water frame buffer: */
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->waterFramebufferObject);
 	glViewport(0,0,size[0],size[1]);
+	glClearColor(waterDeposit*stepSize,0.0f,0.0f,0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
 	
-	/* Set up the Euler integration step shader: */
-	glUseProgramObjectARB(dataItem->eulerStepShader);
-	glUniformARB(dataItem->eulerStepShaderUniformLocations[0],stepSize);
-	glUniformARB(dataItem->eulerStepShaderUniformLocations[1],Math::pow(attenuation,stepSize));
-	glActiveTextureARB(GL_TEXTURE0_ARB);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
-	glUniform1iARB(dataItem->eulerStepShaderUniformLocations[2],0);
-	glActiveTextureARB(GL_TEXTURE1_ARB);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->derivativeTextureObject);
-	glUniform1iARB(dataItem->eulerStepShaderUniformLocations[3],1);
+	/* Enable additive rendering: */
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE,GL_ONE);
 	
-	/* Run the Euler integration step: */
-	glBegin(GL_QUADS);
-	glVertex2i(0,0);
-	glVertex2i(size[0],0);
-	glVertex2i(size[0],size[1]);
-	glVertex2i(0,size[1]);
-	glEnd();
+	/* Set up the water adding shader: */
+	glUseProgramObjectARB(dataItem->waterAddShader);
+	glUniformMatrix4fvARB(dataItem->waterAddShaderUniformLocations[0],1,GL_FALSE,waterAddPmvMatrix);
+	glUniform1fARB(dataItem->waterAddShaderUniformLocations[1],stepSize);
 	
-	/*********************************************************************
-	Step 3: Calculate temporal derivative of intermediate quantities.
+	/* Bind the water texture: */
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->waterTextureObject);
+	glUniform1iARB(dataItem->waterAddShaderUniformLocations[2],0);
+	
+	/* Call all render functions: */
+	for(std::vector<const AddWaterFunction*>::const_iterator rfIt=renderFunctions.begin();rfIt!=renderFunctions.end();++rfIt)
+		(**rfIt)(contextData);
+	
+	/* Restore OpenGL state: */
+	glDisable(GL_BLEND);
+	glClearColor(currentClearColor[0],currentClearColor[1],currentClearColor[2],currentClearColor[3]);
+	}
+
+bool WaterTable2::isCullingDryTiles(const WaterTable2::DataItem* dataItem) const
+	{
+	/* Dry tiles can only be skipped by the GPU backend if no water is deposited uniformly over the entire grid: */
+	return dryCullingTileSize>0&&simulationBackend==GPU_BACKEND&&!compareBackends&&waterDeposit==0.0f&&dataItem->haveActiveTiles&&dataItem->wetTileSize==dryCullingTileSize;
+	}
+
+void WaterTable2::updateWetTiles(WaterTable2::DataItem* dataItem) const
+	{
+	/* Bail out if dry tile culling is disabled or the wet tile grid cannot be read back asynchronously: */
+	if(dryCullingTileSize<=0||simulationBackend!=GPU_BACKEND||compareBackends||waterDeposit!=0.0f||!dataItem->haveStepSizeReadback)
+		{
+		dataItem->wetTileReadbackPending=false;
+		dataItem->haveActiveTiles=false;
+		return;
+		}
+	
+	/* Check if the wet tile grid needs to be re-allocated for a new tile size: */
+	bool reallocate=dataItem->wetTileSize!=dryCullingTileSize;
+	if(reallocate)
+		{
+		dataItem->wetTileSize=dryCullingTileSize;
+		for(int i=0;i<2;++i)
+			dataItem->numWetTiles[i]=(size[i]+dryCullingTileSize-1)/dryCullingTileSize;
+		dataItem->wetTileReadbackPending=false;
+		dataItem->haveActiveTiles=false;
+		}
+	GLsizei ntx=dataItem->numWetTiles[0];
+	GLsizei nty=dataItem->numWetTiles[1];
+	
+	if(dataItem->wetTileReadbackPending)
+		{
+		/* Retrieve the wet tile grid issued during the previous frame, which the GPU has finished by now: */
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,dataItem->wetTileBufferObject);
+		const GLfloat* wetTiles=static_cast<const GLfloat*>(glMapBufferARB(GL_PIXEL_PACK_BUFFER_ARB,GL_READ_ONLY_ARB));
+		if(wetTiles!=0)
+			{
+			/* Mark all wet tiles and their direct neighbors as active, so that water can flow one tile further before the next wet tile grid arrives: */
+			std::vector<bool> active(nty*ntx,false);
+			const GLfloat* wtPtr=wetTiles;
+			for(GLsizei ty=0;ty<nty;++ty)
+				for(GLsizei tx=0;tx<ntx;++tx,wtPtr+=4)
+					if(wtPtr[0]>dryCullingThreshold||wtPtr[1]>0.0f)
+						{
+						for(GLsizei y=Math::max(ty-1,0);y<=Math::min(ty+1,nty-1);++y)
+							for(GLsizei x=Math::max(tx-1,0);x<=Math::min(tx+1,ntx-1);++x)
+								active[y*ntx+x]=true;
+						}
+			glUnmapBufferARB(GL_PIXEL_PACK_BUFFER_ARB);
+			
+			/* Merge runs of active and inactive tiles in each row of tiles into rectangles: */
+			dataItem->activeRects.clear();
+			dataItem->inactiveRects.clear();
+			dataItem->numActiveTiles=0;
+			GLsizei ts=dryCullingTileSize;
+			for(GLsizei ty=0;ty<nty;++ty)
+				{
+				GLsizei tx=0;
+				while(tx<ntx)
+					{
+					bool runActive=active[ty*ntx+tx];
+					GLsizei runStart=tx;
+					for(++tx;tx<ntx&&active[ty*ntx+tx]==runActive;++tx)
+						;
+					std::vector<GLint>& rects=runActive?dataItem->activeRects:dataItem->inactiveRects;
+					rects.push_back(runStart*ts);
+					rects.push_back(ty*ts);
+					rects.push_back(Math::min(tx*ts,size[0]));
+					rects.push_back(Math::min((ty+1)*ts,size[1]));
+					if(runActive)
+						dataItem->numActiveTiles+=tx-runStart;
+					}
+				}
+			dataItem->haveActiveTiles=true;
+			}
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+		dataItem->wetTileReadbackPending=false;
+		}
+	
+	/* Save relevant OpenGL state: */
+	glPushAttrib(GL_VIEWPORT_BIT);
+	GLint currentFrameBuffer;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
+	
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->wetTileFramebufferObject);
+	if(reallocate)
+		{
+		/* Allocate the wet tile texture and attach it to the wet tile frame buffer: */
+		glActiveTextureARB(GL_TEXTURE0_ARB);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->wetTileTextureObject);
+		glTexImage2D(GL_TEXTURE_RECTANGLE_ARB,0,GL_RGBA32F,ntx,nty,0,GL_RGBA,GL_FLOAT,0);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,GL_COLOR_ATTACHMENT0_EXT,GL_TEXTURE_RECTANGLE_ARB,dataItem->wetTileTextureObject,0);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
+		glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+		
+		/* Allocate the wet tile pixel buffer object: */
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,dataItem->wetTileBufferObject);
+		glBufferDataARB(GL_PIXEL_PACK_BUFFER_ARB,nty*ntx*4*sizeof(GLfloat),0,GL_STREAM_READ_ARB);
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+		}
+	glViewport(0,0,ntx,nty);
+	
+	/* Set up the wet tile reduction shader: */
+	glUseProgramObjectARB(dataItem->wetTileShader);
+	glUniformARB(dataItem->wetTileShaderUniformLocations[0],GLfloat(dryCullingTileSize));
+	glUniformARB(dataItem->wetTileShaderUniformLocations[1],GLfloat(size[0]),GLfloat(size[1]));
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
+	glUniform1iARB(dataItem->wetTileShaderUniformLocations[2],0);
+	for(int i=0;i<3;++i)
+		{
+		glActiveTextureARB(GL_TEXTURE1_ARB+i);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[i]);
+		glUniform1iARB(dataItem->wetTileShaderUniformLocations[3+i],1+i);
+		}
+	glActiveTextureARB(GL_TEXTURE4_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->waterTextureObject);
+	glUniform1iARB(dataItem->wetTileShaderUniformLocations[6],4);
+	
+	/* Reduce the conserved quantity grid to the wet tile grid: */
+	glBegin(GL_QUADS);
+	glVertex2i(0,0);
+	glVertex2i(size[0],0);
+	glVertex2i(size[0],size[1]);
+	glVertex2i(0,size[1]);
+	glEnd();
+	
+	/* Unbind all shaders and textures: */
+	glUseProgramObjectARB(0);
+	for(int i=4;i>=0;--i)
+		{
+		glActiveTextureARB(GL_TEXTURE0_ARB+i);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		}
+	
+	/* Start reading back the wet tile grid into the pixel buffer object, to be retrieved during the next frame: */
+	glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,dataItem->wetTileBufferObject);
+	glReadPixels(0,0,ntx,nty,GL_RGBA,GL_FLOAT,0);
+	glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+	dataItem->wetTileReadbackPending=true;
+	
+	/* Restore OpenGL state: */
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,currentFrameBuffer);
+	glPopAttrib();
+	}
+
+void WaterTable2::drawActiveTiles(const WaterTable2::DataItem* dataItem,GLint border) const
+	{
+	glBegin(GL_QUADS);
+	if(dataItem->cullPasses)
+		{
+		/* Draw all active tile rectangles: */
+		for(std::vector<GLint>::const_iterator rIt=dataItem->activeRects.begin();rIt!=dataItem->activeRects.end();rIt+=4)
+			{
+			glVertex2i(rIt[0]-border,rIt[1]-border);
+			glVertex2i(rIt[2]+border,rIt[1]-border);
+			glVertex2i(rIt[2]+border,rIt[3]+border);
+			glVertex2i(rIt[0]-border,rIt[3]+border);
+			}
+		}
+	else
+		{
+		/* Draw the entire grid: */
+		glVertex2i(0,0);
+		glVertex2i(size[0],0);
+		glVertex2i(size[0],size[1]);
+		glVertex2i(0,size[1]);
+		}
+	glEnd();
+	}
+
+void WaterTable2::copyInactiveTiles(WaterTable2::DataItem* dataItem,GLuint quantityTextureObject) const
+	{
+	/* Bail out if the current step is not culled, or all tiles are active: */
+	if(!dataItem->cullPasses||dataItem->inactiveRects.empty())
+		return;
+	
+	/* Set up the quantity copy shader: */
+	glUseProgramObjectARB(dataItem->quantityCopyShader);
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,quantityTextureObject);
+	glUniform1iARB(dataItem->quantityCopyShaderUniformLocations[0],0);
+	
+	/* Copy all inactive tile rectangles: */
+	glBegin(GL_QUADS);
+	for(std::vector<GLint>::const_iterator rIt=dataItem->inactiveRects.begin();rIt!=dataItem->inactiveRects.end();rIt+=4)
+		{
+		glVertex2i(rIt[0],rIt[1]);
+		glVertex2i(rIt[2],rIt[1]);
+		glVertex2i(rIt[2],rIt[3]);
+		glVertex2i(rIt[0],rIt[3]);
+		}
+	glEnd();
+	
+	/* Unbind unneeded textures: */
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	}
+
+void WaterTable2::runIntegrationStep(WaterTable2::DataItem* dataItem) const
+	{
+	/*********************************************************************
+	Step 1: Perform the tentative Euler integration step.
+	*********************************************************************/
+	
+	/* Set up the Euler step integration frame buffer: */
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+2);
+	glViewport(0,0,size[0],size[1]);
+	
+	/* Set up the Euler integration step shader: */
+	glUseProgramObjectARB(dataItem->eulerStepShader);
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->stepSizeTextureObjects[dataItem->currentStepSize]);
+	glUniform1iARB(dataItem->eulerStepShaderUniformLocations[0],0);
+	glActiveTextureARB(GL_TEXTURE1_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+	glUniform1iARB(dataItem->eulerStepShaderUniformLocations[1],1);
+	glActiveTextureARB(GL_TEXTURE2_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->derivativeTextureObject);
+	glUniform1iARB(dataItem->eulerStepShaderUniformLocations[2],2);
+	
+	/* Run the Euler integration step: */
+	drawActiveTiles(dataItem);
+	
+	/* Unbind unneeded textures: */
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	
+	/* Pass the current quantities through the culled tiles: */
+	copyInactiveTiles(dataItem,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+	
+	/*********************************************************************
+	Step 2: Calculate temporal derivative of intermediate quantities.
 	*********************************************************************/
 	
 	calcDerivative(dataItem,dataItem->quantityTextureObjects[2],false);
 	
 	/*********************************************************************
-	Step 4: Perform the final Runge-Kutta integration step.
+	Step 3: Perform the final Runge-Kutta integration step.
 	*********************************************************************/
 	
 	/* Set up the Runge-Kutta step integration frame buffer: */
@@ -951,25 +1663,27 @@ GLfloat WaterTable2::runSimulationStep(bool forceStepSize,GLContextData& context
 	
 	/* Set up the Runge-Kutta integration step shader: */
 	glUseProgramObjectARB(dataItem->rungeKuttaStepShader);
-	glUniformARB(dataItem->rungeKuttaStepShaderUniformLocations[0],stepSize);
-	glUniformARB(dataItem->rungeKuttaStepShaderUniformLocations[1],Math::pow(attenuation,stepSize));
 	glActiveTextureARB(GL_TEXTURE0_ARB);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
-	glUniform1iARB(dataItem->rungeKuttaStepShaderUniformLocations[2],0);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->stepSizeTextureObjects[dataItem->currentStepSize]);
+	glUniform1iARB(dataItem->rungeKuttaStepShaderUniformLocations[0],0);
 	glActiveTextureARB(GL_TEXTURE1_ARB);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[2]);
-	glUniform1iARB(dataItem->rungeKuttaStepShaderUniformLocations[3],1);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+	glUniform1iARB(dataItem->rungeKuttaStepShaderUniformLocations[1],1);
 	glActiveTextureARB(GL_TEXTURE2_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[2]);
+	glUniform1iARB(dataItem->rungeKuttaStepShaderUniformLocations[2],2);
+	glActiveTextureARB(GL_TEXTURE3_ARB);
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->derivativeTextureObject);
-	glUniform1iARB(dataItem->rungeKuttaStepShaderUniformLocations[4],2);
+	glUniform1iARB(dataItem->rungeKuttaStepShaderUniformLocations[3],3);
 	
 	/* Run the Runge-Kutta integration step: */
-	glBegin(GL_QUADS);
-	glVertex2i(0,0);
-	glVertex2i(size[0],0);
-	glVertex2i(size[0],size[1]);
-	glVertex2i(0,size[1]);
-	glEnd();
+	drawActiveTiles(dataItem);
+	
+	/* Unbind unneeded textures: */
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	
+	/* Pass the current quantities through the culled tiles: */
+	copyInactiveTiles(dataItem,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
 	
 	if(dryBoundary)
 		{
@@ -992,68 +1706,354 @@ GLfloat WaterTable2::runSimulationStep(bool forceStepSize,GLContextData& context
 	
 	/* Update the current quantities: */
 	dataItem->currentQuantity=1-dataItem->currentQuantity;
+	}
+
+void WaterTable2::runWaterUpdate(WaterTable2::DataItem* dataItem,GLfloat stepSize,bool gpuStepSize,GLContextData& contextData) const
+	{
+	/*********************************************************************
+	Step 1: Render all water sources and sinks additively into the water
+	texture, as rates to be scaled by the simulated time on the GPU if the
+	step sizes were determined there.
+	*********************************************************************/
+	
+	renderWater(dataItem,gpuStepSize?1.0f:stepSize,contextData);
 	
+	/*********************************************************************
+	Step 2: Update the conserved quantities based on the water texture.
+	*********************************************************************/
+	
+	/* Set up the integration frame buffer to update the conserved quantities based on the water texture: */
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentQuantity));
+	glViewport(0,0,size[0],size[1]);
+	
+	/* Set up the water update shader: */
+	glUseProgramObjectARB(dataItem->waterShader);
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
+	glUniform1iARB(dataItem->waterShaderUniformLocations[0],0);
+	glActiveTextureARB(GL_TEXTURE1_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+	glUniform1iARB(dataItem->waterShaderUniformLocations[1],1);
+	glActiveTextureARB(GL_TEXTURE2_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->waterTextureObject);
+	glUniform1iARB(dataItem->waterShaderUniformLocations[2],2);
+	
+	/* Scale the water texture by the given total time step minus the time the GPU-side steps left unsimulated; the step size state of a single step has no remaining time: */
+	glActiveTextureARB(GL_TEXTURE3_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->stepSizeTextureObjects[dataItem->currentStepSize]);
+	glUniform1iARB(dataItem->waterShaderUniformLocations[3],3);
+	glUniformARB(dataItem->waterShaderUniformLocations[4],gpuStepSize?stepSize:1.0f);
+	
+	/* Run the water update: */
+	glBegin(GL_QUADS);
+	glVertex2i(0,0);
+	glVertex2i(size[0],0);
+	glVertex2i(size[0],size[1]);
+	glVertex2i(0,size[1]);
+	glEnd();
+	
+	/* Unbind the step size state texture: */
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	glActiveTextureARB(GL_TEXTURE2_ARB);
+	
+	/* Update the current quantities: */
+	dataItem->currentQuantity=1-dataItem->currentQuantity;
+	}
+
+GLfloat WaterTable2::runGpuSimulationStep(WaterTable2::DataItem* dataItem,bool forceStepSize,GLContextData& contextData) const
+	{
+	/* Restrict the step's passes to the active tiles if possible: */
+	dataItem->cullPasses=isCullingDryTiles(dataItem);
+	
+	/* Calculate temporal derivative of most recent quantities and read back the maximum stable step size: */
+	GLfloat stepSize=calcDerivative(dataItem,dataItem->quantityTextureObjects[dataItem->currentQuantity],!forceStepSize);
+	
+	/* Upload the step size state for the integration step: */
+	GLfloat stepSizeState[4];
+	stepSizeState[0]=stepSize;
+	stepSizeState[1]=Math::pow(attenuation,stepSize);
+	stepSizeState[2]=0.0f;
+	stepSizeState[3]=stepSize;
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->stepSizeTextureObjects[dataItem->currentStepSize]);
+	glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,0,0,1,1,GL_RGBA,GL_FLOAT,stepSizeState);
+	
+	/* Run the Euler and Runge-Kutta integration steps: */
+	runIntegrationStep(dataItem);
+	
+	/* Add or remove water: */
 	if(waterDeposit!=0.0f||!renderFunctions.empty())
+		runWaterUpdate(dataItem,stepSize,false,contextData);
+	
+	/* Return the Runge-Kutta step's step size: */
+	dataItem->cullPasses=false;
+	return stepSize;
+	}
+
+bool WaterTable2::isCpuSolverCurrent(const WaterTable2::DataItem* dataItem) const
+	{
+	return (simulationBackend==CPU_BACKEND||compareBackends)&&dataItem->cpuSolver!=0&&dataItem->cpuSolverVersion==backendVersion;
+	}
+
+CPUWaterSolver* WaterTable2::prepareCpuSolver(WaterTable2::DataItem* dataItem) const
+	{
+	/* Bail out if the CPU solver is not used: */
+	if(simulationBackend!=CPU_BACKEND&&!compareBackends)
+		return 0;
+	
+	if(dataItem->cpuSolverVersion!=backendVersion)
 		{
-		/* Save OpenGL state: */
-		GLfloat currentClearColor[4];
-		glGetFloatv(GL_COLOR_CLEAR_VALUE,currentClearColor);
-		
-		/*******************************************************************
-		Step 5: Render all water sources and sinks additively into the water
-		texture.
-		*******************************************************************/
-		
-		/* Set up and clear the water frame buffer: */
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->waterFramebufferObject);
-		glViewport(0,0,size[0],size[1]);
-		glClearColor(waterDeposit*stepSize,0.0f,0.0f,0.0f);
-		glClear(GL_COLOR_BUFFER_BIT);
-		
-		/* Enable additive rendering: */
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_ONE,GL_ONE);
-		
-		/* Set up the water adding shader: */
-		glUseProgramObjectARB(dataItem->waterAddShader);
-		glUniformMatrix4fvARB(dataItem->waterAddShaderUniformLocations[0],1,GL_FALSE,waterAddPmvMatrix);
-		glUniform1fARB(dataItem->waterAddShaderUniformLocations[1],stepSize);
-		
-		/* Bind the water texture: */
-		glActiveTextureARB(GL_TEXTURE0_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->waterTextureObject);
-		glUniform1iARB(dataItem->waterAddShaderUniformLocations[2],0);
-		
-		/* Call all render functions: */
-		for(std::vector<const AddWaterFunction*>::const_iterator rfIt=renderFunctions.begin();rfIt!=renderFunctions.end();++rfIt)
-			(**rfIt)(contextData);
+		if(dataItem->cpuSolver==0)
+			{
+			/* Create a CPU solver with the same simulation parameters as the GPU shaders: */
+			unsigned int solverSize[2];
+			for(int i=0;i<2;++i)
+				solverSize[i]=size[i];
+			dataItem->cpuSolver=new CPUWaterSolver(solverSize,cellSize,theta,g,epsilon);
+			
+			/* Allocate buffers to exchange conserved quantity grids: */
+			for(int i=0;i<2;++i)
+				dataItem->transferBuffers[i]=new GLfloat[size[1]*size[0]*3];
+			}
+		dataItem->cpuSolver->setNumThreads(numCpuThreads);
+		dataItem->cpuSolver->setMultiRate(multiRateLevels,multiRateTileSize);
 		
-		/* Restore OpenGL state: */
-		glDisable(GL_BLEND);
-		glClearColor(currentClearColor[0],currentClearColor[1],currentClearColor[2],currentClearColor[3]);
+		/* Synchronize the CPU solver with the current GPU simulation state: */
+		readTexture(dataItem->bathymetryTextureObjects[dataItem->currentBathymetry],GL_RED,dataItem->transferBuffers[0]);
+		dataItem->cpuSolver->setBathymetry(dataItem->transferBuffers[0]);
+		readTexture(dataItem->quantityTextureObjects[dataItem->currentQuantity],GL_RGB,dataItem->transferBuffers[0]);
+		dataItem->cpuSolver->setQuantity(dataItem->transferBuffers[0]);
 		
-		/*******************************************************************
-		Step 6: Update the conserved quantities based on the water texture.
-		*******************************************************************/
+		dataItem->cpuSolverVersion=backendVersion;
+		}
+	
+	return dataItem->cpuSolver;
+	}
+
+void WaterTable2::readTexture(GLuint textureObject,GLenum format,GLfloat* buffer) const
+	{
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,textureObject);
+	glGetTexImage(GL_TEXTURE_RECTANGLE_ARB,0,format,GL_FLOAT,buffer);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	}
+
+void WaterTable2::uploadCpuQuantity(WaterTable2::DataItem* dataItem) const
+	{
+	/* Upload the CPU solver's conserved quantities into the current quantity texture for rendering: */
+	dataItem->cpuSolver->getQuantity(dataItem->transferBuffers[0]);
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
+	glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,0,0,size[0],size[1],GL_RGB,GL_FLOAT,dataItem->transferBuffers[0]);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	}
+
+GLfloat WaterTable2::runCpuSimulationStep(WaterTable2::DataItem* dataItem,bool forceStepSize,GLContextData& contextData) const
+	{
+	/* Run the integration step: */
+	GLfloat stepSize=dataItem->cpuSolver->runSimulationStep(maxStepSize,forceStepSize,attenuation,dryBoundary);
+	
+	if(waterDeposit!=0.0f||!renderFunctions.empty())
+		{
+		if(renderFunctions.empty())
+			{
+			/* Deposit the same amount of water everywhere: */
+			dataItem->cpuSolver->updateWater(waterDeposit*stepSize);
+			}
+		else
+			{
+			/* Render all water sources and sinks on the GPU and read back the water texture: */
+			renderWater(dataItem,stepSize,contextData);
+			readTexture(dataItem->waterTextureObject,GL_RED,dataItem->transferBuffers[0]);
+			dataItem->cpuSolver->updateWater(dataItem->transferBuffers[0]);
+			}
+		}
+	
+	/* Upload the new conserved quantities for rendering: */
+	uploadCpuQuantity(dataItem);
+	
+	return stepSize;
+	}
+
+GLfloat WaterTable2::runComparedSimulationStep(WaterTable2::DataItem* dataItem,bool forceStepSize,GLContextData& contextData) const
+	{
+	CPUWaterSolver* cpuSolver=dataItem->cpuSolver;
+	
+	/* Start the CPU solver from the GPU's state if the GPU is the primary backend; otherwise the GPU's state is the CPU's last upload: */
+	if(simulationBackend==GPU_BACKEND)
+		{
+		readTexture(dataItem->quantityTextureObjects[dataItem->currentQuantity],GL_RGB,dataItem->transferBuffers[0]);
+		cpuSolver->setQuantity(dataItem->transferBuffers[0]);
+		}
+	
+	/* Run and time the GPU step, which determines the step size for both backends: */
+	glFinish();
+	Misc::Timer gpuTimer;
+	GLfloat stepSize=runGpuSimulationStep(dataItem,forceStepSize,contextData);
+	glFinish();
+	gpuTimer.elapse();
+	
+	/* Read back the water texture rendered by the GPU step: */
+	bool updateWater=waterDeposit!=0.0f||!renderFunctions.empty();
+	if(updateWater)
+		readTexture(dataItem->waterTextureObject,GL_RED,dataItem->transferBuffers[1]);
+	
+	/* Run and time the CPU step using the GPU's step size: */
+	Misc::Timer cpuTimer;
+	cpuSolver->runSimulationStep(stepSize,true,attenuation,dryBoundary);
+	if(updateWater)
+		cpuSolver->updateWater(dataItem->transferBuffers[1]);
+	cpuTimer.elapse();
+	
+	/* Compare the step sizes the two backends would have taken: */
+	if(!forceStepSize)
+		{
+		GLfloat stepSizeDifference=Math::abs(Math::min(cpuSolver->getMaxStepSize(),maxStepSize)-stepSize);
+		if(backendComparison.maxStepSizeDifference<stepSizeDifference)
+			backendComparison.maxStepSizeDifference=stepSizeDifference;
+		}
+	
+	/* Compare the resulting conserved quantities: */
+	readTexture(dataItem->quantityTextureObjects[dataItem->currentQuantity],GL_RGB,dataItem->transferBuffers[0]);
+	cpuSolver->getQuantity(dataItem->transferBuffers[1]);
+	const GLfloat* gqPtr=dataItem->transferBuffers[0];
+	const GLfloat* cqPtr=dataItem->transferBuffers[1];
+	for(GLsizei i=size[1]*size[0];i>0;--i,gqPtr+=3,cqPtr+=3)
+		for(int j=0;j<3;++j)
+			{
+			GLfloat difference=Math::abs(cqPtr[j]-gqPtr[j]);
+			if(backendComparison.maxQuantityDifference[j]<difference)
+				backendComparison.maxQuantityDifference[j]=difference;
+			backendComparison.sumSqQuantityDifference[j]+=double(difference)*double(difference);
+			}
+	backendComparison.numQuantityValues+=double(size[1])*double(size[0]);
+	++backendComparison.numSteps;
+	backendComparison.gpuTime+=gpuTimer.getTime();
+	backendComparison.cpuTime+=cpuTimer.getTime();
+	
+	/* Replace the GPU's result if the CPU is the primary backend: */
+	if(simulationBackend==CPU_BACKEND)
+		uploadCpuQuantity(dataItem);
+	
+	return stepSize;
+	}
+
+GLfloat WaterTable2::runSimulationStep(bool forceStepSize,GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	
+	/* Save relevant OpenGL state: */
+	glPushAttrib(GL_COLOR_BUFFER_BIT|GL_VIEWPORT_BIT);
+	GLint currentFrameBuffer;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
+	
+	/* Run the simulation step on the selected backend(s): */
+	GLfloat stepSize;
+	if(prepareCpuSolver(dataItem)==0)
+		stepSize=runGpuSimulationStep(dataItem,forceStepSize,contextData);
+	else if(compareBackends)
+		stepSize=runComparedSimulationStep(dataItem,forceStepSize,contextData);
+	else
+		stepSize=runCpuSimulationStep(dataItem,forceStepSize,contextData);
+	
+	/* Unbind all shaders and textures: */
+	glUseProgramObjectARB(0);
+	glActiveTextureARB(GL_TEXTURE2_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	glActiveTextureARB(GL_TEXTURE1_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+	
+	/* Restore OpenGL state: */
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,currentFrameBuffer);
+	glPopAttrib();
+	
+	/* Return the Runge-Kutta step's step size: */
+	return stepSize;
+	}
+
+void WaterTable2::setGpuStepSize(bool newGpuStepSize)
+	{
+	gpuStepSize=newGpuStepSize;
+	}
+
+unsigned int WaterTable2::runSimulationSteps(GLfloat totalTimeStep,unsigned int maxNumSteps,GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	
+	if(dataItem->stepSizeReadbackPending)
+		{
+		/* Retrieve the step size state at the end of the previous frame, which the GPU has finished by now: */
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,dataItem->stepSizeBufferObject);
+		const GLfloat* stepSizeState=static_cast<const GLfloat*>(glMapBufferARB(GL_PIXEL_PACK_BUFFER_ARB,GL_READ_ONLY_ARB));
+		if(stepSizeState!=0)
+			{
+			dataItem->lastUnsimulatedTime=stepSizeState[2];
+			dataItem->lastStableStepSize=stepSizeState[3];
+			glUnmapBufferARB(GL_PIXEL_PACK_BUFFER_ARB);
+			}
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+		dataItem->stepSizeReadbackPending=false;
+		}
+	
+	/* Bail out if there is nothing to simulate: */
+	if(totalTimeStep<=0.0f||maxNumSteps==0)
+		return 0;
+	
+	/* Estimate the number of steps to issue from the previous frame's stable step size, with one step of slack: */
+	unsigned int numSteps=maxNumSteps;
+	if(dataItem->lastStableStepSize>0.0f)
+		{
+		GLfloat estimatedNumSteps=Math::ceil(totalTimeStep/dataItem->lastStableStepSize)+1.0f;
+		if(estimatedNumSteps<GLfloat(maxNumSteps))
+			numSteps=(unsigned int)(estimatedNumSteps);
+		}
+	
+	/* Save relevant OpenGL state: */
+	glPushAttrib(GL_COLOR_BUFFER_BIT|GL_VIEWPORT_BIT);
+	GLint currentFrameBuffer;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT,&currentFrameBuffer);
+	
+	/* Reset the step size state to spend the given total time step: */
+	GLfloat stepSizeState[4];
+	stepSizeState[0]=0.0f;
+	stepSizeState[1]=1.0f;
+	stepSizeState[2]=totalTimeStep;
+	stepSizeState[3]=0.0f;
+	glActiveTextureARB(GL_TEXTURE0_ARB);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->stepSizeTextureObjects[dataItem->currentStepSize]);
+	glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB,0,0,0,1,1,GL_RGBA,GL_FLOAT,stepSizeState);
+	
+	/* Restrict the steps' passes to the active tiles if possible: */
+	dataItem->cullPasses=isCullingDryTiles(dataItem);
+	
+	for(unsigned int step=0;step<numSteps;++step)
+		{
+		/* Calculate temporal derivative of most recent quantities and reduce the maximum step size texture on the GPU: */
+		calcDerivative(dataItem,dataItem->quantityTextureObjects[dataItem->currentQuantity],false);
+		int currentMaxStepSizeTexture=reduceMaxStepSize(dataItem);
 		
-		/* Set up the integration frame buffer to update the conserved quantities based on the water texture: */
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->integrationFramebufferObject);
-		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentQuantity));
-		glViewport(0,0,size[0],size[1]);
+		/* Set up the step size state frame buffer: */
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->stepSizeFramebufferObject);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT+(1-dataItem->currentStepSize));
+		glViewport(0,0,1,1);
 		
-		/* Set up the water update shader: */
-		glUseProgramObjectARB(dataItem->waterShader);
+		/* Set up the step size calculation shader: */
+		glUseProgramObjectARB(dataItem->stepSizeShader);
+		glUniformARB(dataItem->stepSizeShaderUniformLocations[0],maxStepSize);
+		glUniformARB(dataItem->stepSizeShaderUniformLocations[1],attenuation);
 		glActiveTextureARB(GL_TEXTURE0_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->bathymetryTextureObjects[dataItem->currentBathymetry]);
-		glUniform1iARB(dataItem->waterShaderUniformLocations[0],0);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->maxStepSizeTextureObjects[currentMaxStepSizeTexture]);
+		glUniform1iARB(dataItem->stepSizeShaderUniformLocations[2],0);
 		glActiveTextureARB(GL_TEXTURE1_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->quantityTextureObjects[dataItem->currentQuantity]);
-		glUniform1iARB(dataItem->waterShaderUniformLocations[1],1);
-		glActiveTextureARB(GL_TEXTURE2_ARB);
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->waterTextureObject);
-		glUniform1iARB(dataItem->waterShaderUniformLocations[2],2);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,dataItem->stepSizeTextureObjects[dataItem->currentStepSize]);
+		glUniform1iARB(dataItem->stepSizeShaderUniformLocations[3],1);
 		
-		/* Run the water update: */
+		/* Calculate the next step size: */
 		glBegin(GL_QUADS);
 		glVertex2i(0,0);
 		glVertex2i(size[0],0);
@@ -1061,8 +2061,31 @@ GLfloat WaterTable2::runSimulationStep(bool forceStepSize,GLContextData& context
 		glVertex2i(0,size[1]);
 		glEnd();
 		
-		/* Update the current quantities: */
-		dataItem->currentQuantity=1-dataItem->currentQuantity;
+		/* Unbind unneeded textures: */
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB,0);
+		
+		/* Update the current step size state: */
+		dataItem->currentStepSize=1-dataItem->currentStepSize;
+		
+		/* Run the Euler and Runge-Kutta integration steps: */
+		runIntegrationStep(dataItem);
+		}
+	
+	dataItem->cullPasses=false;
+	
+	/* Add or remove water for all simulated time at once, as the individual step sizes and the unsimulated remainder are only known on the GPU: */
+	if(waterDeposit!=0.0f||!renderFunctions.empty())
+		runWaterUpdate(dataItem,totalTimeStep,true,contextData);
+	
+	if(dataItem->haveStepSizeReadback)
+		{
+		/* Start reading back the final step size state into the pixel buffer object, to be retrieved during the next frame: */
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,dataItem->stepSizeFramebufferObject);
+		glReadBuffer(GL_COLOR_ATTACHMENT0_EXT+dataItem->currentStepSize);
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,dataItem->stepSizeBufferObject);
+		glReadPixels(0,0,1,1,GL_RGBA,GL_FLOAT,0);
+		glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB,0);
+		dataItem->stepSizeReadbackPending=true;
 		}
 	
 	/* Unbind all shaders and textures: */
@@ -1078,8 +2101,25 @@ GLfloat WaterTable2::runSimulationStep(bool forceStepSize,GLContextData& context
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT,currentFrameBuffer);
 	glPopAttrib();
 	
-	/* Return the Runge-Kutta step's step size: */
-	return stepSize;
+	return numSteps;
+	}
+
+GLfloat WaterTable2::getUnsimulatedTime(GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	
+	return dataItem->lastUnsimulatedTime;
+	}
+
+GLfloat WaterTable2::getActiveTileFraction(GLContextData& contextData) const
+	{
+	/* Get the data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	
+	if(!isCullingDryTiles(dataItem))
+		return 1.0f;
+	return GLfloat(dataItem->numActiveTiles)/GLfloat(dataItem->numWetTiles[1]*dataItem->numWetTiles[0]);
 	}
 
 void WaterTable2::bindBathymetryTexture(GLContextData& contextData) const
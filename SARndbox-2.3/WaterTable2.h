@@ -26,6 +26,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <vector>
 #include <Misc/FunctionCalls.h>
+#include <Math/Math.h>
 #include <Geometry/Point.h>
 #include <Geometry/Box.h>
 #include <Geometry/OrthonormalTransformation.h>
@@ -38,6 +39,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 /* Forward declarations: */
 class DepthImageRenderer;
+class CPUWaterSolver;
 
 typedef Misc::FunctionCall<GLContextData&> AddWaterFunction; // Type for render functions called to locally add water to the water table
 
@@ -48,6 +50,38 @@ class WaterTable2:public GLObject
 	typedef Geometry::Box<Scalar,3> Box;
 	typedef Geometry::OrthonormalTransformation<Scalar,3> ONTransform;
 	
+	enum SimulationBackend // Enumerated type for implementations of the water flow simulation
+		{
+		GPU_BACKEND, // Simulation runs in fragment shaders on the GPU
+		CPU_BACKEND // Simulation runs in a multithreaded CPU solver; results are uploaded to the GPU for rendering
+		};
+	
+	struct BackendComparison // Structure accumulating differences and timings between the GPU and CPU simulation backends
+		{
+		/* Elements: */
+		public:
+		unsigned int numSteps; // Number of compared simulation steps
+		double gpuTime; // Total time spent in GPU simulation steps in seconds
+		double cpuTime; // Total time spent in CPU simulation steps in seconds
+		GLfloat maxStepSizeDifference; // Maximum absolute difference between the step sizes calculated by the two backends
+		GLfloat maxQuantityDifference[3]; // Maximum absolute differences in the conserved quantities (w, hu, hv)
+		double sumSqQuantityDifference[3]; // Sums of squared differences in the conserved quantities
+		double numQuantityValues; // Number of compared cells
+		
+		/* Constructors and destructors: */
+		BackendComparison(void)
+			{
+			reset();
+			}
+		
+		/* Methods: */
+		void reset(void); // Resets all accumulated statistics
+		double getRmsQuantityDifference(int component) const // Returns the root-mean-square difference in the given conserved quantity
+			{
+			return numQuantityValues>0.0?Math::sqrt(sumSqQuantityDifference[component]/numQuantityValues):0.0;
+			}
+		};
+	
 	private:
 	struct DataItem:public GLObject::DataItem // Structure holding per-context state
 		{
@@ -61,11 +95,14 @@ class WaterTable2:public GLObject
 		GLuint derivativeTextureObject; // Three-component color texture object holding the cell-centered temporal derivative grid
 		GLuint maxStepSizeTextureObjects[2]; // Double-buffered one-component color texture objects to gather the maximum step size for Runge-Kutta integration steps
 		GLuint waterTextureObject; // One-component color texture object to add or remove water to/from the conserved quantity grid
+		GLuint stepSizeTextureObjects[2]; // Double-buffered 1x1 four-component color texture objects holding the step size state (step size, attenuation factor, remaining time, stable step size) read by the integration steps
+		int currentStepSize; // Index of step size texture containing the most recent step size state
 		GLuint bathymetryFramebufferObject; // Frame buffer used to render the bathymetry surface into the bathymetry grid
 		GLuint derivativeFramebufferObject; // Frame buffer used for temporal derivative computation
 		GLuint maxStepSizeFramebufferObject; // Frame buffer used to calculate the maximum integration step size
 		GLuint integrationFramebufferObject; // Frame buffer used for the Euler and Runge-Kutta integration steps
 		GLuint waterFramebufferObject; // Frame buffer used for the water rendering step
+		GLuint stepSizeFramebufferObject; // Frame buffer used to update the step size state on the GPU
 		GLhandleARB bathymetryShader; // Shader to update cell-centered conserved quantities after a change to the bathymetry grid
 		GLint bathymetryShaderUniformLocations[3];
 		GLhandleARB waterAdaptShader; // Shader to adapt a new conserved quantity grid to the current bathymetry grid
@@ -74,16 +111,42 @@ class WaterTable2:public GLObject
 		GLint derivativeShaderUniformLocations[6];
 		GLhandleARB maxStepSizeShader; // Shader to compute a maximum step size for a subsequent Runge-Kutta integration step
 		GLint maxStepSizeShaderUniformLocations[2];
+		GLhandleARB stepSizeShader; // Shader to compute the next step size from the reduced maximum step size and the remaining time
+		GLint stepSizeShaderUniformLocations[4];
 		GLhandleARB boundaryShader; // Shader to enforce boundary conditions on the quantities grid
 		GLint boundaryShaderUniformLocations[1];
 		GLhandleARB eulerStepShader; // Shader to compute an Euler integration step
-		GLint eulerStepShaderUniformLocations[4];
+		GLint eulerStepShaderUniformLocations[3];
 		GLhandleARB rungeKuttaStepShader; // Shader to compute a Runge-Kutta integration step
-		GLint rungeKuttaStepShaderUniformLocations[5];
+		GLint rungeKuttaStepShaderUniformLocations[4];
 		GLhandleARB waterAddShader; // Shader to render water adder objects
 		GLint waterAddShaderUniformLocations[3];
 		GLhandleARB waterShader; // Shader to add or remove water from the conserved quantities grid
-		GLint waterShaderUniformLocations[3];
+		GLint waterShaderUniformLocations[5];
+		CPUWaterSolver* cpuSolver; // CPU solver mirroring this context's simulation state if the CPU backend or backend comparison is enabled
+		unsigned int cpuSolverVersion; // Backend settings version for which the CPU solver was synchronized with the GPU simulation state
+		GLfloat* transferBuffers[2]; // Buffers to exchange simulation grids between the GPU and the CPU solver
+		bool haveStepSizeReadback; // Flag whether the step size state can be read back asynchronously via a pixel buffer object
+		GLuint stepSizeBufferObject; // Pixel buffer object receiving the step size state at the end of each frame with GPU-determined step sizes
+		bool stepSizeReadbackPending; // Flag whether the pixel buffer object holds a step size state that has not been read yet
+		GLfloat lastStableStepSize; // Stable step size at the end of the most recent frame whose step size state was read back
+		GLfloat lastUnsimulatedTime; // Part of the total time step the most recent read-back frame could not simulate
+		GLuint wetTileTextureObject; // Four-component color texture object holding the maximum water column height and water source amount of each tile of the conserved quantity grid
+		GLuint wetTileFramebufferObject; // Frame buffer used to reduce the conserved quantity grid to the wet tile grid
+		GLhandleARB wetTileShader; // Shader to reduce the conserved quantity grid to the wet tile grid
+		GLint wetTileShaderUniformLocations[7];
+		GLhandleARB quantityCopyShader; // Shader to copy conserved quantities unchanged through culled tiles
+		GLint quantityCopyShaderUniformLocations[1];
+		GLsizei wetTileSize; // Tile size for which the wet tile texture and its pixel buffer object were allocated
+		GLsizei numWetTiles[2]; // Width and height of the wet tile grid
+		GLuint wetTileBufferObject; // Pixel buffer object receiving the wet tile grid once per frame
+		bool wetTileReadbackPending; // Flag whether the pixel buffer object holds a wet tile grid that has not been read yet
+		bool haveActiveTiles; // Flag whether the active and inactive tile rectangles reflect a read-back wet tile grid
+		unsigned int numActiveTiles; // Number of tiles in the current active set
+		std::vector<GLint> activeRects; // Grid-aligned rectangles (x0, y0, x1, y1) covering all wet tiles and their neighbors
+		std::vector<GLint> inactiveRects; // Grid-aligned rectangles covering all remaining dry tiles
+		bool cullPasses; // Flag whether the passes of the current simulation step only rasterize active tiles
+		std::vector<GLfloat> bathymetryTileRanges; // Depth range of each depth image tile as of the most recent bathymetry update
 		
 		/* Constructors and destructors: */
 		DataItem(void);
@@ -112,10 +175,37 @@ class WaterTable2:public GLObject
 	unsigned int readBathymetryRequest; // Request token to read back the current bathymetry grid from the GPU
 	mutable GLfloat* readBathymetryBuffer; // Buffer into which to read the current bathymetry grid
 	mutable unsigned int readBathymetryReply; // Reply token after reading back the current bathymetry grid
+	SimulationBackend simulationBackend; // Implementation of the water flow simulation
+	unsigned int numCpuThreads; // Number of threads used by the CPU simulation backend
+	unsigned int multiRateLevels; // Maximum number of times the CPU simulation backend halves the step size of fast tiles of the grid; zero disables multi-rate integration
+	unsigned int multiRateTileSize; // Width and height of the tiles of the grid in multi-rate integration
+	bool compareBackends; // Flag whether to run both backends side-by-side and accumulate their differences
+	unsigned int backendVersion; // Version number of backend settings to invalidate per-context CPU solvers
+	mutable BackendComparison backendComparison; // Differences and timings accumulated while comparing backends
+	bool gpuStepSize; // Flag whether runSimulationSteps() determines step sizes on the GPU instead of reading them back after every step
+	GLsizei dryCullingTileSize; // Width and height of the tiles in which the GPU backend skips dry regions of the grid; zero disables dry tile culling
+	GLfloat dryCullingThreshold; // Water column height below which a tile is considered dry
 	
 	/* Private methods: */
 	void calcTransformations(void); // Calculates derived transformations
+	bool calcBathymetryUpdateRegion(DataItem* dataItem,GLint region[4]) const; // Calculates the region of the bathymetry grid (x0, y0, x1, y1) affected by depth image tiles that changed since the last bathymetry update; returns false if the entire grid needs to be updated
+	void calcBathymetryUpdateRows(const DataItem* dataItem,const GLint region[4],unsigned int rows[2]) const; // Calculates the half-open range of depth image rows whose surface can project into the given bathymetry grid region
 	GLfloat calcDerivative(DataItem* dataItem,GLuint quantityTextureObject,bool calcMaxStepSize) const; // Calculates the temporal derivative of the conserved quantities in the given texture object and returns maximum step size if flag is true
+	int reduceMaxStepSize(DataItem* dataItem) const; // Reduces the maximum step size texture written by the most recent temporal derivative computation to a single pixel; returns the index of the maximum step size texture holding the result
+	bool isCullingDryTiles(const DataItem* dataItem) const; // Returns true if the next simulation step can skip the context's dry tiles
+	void updateWetTiles(DataItem* dataItem) const; // Retrieves the wet tile grid read back during the previous frame and starts reducing and reading back the current one
+	void drawActiveTiles(const DataItem* dataItem,GLint border =0) const; // Rasterizes the active tiles, or the entire grid if the current step is not culled, optionally extended by the given number of cells
+	void copyInactiveTiles(DataItem* dataItem,GLuint quantityTextureObject) const; // Copies the given conserved quantities unchanged through the inactive tiles of the current draw buffer if the current step is culled
+	void runIntegrationStep(DataItem* dataItem) const; // Runs the Euler and Runge-Kutta integration steps with the current step size state, based on the temporal derivative of the most recent quantities
+	void renderWater(DataItem* dataItem,GLfloat stepSize,GLContextData& contextData) const; // Renders all water sources and sinks for a step of the given size into the water texture
+	void runWaterUpdate(DataItem* dataItem,GLfloat stepSize,bool gpuStepSize,GLContextData& contextData) const; // Adds or removes water from all sources and sinks for a step of the given size, or for the part of the given total time step that GPU-side steps actually simulated
+	GLfloat runGpuSimulationStep(DataItem* dataItem,bool forceStepSize,GLContextData& contextData) const; // Runs a water flow simulation step on the GPU
+	bool isCpuSolverCurrent(const DataItem* dataItem) const; // Returns true if the CPU solver is needed and in sync with the context's simulation state
+	CPUWaterSolver* prepareCpuSolver(DataItem* dataItem) const; // Creates or re-synchronizes the context's CPU solver if needed; returns null if the CPU solver is not used
+	void readTexture(GLuint textureObject,GLenum format,GLfloat* buffer) const; // Reads back the contents of the given texture object
+	void uploadCpuQuantity(DataItem* dataItem) const; // Uploads the CPU solver's conserved quantities into the current quantity texture
+	GLfloat runCpuSimulationStep(DataItem* dataItem,bool forceStepSize,GLContextData& contextData) const; // Runs a water flow simulation step on the CPU
+	GLfloat runComparedSimulationStep(DataItem* dataItem,bool forceStepSize,GLContextData& contextData) const; // Runs a water flow simulation step on both backends and accumulates their differences
 	
 	/* Constructors and destructors: */
 	public:
@@ -166,10 +256,54 @@ class WaterTable2:public GLObject
 		}
 	void setWaterDeposit(GLfloat newWaterDeposit); // Sets the amount of deposited water
 	void setDryBoundary(bool newDryBoundary); // Enables or disables enforcement of dry boundaries
+	static const char* getSimulationBackendName(SimulationBackend backend); // Returns a human-readable name for the given simulation backend
+	SimulationBackend getSimulationBackend(void) const // Returns the current simulation backend
+		{
+		return simulationBackend;
+		}
+	void setSimulationBackend(SimulationBackend newSimulationBackend,unsigned int newNumCpuThreads =1); // Selects the simulation backend and the number of threads used by the CPU backend
+	unsigned int getMultiRateLevels(void) const // Returns the maximum number of step size halvings in multi-rate integration
+		{
+		return multiRateLevels;
+		}
+	unsigned int getMultiRateTileSize(void) const // Returns the tile size in multi-rate integration
+		{
+		return multiRateTileSize;
+		}
+	void setMultiRate(unsigned int newMultiRateLevels,unsigned int newMultiRateTileSize); // Lets the CPU backend advance tiles of the given size with up to 2^newMultiRateLevels sub-steps per integration step depending on their local wave speeds; zero levels disables multi-rate integration
+	bool getCompareBackends(void) const // Returns true if both backends are run side-by-side
+		{
+		return compareBackends;
+		}
+	void setCompareBackends(bool newCompareBackends); // Enables or disables running both backends side-by-side from identical states; the GPU backend determines step sizes
+	const BackendComparison& getBackendComparison(void) const // Returns the differences and timings accumulated while comparing backends
+		{
+		return backendComparison;
+		}
+	void resetBackendComparison(void); // Resets the accumulated backend comparison
 	void updateBathymetry(GLContextData& contextData) const; // Prepares the water table for subsequent calls to the runSimulationStep() method
 	void updateBathymetry(const GLfloat* bathymetryGrid,GLContextData& contextData) const; // Updates the bathymetry directly with a vertex-centered elevation grid of grid size minus 1
 	void setWaterLevel(const GLfloat* waterGrid,GLContextData& contextData) const; // Sets the current water level to the given grid, and resets flux components to zero
+	void readQuantity(GLfloat* quantityGrid,GLContextData& contextData) const; // Writes the current conserved quantities into an interleaved (w, hu, hv) grid of the water table's size; blocks until the GPU has finished all pending simulation steps
+	void setQuantity(const GLfloat* quantityGrid,GLContextData& contextData) const; // Replaces the current conserved quantities with the given interleaved (w, hu, hv) grid, e.g., one read from another OpenGL context
 	GLfloat runSimulationStep(bool forceStepSize,GLContextData& contextData) const; // Runs a water flow simulation step, always uses maxStepSize if flag is true (may lead to instability); returns step size taken by Runge-Kutta integration step
+	bool getGpuStepSize(void) const // Returns true if runSimulationSteps() can determine step sizes on the GPU
+		{
+		return gpuStepSize&&simulationBackend==GPU_BACKEND&&!compareBackends;
+		}
+	void setGpuStepSize(bool newGpuStepSize); // Enables or disables determining step sizes on the GPU in runSimulationSteps(); only used with the GPU backend without backend comparison
+	GLsizei getDryCullingTileSize(void) const // Returns the tile size for dry tile culling, or zero if disabled
+		{
+		return dryCullingTileSize;
+		}
+	GLfloat getDryCullingThreshold(void) const // Returns the water column height below which a tile is considered dry
+		{
+		return dryCullingThreshold;
+		}
+	void setDryCulling(GLsizei newDryCullingTileSize,GLfloat newDryCullingThreshold); // Lets the GPU backend skip tiles of the given size that have been dry for the last frame; zero tile size disables dry tile culling
+	GLfloat getActiveTileFraction(GLContextData& contextData) const; // Returns the fraction of the grid the most recent simulation steps in the given context processed
+	unsigned int runSimulationSteps(GLfloat totalTimeStep,unsigned int maxNumSteps,GLContextData& contextData) const; // Runs up to the given number of simulation steps to advance by the given total time step without reading step sizes back from the GPU; returns the number of issued steps
+	GLfloat getUnsimulatedTime(GLContextData& contextData) const; // Returns the part of the total time step that runSimulationSteps() could not simulate, as reported by the most recent asynchronous readback one frame behind
 	void bindBathymetryTexture(GLContextData& contextData) const; // Binds the bathymetry texture object to the active texture unit
 	void bindQuantityTexture(GLContextData& contextData) const; // Binds the most recent conserved quantities texture object to the active texture unit
 	void uploadWaterTextureTransform(GLint location) const; // Uploads the water texture transformation into the GLSL 4x4 matrix at the given uniform location
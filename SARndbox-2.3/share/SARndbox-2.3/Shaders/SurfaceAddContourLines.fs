@@ -1,7 +1,8 @@
 /***********************************************************************
 SurfaceAddContourLines - Shader fragment to add topographic contour
-lines extracted from a half-pixel offset 2D elevation map to a surface's
-base color.
+lines extracted from a half-pixel offset 2D elevation map, or from the
+screen-space derivatives of a fragment's elevation, to a surface's base
+color.
 Copyright (c) 2012 Oliver Kreylos
 
 This file is part of the Augmented Reality Sandbox (SARndbox).
@@ -26,7 +27,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 uniform sampler2DRect pixelCornerElevationSampler;
 uniform float contourLineFactor;
 
-void addContourLines(in vec2 fragCoord,inout vec4 baseColor)
+void addContourLinesFromCorners(in vec2 fragCoord,in vec4 cornerElevations,inout vec4 baseColor)
 	{
 	#if 0
 	
@@ -35,15 +36,9 @@ void addContourLines(in vec2 fragCoord,inout vec4 baseColor)
 	least one contour line. Always draws 4-connected lines.
 	*********************************************************************/
 	
-	/* Calculate the elevation of each pixel corner by evaluating the half-pixel offset elevation texture: */
-	float corner0=texture2DRect(pixelCornerElevationSampler,vec2(fragCoord.x,fragCoord.y)).r;
-	float corner1=texture2DRect(pixelCornerElevationSampler,vec2(fragCoord.x+1.0,fragCoord.y)).r;
-	float corner2=texture2DRect(pixelCornerElevationSampler,vec2(fragCoord.x,fragCoord.y+1.0)).r;
-	float corner3=texture2DRect(pixelCornerElevationSampler,vec2(fragCoord.x+1.0,fragCoord.y+1.0)).r;
-	
 	/* Calculate the elevation range of the pixel's area: */
-	float elMin=min(min(corner0,corner1),min(corner2,corner3));
-	float elMax=max(max(corner0,corner1),max(corner2,corner3));
+	float elMin=min(min(cornerElevations.x,cornerElevations.y),min(cornerElevations.z,cornerElevations.w));
+	float elMax=max(max(cornerElevations.x,cornerElevations.y),max(cornerElevations.z,cornerElevations.w));
 	
 	/* Check if the pixel's area crosses at least one contour line: */
 	if(floor(elMin*contourLineFactor)!=floor(elMax*contourLineFactor))
@@ -59,11 +54,11 @@ void addContourLines(in vec2 fragCoord,inout vec4 baseColor)
 	removing redundant 4-connected pixels.
 	*********************************************************************/
 	
-	/* Calculate the contour line interval containing each pixel corner by evaluating the half-pixel offset elevation texture: */
-	float corner0=floor(texture2DRect(pixelCornerElevationSampler,vec2(fragCoord.x,fragCoord.y)).r*contourLineFactor);
-	float corner1=floor(texture2DRect(pixelCornerElevationSampler,vec2(fragCoord.x+1.0,fragCoord.y)).r*contourLineFactor);
-	float corner2=floor(texture2DRect(pixelCornerElevationSampler,vec2(fragCoord.x,fragCoord.y+1.0)).r*contourLineFactor);
-	float corner3=floor(texture2DRect(pixelCornerElevationSampler,vec2(fragCoord.x+1.0,fragCoord.y+1.0)).r*contourLineFactor);
+	/* Calculate the contour line interval containing each pixel corner: */
+	float corner0=floor(cornerElevations.x*contourLineFactor);
+	float corner1=floor(cornerElevations.y*contourLineFactor);
+	float corner2=floor(cornerElevations.z*contourLineFactor);
+	float corner3=floor(cornerElevations.w*contourLineFactor);
 	
 	/* Find all pixel edges that cross at least one contour line: */
 	int edgeMask=0;
@@ -98,3 +93,25 @@ void addContourLines(in vec2 fragCoord,inout vec4 baseColor)
 	
 	#endif
 	}
+
+void addContourLines(in vec2 fragCoord,inout vec4 baseColor)
+	{
+	/* Calculate the elevation of each pixel corner by evaluating the half-pixel offset elevation texture: */
+	vec4 cornerElevations;
+	cornerElevations.x=texture2DRect(pixelCornerElevationSampler,vec2(fragCoord.x,fragCoord.y)).r;
+	cornerElevations.y=texture2DRect(pixelCornerElevationSampler,vec2(fragCoord.x+1.0,fragCoord.y)).r;
+	cornerElevations.z=texture2DRect(pixelCornerElevationSampler,vec2(fragCoord.x,fragCoord.y+1.0)).r;
+	cornerElevations.w=texture2DRect(pixelCornerElevationSampler,vec2(fragCoord.x+1.0,fragCoord.y+1.0)).r;
+	
+	addContourLinesFromCorners(fragCoord,cornerElevations,baseColor);
+	}
+
+void addContourLinesFromElevation(in vec2 fragCoord,in float elevation,inout vec4 baseColor)
+	{
+	/* Extrapolate the elevation of each pixel corner from the elevation's screen-space derivatives: */
+	float dx=0.5*dFdx(elevation);
+	float dy=0.5*dFdy(elevation);
+	vec4 cornerElevations=vec4(elevation-dx-dy,elevation+dx-dy,elevation-dx+dy,elevation+dx+dy);
+	
+	addContourLinesFromCorners(fragCoord,cornerElevations,baseColor);
+	}
@@ -21,13 +21,17 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #extension GL_ARB_texture_rectangle : enable
 
-uniform float stepSize;
-uniform float attenuation;
+uniform sampler2DRect stepSizeSampler;
 uniform sampler2DRect quantitySampler;
 uniform sampler2DRect derivativeSampler;
 
 void main()
 	{
+	/* Get the step size and attenuation factor for this step: */
+	vec2 stepState=texture2DRect(stepSizeSampler,vec2(0.5,0.5)).rg;
+	float stepSize=stepState.x;
+	float attenuation=stepState.y;
+	
 	/* Calculate the Euler step: */
 	vec3 q=texture2DRect(quantitySampler,gl_FragCoord.xy).rgb;
 	vec3 qt=texture2DRect(derivativeSampler,gl_FragCoord.xy).rgb;
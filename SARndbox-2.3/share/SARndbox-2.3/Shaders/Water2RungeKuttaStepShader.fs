@@ -22,14 +22,18 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #extension GL_ARB_texture_rectangle : enable
 
-uniform float stepSize;
-uniform float attenuation;
+uniform sampler2DRect stepSizeSampler;
 uniform sampler2DRect quantitySampler;
 uniform sampler2DRect quantityStarSampler;
 uniform sampler2DRect derivativeSampler;
 
 void main()
 	{
+	/* Get the step size and attenuation factor for this step: */
+	vec2 stepState=texture2DRect(stepSizeSampler,vec2(0.5,0.5)).rg;
+	float stepSize=stepState.x;
+	float attenuation=stepState.y;
+	
 	/* Calculate the Runge-Kutta step: */
 	vec3 q=texture2DRect(quantitySampler,gl_FragCoord.xy).rgb;
 	vec3 qStar=texture2DRect(quantityStarSampler,gl_FragCoord.xy).rgb;
@@ -0,0 +1,43 @@
+/***********************************************************************
+Water2StepSizeShader - Shader to calculate the step size of the next
+Runge-Kutta integration step from the reduced maximum step size texture
+and the remaining simulation time, without reading either back to the
+CPU.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#extension GL_ARB_texture_rectangle : enable
+
+uniform float maxStepSize;
+uniform float attenuation;
+uniform sampler2DRect maxStepSizeSampler;
+uniform sampler2DRect stepSizeSampler;
+
+void main()
+	{
+	/* Limit the maximum stable step size of the entire grid to the client-specified range: */
+	float stableStepSize=min(texture2DRect(maxStepSizeSampler,vec2(0.5,0.5)).r,maxStepSize);
+	
+	/* Limit the step size to the simulation time remaining in the current frame: */
+	float remainingTime=texture2DRect(stepSizeSampler,vec2(0.5,0.5)).b;
+	float stepSize=min(stableStepSize,remainingTime);
+	
+	/* Write the new step size state (step size, attenuation factor, remaining time, stable step size): */
+	gl_FragData[0]=vec4(stepSize,pow(attenuation,stepSize),remainingTime-stepSize,stableStepSize);
+	}
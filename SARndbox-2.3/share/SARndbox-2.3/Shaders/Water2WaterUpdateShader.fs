@@ -25,6 +25,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 uniform sampler2DRect bathymetrySampler;
 uniform sampler2DRect quantitySampler;
 uniform sampler2DRect waterSampler;
+uniform sampler2DRect stepSizeSampler;
+uniform float waterTimeStep;
 
 void main()
 	{
@@ -39,7 +41,8 @@ void main()
 	
 	/* Calculate the old and new water column heights: */
 	float hOld=q.x-b;
-	float hNew=max(hOld+texture2DRect(waterSampler,gl_FragCoord.xy).r,0.0);
+	float waterScale=waterTimeStep-texture2DRect(stepSizeSampler,vec2(0.5,0.5)).b;
+	float hNew=max(hOld+texture2DRect(waterSampler,gl_FragCoord.xy).r*waterScale,0.0);
 	
 	/* Update the water surface height: */
 	q.x=hNew+b;
@@ -0,0 +1,65 @@
+/***********************************************************************
+Water2WetTileShader - Shader to reduce the water surface grid to a
+coarse grid of tiles, recording the maximum water column height and the
+maximum water source/sink amount over all cells in each tile.
+Copyright (c) 2026 agent
+
+This file is part of the Augmented Reality Sandbox (SARndbox).
+
+The Augmented Reality Sandbox is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Augmented Reality Sandbox is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Augmented Reality Sandbox; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#extension GL_ARB_texture_rectangle : enable
+
+uniform float tileSize;
+uniform vec2 gridSize;
+uniform sampler2DRect bathymetrySampler;
+uniform sampler2DRect quantity0Sampler;
+uniform sampler2DRect quantity1Sampler;
+uniform sampler2DRect quantity2Sampler;
+uniform sampler2DRect waterSampler;
+
+void main()
+	{
+	/* Calculate the range of grid cells covered by this tile: */
+	vec2 cellMin=floor(gl_FragCoord.xy)*tileSize;
+	vec2 cellMax=min(cellMin+vec2(tileSize),gridSize);
+
+	/* Find the maximum water column height in all three quantity buffers, and the maximum water source/sink amount: */
+	float maxHeight=0.0;
+	float maxWater=0.0;
+	for(float y=cellMin.y;y<cellMax.y;y+=1.0)
+		for(float x=cellMin.x;x<cellMax.x;x+=1.0)
+			{
+			vec2 cell=vec2(x+0.5,y+0.5);
+
+			/* Calculate the cell-centered bathymetry elevation: */
+			float b=(texture2DRect(bathymetrySampler,vec2(cell.x-1.0,cell.y-1.0)).r+
+			         texture2DRect(bathymetrySampler,vec2(cell.x,cell.y-1.0)).r+
+			         texture2DRect(bathymetrySampler,vec2(cell.x-1.0,cell.y)).r+
+			         texture2DRect(bathymetrySampler,cell).r)*0.25;
+
+			/* Update the maximum water column height: */
+			maxHeight=max(maxHeight,texture2DRect(quantity0Sampler,cell).r-b);
+			maxHeight=max(maxHeight,texture2DRect(quantity1Sampler,cell).r-b);
+			maxHeight=max(maxHeight,texture2DRect(quantity2Sampler,cell).r-b);
+
+			/* Update the maximum water source/sink amount: */
+			maxWater=max(maxWater,abs(texture2DRect(waterSampler,cell).r));
+			}
+
+	/* Write the tile's wetness state: */
+	gl_FragColor=vec4(maxHeight,maxWater,0.0,0.0);
+	}